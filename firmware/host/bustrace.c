@@ -0,0 +1,224 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Decoder for the Z80 I/O bus trace sent by the z80_ssd console     *
+ * 'B' command.  Reads a capture of the serial port, finds the trace in  *
+ * it and prints a timeline of the guest driver's register accesses.     *
+ * Runs of FIFO transfers and repeated status polls are folded into one  *
+ * line unless -r is given.                                              *
+ *                                                                       *
+ * Usage: bustrace [-r] [capture.bin]                                    *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Must match z80_ssd.c */
+#define BUS_TRACE_IN        0x80
+#define BUS_TRACE_STALL     0x40
+#define BUS_TRACE_TRIG      0x20
+#define BUS_TRACE_VERSION   1
+#define BUS_TRACE_HDR_LEN   6
+#define BUS_TRACE_REC_LEN   4
+
+#define MAX_CAPTURE         (1024 * 1024)
+
+typedef struct {
+    uint8_t  flags;
+    uint8_t  data;
+    uint16_t stamp;
+    double   us;        /* Since the first record */
+} bus_rec_t;
+
+static const char *cmd_name(uint8_t cmd)
+{
+    switch (cmd & 0x7F) {
+    case 0x00: return "RESET";
+    case 0x01: return "READ_SECT";
+    case 0x02: return "WRITE_SECT";
+    case 0x08: return "FORMAT_TRK";
+    case 0x0b: return "ACCESS_FIFO";
+    case 0x10: return "READ_PARAMETERS";
+    default:   return "?";
+    }
+}
+
+static const char *port_name(uint8_t port, bool in)
+{
+    switch (port) {
+    case 0x0: return in ? "status" : "taskfile";
+    case 0x1:
+    case 0x2:
+    case 0x3: return "taskfile";
+    case 0x4: return in ? "FIFO status" : "FIFO reset";
+    case 0x8: return "FIFO";
+    case 0x9: return "stats index";
+    case 0xa: return "stats data";
+    default:  return "unused";
+    }
+}
+
+static bool same_run(const bus_rec_t *a, const bus_rec_t *b)
+{
+    uint8_t port = a->flags & 0x0F;
+
+    if (((a->flags ^ b->flags) & (BUS_TRACE_IN | 0x0F)) || (b->flags & (BUS_TRACE_TRIG | BUS_TRACE_STALL))) {
+        return false;
+    }
+    if (port == 0x8) {
+        return true;    /* FIFO data, whatever the value */
+    }
+    /* Status polls returning the same value */
+    return (port == 0x0) && (a->flags & BUS_TRACE_IN) && (a->data == b->data);
+}
+
+static void print_one(const bus_rec_t *r, double prev_us)
+{
+    uint8_t port = r->flags & 0x0F;
+    bool in = (r->flags & BUS_TRACE_IN) != 0;
+
+    printf("%12.1f %+9.1f  %-3s %02Xh %-12s %02X", r->us, r->us - prev_us,
+           in ? "IN" : "OUT", 0x40 | port, port_name(port, in), r->data);
+    if (!in && (port == 0x0)) {
+        printf((r->data & 0x80) ? "  command %s" : "  C/H/S/N, start command", cmd_name(r->data));
+    }
+    if (r->flags & BUS_TRACE_STALL) {
+        printf("  (stalled)");
+    }
+    if (r->flags & BUS_TRACE_TRIG) {
+        printf("  <<< TRIGGER");
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = NULL;
+    bool raw = false;
+    FILE *fp = stdin;
+    uint8_t *buf;
+    size_t len, i, pos;
+    uint8_t sum = 0;
+    uint8_t count, ticks_per_us;
+    bus_rec_t *rec;
+    double us = 0.0;
+    uint32_t fifo_n = 0, poll_n = 0;
+    double fifo_us = 0.0, fifo_max = 0.0;
+
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-r") == 0) {
+            raw = true;
+        } else {
+            name = argv[a];
+        }
+    }
+    if ((name != NULL) && ((fp = fopen(name, "rb")) == NULL)) {
+        perror(name);
+        return 1;
+    }
+
+    buf = malloc(MAX_CAPTURE);
+    len = fread(buf, 1, MAX_CAPTURE, fp);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    /* The trace is usually surrounded by console text; use the last one. */
+    pos = len;
+    for (i = 0; i + BUS_TRACE_HDR_LEN <= len; i++) {
+        if ((buf[i] == 'B') && (buf[i + 1] == 'T') && (buf[i + 2] == BUS_TRACE_VERSION) &&
+            (i + BUS_TRACE_HDR_LEN + buf[i + 5] * BUS_TRACE_REC_LEN + 1 <= len)) {
+            pos = i;
+        }
+    }
+    if (pos == len) {
+        fprintf(stderr, "No bus trace found.\n");
+        return 1;
+    }
+
+    ticks_per_us = buf[pos + 4];
+    count = buf[pos + 5];
+    for (i = 0; i < BUS_TRACE_HDR_LEN + (size_t)count * BUS_TRACE_REC_LEN; i++) {
+        sum += buf[pos + i];
+    }
+    if ((sum != buf[pos + i]) || (ticks_per_us == 0)) {
+        fprintf(stderr, "Bus trace checksum error.\n");
+        return 1;
+    }
+
+    rec = calloc(count + 1, sizeof(bus_rec_t));
+    for (i = 0; i < count; i++) {
+        const uint8_t *p = &buf[pos + BUS_TRACE_HDR_LEN + i * BUS_TRACE_REC_LEN];
+
+        rec[i].flags = p[0];
+        rec[i].data = p[1];
+        rec[i].stamp = (uint16_t)(p[2] | (p[3] << 8));
+        if (i != 0) {
+            /* Gaps of more than one TMR1 period (32.8ms) fold. */
+            us += (uint16_t)(rec[i].stamp - rec[i - 1].stamp) / (double)ticks_per_us;
+        }
+        rec[i].us = us;
+    }
+
+    printf("%u cycles, %s\n\n", count, buf[pos + 3] & 1 ? "triggered" : "not triggered");
+    printf("    time(us)  delta(us) dir port register     data\n");
+
+    for (i = 0; i < count; ) {
+        size_t n = 1;
+        double prev = (i == 0) ? 0.0 : rec[i - 1].us;
+
+        while (!raw && (i + n < count) && same_run(&rec[i], &rec[i + n])) {
+            n++;
+        }
+        if (n < 3) {
+            for (size_t j = 0; j < n; j++) {
+                print_one(&rec[i + j], (i + j == 0) ? 0.0 : rec[i + j - 1].us);
+            }
+        } else {
+            uint8_t port = rec[i].flags & 0x0F;
+            double span = rec[i + n - 1].us - rec[i].us;
+
+            printf("%12.1f %+9.1f  %-3s %02Xh %-12s x%zu over %.1fus, %.2fus each", rec[i].us,
+                   rec[i].us - prev, (rec[i].flags & BUS_TRACE_IN) ? "IN" : "OUT", 0x40 | port,
+                   port_name(port, rec[i].flags & BUS_TRACE_IN), n, span, span / (n - 1));
+            if (port == 0x0) {
+                printf(", = %02X", rec[i].data);
+            }
+            printf("\n");
+        }
+        i += n;
+    }
+
+    /* Summary of FIFO pacing and status polling */
+    for (i = 0; i < count; i++) {
+        uint8_t port = rec[i].flags & 0x0F;
+
+        if ((i != 0) && (port == 0x8) && ((rec[i - 1].flags & 0x0F) == 0x8)) {
+            double d = rec[i].us - rec[i - 1].us;
+
+            fifo_n++;
+            fifo_us += d;
+            if (d > fifo_max) fifo_max = d;
+        }
+        if ((port == 0x0) && (rec[i].flags & BUS_TRACE_IN)) {
+            poll_n++;
+        }
+    }
+    printf("\n");
+    if (fifo_n != 0) {
+        printf("FIFO: %u back-to-back bytes, avg %.2fus, max %.1fus apart\n",
+               fifo_n, fifo_us / fifo_n, fifo_max);
+    }
+    printf("Status reads: %u\n", poll_n);
+
+    free(rec);
+    free(buf);
+    return 0;
+}
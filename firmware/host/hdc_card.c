@@ -0,0 +1,258 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Scratch FAT16 card image for hdcsim and hdcbench.  There is no    *
+ * partition table; the drive images follow the root directory, either  *
+ * contiguous or in fragments taken in turn from each image.             *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_model.h"
+#include "hdc_card.h"
+
+#define CARD_SPC            8           /* Sectors per cluster */
+#define CARD_FAT_SECTS      129
+#define CARD_ROOT_ENTS      512
+#define CARD_FAT_START      1
+#define CARD_ROOT_START     (CARD_FAT_START + 2 * CARD_FAT_SECTS)
+#define CARD_DATA_START     (CARD_ROOT_START + CARD_ROOT_ENTS * 32 / 512)
+
+const uint16_t hdc_card_cyls[HDC_CARD_DRIVES]    = { 680, 615, 615, 612 };
+const uint8_t  hdc_card_heads[HDC_CARD_DRIVES]   = { 15, 4, 4, 2 };
+const bool     hdc_card_present[HDC_CARD_DRIVES] = { true, false, false, true };
+uint8_t       *hdc_card_shadow[HDC_CARD_DRIVES];
+
+static uint16_t *chain[HDC_CARD_DRIVES];        /* Clusters of each image, in file order */
+
+uint32_t hdc_card_image_size(int drive)
+{
+    return (uint32_t)hdc_card_cyls[drive] * hdc_card_heads[drive] * HDC_CARD_SPT * HDC_CARD_SECT_LEN;
+}
+
+static uint32_t image_clusters(int drive)
+{
+    return hdc_card_image_size(drive) / (CARD_SPC * SD_CARD_MODEL_BLOCK);
+}
+
+/* SD block holding block `b` of a drive image. */
+static uint32_t image_block(int drive, uint32_t b)
+{
+    return CARD_DATA_START + (uint32_t)(chain[drive][b / CARD_SPC] - 2) * CARD_SPC + b % CARD_SPC;
+}
+
+/* The card block holding a byte of a drive image. */
+uint32_t hdc_card_block(int drive, uint32_t offset)
+{
+    return image_block(drive, offset / SD_CARD_MODEL_BLOCK);
+}
+
+static uint8_t pattern(uint32_t lba, uint32_t i)
+{
+    return (uint8_t)(lba * 7 + i + (i >> 8) * 0x55);
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, (uint16_t)v);
+    put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static bool write_block(FILE *image, uint32_t lba, const uint8_t *buf)
+{
+    return (fseek(image, (long)lba * SD_CARD_MODEL_BLOCK, SEEK_SET) == 0) &&
+           (fwrite(buf, 1, SD_CARD_MODEL_BLOCK, image) == SD_CARD_MODEL_BLOCK);
+}
+
+static void dir_entry(uint8_t *p, const char *name, uint8_t attr, uint16_t cluster, uint32_t size)
+{
+    memcpy(p, name, 11);
+    p[11] = attr;
+    put16(&p[26], cluster);
+    put32(&p[28], size);
+}
+
+/* Allocate the clusters of the drive images.  With more than one fragment,
+ * each image is cut into that many runs, and the runs of the images are
+ * laid out in turn.
+ */
+static bool allocate(uint32_t fragments)
+{
+    uint16_t cluster = 2;
+
+    if (fragments == 0) {
+        fragments = 1;
+    }
+    for (int d = 0; d < HDC_CARD_DRIVES; d++) {
+        free(chain[d]);
+        chain[d] = NULL;
+        if (hdc_card_present[d] && ((chain[d] = malloc(image_clusters(d) * sizeof(uint16_t))) == NULL)) {
+            return false;
+        }
+    }
+    for (uint32_t f = 0; f < fragments; f++) {
+        for (int d = 0; d < HDC_CARD_DRIVES; d++) {
+            uint32_t n = image_clusters(d);
+
+            if (!hdc_card_present[d]) {
+                continue;
+            }
+            for (uint32_t c = n * f / fragments; c < n * (f + 1) / fragments; c++) {
+                chain[d][c] = cluster++;
+            }
+        }
+    }
+    return true;
+}
+
+/* Lay out the volume, fill the drive images with a pattern, and load the
+ * shadow copies.
+ */
+bool hdc_card_build(FILE *image, uint32_t fragments)
+{
+    static const char *names[HDC_CARD_DRIVES] = { "IBCDISK0DSK", NULL, NULL, "IBCDISK3DSK" };
+    uint8_t buf[SD_CARD_MODEL_BLOCK];
+    uint8_t root[CARD_ROOT_ENTS * 32];
+    uint16_t fat[CARD_FAT_SECTS * 256];
+    int ent = 1;
+
+    if (!allocate(fragments)) {
+        return false;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, "\xEB\x3C\x90" "MSDOS5.0", 11);
+    put16(&buf[11], SD_CARD_MODEL_BLOCK);
+    buf[13] = CARD_SPC;
+    put16(&buf[14], CARD_FAT_START);
+    buf[16] = 2;
+    put16(&buf[17], CARD_ROOT_ENTS);
+    buf[21] = 0xF8;
+    put16(&buf[22], CARD_FAT_SECTS);
+    put16(&buf[24], 63);
+    put16(&buf[26], 255);
+    put32(&buf[32], HDC_CARD_BLOCKS);
+    buf[36] = 0x80;
+    buf[38] = 0x29;
+    put32(&buf[39], 0x5A383053);
+    memcpy(&buf[43], "Z80SSD     FAT16   ", 19);
+    buf[510] = 0x55;
+    buf[511] = 0xAA;
+    if (!write_block(image, 0, buf)) {
+        return false;
+    }
+
+    memset(fat, 0, sizeof(fat));
+    memset(root, 0, sizeof(root));
+    fat[0] = 0xFFF8;
+    fat[1] = 0xFFFF;
+    dir_entry(&root[0], "Z80SSD     ", 0x08, 0, 0);
+
+    for (int d = 0; d < HDC_CARD_DRIVES; d++) {
+        uint32_t size = hdc_card_image_size(d);
+        uint32_t clusters = image_clusters(d);
+
+        if (!hdc_card_present[d]) {
+            continue;
+        }
+        free(hdc_card_shadow[d]);
+        if ((hdc_card_shadow[d] = malloc(size)) == NULL) {
+            return false;
+        }
+        dir_entry(&root[ent++ * 32], names[d], 0x20, chain[d][0], size);
+        for (uint32_t c = 0; c < clusters; c++) {
+            fat[chain[d][c]] = (c + 1 == clusters) ? 0xFFFF : chain[d][c + 1];
+        }
+        for (uint32_t b = 0; b < size / SD_CARD_MODEL_BLOCK; b++) {
+            uint32_t lba = image_block(d, b);
+
+            for (uint32_t i = 0; i < SD_CARD_MODEL_BLOCK; i++) {
+                buf[i] = pattern(lba, i);
+            }
+            memcpy(&hdc_card_shadow[d][b * SD_CARD_MODEL_BLOCK], buf, SD_CARD_MODEL_BLOCK);
+            if (!write_block(image, lba, buf)) {
+                return false;
+            }
+        }
+    }
+
+    for (uint32_t s = 0; s < CARD_FAT_SECTS; s++) {
+        for (int i = 0; i < 256; i++) {
+            put16(&buf[i * 2], fat[s * 256 + i]);
+        }
+        if (!write_block(image, CARD_FAT_START + s, buf) ||
+            !write_block(image, CARD_FAT_START + CARD_FAT_SECTS + s, buf)) {
+            return false;
+        }
+    }
+    for (uint32_t s = 0; s < sizeof(root) / SD_CARD_MODEL_BLOCK; s++) {
+        if (!write_block(image, CARD_ROOT_START + s, &root[s * SD_CARD_MODEL_BLOCK])) {
+            return false;
+        }
+    }
+
+    /* Extend the image to the full card. */
+    memset(buf, 0, sizeof(buf));
+    return write_block(image, HDC_CARD_BLOCKS - 1, buf);
+}
+
+static bool patch32(FILE *image, long pos, uint32_t v)
+{
+    uint8_t buf[4];
+
+    put32(buf, v);
+    return (fseek(image, pos, SEEK_SET) == 0) && (fwrite(buf, 1, sizeof(buf), image) == sizeof(buf)) &&
+           (fflush(image) == 0);
+}
+
+/* Change the volume serial number in the boot sector. */
+bool hdc_card_set_serial(FILE *image, uint32_t serial)
+{
+    return patch32(image, 39, serial);
+}
+
+/* Change the modification date and time in a drive image's directory entry. */
+bool hdc_card_set_mtime(FILE *image, int drive, uint32_t mtime)
+{
+    int ent = 1;
+
+    for (int d = 0; d < drive; d++) {
+        ent += hdc_card_present[d];
+    }
+    return hdc_card_present[drive] &&
+           patch32(image, (long)CARD_ROOT_START * SD_CARD_MODEL_BLOCK + ent * 32 + 22, mtime);
+}
+
+/* Compare the drive images on the card with the shadow copies. */
+uint32_t hdc_card_check(FILE *image)
+{
+    uint8_t buf[SD_CARD_MODEL_BLOCK];
+    uint32_t bad = 0;
+
+    fflush(image);
+    for (int d = 0; d < HDC_CARD_DRIVES; d++) {
+        if (!hdc_card_present[d]) {
+            continue;
+        }
+        for (uint32_t b = 0; b < hdc_card_image_size(d) / SD_CARD_MODEL_BLOCK; b++) {
+            if ((fseek(image, (long)image_block(d, b) * SD_CARD_MODEL_BLOCK, SEEK_SET) != 0) ||
+                (fread(buf, 1, sizeof(buf), image) != sizeof(buf)) ||
+                (memcmp(buf, &hdc_card_shadow[d][b * SD_CARD_MODEL_BLOCK], sizeof(buf)) != 0)) {
+                if (bad++ == 0) {
+                    fprintf(stderr, "Drive %d: block %u of the image differs.\n", d, b);
+                }
+            }
+        }
+    }
+    return bad;
+}
@@ -0,0 +1,39 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Scratch SD card for the host models of the controller: a FAT16    *
+ * volume holding IBCDISK0.dsk and IBCDISK3.dsk, filled with a pattern,  *
+ * and a shadow copy of each drive image to check the card against.      *
+ * The images may be split into fragments, interleaved with each other,  *
+ * to exercise fast seek and the FAT chain.                              *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef HDC_CARD_H
+#define HDC_CARD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HDC_CARD_BLOCKS     262144UL    /* 128MB */
+#define HDC_CARD_DRIVES     4
+#define HDC_CARD_SECT_LEN   256
+#define HDC_CARD_SPT        32
+
+extern const uint16_t hdc_card_cyls[HDC_CARD_DRIVES];
+extern const uint8_t  hdc_card_heads[HDC_CARD_DRIVES];
+extern const bool     hdc_card_present[HDC_CARD_DRIVES];
+extern uint8_t       *hdc_card_shadow[HDC_CARD_DRIVES];
+
+uint32_t hdc_card_image_size(int drive);
+uint32_t hdc_card_block(int drive, uint32_t offset);
+bool hdc_card_build(FILE *image, uint32_t fragments);
+uint32_t hdc_card_check(FILE *image);
+bool hdc_card_set_serial(FILE *image, uint32_t serial);
+bool hdc_card_set_mtime(FILE *image, int drive, uint32_t mtime);
+
+#endif /* HDC_CARD_H */
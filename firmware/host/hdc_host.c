@@ -0,0 +1,341 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Host environment for ibc_disk_ctrl.c: the globals and hooks it    *
+ * expects from z80_ssd.c and the MCC drivers, and a model of the main   *
+ * loop and CLC2_ISR on a common clock, in microseconds.                 *
+ *                                                                       *
+ * Each main loop pass runs to completion at its start time, and its     *
+ * results are hidden from the Z80 until it ends: an I/O cycle during a  *
+ * pass sees the status and FIFO slots as they were before it, or when   *
+ * the pass let a stalled FIFO cycle go.  RESET and FORMAT_TRK run with  *
+ * the CLC2 interrupt disabled, so an I/O cycle during one is held until *
+ * it ends.                                                              *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <xc.h>
+#include "tmr1.h"
+#include "uart1.h"
+#include "sd_spi/sd_spi.h"
+#include "spi_model.h"
+#include "hdc_host.h"
+
+/* SPI1 clocks from spi1.c: 64MHz / (2 * (BAUD + 1)) */
+#define SD_FAST_US          (8 / 8.0)
+#define SD_SLOW_US          (8 / 0.4)
+
+#define FIFO_PORT           0x48
+#define STATUS_PORT         0x40
+#define NSEC_PORT           0x42
+#define CMD_RESET           0x00
+#define CMD_FORMAT_TRK      0x08
+
+#define STALL_PASS_LIMIT    1000000     /* Idle passes before a stall is a deadlock */
+#define STALL_MAX_US        1000.0      /* TMR0 stall timeout, as in z80_ssd.c */
+#define RING_SLOTS          10          /* Slots in sectbuf, IBC_HDC_RING_SLOTS */
+
+volatile host_INTCON0bits_t INTCON0bits;
+volatile bool do_command_flag = 0;
+
+extern void IBC_HDC_IdleTasks(void);
+extern uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData);
+extern uint8_t IBC_HDC_Read(const uint8_t Addr);
+extern uint8_t IBC_HDC_GetStatus(void);
+extern uint8_t IBC_HDC_doCommand(void);
+
+extern uint8_t   sectbuf[];
+volatile extern uint16_t  secbuf_index;
+volatile extern uint8_t   secbuf_ready;
+volatile extern bool      secbuf_written;
+volatile extern uint8_t   secbuf_next_ready;
+volatile extern uint8_t   secbuf_lap;
+
+static hdc_host_config_t cfg = HDC_HOST_DEFAULTS;
+static hdc_host_stats_t stats;
+
+static double   pic_time;       /* End of the current pass, when the next one starts */
+static double   pass_start;
+static double   pass_cost;      /* Firmware time of the current pass, less the SPI bus */
+static uint32_t pass_bytes;     /* SPI byte counts at the start of the pass */
+static uint32_t pass_slow;
+static bool     pass_masked;    /* CLC2 interrupt disabled for the pass */
+static uint8_t  pre_status;     /* Status and slots the Z80 sees until the pass ends */
+static uint8_t  pre_ready;
+static uint8_t  pre_next_ready;
+static bool     status_hidden;
+static uint8_t  next_cmd;       /* Command of the last task file write */
+static uint8_t  next_nsec;      /* Last write to the sector count port */
+
+static uint8_t  fifo_stalled;   /* 1: read, 2: write, as in z80_ssd.c */
+static uint8_t  fifo_data;
+static bool     fifo_timed_out;
+static double   fifo_release;   /* When the pass in progress let a stalled cycle go */
+static bool     deadlocked;
+
+/* Time within the current pass, as far as the firmware has got. */
+static double hdc_host_now(void)
+{
+    const spi_model_stats_t *spi = spi_model_get_stats();
+    uint32_t bytes = spi->bytes - pass_bytes;
+    uint32_t slow = spi->slow_bytes - pass_slow;
+
+    return pass_start + pass_cost + (bytes - slow) * SD_FAST_US + slow * SD_SLOW_US;
+}
+
+uint16_t TMR1_ReadTimer(void)
+{
+    return (uint16_t)TMR1_ReadTimer32();
+}
+
+uint32_t TMR1_ReadTimer32(void)
+{
+    return (uint32_t)(uint64_t)(hdc_host_now() * TMR1_TICKS_PER_US);
+}
+
+bool UART1_is_tx_done(void)
+{
+    return true;
+}
+
+uint16_t UART1_GetTxDroppedCount(void)
+{
+    return 0;
+}
+
+/* The WAIT# monitor and bus trace are not modelled. */
+void z80_ssd_WaitDump(void)
+{
+}
+
+void z80_ssd_WaitReset(void)
+{
+}
+
+void z80_ssd_BusTraceDump(void)
+{
+}
+
+void z80_ssd_fifo_resume(void)
+{
+    if (fifo_stalled && ((uint8_t)(secbuf_index >> 8) < secbuf_ready)) {
+        if (fifo_stalled == 1) {
+            fifo_data = sectbuf[secbuf_index++];
+        } else {
+            sectbuf[secbuf_index++] = fifo_data;
+            secbuf_written = true;
+        }
+        fifo_stalled = 0;
+        fifo_release = hdc_host_now();
+        pre_ready = secbuf_ready;
+        pre_next_ready = secbuf_next_ready;
+    }
+}
+
+bool z80_ssd_fifo_stalled(void)
+{
+    return fifo_stalled != 0;
+}
+
+bool z80_ssd_fifo_timed_out(void)
+{
+    return fifo_timed_out;
+}
+
+void z80_ssd_fifo_timeout_clear(void)
+{
+    fifo_timed_out = false;
+}
+
+/* One pass of the z80_ssd_main() loop, less the console. */
+static void hdc_host_pass(void)
+{
+    const spi_model_stats_t *spi = spi_model_get_stats();
+
+    pass_start = pic_time;
+    pass_bytes = spi->bytes;
+    pass_slow = spi->slow_bytes;
+    pre_status = IBC_HDC_GetStatus();
+    pre_ready = secbuf_ready;
+    pre_next_ready = secbuf_next_ready;
+
+    if (do_command_flag == 1) {
+        pass_masked = (next_cmd == CMD_RESET) || (next_cmd == CMD_FORMAT_TRK);
+        pass_cost = cfg.cmd;
+        IBC_HDC_doCommand();
+        do_command_flag = 0;
+        stats.commands++;
+    } else {
+        pass_masked = false;
+        pass_cost = cfg.poll;
+        IBC_HDC_IdleTasks();
+        SD_SPI_StreamIdleTasks();
+        stats.polls++;
+    }
+
+    pic_time = hdc_host_now();
+    status_hidden = (IBC_HDC_GetStatus() != pre_status);
+}
+
+void hdc_host_init(const hdc_host_config_t *config)
+{
+    cfg = *config;
+    memset(&stats, 0, sizeof(stats));
+    pic_time = 0.0;
+    pass_start = 0.0;
+    pass_cost = 0.0;
+    pass_masked = false;
+    status_hidden = false;
+    fifo_stalled = 0;
+    fifo_timed_out = false;
+    deadlocked = false;
+    INTCON0bits.GIEH = 1;
+    INTCON0bits.GIEL = 1;
+}
+
+/* Run the main loop up to `now`. */
+void hdc_host_run(double now)
+{
+    while (pic_time <= now) {
+        hdc_host_pass();
+    }
+}
+
+/* A FIFO cycle: returns when WAIT# is released. */
+static double hdc_host_fifo(double now, bool write, uint8_t *data)
+{
+    uint8_t ready = (now < pic_time) ? pre_ready : secbuf_ready;
+    uint8_t next_ready = (now < pic_time) ? pre_next_ready : secbuf_next_ready;
+    uint32_t passes = 0;
+
+    if (((uint8_t)(secbuf_index >> 8) >= RING_SLOTS) && (next_ready != 0) && (secbuf_next_ready != 0)) {
+        /* CLC2_ISR starts the next lap of the ring. */
+        ready = pre_ready = next_ready;
+        pre_next_ready = 0;
+        secbuf_ready = secbuf_next_ready;
+        secbuf_next_ready = 0;
+        secbuf_lap++;
+        secbuf_index = 0;
+    }
+
+    if ((uint8_t)(secbuf_index >> 8) < ready) {
+        if (write) {
+            sectbuf[secbuf_index++] = *data;
+            secbuf_written = true;
+        } else {
+            *data = sectbuf[secbuf_index++];
+        }
+        return now;
+    }
+    if (fifo_timed_out) {
+        /* Completed at once, without data, until the firmware clears it. */
+        if (!write) {
+            *data = 0xFF;
+        }
+        return now;
+    }
+
+    stats.stalls++;
+    fifo_stalled = write ? 2 : 1;
+    fifo_data = *data;
+
+    /* Already released by the pass in progress?  Then only its end is
+     * known.
+     */
+    z80_ssd_fifo_resume();
+    fifo_release = pic_time;
+
+    while (fifo_stalled && (pic_time - now < STALL_MAX_US)) {
+        if (++passes > STALL_PASS_LIMIT) {
+            fifo_stalled = 0;
+            deadlocked = true;
+            break;
+        }
+        hdc_host_pass();
+    }
+
+    if (fifo_stalled || deadlocked) {
+        fifo_release = pic_time;
+    }
+    if (fifo_release - now > STALL_MAX_US) {
+        /* TMR0_ISR let the Z80 go without its data, part way through the
+         * pass.  Take back a release the pass did after that.
+         */
+        if (!fifo_stalled) {
+            secbuf_index--;
+        }
+        fifo_stalled = 0;
+        fifo_timed_out = true;
+        stats.timeouts++;
+        if (!write) {
+            *data = 0xFF;
+        }
+        stats.stall_us += STALL_MAX_US;
+        return now + STALL_MAX_US;
+    }
+
+    *data = fifo_data;
+    stats.stall_us += fifo_release - now;
+    return fifo_release;
+}
+
+/* An I/O cycle to ports 40h-4Fh, started at `now`; returns the time WAIT#
+ * is released.  The ISR's time is taken from the main loop.
+ */
+double hdc_host_access(double now, uint8_t port, bool write, uint8_t *data)
+{
+    double isr = (port != FIFO_PORT) ? cfg.isr_reg : write ? cfg.isr_fifo_wr : cfg.isr_fifo_rd;
+
+    stats.accesses++;
+    if (pass_masked && (now < pic_time)) {
+        stats.held++;
+        stats.held_us += pic_time - now;
+        now = pic_time;
+    }
+
+    if (port == FIFO_PORT) {
+        now = hdc_host_fifo(now, write, data);
+    } else if (write) {
+        if (port == STATUS_PORT) {
+            if (*data & 0x80) {
+                next_cmd = *data & 0x7F;
+            }
+            status_hidden = false;
+        } else if (port == NSEC_PORT) {
+            next_nsec = *data;
+        }
+        IBC_HDC_Write(port, *data);
+        /* A READ_SECT completed in the ISR, from the cache. */
+        if ((port == STATUS_PORT) && !(*data & 0x80) && !do_command_flag &&
+            (IBC_HDC_GetStatus() == 0x60)) {
+            isr += cfg.isr_hit * ((next_nsec != 0) ? next_nsec : 1);
+            stats.isr_reads++;
+        }
+    } else if ((port == STATUS_PORT) && status_hidden && (now < pic_time)) {
+        *data = pre_status;
+    } else {
+        *data = IBC_HDC_Read(port);
+    }
+
+    stats.isr_us += isr;
+    if (pic_time < now) {
+        pic_time = now;
+    }
+    pic_time += isr;
+    return now + isr;
+}
+
+bool hdc_host_deadlocked(void)
+{
+    return deadlocked;
+}
+
+const hdc_host_stats_t *hdc_host_get_stats(void)
+{
+    return &stats;
+}
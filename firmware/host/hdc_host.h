@@ -0,0 +1,53 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Host environment for ibc_disk_ctrl.c.  Stands in for z80_ssd.c:   *
+ * runs the z80_ssd_main() loop one pass at a time on a modelled clock,  *
+ * and handles Z80 I/O cycles the way CLC2_ISR does, returning the time  *
+ * WAIT# is released.  The firmware's own time is the SPI bus time of    *
+ * each pass plus a fixed cost per command or idle pass; TMR1 follows    *
+ * it.                                                                   *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef HDC_HOST_H
+#define HDC_HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    double isr_fifo_rd;     /* CLC2_ISR time for a FIFO read, us */
+    double isr_fifo_wr;     /* ...a FIFO write */
+    double isr_reg;         /* ...any other register */
+    double isr_hit;         /* ...plus this per sector of a READ_SECT it
+                               completes from the cache */
+    double cmd;             /* Firmware time per command, besides the SD card */
+    double poll;            /* One idle pass of the main loop */
+} hdc_host_config_t;
+
+#define HDC_HOST_DEFAULTS   { 2.0, 1.75, 3.0, 25.0, 50.0, 5.0 }
+
+typedef struct {
+    uint32_t commands;      /* doCommand() passes */
+    uint32_t polls;         /* Idle passes */
+    uint32_t accesses;      /* I/O cycles */
+    uint32_t stalls;        /* FIFO cycles held for a slot */
+    uint32_t timeouts;      /* ...and let go without it */
+    uint32_t held;          /* I/O cycles held while the interrupt was disabled */
+    uint32_t isr_reads;     /* READ_SECTs completed in the ISR */
+    double   isr_us;        /* WAIT# time in CLC2_ISR */
+    double   stall_us;      /* WAIT# time for stalled FIFO cycles */
+    double   held_us;       /* WAIT# time with the interrupt disabled */
+} hdc_host_stats_t;
+
+void hdc_host_init(const hdc_host_config_t *config);
+void hdc_host_run(double now);
+double hdc_host_access(double now, uint8_t port, bool write, uint8_t *data);
+bool hdc_host_deadlocked(void);
+const hdc_host_stats_t *hdc_host_get_stats(void);
+
+#endif /* HDC_HOST_H */
@@ -0,0 +1,740 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Workload benchmark for the controller engine.  A driver written   *
+ * in C issues commands to the unmodified ibc_disk_ctrl.c through its    *
+ * ports, on the hdc_host.c clock, with a fixed time between I/O cycles  *
+ * instead of an emulated Z80.  The card is the hdcsim scratch volume,   *
+ * in memory or in a file, with the drive images optionally fragmented.  *
+ *                                                                       *
+ * For each workload hdcbench reports, as JSON: commands and bytes per   *
+ * modelled second, f_lseek() calls and the FAT clusters they followed,  *
+ * disk_read()/disk_write() calls, SD commands, SD blocks read, written  *
+ * and touched, and the write amplification (SD bytes written per byte   *
+ * the guest wrote).  Writes the firmware defers are flushed by idling   *
+ * after each workload and counted with it.  The run is deterministic,   *
+ * so a previous report can be given as a baseline: any metric that got  *
+ * worse by more than the tolerance is listed on stderr, and the exit    *
+ * status is 2.  Data errors exit with 1, as does a VERIFY that takes    *
+ * more SD commands than it has tracks: its reads are contiguous, so     *
+ * they should stay in the card's multiple block commands, or a run      *
+ * that loses the data of a WRITE_SECT issued with no FIFO reset before  *
+ * it, straight after a READ_SECT or another WRITE_SECT, or a wrong read *
+ * around a READ_SECT completed in CLC2_ISR, or a drive image sidecar    *
+ * used after the volume serial number or the image's modification time  *
+ * changed.                                                              *
+ *                                                                       *
+ * Usage: hdcbench [options]                                             *
+ *     -a US       card read access time, NAC (100)                      *
+ *     -b US       card programming time per written block (250)         *
+ *     -s US       card busy time after a stop (500)                     *
+ *     -i US       CLC2_ISR time for a FIFO read (2.0)                   *
+ *     -o US       CLC2_ISR time for a FIFO write (1.75)                 *
+ *     -g US       CLC2_ISR time for any other register (3.0)            *
+ *     -k US       ...plus this per sector of a READ_SECT it completes   *
+ *                 from the cache (25)                                   *
+ *     -x US       firmware time per command, besides the card (50)      *
+ *     -p US       idle pass of the main loop (5)                        *
+ *     -z US       guest time between I/O cycles (5.25, INIR at 4MHz)    *
+ *     -c TRACKS   tracks read by VERIFY (2048, 16MB)                    *
+ *     -n COUNT    random and sequential reads, random writes; COPY     *
+ *                 moves COUNT/2 sectors (4096)                          *
+ *     -F N        split each drive image into N interleaved fragments   *
+ *     -f FILE     keep the card image in FILE rather than in memory     *
+ *     -j FILE     write the report to FILE rather than stdout           *
+ *     -r FILE     compare with a baseline report                        *
+ *     -t PCT      regression tolerance (5)                              *
+ *     -l FILE     save the firmware's console output                    *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "sd_spi/sd_spi.h"
+#include "fatfs/ff.h"
+#include "fatfs/diskio.h"
+#include "spi_model.h"
+#include "sd_card_model.h"
+#include "hdc_card.h"
+#include "hdc_host.h"
+
+#define SECT_LEN            HDC_CARD_SECT_LEN
+#define SPT                 HDC_CARD_SPT
+#define SETTLE_US           250000.0    /* Idle time after a workload, past the sync policy */
+
+/* Command flags, as in hdcsim */
+#define F_DATA_FIRST        0x01        /* Reset the FIFO and write the data before the command */
+#define F_DATA_AFTER        0x02        /* Reset the FIFO, write the data after the command */
+#define F_READ              0x04        /* Reset the FIFO and read the data after the command */
+#define F_KEEP_FIFO         0x08        /* ...but leave the FIFO as the last command left it */
+
+#define CMD_RESET           0x00
+#define CMD_READ_SECT       0x01
+#define CMD_WRITE_SECT      0x02
+#define CMD_FORMAT_TRK      0x08
+
+#define STATUS_BUSY         0x10
+#define STATUS_ERROR        0x01
+
+#define COPY_CHUNK          8           /* Sectors per OASIS COPY transfer */
+#define COPY_DEST_CYL       2           /* First cylinder COPY writes on drive 3 */
+#define VERIFY_SD_CMDS_SLACK 16         /* SD commands VERIFY may take beyond one per track */
+#define FIFO_CHECKS         64          /* Command sequences with no FIFO reset between */
+#define FIFO_SECTS          10          /* Longest of those WRITE_SECTs, the size of the FIFO */
+#define FAST_READ_CHECKS    64          /* READ_SECTs completed in CLC2_ISR and followed at once */
+#define FAST_READ_EVICT     4           /* Writes that push a line out, IBC_HDC_CACHE_LINES */
+
+/* Metrics of a workload.  `better` is +1 if a higher value is better, -1
+ * if lower is better, and 0 for the size of the workload itself.
+ */
+enum {
+    M_COMMANDS, M_BYTES, M_ERRORS, M_MODEL_US, M_CMDS_PER_S, M_BYTES_PER_S, M_LSEEKS, M_LSEEK_STEPS,
+    M_DISK_READS, M_DISK_WRITES, M_SD_CMDS, M_BLOCKS_READ, M_BLOCKS_WRITTEN, M_BLOCKS_TOUCHED, M_WRITE_AMP,
+    METRICS
+};
+
+static const struct {
+    const char *name;
+    int better;
+} metric[METRICS] = {
+    { "commands", 0 },          { "bytes", 0 },             { "errors", -1 },
+    { "model_us", -1 },         { "commands_per_s", 1 },    { "bytes_per_s", 1 },
+    { "lseek_calls", -1 },      { "lseek_chain_steps", -1 },{ "disk_reads", -1 },
+    { "disk_writes", -1 },      { "sd_commands", -1 },      { "sd_blocks_read", -1 },
+    { "sd_blocks_written", -1 },{ "sd_blocks_touched", -1 },{ "write_amplification", -1 },
+};
+
+typedef enum {
+    W_VERIFY, W_RANDOM_READ, W_RANDOM_WRITE, W_FORMAT, W_COPY, W_SEQ_READ, WORKLOADS
+} workload_type_t;
+
+static const char *workload_names[WORKLOADS] = {
+    "verify", "random_read", "random_write", "format", "copy", "seq_read"
+};
+
+/* Counted by the link-time wrappers below. */
+static struct {
+    uint32_t lseeks;
+    uint32_t lseek_steps;
+    uint32_t disk_reads;
+    uint32_t disk_writes;
+} fw;
+
+static FILE *report;
+static FILE *image;
+static hdc_host_config_t host = HDC_HOST_DEFAULTS;
+static double guest_us = 5.25;
+static double now;                      /* Modelled time, us */
+static uint32_t rand_state = 1;
+static uint32_t mismatches;
+static uint64_t guest_moved;            /* Bytes the guest read or wrote, including FORMAT_TRK */
+static uint64_t guest_written;
+static uint8_t  data[SECT_LEN * 255];
+static uint32_t held_for;               /* Task files to issue before the main loop runs again */
+
+FRESULT __real_f_lseek(FIL *fp, FSIZE_t ofs);
+DRESULT __real_disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
+DRESULT __real_disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count);
+
+/* Without a link map, f_lseek() follows the FAT chain a cluster at a time,
+ * from the current cluster or, seeking backwards, from the first one.  With
+ * a map it only walks the chain to build it.  Count the clusters followed
+ * the same way.
+ */
+FRESULT __wrap_f_lseek(FIL *fp, FSIZE_t ofs)
+{
+    fw.lseeks++;
+    if (fp->obj.fs != NULL) {
+        FSIZE_t bcs = (FSIZE_t)fp->obj.fs->csize * FF_MAX_SS;
+        FSIZE_t pos = ofs;
+
+        if (fp->cltbl != NULL) {
+            if (ofs == CREATE_LINKMAP) {
+                fw.lseek_steps += (fp->obj.objsize + bcs - 1) / bcs;
+            }
+        } else {
+            if ((pos > fp->obj.objsize) && !(fp->flag & FA_WRITE)) {
+                pos = fp->obj.objsize;
+            }
+            if (pos > 0) {
+                if ((fp->fptr > 0) && ((pos - 1) / bcs >= (fp->fptr - 1) / bcs)) {
+                    fw.lseek_steps += (pos - 1) / bcs - (fp->fptr - 1) / bcs;
+                } else {
+                    fw.lseek_steps += (pos - 1) / bcs;
+                }
+            }
+        }
+    }
+    return __real_f_lseek(fp, ofs);
+}
+
+DRESULT __wrap_disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    fw.disk_reads++;
+    return __real_disk_read(pdrv, buff, sector, count);
+}
+
+DRESULT __wrap_disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    fw.disk_writes++;
+    return __real_disk_write(pdrv, buff, sector, count);
+}
+
+static uint32_t next_random(void)
+{
+    rand_state = rand_state * 1103515245u + 12345u;
+    return rand_state >> 8;
+}
+
+/* One guest I/O cycle; the guest's next one follows after guest_us. */
+static uint8_t io(uint8_t port, bool write, uint8_t v)
+{
+    if (held_for == 0) {
+        hdc_host_run(now);
+    }
+    now = hdc_host_access(now, port, write, &v) + guest_us;
+    if (hdc_host_deadlocked()) {
+        fprintf(stderr, "Deadlock: the guest is stalled on the FIFO and nothing will release it.\n");
+        exit(1);
+    }
+    return v;
+}
+
+/* Issue one command the way the hdcsim guest driver does: the FIFO data
+ * before or after the two-phase task file load, then a status poll until
+ * the busy bit clears.  Read data is checked against the shadow copy, and
+ * the shadow copy follows writes.  Returns true if the command failed.
+ */
+static bool command(uint8_t cmd, uint8_t drive, uint16_t cyl, uint8_t head, uint8_t sect, uint8_t nsec,
+                    uint8_t flags)
+{
+    uint32_t offset = ((uint32_t)(cyl * hdc_card_heads[drive] + head) * SPT + sect) * SECT_LEN;
+    uint32_t len = nsec * SECT_LEN;
+    uint8_t *shadow = hdc_card_shadow[drive];
+    uint8_t status;
+
+    if (flags & (F_DATA_FIRST | F_DATA_AFTER)) {
+        for (uint32_t i = 0; i < len; i++) {
+            data[i] = (uint8_t)next_random();
+        }
+        if (!(flags & F_KEEP_FIFO)) {
+            io(0x44, true, 0);
+        }
+    }
+    if (flags & F_DATA_FIRST) {
+        for (uint32_t i = 0; i < len; i++) {
+            io(0x48, true, data[i]);
+        }
+    }
+
+    io(0x41, true, drive);
+    io(0x42, true, (uint8_t)cyl);
+    io(0x43, true, (uint8_t)(cyl >> 8));
+    io(0x40, true, cmd | 0x80);
+    io(0x41, true, head);
+    io(0x42, true, nsec);
+    io(0x43, true, 0);
+    io(0x40, true, sect);
+    if (held_for != 0) {
+        held_for--;
+    }
+    do {
+        status = io(0x40, false, 0);
+        if (status & STATUS_BUSY) {
+            held_for = 0;       /* Only the main loop can finish it. */
+        }
+    } while (status & STATUS_BUSY);
+
+    if (flags & F_DATA_AFTER) {
+        for (uint32_t i = 0; i < len; i++) {
+            io(0x48, true, data[i]);
+        }
+    }
+    if (flags & F_READ) {
+        if (!(flags & F_KEEP_FIFO)) {
+            io(0x44, true, 0);
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            uint8_t v = io(0x48, false, 0);
+
+            if (v != shadow[offset + i]) {
+                if (mismatches++ == 0) {
+                    fprintf(stderr, "Drive %d: byte %u of the image read as %02x, expected %02x.\n",
+                            drive, offset + i, v, shadow[offset + i]);
+                }
+            }
+        }
+    }
+
+    if (cmd == CMD_READ_SECT) {
+        guest_moved += len;
+    } else if (cmd == CMD_WRITE_SECT) {
+        memcpy(&shadow[offset], data, len);
+        guest_moved += len;
+        guest_written += len;
+    } else if (cmd == CMD_FORMAT_TRK) {
+        offset -= sect * SECT_LEN;
+        memset(&shadow[offset], 0xE5, SPT * SECT_LEN);
+        guest_moved += SPT * SECT_LEN;
+        guest_written += SPT * SECT_LEN;
+    }
+    return (status & STATUS_ERROR) != 0;
+}
+
+/* A command addressed by sector number within the drive. */
+static bool sector_command(uint8_t cmd, uint8_t drive, uint32_t s, uint8_t nsec, uint8_t flags)
+{
+    uint32_t spc = hdc_card_heads[drive] * SPT;
+
+    return command(cmd, drive, (uint16_t)(s / spc), (uint8_t)((s / SPT) % hdc_card_heads[drive]),
+                   (uint8_t)(s % SPT), nsec, flags);
+}
+
+/* OASIS COPY, as a trace: look up the source file's directory entry, move
+ * it in COPY_CHUNK-sector pieces from drive 0 to drive 3 with the data in
+ * the FIFO first, then update the destination's directory entry and
+ * allocation map.  File lengths and sources are random.
+ */
+static uint32_t copy_trace(uint32_t sectors, uint32_t *commands)
+{
+    uint32_t errors = 0, dest = COPY_DEST_CYL * hdc_card_heads[3] * SPT;
+    uint32_t dest_end = hdc_card_image_size(3) / SECT_LEN;
+    uint32_t src_end = hdc_card_image_size(0) / SECT_LEN;
+
+    while (sectors != 0) {
+        uint32_t len = 1 + next_random() % 64;
+        uint32_t src = SPT * hdc_card_heads[0] + next_random() % (src_end - SPT * hdc_card_heads[0] - 64);
+        uint8_t dir = (uint8_t)(1 + next_random() % 8);
+
+        if (len > sectors) {
+            len = sectors;
+        }
+        if (dest + len > dest_end) {
+            dest = COPY_DEST_CYL * hdc_card_heads[3] * SPT;
+        }
+        errors += command(CMD_READ_SECT, 0, 0, 0, dir, 1, F_READ);
+        for (uint32_t i = 0; i < len; i += COPY_CHUNK) {
+            uint8_t n = (uint8_t)((len - i < COPY_CHUNK) ? len - i : COPY_CHUNK);
+
+            errors += sector_command(CMD_READ_SECT, 0, src + i, n, F_READ);
+            errors += sector_command(CMD_WRITE_SECT, 3, dest + i, n, F_DATA_FIRST);
+            *commands += 2;
+        }
+        errors += command(CMD_READ_SECT, 3, 0, 0, dir, 1, F_READ);
+        errors += command(CMD_WRITE_SECT, 3, 0, 0, dir, 1, F_DATA_FIRST);
+        errors += command(CMD_WRITE_SECT, 3, 0, 0, 0, 1, F_DATA_FIRST);
+        *commands += 4;
+        dest += len;
+        sectors -= len;
+    }
+    return errors;
+}
+
+/* A guest needn't start the FIFO over between commands: neither the FIFO a
+ * READ_SECT leaves part read, nor the data a WRITE_SECT took after the
+ * command, may be taken for the data of a WRITE_SECT that follows the
+ * command.  The writes are read back.  Returns the number of commands that
+ * failed or read the wrong data.
+ */
+static uint32_t fifo_check(void)
+{
+    uint32_t errors = 0, bad = mismatches;
+    uint32_t end = hdc_card_image_size(0) / SECT_LEN - SPT;
+
+    for (uint32_t i = 0; i < FIFO_CHECKS; i++) {
+        uint32_t s = next_random() % end;
+        uint8_t n = (uint8_t)(1 + next_random() % FIFO_SECTS);
+        uint8_t n2 = (uint8_t)(1 + next_random() % FIFO_SECTS);
+
+        errors += sector_command(CMD_READ_SECT, 0, s, 1, F_READ | F_KEEP_FIFO);
+        errors += sector_command(CMD_WRITE_SECT, 0, s, n, F_DATA_AFTER | F_KEEP_FIFO);
+        errors += sector_command(CMD_WRITE_SECT, 0, s + n, n2, F_DATA_AFTER | F_KEEP_FIFO);
+        errors += sector_command(CMD_READ_SECT, 0, s, n, F_READ | F_KEEP_FIFO);
+        errors += sector_command(CMD_READ_SECT, 0, s + n, n2, F_READ | F_KEEP_FIFO);
+    }
+    return errors + (mismatches - bad);
+}
+
+/* With IBC_HDC_FAST_READ (hdcbench_fast), CLC2_ISR completes a READ_SECT
+ * from the cache and leaves the rest to the main loop.  A WRITE_SECT puts a
+ * line in the cache, with the whole FIFO free, and a READ_SECT from it is
+ * completed in the ISR.  Keep the loop from running until the next command
+ * is in, so that command finds the READ_SECT still unaccounted for: either
+ * a WRITE_SECT to the same line, or the first of the writes that evict it.
+ * The sectors are then read back.  Returns the number of commands that
+ * failed or read the wrong data, plus one if CLC2_ISR didn't complete every
+ * held READ_SECT, or completed any in a build without IBC_HDC_FAST_READ.
+ */
+static uint32_t fast_read_check(void)
+{
+    uint32_t errors = 0, bad = mismatches, isr_reads = hdc_host_get_stats()->isr_reads;
+    uint32_t end = hdc_card_image_size(0) / SECT_LEN - 2 * (FAST_READ_EVICT + 1);
+
+    for (uint32_t i = 0; i < FAST_READ_CHECKS; i++) {
+        uint32_t s = (next_random() % end) & ~1u;   /* The first sector of a cache line */
+
+        errors += sector_command(CMD_WRITE_SECT, 0, s, 2, F_DATA_FIRST);
+        held_for = 2;
+        errors += sector_command(CMD_READ_SECT, 0, s + (i & 1), 1, F_READ);
+        if (i & 2) {
+            errors += sector_command(CMD_WRITE_SECT, 0, s + 1 - (i & 1), 1, F_DATA_FIRST);
+        } else {
+            for (uint32_t j = 1; j <= FAST_READ_EVICT; j++) {
+                errors += sector_command(CMD_WRITE_SECT, 0, s + 2 * j, 1, F_DATA_FIRST);
+            }
+        }
+        errors += sector_command(CMD_READ_SECT, 0, s, 2, F_READ);
+        errors += sector_command(CMD_READ_SECT, 0, s + 1, 1, F_READ);
+    }
+    isr_reads = hdc_host_get_stats()->isr_reads - isr_reads;
+#ifdef IBC_HDC_FAST_READ
+    return errors + (mismatches - bad) + (isr_reads < FAST_READ_CHECKS);
+#else
+    return errors + (mismatches - bad) + (isr_reads != 0);
+#endif /* IBC_HDC_FAST_READ */
+}
+
+/* A RESET remounts the card and maps the contiguous drive images from
+ * their IBCDISKn.ext sidecars, without building a link map.  Change the
+ * volume serial number or an image's modification time behind the
+ * firmware's back and the sidecar must be rejected: the next RESET builds
+ * the link map again, and writes a sidecar that the one after it uses.
+ * The first RESET only settles the sidecars, as writes through FatFs in
+ * the workloads changed the images' modification times.  Returns the
+ * number of RESETs that failed or went the wrong way.
+ */
+static uint32_t sidecar_check(uint32_t fragments)
+{
+    uint32_t errors = 0;
+
+    if (fragments > 1) {
+        return 0;           /* Fragmented images are never mapped */
+    }
+    for (int i = 0; i < 5; i++) {
+        uint32_t lseeks = fw.lseeks;
+        bool changed = (i == 1) ? hdc_card_set_mtime(image, 3, 0x5A385353) :
+                       (i == 3) ? hdc_card_set_serial(image, 0x53533830) : false;
+
+        errors += command(CMD_RESET, 0, 0, 0, 0, 1, 0);
+        if (i != 0) {
+            errors += ((fw.lseeks != lseeks) != changed);
+        }
+    }
+    return errors;
+}
+
+typedef struct {
+    uint32_t lseeks, lseek_steps, disk_reads, disk_writes;
+    uint32_t sd_cmds, blocks_read, blocks_written;
+    uint64_t guest_moved, guest_written;
+    double   now;
+} snapshot_t;
+
+static void take_snapshot(snapshot_t *s)
+{
+    const sd_card_model_stats_t *card = sd_card_model_get_stats();
+
+    s->lseeks = fw.lseeks;
+    s->lseek_steps = fw.lseek_steps;
+    s->disk_reads = fw.disk_reads;
+    s->disk_writes = fw.disk_writes;
+    s->sd_cmds = SD_SPI_GetCommandTotal();
+    s->blocks_read = card->blocks_read;
+    s->blocks_written = card->blocks_written;
+    s->guest_moved = guest_moved;
+    s->guest_written = guest_written;
+    s->now = now;
+}
+
+static void run_workload(workload_type_t type, uint32_t tracks, uint32_t count, double *m)
+{
+    uint32_t commands = 0, errors = 0, bad = mismatches;
+    snapshot_t a, b;
+    double us;
+
+    sd_card_model_track_blocks(true);
+    take_snapshot(&a);
+
+    switch (type) {
+    case W_VERIFY:
+        /* OASIS VERIFY reads a track at a time. */
+        for (uint32_t t = 0; t < tracks; t++) {
+            errors += sector_command(CMD_READ_SECT, 0, t * SPT, SPT, F_READ);
+            commands++;
+        }
+        break;
+    case W_RANDOM_READ:
+        for (uint32_t i = 0; i < count; i++) {
+            errors += sector_command(CMD_READ_SECT, 0, next_random() % (hdc_card_image_size(0) / SECT_LEN), 1, F_READ);
+        }
+        commands = count;
+        break;
+    case W_RANDOM_WRITE:
+        for (uint32_t i = 0; i < count; i++) {
+            errors += sector_command(CMD_WRITE_SECT, 0, next_random() % (hdc_card_image_size(0) / SECT_LEN), 1,
+                                     F_DATA_FIRST);
+        }
+        commands = count;
+        break;
+    case W_FORMAT:
+        for (uint32_t t = 0; t < (uint32_t)hdc_card_cyls[3] * hdc_card_heads[3]; t++) {
+            errors += sector_command(CMD_FORMAT_TRK, 3, t * SPT, 1, 0);
+            commands++;
+        }
+        break;
+    case W_COPY:
+        errors += copy_trace(count / 2, &commands);
+        break;
+    case W_SEQ_READ:
+        /* A file read a sector at a time, which read-ahead keeps ahead of. */
+        for (uint32_t i = 0; i < count; i++) {
+            errors += sector_command(CMD_READ_SECT, 0, i, 1, F_READ);
+        }
+        commands = count;
+        break;
+    default:
+        break;
+    }
+
+    us = now - a.now;
+    hdc_host_run(now + SETTLE_US);
+    now += SETTLE_US;
+    take_snapshot(&b);
+
+    m[M_COMMANDS] = commands;
+    m[M_BYTES] = (double)(b.guest_moved - a.guest_moved);
+    m[M_ERRORS] = errors + (mismatches - bad);
+    m[M_MODEL_US] = us;
+    m[M_CMDS_PER_S] = commands / (us / 1e6);
+    m[M_BYTES_PER_S] = m[M_BYTES] / (us / 1e6);
+    m[M_LSEEKS] = b.lseeks - a.lseeks;
+    m[M_LSEEK_STEPS] = b.lseek_steps - a.lseek_steps;
+    m[M_DISK_READS] = b.disk_reads - a.disk_reads;
+    m[M_DISK_WRITES] = b.disk_writes - a.disk_writes;
+    m[M_SD_CMDS] = b.sd_cmds - a.sd_cmds;
+    m[M_BLOCKS_READ] = b.blocks_read - a.blocks_read;
+    m[M_BLOCKS_WRITTEN] = b.blocks_written - a.blocks_written;
+    m[M_BLOCKS_TOUCHED] = sd_card_model_get_stats()->blocks_touched;
+    m[M_WRITE_AMP] = (b.guest_written != a.guest_written) ?
+                     m[M_BLOCKS_WRITTEN] * SD_CARD_MODEL_BLOCK / (double)(b.guest_written - a.guest_written) : 0.0;
+}
+
+static void print_report(const sd_card_model_config_t *card, uint32_t fragments, double m[][METRICS], bool ok)
+{
+    fprintf(report, "{\n  \"config\": { \"nac\": %u, \"write_busy\": %u, \"stop_busy\": %u, ",
+            card->nac, card->write_busy, card->stop_busy);
+    fprintf(report, "\"isr_fifo_rd\": %g, \"isr_fifo_wr\": %g, \"isr_reg\": %g, \"isr_hit\": %g, \"cmd\": %g, \"poll\": %g, ",
+            host.isr_fifo_rd, host.isr_fifo_wr, host.isr_reg, host.isr_hit, host.cmd, host.poll);
+    fprintf(report, "\"guest\": %g, \"fragments\": %u },\n  \"workloads\": [\n", guest_us, fragments);
+    for (int w = 0; w < WORKLOADS; w++) {
+        fprintf(report, "    { \"name\": \"%s\"", workload_names[w]);
+        for (int i = 0; i < METRICS; i++) {
+            fprintf(report, ", \"%s\": %.*f", metric[i].name, (m[w][i] == (uint64_t)m[w][i]) ? 0 : 3, m[w][i]);
+        }
+        fprintf(report, " }%s\n", (w + 1 < WORKLOADS) ? "," : "");
+    }
+    fprintf(report, "  ],\n  \"result\": \"%s\"\n}\n", ok ? "ok" : "FAIL");
+}
+
+/* Find a metric of a workload in a report written by print_report(). */
+static bool find_metric(const char *text, const char *workload, const char *name, double *v)
+{
+    char key[64];
+    const char *p, *end;
+
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", workload);
+    if ((p = strstr(text, key)) == NULL) {
+        return false;
+    }
+    end = strchr(p, '}');
+    snprintf(key, sizeof(key), "\"%s\": ", name);
+    if (((p = strstr(p, key)) == NULL) || ((end != NULL) && (p > end))) {
+        return false;
+    }
+    *v = strtod(p + strlen(key), NULL);
+    return true;
+}
+
+/* List the metrics that are worse than the baseline by more than `tol`.
+ * Returns the number of regressions.
+ */
+static uint32_t compare(const char *path, double m[][METRICS], double tol)
+{
+    FILE *fp = fopen(path, "r");
+    uint32_t regressions = 0;
+    char *text;
+    long size;
+
+    if ((fp == NULL) || (fseek(fp, 0, SEEK_END) != 0) || ((size = ftell(fp)) < 0) ||
+        ((text = calloc(size + 1, 1)) == NULL)) {
+        perror(path);
+        exit(1);
+    }
+    rewind(fp);
+    if (fread(text, 1, size, fp) != (size_t)size) {
+        perror(path);
+        exit(1);
+    }
+    fclose(fp);
+
+    for (int w = 0; w < WORKLOADS; w++) {
+        double base;
+
+        if (!find_metric(text, workload_names[w], metric[M_BYTES].name, &base)) {
+            fprintf(stderr, "%s: not in the baseline.\n", workload_names[w]);
+            continue;
+        }
+        if ((base != m[w][M_BYTES]) ||
+            (find_metric(text, workload_names[w], metric[M_COMMANDS].name, &base) && (base != m[w][M_COMMANDS]))) {
+            fprintf(stderr, "%s: the workload differs from the baseline, not compared.\n", workload_names[w]);
+            continue;
+        }
+        for (int i = 0; i < METRICS; i++) {
+            double v = m[w][i];
+            bool worse;
+
+            if ((metric[i].better == 0) || !find_metric(text, workload_names[w], metric[i].name, &base)) {
+                continue;
+            }
+            worse = (metric[i].better > 0) ? (v < base * (1.0 - tol)) : (v > base * (1.0 + tol));
+            if (worse) {
+                fprintf(stderr, "Regression: %s %s %.3f, baseline %.3f (%+.1f%%)\n", workload_names[w],
+                        metric[i].name, v, base, (base != 0.0) ? (v - base) * 100.0 / base : 100.0);
+                regressions++;
+            }
+        }
+    }
+    free(text);
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    sd_card_model_config_t card = SD_CARD_MODEL_DEFAULTS;
+    static double m[WORKLOADS][METRICS];
+    const char *log = "/dev/null";
+    const char *card_file = NULL, *json = NULL, *baseline = NULL;
+    uint32_t tracks = 2048, count = 4096, fragments = 0;
+    uint32_t errors = 0;
+    double tol = 5.0;
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if ((argv[a][0] == '-') && (a + 1 < argc) && strchr("absiogkxpzcnFt", argv[a][1])) {
+            double v = strtod(argv[++a], NULL);
+
+            /* At 8MHz one SPI byte time is 1us. */
+            switch (argv[a - 1][1]) {
+            case 'a': card.nac = (uint32_t)v; break;
+            case 'b': card.write_busy = (uint32_t)v; break;
+            case 's': card.stop_busy = (uint32_t)v; break;
+            case 'i': host.isr_fifo_rd = v; break;
+            case 'o': host.isr_fifo_wr = v; break;
+            case 'g': host.isr_reg = v; break;
+            case 'k': host.isr_hit = v; break;
+            case 'x': host.cmd = v; break;
+            case 'p': host.poll = v; break;
+            case 'z': guest_us = v; break;
+            case 'c': tracks = (uint32_t)v; break;
+            case 'n': count = (uint32_t)v; break;
+            case 'F': fragments = (uint32_t)v; break;
+            case 't': tol = v; break;
+            }
+        } else if ((argv[a][0] == '-') && (a + 1 < argc) && strchr("fjrl", argv[a][1])) {
+            switch (argv[a++][1]) {
+            case 'f': card_file = argv[a]; break;
+            case 'j': json = argv[a]; break;
+            case 'r': baseline = argv[a]; break;
+            case 'l': log = argv[a]; break;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [-a nac_us] [-b busy_us] [-s stop_us] [-i fifo_rd_us] [-o fifo_wr_us] [-g reg_us]\n"
+                    "       [-k hit_us] [-x cmd_us] [-p poll_us] [-z guest_us] [-c tracks] [-n count] [-F fragments]\n"
+                    "       [-f card_file] [-j json_file] [-r baseline] [-t tolerance_pct] [-l log]\n", argv[0]);
+            return 1;
+        }
+    }
+    if ((host.poll <= 0.0) || (guest_us <= 0.0) || (tracks < 1) ||
+        (tracks > (uint32_t)hdc_card_cyls[0] * hdc_card_heads[0]) || (count < 2) || (fragments > 64)) {
+        fprintf(stderr, "The poll and guest times must be positive, the tracks 1-%d, the count at least 2\n"
+                "and the fragments at most 64.\n", hdc_card_cyls[0] * hdc_card_heads[0]);
+        return 1;
+    }
+
+    /* The firmware's console output goes to stdout; keep the report apart. */
+    fflush(stdout);
+    if (json != NULL) {
+        report = fopen(json, "w");
+    } else {
+        report = fdopen(dup(fileno(stdout)), "w");
+    }
+    if ((report == NULL) || (freopen(log, "w", stdout) == NULL)) {
+        perror((report == NULL) ? json : log);
+        return 1;
+    }
+
+    if (card_file != NULL) {
+        image = fopen(card_file, "w+b");
+    } else {
+        void *mem = calloc(HDC_CARD_BLOCKS, SD_CARD_MODEL_BLOCK);
+
+        image = (mem != NULL) ? fmemopen(mem, HDC_CARD_BLOCKS * SD_CARD_MODEL_BLOCK, "r+b") : NULL;
+    }
+    if ((image == NULL) || !hdc_card_build(image, fragments)) {
+        fprintf(stderr, "Could not build the card image.\n");
+        return 1;
+    }
+    if (!sd_card_model_open(image, &card)) {
+        fprintf(stderr, "The card image is too small.\n");
+        return 1;
+    }
+    spi_model_reset();
+    spi_model_attach(sd_card_model_device);
+    hdc_host_init(&host);
+
+    /* Mount the card and open the drive images. */
+    errors += command(CMD_RESET, 0, 0, 0, 0, 1, 0);
+    for (int w = 0; w < WORKLOADS; w++) {
+        run_workload((workload_type_t)w, tracks, count, m[w]);
+        errors += (uint32_t)m[w][M_ERRORS];
+    }
+    if (m[W_VERIFY][M_SD_CMDS] > tracks + VERIFY_SD_CMDS_SLACK) {
+        fprintf(stderr, "VERIFY took %.0f SD commands for %u tracks; its multiple block reads were broken up.\n",
+                m[W_VERIFY][M_SD_CMDS], tracks);
+        errors++;
+    }
+    if (fifo_check() != 0) {
+        fprintf(stderr, "A WRITE_SECT with no FIFO reset before it lost its data.\n");
+        errors++;
+    }
+    if (fast_read_check() != 0) {
+        fprintf(stderr, "A READ_SECT completed in CLC2_ISR, or a command straight after it, went wrong.\n");
+        errors++;
+    }
+    if (sidecar_check(fragments) != 0) {
+        fprintf(stderr, "A drive image's sidecar was used after the volume or the image changed, or not used after.\n");
+        errors++;
+    }
+    /* RESET writes everything back to the card. */
+    errors += command(CMD_RESET, 0, 0, 0, 0, 1, 0);
+    errors += hdc_card_check(image);
+
+    print_report(&card, fragments, m, errors == 0);
+    fclose(report);
+    fclose(image);
+
+    if (errors) {
+        return 1;
+    }
+    if ((baseline != NULL) && (compare(baseline, m, tol / 100.0) != 0)) {
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,680 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     End-to-end model of the z80_ssd: a Z80 running a driver in the    *
+ * style of the OASIS one talks to the unmodified ibc_disk_ctrl.c, which *
+ * runs FatFs and sd_spi.c against the SD card model.  The card image is *
+ * a scratch FAT16 volume holding IBCDISK0.dsk and IBCDISK3.dsk.  Every  *
+ * byte read through the FIFO is checked against a shadow copy of the    *
+ * drive images, and so is the card image at the end.  For each          *
+ * workload, hdcsim reports the Z80 T-states per KB transferred and the  *
+ * wait states the controller added.  A FIFO timeout is then injected    *
+ * into a streaming READ_SECT, and a card write error into a streaming   *
+ * WRITE_SECT; the command after each must report it.                    *
+ *                                                                       *
+ * Usage: hdcsim [options]                                               *
+ *     -m MHZ      Z80 clock (4)                                         *
+ *     -a US       card read access time, NAC (100)                      *
+ *     -b US       card programming time per written block (250)         *
+ *     -s US       card busy time after a stop (500)                     *
+ *     -i US       CLC2_ISR time for a FIFO read (2.0)                   *
+ *     -o US       CLC2_ISR time for a FIFO write (1.75)                 *
+ *     -g US       CLC2_ISR time for any other register (3.0)            *
+ *     -k US       ...plus this per sector of a READ_SECT it completes   *
+ *                 from the cache (25)                                   *
+ *     -x US       firmware time per command, besides the card (50)      *
+ *     -p US       idle pass of the main loop (5)                        *
+ *     -c TRACKS   tracks read by VERIFY; the other workloads scale      *
+ *                 with it (256)                                         *
+ *     -l FILE     save the firmware's console output                    *
+ *     -v          print the card's per-command statistics               *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "sd_spi/sd_spi.h"
+#include "spi_model.h"
+#include "sd_card_model.h"
+#include "hdc_card.h"
+#include "hdc_host.h"
+#include "z80.h"
+
+#define SECT_LEN            HDC_CARD_SECT_LEN
+#define SPT                 HDC_CARD_SPT
+
+/* Guest memory */
+#define GUEST_PUTDATA       0x0100
+#define GUEST_GETDATA       0x0120
+#define GUEST_LIST          0x0200
+#define GUEST_STACK         0x7F00
+#define GUEST_READ_BUF      0x8000
+#define GUEST_WRITE_BUF     0xA000      /* Three buffers of 8KB */
+#define ENTRY_LEN           12
+#define BATCH_LEN           256
+#define TIMEOUT_DELAY_US    20000       /* Injected card delay, well over STALL_MAX_US */
+
+/* Command list entry flags */
+#define F_DATA_FIRST        0x01        /* Reset the FIFO and write the data before the command */
+#define F_DATA_AFTER        0x02        /* Reset the FIFO, write the data after the command */
+#define F_READ              0x04        /* Reset the FIFO and read the data after the command */
+
+#define CMD_RESET           0x00
+#define CMD_READ_SECT       0x01
+#define CMD_WRITE_SECT      0x02
+#define CMD_FORMAT_TRK      0x08
+#define CMD_READ_PARAMS     0x10
+
+typedef struct {
+    uint8_t  cmd;
+    uint8_t  drive;
+    uint16_t cyl;
+    uint8_t  head;
+    uint8_t  sect;
+    uint8_t  nsec;
+    uint8_t  flags;
+    uint16_t buf;
+} guest_cmd_t;
+
+static FILE *report;
+static FILE *image;
+static double mhz = 4.0;
+static uint32_t rand_state = 1;
+
+static z80_t cpu;
+static uint8_t mem[65536];
+
+/* What the guest has told the controller, tracked from its port writes. */
+static struct {
+    uint8_t  holding[4];
+    uint8_t  cmd;
+    uint8_t  drive;
+    uint16_t cyl;
+    uint32_t offset;
+    uint32_t len;
+    bool     reading;       /* FIFO reads are READ_SECT data */
+    bool     writing;       /* FIFO writes are WRITE_SECT data, after the command */
+    uint32_t pos;           /* FIFO position since port 44h was written */
+    uint8_t  fifo[SECT_LEN * 255];
+} tf;
+
+static uint32_t mismatches;
+static bool unchecked;          /* The FIFO data is known to be bad; don't check it */
+static uint32_t status_polls;
+static uint64_t wait_states;
+
+static uint32_t next_random(void)
+{
+    rand_state = rand_state * 1103515245u + 12345u;
+    return rand_state >> 8;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+/* Track the task file like IBC_HDC_Write(), and keep the shadow copies
+ * current as commands are issued.
+ */
+static void guest_out(uint8_t port, uint8_t v)
+{
+    switch (port) {
+    case 0x40:
+        if (v & 0x80) {
+            tf.cmd = v & 0x7F;
+            tf.drive = tf.holding[1] & 0x03;
+            tf.cyl = (uint16_t)(tf.holding[2] | (tf.holding[3] << 8));
+            break;
+        }
+        tf.reading = false;
+        tf.writing = false;
+        if (!hdc_card_present[tf.drive]) {
+            break;
+        }
+        tf.offset = ((uint32_t)(tf.cyl * hdc_card_heads[tf.drive] + tf.holding[1]) * SPT + v) * SECT_LEN;
+        tf.len = (tf.holding[2] ? tf.holding[2] : 1) * SECT_LEN;
+        if (tf.offset + tf.len > hdc_card_image_size(tf.drive)) {
+            break;
+        }
+        switch (tf.cmd) {
+        case CMD_READ_SECT:
+            tf.reading = true;
+            break;
+        case CMD_WRITE_SECT:
+            if (tf.pos >= tf.len) {
+                memcpy(&hdc_card_shadow[tf.drive][tf.offset], tf.fifo, tf.len);
+            } else {
+                tf.writing = true;
+                tf.pos = 0;
+            }
+            break;
+        case CMD_FORMAT_TRK:
+            tf.offset -= v * SECT_LEN;
+            memset(&hdc_card_shadow[tf.drive][tf.offset], 0xE5, SPT * SECT_LEN);
+            break;
+        }
+        break;
+    case 0x41:
+    case 0x42:
+    case 0x43:
+        tf.holding[port & 0x03] = v;
+        break;
+    case 0x44:
+        tf.pos = 0;
+        break;
+    case 0x48:
+        if (tf.writing) {
+            if (tf.pos < tf.len) {
+                hdc_card_shadow[tf.drive][tf.offset + tf.pos++] = v;
+            }
+        } else if (tf.pos < sizeof(tf.fifo)) {
+            tf.fifo[tf.pos++] = v;
+        }
+        break;
+    }
+}
+
+static void guest_in(uint8_t port, uint8_t v)
+{
+    if (port == 0x40) {
+        status_polls++;
+    } else if ((port == 0x48) && tf.reading && !unchecked && (tf.pos < tf.len)) {
+        if (v != hdc_card_shadow[tf.drive][tf.offset + tf.pos]) {
+            if (mismatches++ == 0) {
+                fprintf(stderr, "Drive %d: byte %u of the image read as %02x, expected %02x.\n",
+                        tf.drive, tf.offset + tf.pos, v, hdc_card_shadow[tf.drive][tf.offset + tf.pos]);
+            }
+        }
+        tf.pos++;
+    }
+}
+
+static void add_wait(z80_t *z, double now, double release)
+{
+    uint32_t t = (uint32_t)ceil((release - now) * mhz - 1e-9);
+
+    z->wait += t;
+    wait_states += t;
+}
+
+static uint8_t cpu_in(z80_t *z, uint16_t port)
+{
+    double now = (double)(z->cycles + z->wait) / mhz;
+    uint8_t p = (uint8_t)port, v = 0xFF;
+
+    if ((p & 0xF0) != 0x40) {
+        return v;
+    }
+    add_wait(z, now, hdc_host_access(now, p, false, &v));
+    guest_in(p, v);
+    return v;
+}
+
+static void cpu_out(z80_t *z, uint16_t port, uint8_t v)
+{
+    double now = (double)(z->cycles + z->wait) / mhz;
+    uint8_t p = (uint8_t)port;
+
+    if ((p & 0xF0) != 0x40) {
+        return;
+    }
+    guest_out(p, v);
+    add_wait(z, now, hdc_host_access(now, p, true, &v));
+}
+
+/* The driver walks the command list at GUEST_LIST.  Each entry is: command,
+ * drive, cylinder (2), head, sector, count, flags, buffer (2), and a byte
+ * for the final status.  It writes the task file in two phases, as the
+ * OASIS driver does, polls the status until the busy bit clears, and moves
+ * the data with OTIR/INIR, 256 bytes at a time.
+ */
+static void load_driver(void)
+{
+    static const uint8_t main_code[] = {
+        0x31, 0x00, 0x7F,               /* 0000 LD   SP,GUEST_STACK */
+        0xDD, 0x21, 0x00, 0x02,         /* 0003 LD   IX,GUEST_LIST */
+        0xDD, 0x7E, 0x00,               /* 0007 NEXT: LD A,(IX+0) */
+        0xFE, 0xFF,                     /* 000A CP   0FFh */
+        0x28, 0x5D,                     /* 000C JR   Z,DONE */
+        0xDD, 0xCB, 0x07, 0x46,         /* 000E BIT  0,(IX+7) */
+        0x28, 0x05,                     /* 0012 JR   Z,NOPRE */
+        0xD3, 0x44,                     /* 0014 OUT  (44h),A */
+        0xCD, 0x00, 0x01,               /* 0016 CALL PUTDATA */
+        0xDD, 0xCB, 0x07, 0x4E,         /* 0019 NOPRE: BIT 1,(IX+7) */
+        0x28, 0x02,                     /* 001D JR   Z,TASK */
+        0xD3, 0x44,                     /* 001F OUT  (44h),A */
+        0xDD, 0x7E, 0x01, 0xD3, 0x41,   /* 0021 TASK: LD A,(IX+1) / OUT (41h),A */
+        0xDD, 0x7E, 0x02, 0xD3, 0x42,   /* 0026 LD A,(IX+2) / OUT (42h),A */
+        0xDD, 0x7E, 0x03, 0xD3, 0x43,   /* 002B LD A,(IX+3) / OUT (43h),A */
+        0xDD, 0x7E, 0x00, 0xF6, 0x80,   /* 0030 LD A,(IX+0) / OR 80h */
+        0xD3, 0x40,                     /* 0035 OUT  (40h),A */
+        0xDD, 0x7E, 0x04, 0xD3, 0x41,   /* 0037 LD A,(IX+4) / OUT (41h),A */
+        0xDD, 0x7E, 0x06, 0xD3, 0x42,   /* 003C LD A,(IX+6) / OUT (42h),A */
+        0xAF, 0xD3, 0x43,               /* 0041 XOR A / OUT (43h),A */
+        0xDD, 0x7E, 0x05, 0xD3, 0x40,   /* 0044 LD A,(IX+5) / OUT (40h),A */
+        0xDB, 0x40,                     /* 0049 BUSY: IN A,(40h) */
+        0xCB, 0x67,                     /* 004B BIT  4,A */
+        0x20, 0xFA,                     /* 004D JR   NZ,BUSY */
+        0xDD, 0x77, 0x0A,               /* 004F LD   (IX+10),A */
+        0xDD, 0xCB, 0x07, 0x4E,         /* 0052 BIT  1,(IX+7) */
+        0xC4, 0x00, 0x01,               /* 0056 CALL NZ,PUTDATA */
+        0xDD, 0xCB, 0x07, 0x56,         /* 0059 BIT  2,(IX+7) */
+        0x28, 0x05,                     /* 005D JR   Z,NOREAD */
+        0xD3, 0x44,                     /* 005F OUT  (44h),A */
+        0xCD, 0x20, 0x01,               /* 0061 CALL GETDATA */
+        0x11, 0x0C, 0x00,               /* 0064 NOREAD: LD DE,ENTRY_LEN */
+        0xDD, 0x19,                     /* 0067 ADD  IX,DE */
+        0x18, 0x9C,                     /* 0069 JR   NEXT */
+        0x76,                           /* 006B DONE: HALT */
+    };
+    static const uint8_t xfer_code[] = {
+        0xDD, 0x6E, 0x08,               /* LD   L,(IX+8) */
+        0xDD, 0x66, 0x09,               /* LD   H,(IX+9) */
+        0xDD, 0x56, 0x06,               /* LD   D,(IX+6) */
+        0x01, 0x48, 0x00,               /* LOOP: LD BC,0048h */
+        0xED, 0xB3,                     /* OTIR, or INIR for GETDATA */
+        0x15,                           /* DEC  D */
+        0x20, 0xF8,                     /* JR   NZ,LOOP */
+        0xC9,                           /* RET */
+    };
+
+    memset(mem, 0, sizeof(mem));
+    memcpy(&mem[0], main_code, sizeof(main_code));
+    memcpy(&mem[GUEST_PUTDATA], xfer_code, sizeof(xfer_code));
+    memcpy(&mem[GUEST_GETDATA], xfer_code, sizeof(xfer_code));
+    mem[GUEST_GETDATA + 13] = 0xB2;
+
+    z80_reset(&cpu);
+    cpu.mem = mem;
+    cpu.in = cpu_in;
+    cpu.out = cpu_out;
+}
+
+/* Run one batch of commands through the driver.  Returns the number that
+ * finished with the error bit set.
+ */
+static uint32_t run_batch(const guest_cmd_t *cmds, uint32_t n, uint32_t batch)
+{
+    uint32_t errors = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t *p = &mem[GUEST_LIST + i * ENTRY_LEN];
+
+        p[0] = cmds[i].cmd;
+        p[1] = cmds[i].drive;
+        put16(&p[2], cmds[i].cyl);
+        p[4] = cmds[i].head;
+        p[5] = cmds[i].sect;
+        p[6] = cmds[i].nsec;
+        p[7] = cmds[i].flags;
+        put16(&p[8], cmds[i].buf);
+        p[10] = 0xFF;
+    }
+    mem[GUEST_LIST + n * ENTRY_LEN] = 0xFF;
+    for (uint32_t i = GUEST_WRITE_BUF; i < sizeof(mem); i++) {
+        mem[i] = (uint8_t)(i * 3 + batch * 17 + (i >> 8));
+    }
+
+    cpu.pc = 0;
+    cpu.halted = false;
+    while (!cpu.halted) {
+        hdc_host_run((double)cpu.cycles / mhz);
+        z80_step(&cpu);
+        if (hdc_host_deadlocked()) {
+            fprintf(stderr, "Deadlock: the Z80 is stalled on the FIFO and nothing will release it.\n");
+            exit(1);
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (mem[GUEST_LIST + i * ENTRY_LEN + 10] & 0x01) {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+typedef struct {
+    guest_cmd_t cmds[BATCH_LEN];
+    uint32_t n;
+    uint32_t batches;
+    uint32_t commands;
+    uint32_t errors;
+    uint32_t sectors;
+} workload_t;
+
+static void flush_cmds(workload_t *w)
+{
+    if (w->n != 0) {
+        w->errors += run_batch(w->cmds, w->n, w->batches++);
+        w->n = 0;
+    }
+}
+
+static void add_cmd(workload_t *w, uint8_t cmd, uint8_t drive, uint16_t cyl, uint8_t head, uint8_t sect,
+                    uint8_t nsec, uint8_t flags)
+{
+    guest_cmd_t *c = &w->cmds[w->n++];
+
+    c->cmd = cmd;
+    c->drive = drive;
+    c->cyl = cyl;
+    c->head = head;
+    c->sect = sect;
+    c->nsec = nsec;
+    c->flags = flags;
+    c->buf = (flags & F_READ) ? GUEST_READ_BUF : (uint16_t)(GUEST_WRITE_BUF + (w->commands % 3) * 0x2000);
+    w->commands++;
+    if ((cmd == CMD_READ_SECT) || (cmd == CMD_WRITE_SECT)) {
+        w->sectors += nsec;
+    } else if (cmd == CMD_FORMAT_TRK) {
+        w->sectors += SPT;
+    }
+    if (w->n == BATCH_LEN) {
+        flush_cmds(w);
+    }
+}
+
+static void print_header(void)
+{
+    fprintf(report, "Workload       commands      KB   Z80 ms    T/KB    KB/s  wait T/KB  stall T/KB  polls/cmd  result\n");
+}
+
+static void print_line(const char *name, const workload_t *w, uint64_t cycles, uint64_t waits, double stall_us,
+                       uint32_t polls, uint32_t bad)
+{
+    double kb = w->sectors * SECT_LEN / 1024.0;
+    double ms = cycles / mhz / 1000.0;
+
+    fprintf(report, "%-14s %8u %7.0f %8.1f %7.0f %7.1f %10.0f %11.0f %10.1f  %s\n", name, w->commands, kb, ms,
+            (kb > 0.0) ? cycles / kb : 0.0, (ms > 0.0) ? kb / (ms / 1000.0) : 0.0,
+            (kb > 0.0) ? waits / kb : 0.0, (kb > 0.0) ? stall_us * mhz / kb : 0.0,
+            w->commands ? (double)polls / w->commands : 0.0, bad ? "FAIL" : "ok");
+}
+
+typedef enum {
+    W_RESET, W_VERIFY, W_RANDOM_READ, W_RANDOM_WRITE, W_LONG_WRITE, W_FORMAT, W_READ_BACK, W_CACHED_READ
+} workload_type_t;
+
+static uint32_t run_workload(const char *name, workload_type_t type, uint32_t tracks)
+{
+    static workload_t w;
+    uint64_t cycles = cpu.cycles, waits = wait_states;
+    double stall_us = hdc_host_get_stats()->stall_us;
+    uint32_t polls = status_polls, bad = mismatches;
+
+    memset(&w, 0, sizeof(w));
+    switch (type) {
+    case W_RESET:
+        add_cmd(&w, CMD_RESET, 0, 0, 0, 0, 1, 0);
+        add_cmd(&w, CMD_READ_PARAMS, 0, 0, 0, 0, 1, F_READ);
+        break;
+    case W_VERIFY:
+        /* OASIS VERIFY reads a track at a time. */
+        for (uint32_t t = 0; t < tracks; t++) {
+            add_cmd(&w, CMD_READ_SECT, 0, (uint16_t)(t / hdc_card_heads[0]), (uint8_t)(t % hdc_card_heads[0]), 0, SPT, F_READ);
+        }
+        break;
+    case W_RANDOM_READ:
+        for (uint32_t i = 0; i < tracks * 2; i++) {
+            uint32_t s = next_random() % (hdc_card_image_size(0) / SECT_LEN);
+
+            add_cmd(&w, CMD_READ_SECT, 0, (uint16_t)(s / (hdc_card_heads[0] * SPT)),
+                    (uint8_t)((s / SPT) % hdc_card_heads[0]), (uint8_t)(s % SPT), 1, F_READ);
+        }
+        break;
+    case W_RANDOM_WRITE:
+        /* Short writes with the data in the FIFO first, as OASIS does. */
+        for (uint32_t i = 0; i < tracks; i++) {
+            uint32_t s = next_random() % (hdc_card_image_size(0) / SECT_LEN - 10);
+
+            add_cmd(&w, CMD_WRITE_SECT, 0, (uint16_t)(s / (hdc_card_heads[0] * SPT)),
+                    (uint8_t)((s / SPT) % hdc_card_heads[0]), (uint8_t)(s % SPT), (uint8_t)(1 + next_random() % 10),
+                    F_DATA_FIRST);
+        }
+        break;
+    case W_LONG_WRITE:
+        /* Whole tracks, too long for the FIFO: the data follows the command. */
+        for (uint32_t t = 0; t < tracks / 4; t++) {
+            add_cmd(&w, CMD_WRITE_SECT, 3, (uint16_t)(t / hdc_card_heads[3]), (uint8_t)(t % hdc_card_heads[3]), 0, SPT,
+                    F_DATA_AFTER);
+        }
+        break;
+    case W_FORMAT:
+        for (uint32_t t = tracks / 4; t < tracks / 2; t++) {
+            add_cmd(&w, CMD_FORMAT_TRK, 3, (uint16_t)(t / hdc_card_heads[3]), (uint8_t)(t % hdc_card_heads[3]), 0, 1, 0);
+        }
+        break;
+    case W_READ_BACK:
+        for (uint32_t t = 0; t < tracks / 2; t++) {
+            add_cmd(&w, CMD_READ_SECT, 3, (uint16_t)(t / hdc_card_heads[3]), (uint8_t)(t % hdc_card_heads[3]), 0, SPT, F_READ);
+        }
+        break;
+    case W_CACHED_READ:
+        /* A short write leaves its cache line and the whole FIFO free, so
+         * the sectors are read back from the cache by CLC2_ISR.
+         */
+        for (uint32_t i = 0; i < tracks / 4; i++) {
+            uint32_t s = (next_random() % (hdc_card_image_size(0) / SECT_LEN)) & ~1u;
+            uint16_t cyl = (uint16_t)(s / (hdc_card_heads[0] * SPT));
+            uint8_t head = (uint8_t)((s / SPT) % hdc_card_heads[0]);
+
+            add_cmd(&w, CMD_WRITE_SECT, 0, cyl, head, (uint8_t)(s % SPT), 2, F_DATA_FIRST);
+            add_cmd(&w, CMD_READ_SECT, 0, cyl, head, (uint8_t)(s % SPT + 1), 1, F_READ);
+            add_cmd(&w, CMD_READ_SECT, 0, cyl, head, (uint8_t)(s % SPT), 2, F_READ);
+        }
+        break;
+    }
+    flush_cmds(&w);
+
+    bad = (mismatches - bad) + w.errors;
+    print_line(name, &w, cpu.cycles - cycles, wait_states - waits, hdc_host_get_stats()->stall_us - stall_us,
+               status_polls - polls, bad);
+    return bad;
+}
+
+/* The final status the driver stored for entry i of the last batch. */
+static uint8_t batch_status(uint32_t i)
+{
+    return mem[GUEST_LIST + i * ENTRY_LEN + 10];
+}
+
+/* A transfer failed after its command completed: check that entry i of
+ * the last batch reported the error, and that the entry after it didn't.
+ */
+static uint32_t reported_once(const char *what, uint32_t i)
+{
+    uint32_t errors = 0;
+
+    if (!(batch_status(i) & 0x01)) {
+        fprintf(stderr, "%s after its command completed wasn't reported to the guest.\n", what);
+        errors++;
+    }
+    if (batch_status(i + 1) & 0x01) {
+        fprintf(stderr, "%s was reported to the guest more than once.\n", what);
+        errors++;
+    }
+    return errors;
+}
+
+/* Make a streaming READ_SECT time out on the FIFO: the first block the idle
+ * loop reads after status has gone ready is held up at the card for longer
+ * than STALL_MAX_US, so the Z80 is let go without its data.  The READ_SECT
+ * has already completed by then, so the error must be reported by the next
+ * command, and not by the one after it.  Returns the number of failures.
+ */
+static uint32_t timeout_check(void)
+{
+    uint16_t cyl = (uint16_t)(hdc_card_cyls[0] - 1);
+    uint8_t head = (uint8_t)(hdc_card_heads[0] - 1);
+    uint32_t offset = ((uint32_t)cyl * hdc_card_heads[0] + head) * SPT * SECT_LEN;
+    const guest_cmd_t read_track[] = { { CMD_READ_SECT, 0, cyl, head, 0, SPT, F_READ, GUEST_READ_BUF } };
+    const guest_cmd_t after[] = {
+        { CMD_READ_SECT, 0, 0, 0, 0, 1, F_READ, GUEST_READ_BUF },
+        { CMD_READ_SECT, 0, 0, 0, 1, 1, F_READ, GUEST_READ_BUF },
+    };
+    uint32_t timeouts = hdc_host_get_stats()->timeouts;
+    uint32_t faults = sd_card_model_get_stats()->faults;
+    uint32_t errors = 0;
+
+    /* The lead reads the first IBC_HDC_READ_LEAD slots, ie. two blocks. */
+    sd_card_model_delay_block(hdc_card_block(0, offset + 4 * SECT_LEN), TIMEOUT_DELAY_US);
+    /* The Z80 reads whatever the FIFO holds after the timeout. */
+    unchecked = true;
+    run_batch(read_track, 1, 0);
+    unchecked = false;
+    if ((sd_card_model_get_stats()->faults == faults) || (hdc_host_get_stats()->timeouts == timeouts)) {
+        fprintf(stderr, "The injected card delay didn't time out a FIFO cycle.\n");
+        errors++;
+    }
+
+    run_batch(after, 2, 1);
+    return errors + reported_once("A FIFO timeout", 0);
+}
+
+/* Fail the card write of a slot of a long WRITE_SECT, which the idle loop
+ * writes out while the Z80 fills the FIFO, after status has gone ready.
+ * The next command must report the error, and not the one after it.  The
+ * guest then writes the track again, so the card still matches the shadow
+ * at the end.  Returns the number of failures.
+ */
+static uint32_t write_fault_check(void)
+{
+    uint16_t cyl = (uint16_t)(hdc_card_cyls[3] - 1);
+    uint8_t head = (uint8_t)(hdc_card_heads[3] - 1);
+    uint32_t offset = ((uint32_t)cyl * hdc_card_heads[3] + head) * SPT * SECT_LEN;
+    const guest_cmd_t cmds[] = {
+        { CMD_WRITE_SECT, 3, cyl, head, 0, SPT, F_DATA_AFTER, GUEST_WRITE_BUF },
+        { CMD_READ_SECT, 0, 0, 0, 0, 1, F_READ, GUEST_READ_BUF },
+        { CMD_READ_SECT, 0, 0, 0, 1, 1, F_READ, GUEST_READ_BUF },
+        { CMD_WRITE_SECT, 3, cyl, head, 0, SPT, F_DATA_AFTER, GUEST_WRITE_BUF },
+    };
+    uint32_t faults = sd_card_model_get_stats()->faults;
+    uint32_t errors = 0;
+
+    sd_card_model_fail_block(hdc_card_block(3, offset + 4 * SECT_LEN));
+    run_batch(cmds, 4, 2);
+    if (sd_card_model_get_stats()->faults == faults) {
+        fprintf(stderr, "The injected write error didn't reach the card.\n");
+        errors++;
+    }
+    if (batch_status(3) & 0x01) {
+        fprintf(stderr, "Writing the track again after a failed card write didn't work.\n");
+        errors++;
+    }
+    return errors + reported_once("A failed card write", 1);
+}
+
+int main(int argc, char *argv[])
+{
+    sd_card_model_config_t card = SD_CARD_MODEL_DEFAULTS;
+    hdc_host_config_t host = HDC_HOST_DEFAULTS;
+    const hdc_host_stats_t *stats;
+    const char *log = "/dev/null";
+    uint32_t tracks = 256;
+    uint32_t errors = 0;
+    bool verbose = false;
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if ((argv[a][0] == '-') && (a + 1 < argc) && strchr("mabsiogkxpc", argv[a][1])) {
+            double v = strtod(argv[++a], NULL);
+
+            /* At 8MHz one SPI byte time is 1us. */
+            switch (argv[a - 1][1]) {
+            case 'm': mhz = v; break;
+            case 'a': card.nac = (uint32_t)v; break;
+            case 'b': card.write_busy = (uint32_t)v; break;
+            case 's': card.stop_busy = (uint32_t)v; break;
+            case 'i': host.isr_fifo_rd = v; break;
+            case 'o': host.isr_fifo_wr = v; break;
+            case 'g': host.isr_reg = v; break;
+            case 'k': host.isr_hit = v; break;
+            case 'x': host.cmd = v; break;
+            case 'p': host.poll = v; break;
+            case 'c': tracks = (uint32_t)v; break;
+            }
+        } else if ((strcmp(argv[a], "-l") == 0) && (a + 1 < argc)) {
+            log = argv[++a];
+        } else if (strcmp(argv[a], "-v") == 0) {
+            verbose = true;
+        } else {
+            fprintf(stderr, "Usage: %s [-m mhz] [-a nac_us] [-b busy_us] [-s stop_us] [-i fifo_rd_us] [-o fifo_wr_us]\n"
+                    "       [-g reg_us] [-k hit_us] [-x cmd_us] [-p poll_us] [-c tracks] [-l log] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if ((mhz <= 0.0) || (host.poll <= 0.0) || (tracks < 4) || (tracks > hdc_card_cyls[0] * hdc_card_heads[0]) ||
+        (tracks / 2 > hdc_card_cyls[3] * hdc_card_heads[3])) {
+        fprintf(stderr, "The clock and poll time must be positive, and the tracks 4-%d.\n",
+                2 * hdc_card_cyls[3] * hdc_card_heads[3]);
+        return 1;
+    }
+
+    /* The firmware's console output goes to stdout; keep the report apart. */
+    fflush(stdout);
+    if (((report = fdopen(dup(fileno(stdout)), "w")) == NULL) || (freopen(log, "w", stdout) == NULL)) {
+        perror(log);
+        return 1;
+    }
+
+    if (((image = tmpfile()) == NULL) || !hdc_card_build(image, 0)) {
+        fprintf(stderr, "Could not build the card image.\n");
+        return 1;
+    }
+    if (!sd_card_model_open(image, &card)) {
+        fprintf(stderr, "The card image is too small.\n");
+        return 1;
+    }
+    spi_model_reset();
+    spi_model_attach(sd_card_model_device);
+    hdc_host_init(&host);
+    load_driver();
+
+    fprintf(report, "Z80 %.2fMHz; CLC2_ISR %.2f/%.2f/%.2fus (FIFO read/write, other), +%.0fus per cached sector; "
+            "%.0fus per command, %.0fus per idle pass\n",
+            mhz, host.isr_fifo_rd, host.isr_fifo_wr, host.isr_reg, host.isr_hit, host.cmd, host.poll);
+    fprintf(report, "Card: NCR %u, NAC %u, write busy %u, stop busy %u byte times\n\n",
+            card.ncr, card.nac, card.write_busy, card.stop_busy);
+    print_header();
+
+    errors += run_workload("reset", W_RESET, tracks);
+    errors += run_workload("verify", W_VERIFY, tracks);
+    errors += run_workload("random read", W_RANDOM_READ, tracks);
+    errors += run_workload("random write", W_RANDOM_WRITE, tracks);
+    errors += run_workload("long write", W_LONG_WRITE, tracks);
+    errors += run_workload("format", W_FORMAT, tracks);
+    errors += run_workload("read back", W_READ_BACK, tracks);
+    errors += run_workload("cached read", W_CACHED_READ, tracks);
+    errors += timeout_check();
+    errors += write_fault_check();
+    /* RESET writes everything back to the card. */
+    errors += run_workload("reset", W_RESET, tracks);
+    errors += hdc_card_check(image);
+
+    stats = hdc_host_get_stats();
+    fprintf(report, "\nTotal: %.1f ms modelled, %u commands (%u in CLC2_ISR), %u idle passes, %u I/O cycles\n",
+            cpu.cycles / mhz / 1000.0, stats->commands + stats->isr_reads, stats->isr_reads, stats->polls, stats->accesses);
+    fprintf(report, "WAIT#: CLC2_ISR %.1f ms, %u FIFO stalls %.1f ms (%u timed out), %u cycles held %.1f ms\n",
+            stats->isr_us / 1000.0, stats->stalls, stats->stall_us / 1000.0, stats->timeouts,
+            stats->held, stats->held_us / 1000.0);
+    fprintf(report, "Result: %s\n", errors ? "FAIL" : "ok");
+
+    if (verbose) {
+        fprintf(report, "\n");
+        sd_card_model_print_stats(report);
+    }
+    fclose(image);
+    fclose(report);
+    return errors ? 1 : 0;
+}
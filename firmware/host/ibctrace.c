@@ -0,0 +1,282 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Summarise an IBCTRACE.BIN workload log written by the z80_ssd     *
+ * command recorder: command and read/write mix, sequentiality, hot      *
+ * cylinders, request sizes, inter-arrival times and latency.            *
+ *                                                                       *
+ * Usage: ibctrace [-l] IBCTRACE.BIN                                     *
+ *     -l  also list every record                                        *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Must match ibc_disk_ctrl.c */
+#define RECORD_LEN          16
+#define RECORD_MAGIC        0x54434249UL    /* "IBCT" */
+#define RECORD_VERSION      1
+#define RECORD_SESSION      0xFF
+
+#define CMD_RESET           0x00
+#define CMD_READ_SECT       0x01
+#define CMD_WRITE_SECT      0x02
+#define CMD_FORMAT_TRK      0x08
+#define CMD_ACCESS_FIFO     0x0b
+#define CMD_READ_PARAMETERS 0x10
+
+#define MAX_DRIVES          4
+#define MAX_CYLS            1024
+#define LOG2_BUCKETS        24
+#define NSEC_MAX            256
+
+typedef struct {
+    uint32_t stamp;
+    uint32_t latency;
+    uint16_t cyl;
+    uint8_t  cmd;
+    uint8_t  drive;
+    uint8_t  head;
+    uint8_t  sect;
+    uint8_t  nsec;
+    uint8_t  status;
+} record_t;
+
+/* Drive geometry, as set up by IBC_HDC_Reset() */
+static const struct { uint16_t ncyls; uint8_t nheads; uint8_t nsectors; } geometry[MAX_DRIVES] = {
+    { 680, 15, 32 }, { 615, 4, 32 }, { 615, 4, 32 }, { 612, 2, 32 }
+};
+
+typedef struct {
+    uint32_t count;
+    uint64_t latency_sum;
+    uint32_t latency_max;
+    uint64_t sectors;
+} cmd_stat_t;
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const char *cmd_name(uint8_t cmd)
+{
+    switch (cmd) {
+    case CMD_RESET:           return "RESET";
+    case CMD_READ_SECT:       return "READ_SECT";
+    case CMD_WRITE_SECT:      return "WRITE_SECT";
+    case CMD_FORMAT_TRK:      return "FORMAT_TRK";
+    case CMD_ACCESS_FIFO:     return "ACCESS_FIFO";
+    case CMD_READ_PARAMETERS: return "READ_PARAMS";
+    default:                  return "?";
+    }
+}
+
+static int cmd_index(uint8_t cmd)
+{
+    switch (cmd) {
+    case CMD_RESET:           return 0;
+    case CMD_READ_SECT:       return 1;
+    case CMD_WRITE_SECT:      return 2;
+    case CMD_FORMAT_TRK:      return 3;
+    case CMD_ACCESS_FIFO:     return 4;
+    case CMD_READ_PARAMETERS: return 5;
+    default:                  return 6;
+    }
+}
+
+static int log2_bucket(uint64_t v)
+{
+    int b = 0;
+
+    while ((v > 1) && (b < LOG2_BUCKETS - 1)) {
+        v >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static void print_hist(const char *title, const uint32_t *hist, int n, const char *unit)
+{
+    uint32_t total = 0;
+
+    for (int i = 0; i < n; i++) total += hist[i];
+    if (total == 0) return;
+
+    printf("\n%s\n", title);
+    for (int i = 0; i < n; i++) {
+        if (hist[i] != 0) {
+            printf("  >= %8lu%-3s %8u  %5.1f%%\n", 1UL << i, unit, hist[i], 100.0 * hist[i] / total);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = NULL;
+    bool list = false;
+    FILE *fp;
+    uint8_t raw[RECORD_LEN];
+    record_t r;
+    uint32_t ticks_per_us = 2;
+    uint32_t sessions = 0, records = 0;
+    cmd_stat_t stats[7];
+    static uint32_t cyl_hits[MAX_DRIVES][MAX_CYLS];
+    uint32_t arrival_hist[LOG2_BUCKETS] = { 0 };
+    uint32_t latency_hist[LOG2_BUCKETS] = { 0 };
+    uint32_t nsec_hist[NSEC_MAX + 1] = { 0 };
+    uint32_t run_hist[LOG2_BUCKETS] = { 0 };
+    uint32_t sequential = 0, xfers = 0, errors = 0;
+    uint32_t next_lba[MAX_DRIVES];
+    uint32_t run_len = 0;
+    bool have_prev = false, have_next[MAX_DRIVES] = { false };
+    uint32_t prev_stamp = 0;
+
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-l") == 0) {
+            list = true;
+        } else {
+            name = argv[a];
+        }
+    }
+    if (name == NULL) {
+        fprintf(stderr, "Usage: %s [-l] IBCTRACE.BIN\n", argv[0]);
+        return 1;
+    }
+    if ((fp = fopen(name, "rb")) == NULL) {
+        perror(name);
+        return 1;
+    }
+    memset(stats, 0, sizeof(stats));
+
+    while (fread(raw, 1, RECORD_LEN, fp) == RECORD_LEN) {
+        static const uint8_t zero[RECORD_LEN];
+
+        if (memcmp(raw, zero, RECORD_LEN) == 0) {
+            continue;   /* Padding, eg. from copying the file with a tool */
+        }
+        r.stamp   = get32(&raw[0]);
+        r.latency = get32(&raw[4]);
+        r.cyl     = raw[8] | (raw[9] << 8);
+        r.cmd     = raw[10];
+        r.drive   = raw[11] & (MAX_DRIVES - 1);
+        r.head    = raw[12];
+        r.sect    = raw[13];
+        r.nsec    = raw[14];
+        r.status  = raw[15];
+
+        if (r.cmd == RECORD_SESSION) {
+            if ((r.latency != RECORD_MAGIC) || (r.cyl != RECORD_VERSION)) {
+                fprintf(stderr, "Record %u: bad session marker.\n", records);
+                return 1;
+            }
+            ticks_per_us = (r.head != 0) ? r.head : 2;
+            sessions++;
+            have_prev = false;
+            if (list) printf("--- session %u\n", sessions);
+            continue;
+        }
+        records++;
+
+        cmd_stat_t *s = &stats[cmd_index(r.cmd)];
+        uint32_t nsec = (r.nsec == 0) ? 1 : r.nsec;
+
+        s->count++;
+        s->latency_sum += r.latency;
+        if (r.latency > s->latency_max) s->latency_max = r.latency;
+        latency_hist[log2_bucket(r.latency / ticks_per_us)]++;
+        if (r.status & 0x01) errors++;
+
+        /* Inter-arrival, start to start; the TMR1 stamp wraps modulo 2^32. */
+        if (have_prev) {
+            arrival_hist[log2_bucket((uint32_t)(r.stamp - prev_stamp) / ticks_per_us)]++;
+        }
+        prev_stamp = r.stamp;
+        have_prev = true;
+
+        if ((r.cmd == CMD_READ_SECT) || (r.cmd == CMD_WRITE_SECT)) {
+            uint32_t lba = ((uint32_t)r.cyl * geometry[r.drive].nheads + r.head) * geometry[r.drive].nsectors + r.sect;
+
+            s->sectors += nsec;
+            xfers++;
+            nsec_hist[nsec]++;
+            if (r.cyl < MAX_CYLS) cyl_hits[r.drive][r.cyl]++;
+
+            if (have_next[r.drive] && (lba == next_lba[r.drive])) {
+                sequential++;
+                run_len++;
+            } else {
+                if (run_len != 0) run_hist[log2_bucket(run_len)]++;
+                run_len = 1;
+            }
+            next_lba[r.drive] = lba + nsec;
+            have_next[r.drive] = true;
+        }
+
+        if (list) {
+            printf("%10.1f %-11s D%u C:%04u/H:%02u/S:%02u/#:%3u st %02X %10.1fus\n",
+                   (double)r.stamp / ticks_per_us, cmd_name(r.cmd), r.drive, r.cyl, r.head,
+                   r.sect, nsec, r.status, (double)r.latency / ticks_per_us);
+        }
+    }
+    fclose(fp);
+    if (run_len != 0) run_hist[log2_bucket(run_len)]++;
+
+    printf("%s: %u commands in %u session(s), %u with the error bit set\n\n", name, records, sessions, errors);
+    printf("Command        count   sectors   avg(us)   max(us)\n");
+    for (int i = 0; i < 7; i++) {
+        static const uint8_t cmds[7] = { CMD_RESET, CMD_READ_SECT, CMD_WRITE_SECT, CMD_FORMAT_TRK,
+                                         CMD_ACCESS_FIFO, CMD_READ_PARAMETERS, 0x7F };
+        if (stats[i].count == 0) continue;
+        printf("%-11s %8u %9llu %9.1f %9.1f\n", (i == 6) ? "other" : cmd_name(cmds[i]), stats[i].count,
+               (unsigned long long)stats[i].sectors,
+               (double)stats[i].latency_sum / stats[i].count / ticks_per_us,
+               (double)stats[i].latency_max / ticks_per_us);
+    }
+
+    if (xfers != 0) {
+        uint64_t rd = stats[cmd_index(CMD_READ_SECT)].sectors;
+        uint64_t wr = stats[cmd_index(CMD_WRITE_SECT)].sectors;
+
+        printf("\nRead/write mix: %.1f%% / %.1f%% of sectors\n", 100.0 * rd / (rd + wr), 100.0 * wr / (rd + wr));
+        printf("Sequential: %u of %u transfers (%.1f%%) start where the last one on the drive ended\n",
+               sequential, xfers, 100.0 * sequential / xfers);
+    }
+
+    print_hist("Sequential run length (transfers):", run_hist, LOG2_BUCKETS, "");
+
+    printf("\nSectors per transfer:\n");
+    for (int i = 1; i <= NSEC_MAX; i++) {
+        if (nsec_hist[i] != 0) printf("  %3d %8u  %5.1f%%\n", i, nsec_hist[i], 100.0 * nsec_hist[i] / xfers);
+    }
+
+    printf("\nHot cylinders:\n");
+    for (int n = 0; n < 10; n++) {
+        uint32_t best = 0;
+        int bd = 0, bc = 0;
+
+        for (int d = 0; d < MAX_DRIVES; d++) {
+            for (int c = 0; c < MAX_CYLS; c++) {
+                if (cyl_hits[d][c] > best) {
+                    best = cyl_hits[d][c];
+                    bd = d;
+                    bc = c;
+                }
+            }
+        }
+        if (best == 0) break;
+        printf("  D%d C:%04d %8u  %5.1f%%\n", bd, bc, best, 100.0 * best / xfers);
+        cyl_hits[bd][bc] = 0;
+    }
+
+    print_hist("Inter-arrival time:", arrival_hist, LOG2_BUCKETS, "us");
+    print_hist("Command latency:", latency_hist, LOG2_BUCKETS, "us");
+    return 0;
+}
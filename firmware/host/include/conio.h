@@ -0,0 +1,17 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Host stand-in for the XC8 <conio.h> included by mcc.h.  Console   *
+ * output goes through the C library in host builds.                     *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef HOST_CONIO_H
+#define HOST_CONIO_H
+
+#include <stdio.h>
+
+#endif /* HOST_CONIO_H */
@@ -0,0 +1,116 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Host stand-in for the XC8 <xc.h> device header.  Declares only    *
+ * the PIC18F47Q43 register bits referenced by the firmware modules that *
+ * are compiled for the host.  The storage lives in spi_model.c,         *
+ * hdc_host.c and spi1_model.c.                                          *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef HOST_XC_H
+#define HOST_XC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    unsigned LATB5 : 1;         /* SD card CS# */
+} host_LATBbits_t;
+
+typedef struct {
+    unsigned RE0 : 1;           /* SD card detect */
+} host_PORTEbits_t;
+
+typedef struct {
+    unsigned GIEL : 1;          /* Interrupt enables, see interrupt_manager.h */
+    unsigned GIEH : 1;
+    unsigned GIE  : 1;
+    unsigned IPEN : 1;
+} host_INTCON0bits_t;
+
+extern volatile host_LATBbits_t LATBbits;
+extern volatile host_PORTEbits_t PORTEbits;
+extern volatile host_INTCON0bits_t INTCON0bits;
+
+#define GIE             INTCON0bits.GIE
+
+/* SPI1, DMA1 and DMA2 for spi1.c, modelled in spi1_model.c.  Each access
+ * goes through a function that lets the peripherals advance one step
+ * before returning the register, so the model sees the driver's register
+ * accesses in order.
+ */
+typedef uint32_t uint24_t;
+
+typedef enum {
+    HOST_SPI1CON0, HOST_SPI1CON1, HOST_SPI1CON2, HOST_SPI1CLK, HOST_SPI1BAUD,
+    HOST_PIR2, HOST_PIR3, HOST_TRISC, HOST_DMASELECT,
+    HOST_ISRPR, HOST_DMA1PR, HOST_DMA2PR, HOST_MAINPR, HOST_PRLOCK,
+    HOST_NUM_SFRS
+} host_sfr_id_t;
+
+typedef union {
+    uint8_t reg;
+    struct { uint8_t : 7; uint8_t EN : 1; } spi1con0;
+    struct { uint8_t RXR : 1; uint8_t TXR : 1; uint8_t SSET : 1; uint8_t : 4; uint8_t BUSY : 1; } spi1con2;
+    struct { uint8_t : 6; uint8_t DMA1DCNTIF : 1; uint8_t : 1; } pir2;
+    struct { uint8_t : 4; uint8_t SPI1RXIF : 1; uint8_t SPI1TXIF : 1; uint8_t : 2; } pir3;
+    struct { uint8_t : 3; uint8_t TRISC3 : 1; uint8_t : 4; } trisc;
+    struct { uint8_t PRLOCKED : 1; uint8_t : 7; } prlock;
+} host_sfr_t;
+
+/* The DMAn registers of the channel selected by DMASELECT. */
+typedef struct {
+    uint8_t  con0;
+    uint8_t  con1;
+    uint24_t ssa;
+    uint16_t ssz;
+    uint16_t dsa;
+    uint16_t dsz;
+    uint8_t  sirq;
+    uint8_t  airq;
+} host_dma_t;
+
+volatile host_sfr_t *spi1_model_sfr(host_sfr_id_t id);
+volatile host_dma_t *spi1_model_dma(void);
+volatile uint16_t *spi1_model_txb(void);
+volatile uint16_t *spi1_model_tcnt(bool high);
+volatile uint8_t *spi1_model_rxb(void);
+
+#define SPI1CON0        (spi1_model_sfr(HOST_SPI1CON0)->reg)
+#define SPI1CON0bits    (spi1_model_sfr(HOST_SPI1CON0)->spi1con0)
+#define SPI1CON1        (spi1_model_sfr(HOST_SPI1CON1)->reg)
+#define SPI1CON2        (spi1_model_sfr(HOST_SPI1CON2)->reg)
+#define SPI1CON2bits    (spi1_model_sfr(HOST_SPI1CON2)->spi1con2)
+#define SPI1CLK         (spi1_model_sfr(HOST_SPI1CLK)->reg)
+#define SPI1BAUD        (spi1_model_sfr(HOST_SPI1BAUD)->reg)
+#define SPI1TCNTL       (*spi1_model_tcnt(false))
+#define SPI1TCNTH       (*spi1_model_tcnt(true))
+#define SPI1TXB         (*spi1_model_txb())
+#define SPI1RXB         (*spi1_model_rxb())
+#define PIR2bits        (spi1_model_sfr(HOST_PIR2)->pir2)
+#define PIR3bits        (spi1_model_sfr(HOST_PIR3)->pir3)
+#define TRISCbits       (spi1_model_sfr(HOST_TRISC)->trisc)
+#define ISRPR           (spi1_model_sfr(HOST_ISRPR)->reg)
+#define DMA1PR          (spi1_model_sfr(HOST_DMA1PR)->reg)
+#define DMA2PR          (spi1_model_sfr(HOST_DMA2PR)->reg)
+#define MAINPR          (spi1_model_sfr(HOST_MAINPR)->reg)
+#define PRLOCK          (spi1_model_sfr(HOST_PRLOCK)->reg)
+#define PRLOCKbits      (spi1_model_sfr(HOST_PRLOCK)->prlock)
+#define DMASELECT       (spi1_model_sfr(HOST_DMASELECT)->reg)
+#define DMAnCON0        (spi1_model_dma()->con0)
+#define DMAnCON1        (spi1_model_dma()->con1)
+#define DMAnSSA         (spi1_model_dma()->ssa)
+#define DMAnSSZ         (spi1_model_dma()->ssz)
+#define DMAnDSA         (spi1_model_dma()->dsa)
+#define DMAnDSZ         (spi1_model_dma()->dsz)
+#define DMAnSIRQ        (spi1_model_dma()->sirq)
+#define DMAnAIRQ        (spi1_model_dma()->airq)
+
+#define _SPI1CON2_SPI1RXR_MASK  0x01
+#define _SPI1CON2_SPI1TXR_MASK  0x02
+
+#endif /* HOST_XC_H */
@@ -0,0 +1,507 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     SPI-mode SD card model for host builds.  The card is driven one   *
+ * byte time at a time by spi_model.c: the byte returned on MISO is      *
+ * chosen before the MOSI byte is looked at, so every response starts at *
+ * the earliest on the byte time after the one that completed the        *
+ * command or data packet, as on a real card.                            *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "sd_card_model.h"
+
+#define CMD_GO_IDLE_STATE       0
+#define CMD_SEND_OP_COND        1
+#define CMD_SEND_IF_COND        8
+#define CMD_SEND_CSD            9
+#define CMD_SEND_CID            10
+#define CMD_STOP_TRANSMISSION   12
+#define CMD_SEND_STATUS         13
+#define CMD_SET_BLOCKLEN        16
+#define CMD_READ_SINGLE_BLOCK   17
+#define CMD_READ_MULTI_BLOCK    18
+#define ACMD_SET_WR_BLK_ERASE   23
+#define CMD_WRITE_SINGLE_BLOCK  24
+#define CMD_WRITE_MULTI_BLOCK   25
+#define ACMD_SD_SEND_OP_COND    41
+#define CMD_APP_CMD             55
+#define CMD_READ_OCR            58
+#define CMD_CRC_ON_OFF          59
+
+#define R1_IDLE                 0x01
+#define R1_ILLEGAL_CMD          0x04
+#define R1_ADDRESS_ERROR        0x20
+#define R1_PARAMETER_ERROR      0x40
+
+#define TOKEN_START             0xFE
+#define TOKEN_START_MULTI       0xFC
+#define TOKEN_STOP              0xFD
+#define TOKEN_DATA_ACCEPTED     0xE5
+#define TOKEN_DATA_WRITE_ERROR  0xED
+#define TOKEN_OUT_OF_RANGE      0x08
+
+#define CARD_NO_FAULT           0xFFFFFFFFu
+
+typedef enum {
+    CARD_IDLE,              /* Waiting for a command */
+    CARD_READ_SINGLE,       /* Sending one block after R1 */
+    CARD_READ_MULTI,        /* Sending blocks until CMD12 */
+    CARD_WRITE_TOKEN,       /* Waiting for a start (or stop) token */
+    CARD_WRITE_DATA         /* Receiving a data packet */
+} card_state_t;
+
+static struct {
+    FILE *image;
+    sd_card_model_config_t config;
+    uint32_t blocks;
+    bool ready;             /* ACMD41 has completed */
+    bool app_cmd;           /* Last command was CMD55 */
+    uint32_t acmd41_polls;
+
+    card_state_t state;
+    bool multi;             /* CMD25 rather than CMD24 */
+    uint32_t lba;
+
+    uint8_t cmd_buf[6];
+    uint8_t cmd_len;
+    sd_card_model_cmd_t *current;
+
+    /* MISO: delay 0xFF bytes, then out[], then busy 0x00 bytes. */
+    uint32_t delay;
+    uint8_t out[1 + SD_CARD_MODEL_BLOCK + 2];
+    uint16_t out_len;
+    uint16_t out_pos;
+    uint32_t busy_next;
+    uint32_t busy;
+
+    uint8_t in[SD_CARD_MODEL_BLOCK + 2];
+    uint16_t in_len;
+
+    /* Faults injected by a test, each for one access to its block. */
+    uint32_t delay_lba;
+    uint32_t delay_bytes;
+    uint32_t fail_lba;
+} card;
+
+static sd_card_model_stats_t card_stats;
+static uint8_t *card_map;       /* One bit per block touched, if tracked */
+
+bool sd_card_model_open(FILE *image, const sd_card_model_config_t *config)
+{
+    long size;
+
+    memset(&card, 0, sizeof(card));
+    free(card_map);
+    card_map = NULL;
+    card.image = image;
+    card.config = *config;
+    card.delay_lba = CARD_NO_FAULT;
+    card.fail_lba = CARD_NO_FAULT;
+    if ((card.config.ncr == 0) || (card.config.ncr > 8)) {
+        card.config.ncr = 1;
+    }
+
+    /* C_SIZE counts 512KB units, any partial unit at the end is not used. */
+    if ((fseek(image, 0, SEEK_END) != 0) || ((size = ftell(image)) < 0)) {
+        return false;
+    }
+    card.blocks = (uint32_t)(size / (512L * 1024L)) * 1024u;
+    sd_card_model_reset_stats();
+    return card.blocks != 0;
+}
+
+void sd_card_model_reset_stats(void)
+{
+    memset(&card_stats, 0, sizeof(card_stats));
+    card.current = NULL;
+    if (card_map != NULL) {
+        memset(card_map, 0, card.blocks / 8);
+    }
+}
+
+/* Count the distinct blocks read or written, in blocks_touched.  The map
+ * costs one bit per block of the card; enabling it again starts a new count.
+ */
+bool sd_card_model_track_blocks(bool enable)
+{
+    free(card_map);
+    card_map = enable ? calloc(card.blocks / 8, 1) : NULL;
+    card_stats.blocks_touched = 0;
+    return (card_map != NULL) == enable;
+}
+
+static void card_touch(uint32_t lba)
+{
+    if ((card_map != NULL) && !(card_map[lba >> 3] & (1 << (lba & 7)))) {
+        card_map[lba >> 3] |= (uint8_t)(1 << (lba & 7));
+        card_stats.blocks_touched++;
+    }
+}
+
+uint32_t sd_card_model_get_blocks(void)
+{
+    return card.blocks;
+}
+
+const sd_card_model_stats_t *sd_card_model_get_stats(void)
+{
+    return &card_stats;
+}
+
+/* The next read of block lba waits this many more byte times for its data
+ * token, eg. to outlast the firmware's FIFO stall timeout.
+ */
+void sd_card_model_delay_block(uint32_t lba, uint32_t bytes)
+{
+    card.delay_lba = lba;
+    card.delay_bytes = bytes;
+}
+
+/* The next write of block lba is answered with a write error, and the
+ * block is left as it was.
+ */
+void sd_card_model_fail_block(uint32_t lba)
+{
+    card.fail_lba = lba;
+}
+
+/* Queue a response: after delay 0xFF bytes, len bytes from data. */
+static void card_respond(uint32_t delay, const uint8_t *data, uint16_t len)
+{
+    card.delay = delay;
+    memcpy(card.out, data, len);
+    card.out_len = len;
+    card.out_pos = 0;
+    card.busy_next = 0;
+}
+
+static void card_r1(uint8_t r1)
+{
+    card_respond(card.config.ncr, &r1, 1);
+    if ((r1 & ~R1_IDLE) && (card.current != NULL)) {
+        card.current->errors++;
+    }
+}
+
+static uint8_t card_r1_status(void)
+{
+    return card.ready ? 0x00 : R1_IDLE;
+}
+
+/* R1 followed by a 32-bit register, for R3 (OCR) and R7. */
+static void card_r3(uint32_t reg)
+{
+    uint8_t r[5] = { card_r1_status(), reg >> 24, reg >> 16, reg >> 8, reg };
+
+    card_respond(card.config.ncr, r, sizeof(r));
+}
+
+/* Load the next block of a read into out[].  False if it can't be read. */
+static bool card_load_block(void)
+{
+    card.out[0] = TOKEN_START;
+    card.out[1 + SD_CARD_MODEL_BLOCK] = 0xFF;  /* CRC, not checked */
+    card.out[2 + SD_CARD_MODEL_BLOCK] = 0xFF;
+    card.out_len = 1 + SD_CARD_MODEL_BLOCK + 2;
+    card.out_pos = 0;
+    card.delay = card.config.nac;
+    card_stats.nac_bytes += card.config.nac;
+
+    if ((card.lba >= card.blocks) ||
+        (fseek(card.image, (long)card.lba * SD_CARD_MODEL_BLOCK, SEEK_SET) != 0) ||
+        (fread(&card.out[1], 1, SD_CARD_MODEL_BLOCK, card.image) != SD_CARD_MODEL_BLOCK)) {
+        card_stats.data_errors++;
+        card.out[0] = TOKEN_OUT_OF_RANGE;
+        card.out_len = 1;
+        card.state = CARD_IDLE;
+        return false;
+    }
+    if (card.lba == card.delay_lba) {
+        card.delay += card.delay_bytes;
+        card.delay_lba = CARD_NO_FAULT;
+        card_stats.faults++;
+    }
+    card_touch(card.lba);
+    card.lba++;
+    card_stats.blocks_read++;
+    return true;
+}
+
+static void card_store_block(void)
+{
+    uint8_t token = TOKEN_DATA_ACCEPTED;
+
+    if (card.lba == card.fail_lba) {
+        card.fail_lba = CARD_NO_FAULT;
+        card_stats.faults++;
+        token = TOKEN_DATA_WRITE_ERROR;
+    } else if ((card.lba >= card.blocks) ||
+        (fseek(card.image, (long)card.lba * SD_CARD_MODEL_BLOCK, SEEK_SET) != 0) ||
+        (fwrite(card.in, 1, SD_CARD_MODEL_BLOCK, card.image) != SD_CARD_MODEL_BLOCK)) {
+        card_stats.data_errors++;
+        token = TOKEN_DATA_WRITE_ERROR;
+    } else {
+        card_touch(card.lba);
+        card.lba++;
+        card_stats.blocks_written++;
+    }
+
+    /* The data response goes out on the next byte time, then the card is
+     * busy programming. */
+    card_respond(0, &token, 1);
+    card.busy_next = card.config.write_busy;
+    card.state = (card.multi && (token == TOKEN_DATA_ACCEPTED)) ? CARD_WRITE_TOKEN : CARD_IDLE;
+}
+
+/* SDHC CSD (structure version 2.0) for the image size. */
+static void card_send_csd(void)
+{
+    uint32_t c_size = card.blocks / 1024 - 1;
+    uint8_t r[1 + 1 + 1 + 16 + 2] = {
+        0x00, 0xFF, TOKEN_START,
+        0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00,
+        (c_size >> 16) & 0x3F, c_size >> 8, c_size,
+        0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01,
+        0xFF, 0xFF
+    };
+
+    /* sd_spi.c reads the CSD without waiting for the data token, so it
+     * follows R1 and the byte the driver clocks after every command. */
+    card_respond(card.config.ncr, r, sizeof(r));
+}
+
+static void card_command(void)
+{
+    uint8_t cmd = card.cmd_buf[0] & 0x3F;
+    uint32_t arg = ((uint32_t)card.cmd_buf[1] << 24) | ((uint32_t)card.cmd_buf[2] << 16) |
+                   ((uint32_t)card.cmd_buf[3] << 8) | card.cmd_buf[4];
+    bool app = card.app_cmd;
+
+    card.app_cmd = false;
+
+    /* A command aborts any response still being sent, eg. CMD12 during a
+     * multi-block read. */
+    card.out_len = card.out_pos = 0;
+    card.delay = 0;
+    card.busy_next = 0;
+
+    if (app && (cmd == ACMD_SD_SEND_OP_COND)) {
+        if (++card.acmd41_polls > card.config.init_polls) {
+            card.ready = true;
+        }
+        card_r3(0x00FF8000);
+        return;
+    }
+    if (app && (cmd == ACMD_SET_WR_BLK_ERASE)) {
+        card_r1(card_r1_status());
+        return;
+    }
+
+    switch (cmd) {
+    case CMD_GO_IDLE_STATE:
+        card.ready = false;
+        card.acmd41_polls = 0;
+        card.state = CARD_IDLE;
+        card_r1(R1_IDLE);
+        break;
+    case CMD_SEND_OP_COND:
+        card.ready = true;
+        card_r1(0x00);
+        break;
+    case CMD_SEND_IF_COND:
+        card_r3(arg & 0xFFF);
+        break;
+    case CMD_READ_OCR:
+        /* Power up complete and CCS (SDHC) once ACMD41 has finished. */
+        card_r3(card.ready ? 0xC0FF8000 : 0x00FF8000);
+        break;
+    case CMD_APP_CMD:
+        card.app_cmd = true;
+        card_r1(card_r1_status());
+        break;
+    case CMD_SEND_CSD:
+        card_send_csd();
+        break;
+    case CMD_STOP_TRANSMISSION:
+        {
+            uint8_t r1 = 0x00;
+
+            /* One stuff byte, then R1b. */
+            card.state = CARD_IDLE;
+            card_respond(1 + card.config.ncr, &r1, 1);
+            card.busy_next = card.config.stop_busy;
+        }
+        break;
+    case CMD_SEND_STATUS:
+        {
+            uint8_t r[2] = { card_r1_status(), 0x00 };
+
+            card_respond(card.config.ncr, r, sizeof(r));
+        }
+        break;
+    case CMD_SET_BLOCKLEN:
+        card_r1((arg == SD_CARD_MODEL_BLOCK) ? card_r1_status() : R1_PARAMETER_ERROR);
+        break;
+    case CMD_CRC_ON_OFF:
+        card_r1(card_r1_status());
+        break;
+    case CMD_READ_SINGLE_BLOCK:
+    case CMD_READ_MULTI_BLOCK:
+    case CMD_WRITE_SINGLE_BLOCK:
+    case CMD_WRITE_MULTI_BLOCK:
+        if (!card.ready) {
+            card_r1(R1_ILLEGAL_CMD | R1_IDLE);
+            break;
+        }
+        if (arg >= card.blocks) {
+            card_r1(R1_ADDRESS_ERROR);
+            break;
+        }
+        card.lba = arg;
+        card_r1(0x00);
+        if (cmd == CMD_READ_SINGLE_BLOCK) {
+            card.state = CARD_READ_SINGLE;
+        } else if (cmd == CMD_READ_MULTI_BLOCK) {
+            card.state = CARD_READ_MULTI;
+        } else {
+            card.multi = (cmd == CMD_WRITE_MULTI_BLOCK);
+            card.state = CARD_WRITE_TOKEN;
+        }
+        break;
+    default:
+        card_r1(R1_ILLEGAL_CMD | card_r1_status());
+        break;
+    }
+}
+
+/* The byte the card drives on MISO for this byte time. */
+static uint8_t card_output(void)
+{
+    for (;;) {
+        if (card.delay != 0) {
+            card.delay--;
+            return 0xFF;
+        }
+        if (card.out_pos < card.out_len) {
+            return card.out[card.out_pos++];
+        }
+        if (card.busy_next != 0) {
+            card.busy = card.busy_next;
+            card.busy_next = 0;
+        }
+        if (card.busy != 0) {
+            card.busy--;
+            card_stats.busy_bytes++;
+            return 0x00;
+        }
+        if (((card.state == CARD_READ_SINGLE) || (card.state == CARD_READ_MULTI)) && (card.cmd_len == 0)) {
+            if (card_load_block() && (card.state == CARD_READ_SINGLE)) {
+                card.state = CARD_IDLE;
+            }
+            continue;
+        }
+        return 0xFF;
+    }
+}
+
+static void card_input(uint8_t mosi)
+{
+    switch (card.state) {
+    case CARD_WRITE_TOKEN:
+        if (card.cmd_len == 0) {
+            if (mosi == (card.multi ? TOKEN_START_MULTI : TOKEN_START)) {
+                card.in_len = 0;
+                card.state = CARD_WRITE_DATA;
+                return;
+            }
+            if (card.multi && (mosi == TOKEN_STOP)) {
+                /* Busy starts after one more byte time (NBR). */
+                card_respond(1, &mosi, 0);
+                card.busy_next = card.config.stop_busy;
+                card.state = CARD_IDLE;
+                return;
+            }
+        }
+        break;
+    case CARD_WRITE_DATA:
+        card.in[card.in_len++] = mosi;
+        if (card.in_len == sizeof(card.in)) {
+            card_store_block();
+        }
+        return;
+    default:
+        break;
+    }
+
+    /* Commands start with 01b and are always 6 bytes long. */
+    if ((card.cmd_len != 0) || ((mosi & 0xC0) == 0x40)) {
+        if (card.cmd_len == 0) {
+            card.current = card.app_cmd ? &card_stats.acmd[mosi & 0x3F] : &card_stats.cmd[mosi & 0x3F];
+            card.current->count++;
+        }
+        card.cmd_buf[card.cmd_len++] = mosi;
+        if (card.cmd_len == sizeof(card.cmd_buf)) {
+            card.cmd_len = 0;
+            card_command();
+        }
+    }
+}
+
+uint8_t sd_card_model_device(uint8_t mosi, bool selected)
+{
+    uint8_t miso = 0xFF;
+
+    if (!selected) {
+        /* The card keeps programming with CS# high, but ignores the bus. */
+        card_stats.idle_bytes++;
+        card.cmd_len = 0;
+        if ((card.delay == 0) && (card.out_pos == card.out_len)) {
+            card.busy += card.busy_next;
+            card.busy_next = 0;
+            if (card.busy != 0) {
+                card.busy--;
+            }
+        }
+    } else {
+        miso = card_output();
+        card_input(mosi);
+    }
+
+    if (card.current != NULL) {
+        card.current->bytes++;
+    }
+    return miso;
+}
+
+static void card_print_cmd(FILE *fp, const char *prefix, int index, const sd_card_model_cmd_t *c)
+{
+    if (c->count != 0) {
+        fprintf(fp, "  %s%-3d %10u %8u %12llu\n", prefix, index, c->count, c->errors,
+                (unsigned long long)c->bytes);
+    }
+}
+
+void sd_card_model_print_stats(FILE *fp)
+{
+    fprintf(fp, "Command       count   errors   byte times\n");
+    for (int i = 0; i < SD_CARD_MODEL_CMDS; i++) {
+        card_print_cmd(fp, " CMD", i, &card_stats.cmd[i]);
+    }
+    for (int i = 0; i < SD_CARD_MODEL_CMDS; i++) {
+        card_print_cmd(fp, "ACMD", i, &card_stats.acmd[i]);
+    }
+    fprintf(fp, "Blocks read %u, written %u, data errors %u, injected faults %u\n", card_stats.blocks_read,
+            card_stats.blocks_written, card_stats.data_errors, card_stats.faults);
+    if (card_map != NULL) {
+        fprintf(fp, "Blocks touched %u\n", card_stats.blocks_touched);
+    }
+    fprintf(fp, "Byte times: NAC %llu, busy %llu, CS# high %llu\n",
+            (unsigned long long)card_stats.nac_bytes, (unsigned long long)card_stats.busy_bytes,
+            (unsigned long long)card_stats.idle_bytes);
+}
@@ -0,0 +1,68 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     SPI-mode SD card model for host builds.  Attached to spi_model.c  *
+ * as its device, it answers the commands sd_spi.c issues (CMD0/8/9/12/  *
+ * 16/17/18/24/25/55/58/59, ACMD23/41) from a Linux file holding the     *
+ * card image.  The card presents itself as SDHC, and its NCR, NAC and   *
+ * busy times are set in SPI byte times so that the driver's polling is  *
+ * exercised the way a real card would.  Every command is counted along  *
+ * with the byte times spent until the next one.  A test can also delay  *
+ * the read of a block, or fail its write, once.                         *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef SD_CARD_MODEL_H
+#define SD_CARD_MODEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SD_CARD_MODEL_BLOCK     512
+#define SD_CARD_MODEL_CMDS      64
+
+typedef struct {
+    uint32_t ncr;           /* 0xFF bytes before each R1 response (1-8) */
+    uint32_t nac;           /* 0xFF bytes before each read data token */
+    uint32_t write_busy;    /* Busy (0x00) bytes after each written block */
+    uint32_t stop_busy;     /* Busy bytes after CMD12 or a stop token */
+    uint32_t init_polls;    /* ACMD41s answered "idle" before the card is ready */
+} sd_card_model_config_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t errors;        /* Answered with an error bit set in R1 */
+    uint64_t bytes;         /* Byte times from this command to the next */
+} sd_card_model_cmd_t;
+
+typedef struct {
+    sd_card_model_cmd_t cmd[SD_CARD_MODEL_CMDS];
+    sd_card_model_cmd_t acmd[SD_CARD_MODEL_CMDS];
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+    uint32_t blocks_touched;/* Distinct blocks read or written, if tracked */
+    uint32_t data_errors;   /* Out of range blocks and I/O errors on the image */
+    uint32_t faults;        /* Injected delays and write errors that took effect */
+    uint64_t nac_bytes;     /* 0xFF bytes clocked waiting for read data */
+    uint64_t busy_bytes;    /* 0x00 bytes clocked while the card was busy */
+    uint64_t idle_bytes;    /* Byte times with CS# high */
+} sd_card_model_stats_t;
+
+/* Typical values for a class 10 card at an 8MHz SPI clock (1 byte = 1us.) */
+#define SD_CARD_MODEL_DEFAULTS  { 1, 100, 250, 500, 20 }
+
+bool sd_card_model_open(FILE *image, const sd_card_model_config_t *config);
+void sd_card_model_reset_stats(void);
+bool sd_card_model_track_blocks(bool enable);
+uint8_t sd_card_model_device(uint8_t mosi, bool selected);
+uint32_t sd_card_model_get_blocks(void);
+const sd_card_model_stats_t *sd_card_model_get_stats(void);
+void sd_card_model_print_stats(FILE *fp);
+void sd_card_model_delay_block(uint32_t lba, uint32_t bytes);
+void sd_card_model_fail_block(uint32_t lba);
+
+#endif /* SD_CARD_MODEL_H */
@@ -0,0 +1,290 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Runs the firmware's SD driver (sd_spi.c) against the SD card      *
+ * model and reports, for a set of sequential and random workloads, the  *
+ * SD commands issued, CS# selects, SPI byte times and the modelled bus  *
+ * time.  All data read or written is checked against the image file,   *
+ * and the exit status is non-zero if anything did not match, or if the  *
+ * random workloads cost more than the one transaction per request of    *
+ * the SD_SPI_STREAM_DISABLE build: more SD commands, or a multiple      *
+ * block command, with its stop, for a single sector.                    *
+ *                                                                       *
+ * Usage: sdsim [options] [image]                                        *
+ *     -n NCR      0xFF bytes before each command response (1)           *
+ *     -a US       read access time, NAC (100)                           *
+ *     -b US       programming time per written block (250)              *
+ *     -s US       busy time after a stop (500)                          *
+ *     -c COUNT    sectors per workload (2048)                           *
+ *     -r SIZE     sectors per request (1)                               *
+ *     -w          run the write workloads on a named image              *
+ *     -v          print the card's per-command statistics               *
+ *                                                                       *
+ * Without an image, a 16MB scratch image is used and the write          *
+ * workloads are always run.                                             *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "sd_spi/sd_spi.h"
+#include "tmr1.h"
+#include "spi_model.h"
+#include "sd_card_model.h"
+
+/* SPI1 clocks from spi1.c: 64MHz / (2 * (BAUD + 1)) */
+#define SD_FAST_HZ          8000000.0
+#define SD_SLOW_HZ          400000.0
+
+#define SCRATCH_BLOCKS      (16 * 2048)
+#define SD_CMD_READ_MULTI   18
+#define SD_CMD_WRITE_MULTI  25
+#define MAX_REQUEST         64
+
+static FILE *image;
+static uint32_t image_blocks;
+static uint32_t request_size = 1;
+static uint32_t rand_state = 1;
+
+static uint32_t next_random(void)
+{
+    rand_state = rand_state * 1103515245u + 12345u;
+    return rand_state >> 8;
+}
+
+static void fill_pattern(uint8_t *buf, uint32_t lba, uint32_t pass)
+{
+    for (int i = 0; i < SD_CARD_MODEL_BLOCK; i++) {
+        buf[i] = (uint8_t)(lba * 7 + pass * 13 + i + (i >> 8) * 0x55);
+    }
+}
+
+/* The driver times its stream idle timeout with TMR1; here the clock is the
+ * modelled SPI bus time. */
+uint32_t TMR1_ReadTimer32(void)
+{
+    const spi_model_stats_t *spi = spi_model_get_stats();
+    uint32_t slow = spi->slow_bytes;
+
+    return (uint32_t)(((spi->bytes - slow) * 8.0 / SD_FAST_HZ + slow * 8.0 / SD_SLOW_HZ) * 1e6 * TMR1_TICKS_PER_US);
+}
+
+static bool image_read(uint32_t lba, uint8_t *buf)
+{
+    return (fseek(image, (long)lba * SD_CARD_MODEL_BLOCK, SEEK_SET) == 0) &&
+           (fread(buf, 1, SD_CARD_MODEL_BLOCK, image) == SD_CARD_MODEL_BLOCK);
+}
+
+/* One request through the driver; false if it failed or the data didn't match. */
+static bool run_request(bool write, uint32_t lba, uint32_t pass)
+{
+    static uint8_t buf[MAX_REQUEST * SD_CARD_MODEL_BLOCK];
+    uint8_t expect[SD_CARD_MODEL_BLOCK];
+
+    if (write) {
+        for (uint32_t i = 0; i < request_size; i++) {
+            fill_pattern(&buf[i * SD_CARD_MODEL_BLOCK], lba + i, pass);
+        }
+        if (!SD_SPI_SectorWrite(lba, buf, (uint16_t)request_size)) {
+            return false;
+        }
+        /* The last block is in the image once the card has accepted it. */
+        for (uint32_t i = 0; i < request_size; i++) {
+            if (!image_read(lba + i, expect) ||
+                (memcmp(expect, &buf[i * SD_CARD_MODEL_BLOCK], SD_CARD_MODEL_BLOCK) != 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (!SD_SPI_SectorRead(lba, buf, (uint16_t)request_size)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < request_size; i++) {
+        if (!image_read(lba + i, expect) ||
+            (memcmp(expect, &buf[i * SD_CARD_MODEL_BLOCK], SD_CARD_MODEL_BLOCK) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_header(void)
+{
+    printf("Workload       requests  sectors   SD cmds  selects  byte times   bus(ms)    KB/s  result\n");
+}
+
+static void print_line(const char *name, uint32_t requests, uint32_t errors, uint32_t commands,
+                       const spi_model_stats_t *before, const spi_model_stats_t *after)
+{
+    uint32_t bytes = after->bytes - before->bytes;
+    uint32_t slow = after->slow_bytes - before->slow_bytes;
+    double ms = ((bytes - slow) * 8.0 / SD_FAST_HZ + slow * 8.0 / SD_SLOW_HZ) * 1000.0;
+    uint32_t sectors = requests * request_size;
+
+    printf("%-14s %8u %8u %9u %8u %11u %9.2f %7.0f  %s\n", name, requests, sectors, commands,
+           after->selects - before->selects, bytes, ms,
+           (ms > 0.0) ? (sectors * SD_CARD_MODEL_BLOCK / 1024.0) / (ms / 1000.0) : 0.0,
+           errors ? "FAIL" : "ok");
+}
+
+/* SD commands the SD_SPI_STREAM_DISABLE build issues for one request: a
+ * single block command, or READ_MULTI_BLOCK and STOP_TRANSMISSION, or
+ * ACMD23 (CMD55 and CMD23) and WRITE_MULTI_BLOCK.
+ */
+static uint32_t single_commands(bool write)
+{
+    return (request_size == 1) ? 1 : write ? 3 : 2;
+}
+
+static uint32_t multi_block_commands(void)
+{
+    const sd_card_model_stats_t *card = sd_card_model_get_stats();
+
+    return card->cmd[SD_CMD_READ_MULTI].count + card->cmd[SD_CMD_WRITE_MULTI].count;
+}
+
+/* Sequential or random requests, then close the stream so its stop is
+ * charged to the workload.  Random requests mustn't cost more than they do
+ * without stream mode. */
+static uint32_t run_workload(const char *name, bool write, bool random, uint32_t count, uint32_t pass)
+{
+    spi_model_stats_t before = *spi_model_get_stats();
+    uint32_t commands = SD_SPI_GetCommandTotal();
+    uint32_t multi = multi_block_commands();
+    uint32_t requests = count / request_size;
+    uint32_t errors = 0;
+
+    for (uint32_t n = 0; n < requests; n++) {
+        uint32_t lba = random ? (next_random() % (image_blocks - request_size + 1)) : n * request_size;
+
+        if (!run_request(write, lba, pass)) {
+            if (errors++ == 0) {
+                fprintf(stderr, "%s: request %u at LBA %u failed.\n", name, n, lba);
+            }
+        }
+    }
+    SD_SPI_StreamClose();
+
+    commands = SD_SPI_GetCommandTotal() - commands;
+    multi = multi_block_commands() - multi;
+    if (random && (commands > requests * single_commands(write))) {
+        fprintf(stderr, "%s: %u SD commands, more than the %u of one transaction per request.\n", name, commands,
+                requests * single_commands(write));
+        errors++;
+    }
+    if (random && (request_size == 1) && (multi != 0)) {
+        fprintf(stderr, "%s: %u single sectors moved with a multiple block command.\n", name, multi);
+        errors++;
+    }
+    print_line(name, requests, errors, commands, &before, spi_model_get_stats());
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    sd_card_model_config_t config = SD_CARD_MODEL_DEFAULTS;
+    const char *name = NULL;
+    uint32_t count = 2048;
+    bool writes = false, verbose = false;
+    uint32_t errors = 0;
+    spi_model_stats_t before;
+    uint32_t commands;
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if ((argv[a][0] == '-') && (a + 1 < argc) && strchr("nabscr", argv[a][1])) {
+            uint32_t v = (uint32_t)strtoul(argv[++a], NULL, 0);
+
+            /* At 8MHz one SPI byte time is 1us. */
+            switch (argv[a - 1][1]) {
+            case 'n': config.ncr = v; break;
+            case 'a': config.nac = (uint32_t)(v * SD_FAST_HZ / 8e6); break;
+            case 'b': config.write_busy = (uint32_t)(v * SD_FAST_HZ / 8e6); break;
+            case 's': config.stop_busy = (uint32_t)(v * SD_FAST_HZ / 8e6); break;
+            case 'c': count = v; break;
+            case 'r': request_size = v; break;
+            }
+        } else if (strcmp(argv[a], "-w") == 0) {
+            writes = true;
+        } else if (strcmp(argv[a], "-v") == 0) {
+            verbose = true;
+        } else if (argv[a][0] == '-') {
+            fprintf(stderr, "Usage: %s [-n ncr] [-a nac_us] [-b busy_us] [-s stop_us] [-c count] [-r size] [-w] [-v] [image]\n",
+                    argv[0]);
+            return 1;
+        } else {
+            name = argv[a];
+        }
+    }
+    if ((request_size == 0) || (request_size > MAX_REQUEST)) {
+        fprintf(stderr, "Request size must be 1-%d sectors.\n", MAX_REQUEST);
+        return 1;
+    }
+
+    if (name != NULL) {
+        if ((image = fopen(name, writes ? "r+b" : "rb")) == NULL) {
+            perror(name);
+            return 1;
+        }
+    } else {
+        static uint8_t buf[SD_CARD_MODEL_BLOCK];
+
+        if ((image = tmpfile()) == NULL) {
+            perror("tmpfile");
+            return 1;
+        }
+        for (uint32_t lba = 0; lba < SCRATCH_BLOCKS; lba++) {
+            fill_pattern(buf, lba, 0);
+            fwrite(buf, 1, sizeof(buf), image);
+        }
+        writes = true;
+    }
+
+    if (!sd_card_model_open(image, &config)) {
+        fprintf(stderr, "The image must be at least 512KB.\n");
+        return 1;
+    }
+    image_blocks = sd_card_model_get_blocks();
+    if (count > image_blocks) {
+        count = image_blocks;
+    }
+
+    spi_model_reset();
+    spi_model_attach(sd_card_model_device);
+
+    printf("Card: %u blocks, NCR %u, NAC %u, write busy %u, stop busy %u byte times\n\n",
+           image_blocks, config.ncr, config.nac, config.write_busy, config.stop_busy);
+    print_header();
+
+    before = *spi_model_get_stats();
+    commands = SD_SPI_GetCommandTotal();
+    if (!SD_SPI_MediaInitialize() || (SD_SPI_GetSectorCount() != image_blocks - 1)) {
+        print_line("initialize", 0, 1, SD_SPI_GetCommandTotal() - commands, &before, spi_model_get_stats());
+        fprintf(stderr, "Card initialization failed.\n");
+        return 1;
+    }
+    print_line("initialize", 0, 0, SD_SPI_GetCommandTotal() - commands, &before, spi_model_get_stats());
+
+    errors += run_workload("seq read", false, false, count, 0);
+    errors += run_workload("random read", false, true, count, 0);
+    if (writes) {
+        errors += run_workload("seq write", true, false, count, 1);
+        errors += run_workload("random write", true, true, count, 2);
+        errors += run_workload("seq read", false, false, count, 0);
+    }
+
+    if (verbose) {
+        printf("\n");
+        sd_card_model_print_stats(stdout);
+    }
+    fclose(image);
+    return errors ? 1 : 0;
+}
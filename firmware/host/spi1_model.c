@@ -0,0 +1,349 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Register-level host model of SPI1 and the DMA1/DMA2 channels.     *
+ * Every register access made by spi1.c first lets the model take one    *
+ * step: register writes since the last access take effect, a DMA        *
+ * channel triggered by SPI1 TX moves a byte, SPI1 shifts a byte through *
+ * spi_model.c if it can, then a channel triggered by SPI1 RX moves a    *
+ * byte.  As on the PIC18F47Q43, SPI1 only shifts while SPI1TCNT is not  *
+ * zero, the counter loads when SPI1TCNTL is written, and with RXR set   *
+ * SPI1 waits while the 2-byte RX FIFO is full.                          *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xc.h>
+#include "spi_model.h"
+#include "spi1_model.h"
+
+#define SPI1_FIFO_DEPTH     2
+#define SPI1_NO_WRITE       0x100   /* TXB/TCNT storage once a write is taken */
+#define SPI1_STALL_LIMIT    100000
+
+#define DMA_CON0_EN         0x80
+#define DMA_CON0_SIRQEN     0x40
+#define DMA_CON1_DSTP       0x20
+#define DMA_CON1_SSTP       0x01
+#define DMA_SIRQ_SPI1RX     0x18
+#define DMA_SIRQ_SPI1TX     0x19
+
+volatile host_INTCON0bits_t INTCON0bits;
+
+static host_sfr_t sfr[HOST_NUM_SFRS];
+static host_dma_t dma[2];
+static uint16_t txb;
+static uint16_t tcnt_w[2];          /* [0] SPI1TCNTL, [1] SPI1TCNTH */
+static uint8_t rxb;
+
+static struct {
+    bool     on;
+    uint8_t *src;
+    uint8_t *dst;
+    uint16_t scnt;
+    uint16_t dcnt;
+} chan[2];
+
+static uint8_t  tx_fifo[SPI1_FIFO_DEPTH];
+static uint8_t  tx_count;
+static uint8_t  rx_fifo[SPI1_FIFO_DEPTH];
+static uint8_t  rx_count;
+static uint16_t tcnt;
+static uint8_t  tcnt_h;             /* SPI1TCNTH waiting for SPI1TCNTL */
+static uint8_t  last_mosi;
+static spi1_model_stats_t stats;
+static void   (*stall_handler)(void);
+static uint32_t stall_limit;
+static uint32_t idle_steps;
+
+void spi1_model_reset(void)
+{
+    memset(sfr, 0, sizeof(sfr));
+    memset(dma, 0, sizeof(dma));
+    memset(chan, 0, sizeof(chan));
+    memset(&stats, 0, sizeof(stats));
+    txb = SPI1_NO_WRITE;
+    tcnt_w[0] = tcnt_w[1] = SPI1_NO_WRITE;
+    rxb = 0;
+    tx_count = rx_count = 0;
+    tcnt = 0;
+    tcnt_h = 0;
+    last_mosi = 0xFF;
+    stall_handler = NULL;
+    stall_limit = SPI1_STALL_LIMIT;
+    idle_steps = 0;
+}
+
+const spi1_model_stats_t *spi1_model_get_stats(void)
+{
+    return &stats;
+}
+
+uint16_t spi1_model_get_tcnt(void)
+{
+    return tcnt;
+}
+
+void spi1_model_set_stall_handler(void (*handler)(void), uint32_t limit)
+{
+    stall_handler = handler;
+    stall_limit = limit;
+    idle_steps = 0;
+}
+
+/* spi1.c gives DMA the 16-bit data memory address of a buffer, as on the
+ * PIC.  The buffers involved are all statics of a small program, so the
+ * host address is the one nearest the model's own storage with the same
+ * low 16 bits.
+ */
+static uint8_t *spi1_model_address(uint32_t address)
+{
+    uintptr_t ref = (uintptr_t)&stats;
+    uintptr_t p = (ref & ~(uintptr_t)0xFFFF) | (address & 0xFFFF);
+
+    if (p > ref + 0x8000) {
+        p -= 0x10000;
+    } else if (p + 0x8000 < ref) {
+        p += 0x10000;
+    }
+    return (uint8_t *)p;
+}
+
+static void spi1_model_tx_push(uint8_t b)
+{
+    if (tx_count == SPI1_FIFO_DEPTH) {
+        stats.tx_overruns++;
+        return;
+    }
+    tx_fifo[tx_count++] = b;
+}
+
+static uint8_t spi1_model_tx_pop(void)
+{
+    uint8_t b = tx_fifo[0];
+
+    tx_fifo[0] = tx_fifo[1];
+    tx_count--;
+    return b;
+}
+
+static void spi1_model_rx_pop(void)
+{
+    if (rx_count != 0) {
+        rxb = rx_fifo[0];
+        rx_fifo[0] = rx_fifo[1];
+        rx_count--;
+    }
+}
+
+static bool spi1_model_armed(uint8_t sirq)
+{
+    for (int i = 0; i < 2; i++) {
+        if (chan[i].on && (dma[i].con0 & DMA_CON0_SIRQEN) && (dma[i].sirq == sirq)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int spi1_model_mode_step(uint8_t mode)
+{
+    return (mode == 1) ? 1 : (mode == 2) ? -1 : 0;
+}
+
+static void spi1_model_dma_stop(int i)
+{
+    dma[i].con0 &= (uint8_t)~DMA_CON0_EN;
+    chan[i].on = false;
+}
+
+/* One trigger's worth of transfer on channel i: a byte from source to
+ * destination, then the count reloads and the SSTP/DSTP stops.
+ */
+static void spi1_model_dma_move(int i)
+{
+    uint8_t b;
+
+    if (chan[i].src == &rxb) {
+        spi1_model_rx_pop();
+        b = rxb;
+    } else {
+        b = *chan[i].src;
+    }
+    if (chan[i].dst == (uint8_t *)&txb) {
+        if ((sfr[HOST_SPI1CON2].reg & _SPI1CON2_SPI1RXR_MASK) && !spi1_model_armed(DMA_SIRQ_SPI1RX)) {
+            stats.rx_unarmed++;
+        }
+        spi1_model_tx_push(b);
+    } else {
+        *chan[i].dst = b;
+    }
+    chan[i].src += spi1_model_mode_step((dma[i].con1 >> 1) & 3);
+    chan[i].dst += spi1_model_mode_step((dma[i].con1 >> 6) & 3);
+    stats.dma_moves[i]++;
+
+    if (--chan[i].scnt == 0) {
+        chan[i].src = spi1_model_address(dma[i].ssa);
+        chan[i].scnt = dma[i].ssz;
+        if (dma[i].con1 & DMA_CON1_SSTP) {
+            spi1_model_dma_stop(i);
+        }
+    }
+    if (--chan[i].dcnt == 0) {
+        chan[i].dst = spi1_model_address(dma[i].dsa);
+        chan[i].dcnt = dma[i].dsz;
+        if (i == 0) {
+            sfr[HOST_PIR2].pir2.DMA1DCNTIF = 1;
+        }
+        if (dma[i].con1 & DMA_CON1_DSTP) {
+            spi1_model_dma_stop(i);
+        }
+    }
+}
+
+/* Move a byte on each enabled channel that sirq is triggering. */
+static bool spi1_model_dma_run(uint8_t sirq, bool triggered)
+{
+    bool moved = false;
+
+    for (int i = 0; i < 2; i++) {
+        if (triggered && chan[i].on && (dma[i].con0 & DMA_CON0_SIRQEN) && (dma[i].sirq == sirq)) {
+            spi1_model_dma_move(i);
+            moved = true;
+            triggered = (sirq == DMA_SIRQ_SPI1RX) ? (rx_count != 0) : (tx_count < SPI1_FIFO_DEPTH);
+        }
+    }
+    return moved;
+}
+
+static bool spi1_model_busy(void)
+{
+    uint8_t con2 = sfr[HOST_SPI1CON2].reg;
+
+    return sfr[HOST_SPI1CON0].spi1con0.EN && (tcnt != 0) &&
+           ((con2 & _SPI1CON2_SPI1TXR_MASK) ? (tx_count != 0) : ((con2 & _SPI1CON2_SPI1RXR_MASK) != 0));
+}
+
+/* Shift one byte if SPI1 has what it needs.  Receive-only transfers clock
+ * out the last bit shifted, as SDO holds it.
+ */
+static bool spi1_model_shift(void)
+{
+    bool rxr = (sfr[HOST_SPI1CON2].reg & _SPI1CON2_SPI1RXR_MASK) != 0;
+    bool txr = (sfr[HOST_SPI1CON2].reg & _SPI1CON2_SPI1TXR_MASK) != 0;
+    uint8_t mosi;
+    uint8_t miso;
+
+    if (!spi1_model_busy() || (rxr && (rx_count == SPI1_FIFO_DEPTH))) {
+        return false;
+    }
+
+    mosi = txr ? spi1_model_tx_pop() : ((last_mosi & 1) ? 0xFF : 0x00);
+    miso = spi_model_shift(mosi);
+    last_mosi = mosi;
+    if (rxr) {
+        rx_fifo[rx_count++] = miso;
+    }
+    tcnt--;
+    stats.bytes++;
+    return true;
+}
+
+static void spi1_model_step(void)
+{
+    bool progress = false;
+
+    /* SPI1TCNTH is held until SPI1TCNTL is written, which loads the whole
+     * counter; the high byte is zero if SPI1TCNTH wasn't written since.
+     */
+    if (tcnt_w[1] != SPI1_NO_WRITE) {
+        tcnt_h = (uint8_t)tcnt_w[1];
+        tcnt_w[1] = SPI1_NO_WRITE;
+        stats.tcnt_loads++;
+        progress = true;
+    }
+    if (tcnt_w[0] != SPI1_NO_WRITE) {
+        tcnt = (uint16_t)((tcnt_h << 8) | tcnt_w[0]);
+        tcnt_h = 0;
+        tcnt_w[0] = SPI1_NO_WRITE;
+        stats.tcnt_loads++;
+        progress = true;
+    }
+    if (txb != SPI1_NO_WRITE) {
+        spi1_model_tx_push((uint8_t)txb);
+        txb = SPI1_NO_WRITE;
+        progress = true;
+    }
+
+    /* A channel being enabled starts from its start addresses and sizes. */
+    for (int i = 0; i < 2; i++) {
+        bool en = (dma[i].con0 & DMA_CON0_EN) != 0;
+
+        if (en && !chan[i].on) {
+            chan[i].src = spi1_model_address(dma[i].ssa);
+            chan[i].dst = spi1_model_address(dma[i].dsa);
+            chan[i].scnt = dma[i].ssz;
+            chan[i].dcnt = dma[i].dsz;
+            progress = true;
+        }
+        chan[i].on = en;
+    }
+
+    progress |= spi1_model_dma_run(DMA_SIRQ_SPI1TX, tx_count < SPI1_FIFO_DEPTH);
+    progress |= spi1_model_shift();
+    progress |= spi1_model_dma_run(DMA_SIRQ_SPI1RX, rx_count != 0);
+
+    if (progress) {
+        idle_steps = 0;
+    } else if (++idle_steps >= stall_limit) {
+        idle_steps = 0;
+        if (stall_handler == NULL) {
+            fprintf(stderr, "spi1_model: no progress in %u register accesses, TCNT %u, TX %u, RX %u\n",
+                    stall_limit, tcnt, tx_count, rx_count);
+            exit(2);
+        }
+        stall_handler();
+    }
+}
+
+volatile host_sfr_t *spi1_model_sfr(host_sfr_id_t id)
+{
+    spi1_model_step();
+    if (id == HOST_PIR3) {
+        sfr[id].pir3.SPI1RXIF = (rx_count != 0);
+        sfr[id].pir3.SPI1TXIF = (tx_count < SPI1_FIFO_DEPTH);
+    } else if (id == HOST_SPI1CON2) {
+        sfr[id].spi1con2.BUSY = spi1_model_busy();
+    }
+    return &sfr[id];
+}
+
+volatile host_dma_t *spi1_model_dma(void)
+{
+    spi1_model_step();
+    return &dma[sfr[HOST_DMASELECT].reg & 1];
+}
+
+volatile uint16_t *spi1_model_txb(void)
+{
+    spi1_model_step();
+    return &txb;
+}
+
+volatile uint16_t *spi1_model_tcnt(bool high)
+{
+    spi1_model_step();
+    return &tcnt_w[high ? 1 : 0];
+}
+
+volatile uint8_t *spi1_model_rxb(void)
+{
+    spi1_model_step();
+    spi1_model_rx_pop();
+    return &rxb;
+}
@@ -0,0 +1,39 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Register-level host model of SPI1 and the DMA1/DMA2 channels, so  *
+ * the firmware's spi1.c can be compiled for the host and checked.       *
+ * Bytes shifted by SPI1 go through spi_model.c, to whatever device is   *
+ * attached there.  The register accessors are declared in <xc.h>.       *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef SPI1_MODEL_H
+#define SPI1_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t bytes;         /* Bytes shifted */
+    uint32_t dma_moves[2];  /* Bytes moved by DMA1 and DMA2 */
+    uint32_t tx_overruns;   /* SPI1TXB written with the TX FIFO full */
+    uint32_t rx_unarmed;    /* Bytes DMA fed to SPI1TXB while no channel was
+                               armed to take the received bytes */
+    uint32_t tcnt_loads;    /* Writes to SPI1TCNTH/SPI1TCNTL */
+} spi1_model_stats_t;
+
+void spi1_model_reset(void);
+const spi1_model_stats_t *spi1_model_get_stats(void);
+uint16_t spi1_model_get_tcnt(void);
+
+/* Called after 'limit' register accesses in a row that let nothing happen,
+ * eg. a driver waiting for a transfer that can never start.  Without a
+ * handler, the model reports the stall and exits.
+ */
+void spi1_model_set_stall_handler(void (*handler)(void), uint32_t limit);
+
+#endif /* SPI1_MODEL_H */
@@ -0,0 +1,277 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Runs the firmware's SPI1 driver (spi1.c) against the register     *
+ * model in spi1_model.c, with a test device attached to spi_model.c.    *
+ * Byte and block transfers of several sizes are checked byte for byte  *
+ * on MOSI and MISO, along with the number of bytes shifted.  In DMA     *
+ * builds it also checks that the RX channel is armed before the TX      *
+ * channel starts, that SPI1TCNT is loaded once for the whole block and  *
+ * that both channels are off with DMA1DCNTIF clear when the block       *
+ * returns.  The exit status is non-zero if anything failed.             *
+ *                                                                       *
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <setjmp.h>
+#include <xc.h>
+#include "spi1.h"
+#include "spi_model.h"
+#include "spi1_model.h"
+
+#define MAX_BLOCK       512
+#define LOG_BYTES       4096
+#define STALL_ACCESSES  10000
+
+static uint8_t mosi_log[LOG_BYTES];
+static uint32_t device_bytes;
+static uint8_t buf[MAX_BLOCK];
+#ifdef SPI1_DMA_ENABLE
+static uint8_t tx_buf[MAX_BLOCK];
+static uint8_t rx_buf[MAX_BLOCK];
+#endif
+static jmp_buf stall_jump;
+static bool stall_seen;
+static uint32_t failures;
+
+static const uint16_t sizes[] = { 1, 15, 16, 300, 512 };
+
+static uint8_t miso_byte(uint32_t n)
+{
+    return (uint8_t)(n * 37 + 11);
+}
+
+/* Logs MOSI and answers with a pattern that depends on the byte count. */
+static uint8_t test_device(uint8_t mosi, bool selected)
+{
+    (void)selected;
+    if (device_bytes < LOG_BYTES) {
+        mosi_log[device_bytes] = mosi;
+    }
+    return miso_byte(device_bytes++);
+}
+
+static void stalled(void)
+{
+    stall_seen = true;
+    longjmp(stall_jump, 1);
+}
+
+/* Start over from reset after a stall, so later tests still run. */
+static void restart(void)
+{
+    spi1_model_reset();
+    spi1_model_set_stall_handler(stalled, STALL_ACCESSES);
+    SPI1_Initialize();
+    (void)SPI1_Open(SDFAST_CONFIG);
+}
+
+static void fill(uint8_t *data, uint16_t len, uint8_t seed)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        data[i] = (uint8_t)(seed + i * 3 + (i >> 8));
+    }
+}
+
+static bool mosi_matches(uint32_t first, const uint8_t *expect, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        if (mosi_log[first + i] != (expect ? expect[i] : 0xFF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool miso_matches(uint32_t first, const uint8_t *data, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        if (data[i] != miso_byte(first + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void report(const char *name, uint16_t len, uint32_t bytes, bool ok)
+{
+    printf("%-24s %5u %6u  %s\n", name, len, bytes, ok ? "ok" : stall_seen ? "FAIL, stalled" : "FAIL");
+    if (!ok) {
+        failures++;
+    }
+    if (stall_seen) {
+        stall_seen = false;
+        restart();
+    }
+}
+
+/* Every byte of the transfer went out exactly once, nothing was dropped
+ * and the transfer counter ran down to zero.
+ */
+static bool clean_finish(const spi1_model_stats_t *before, uint16_t len)
+{
+    const spi1_model_stats_t *after = spi1_model_get_stats();
+
+    return ((after->bytes - before->bytes) == len) &&
+           (after->tx_overruns == before->tx_overruns) &&
+           (after->rx_unarmed == before->rx_unarmed) &&
+           (spi1_model_get_tcnt() == 0) && !PIR3bits.SPI1RXIF;
+}
+
+typedef enum { XFER_EXCHANGE, XFER_WRITE, XFER_READ } xfer_t;
+
+static void test_block(xfer_t type, uint16_t len)
+{
+    static const char *names[] = { "exchange block", "write block", "read block" };
+    static spi1_model_stats_t before;   /* Set after setjmp(), so not a local */
+    uint8_t data[MAX_BLOCK];
+    uint32_t first;
+    volatile bool ok = false;
+
+    if (setjmp(stall_jump) == 0) {
+        /* Leave SDO high, as the SD driver's 0xFF token poll does. */
+        (void)SPI1_ExchangeByte(0xFF);
+
+        fill(buf, len, (uint8_t)(len + type));
+        memcpy(data, buf, len);
+        before = *spi1_model_get_stats();
+        first = device_bytes;
+
+        switch (type) {
+            case XFER_EXCHANGE:
+                SPI1_ExchangeBlock(buf, len);
+                ok = mosi_matches(first, data, len) && miso_matches(first, buf, len);
+                break;
+            case XFER_WRITE:
+                SPI1_WriteBlock(buf, len);
+                ok = mosi_matches(first, data, len) && (memcmp(buf, data, len) == 0);
+                break;
+            case XFER_READ:
+                SPI1_ReadBlock(buf, len);
+                ok = mosi_matches(first, NULL, len) && miso_matches(first, buf, len);
+                break;
+        }
+        ok = ok && clean_finish(&before, len);
+    }
+    report(names[type], len, spi1_model_get_stats()->bytes - before.bytes, ok);
+}
+
+#ifdef SPI1_DMA_ENABLE
+/* A DMA block loads SPI1TCNT once, is moved entirely by the two channels
+ * and leaves both of them off with DMA1DCNTIF clear.
+ */
+static void test_dma_finish(uint16_t len)
+{
+    spi1_model_stats_t before = *spi1_model_get_stats();
+    uint32_t first = device_bytes;
+    volatile bool ok = false;
+
+    fill(tx_buf, len, 0x5A);
+    memcpy(rx_buf, tx_buf, len);
+
+    if (setjmp(stall_jump) == 0) {
+        SPI1_ExchangeBlock(rx_buf, len);
+        ok = !PIR2bits.DMA1DCNTIF &&
+             ((spi1_model_get_stats()->tcnt_loads - before.tcnt_loads) == 2) &&
+             ((spi1_model_get_stats()->dma_moves[0] - before.dma_moves[0]) == len) &&
+             ((spi1_model_get_stats()->dma_moves[1] - before.dma_moves[1]) == len) &&
+             mosi_matches(first, tx_buf, len) && miso_matches(first, rx_buf, len) &&
+             clean_finish(&before, len);
+        DMASELECT = 0;
+        ok = ok && !(DMAnCON0 & 0x80);
+        DMASELECT = 1;
+        ok = ok && !(DMAnCON0 & 0x80);
+    }
+    report("dma finish", len, spi1_model_get_stats()->bytes - before.bytes, ok);
+}
+
+/* The model must catch a TX channel started before the RX channel is
+ * armed, or the driver's clean run above proves nothing.
+ */
+static void test_tx_before_rx(void)
+{
+    spi1_model_stats_t before = *spi1_model_get_stats();
+    volatile bool ok = false;
+
+    if (setjmp(stall_jump) == 0) {
+        DMASELECT = 1;
+        DMAnCON1 = 0x03;
+        DMAnSSA = (uint24_t)tx_buf;
+        DMAnSSZ = SPI1_DMA_MIN_BLOCK;
+        SPI1TCNTH = 0;
+        SPI1TCNTL = SPI1_DMA_MIN_BLOCK;
+        DMAnCON0 = 0xC0;
+
+        DMASELECT = 0;
+        DMAnCON1 = 0x60;
+        DMAnDSA = (uint16_t)rx_buf;
+        DMAnDSZ = SPI1_DMA_MIN_BLOCK;
+        PIR2bits.DMA1DCNTIF = 0;
+        DMAnCON0 = 0xC0;
+
+        while (!PIR2bits.DMA1DCNTIF);
+        PIR2bits.DMA1DCNTIF = 0;
+        ok = (spi1_model_get_stats()->rx_unarmed != before.rx_unarmed);
+    }
+    report("model: TX before RX", SPI1_DMA_MIN_BLOCK, spi1_model_get_stats()->bytes - before.bytes, ok);
+}
+#endif
+
+int main(void)
+{
+    spi_model_reset();
+    spi_model_attach(test_device);
+    spi1_model_reset();
+    spi1_model_set_stall_handler(stalled, STALL_ACCESSES);
+    LATBbits.LATB5 = 0;
+
+    SPI1_Initialize();
+    if (!SPI1_Open(SDFAST_CONFIG) || SPI1_Open(SDFAST_CONFIG)) {
+        printf("SPI1_Open failed, or succeeded while already open.\n");
+        return 1;
+    }
+
+#if defined(SPI1_DMA_ENABLE)
+    printf("SPI1 blocks: DMA from %u bytes\n\n", SPI1_DMA_MIN_BLOCK);
+#elif defined(SPI1_BURST_ENABLE)
+    printf("SPI1 blocks: burst at %u bytes\n\n", SPI1_BURST_BLOCK);
+#else
+    printf("SPI1 blocks: polled\n\n");
+#endif
+    printf("Test                      size  bytes  result\n");
+
+    {
+        spi1_model_stats_t before = *spi1_model_get_stats();
+        uint32_t first = device_bytes;
+        volatile bool ok = false;
+
+        if (setjmp(stall_jump) == 0) {
+            ok = (SPI1_ExchangeByte(0xA5) == miso_byte(first)) && (mosi_log[first] == 0xA5) &&
+                 clean_finish(&before, 1);
+        }
+        report("exchange byte", 1, spi1_model_get_stats()->bytes - before.bytes, ok);
+    }
+
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        test_block(XFER_EXCHANGE, sizes[i]);
+        test_block(XFER_WRITE, sizes[i]);
+        test_block(XFER_READ, sizes[i]);
+    }
+
+#ifdef SPI1_DMA_ENABLE
+    test_dma_finish(MAX_BLOCK);
+    test_dma_finish(SPI1_DMA_MIN_BLOCK);
+    test_tx_before_rx();
+#endif
+
+    SPI1_Close();
+    printf("\nResult: %s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
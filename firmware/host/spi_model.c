@@ -0,0 +1,192 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Host model of the spi_master_functions_t table used by the SD    *
+ * card driver.  Replaces spi_master.c and spi1.c in host builds.        *
+ *                                                                       *
+ *************************************************************************/
+
+#include <string.h>
+#include <xc.h>
+#include "drivers/spi_master.h"
+#include "spi_model.h"
+
+volatile host_LATBbits_t LATBbits = { 1 };
+volatile host_PORTEbits_t PORTEbits = { 1 };
+
+static spi_model_device_t spi_device;
+static spi_model_stats_t spi_stats;
+static spi_model_event_t *spi_log;
+static size_t spi_log_entries;
+static size_t spi_log_count;
+static int spi_open_config = -1;    /* -1 when the port is closed */
+static bool spi_was_selected;
+
+void spi_model_reset(void)
+{
+    memset(&spi_stats, 0, sizeof(spi_stats));
+    spi_log_count = 0;
+    spi_open_config = -1;
+    spi_was_selected = false;
+    LATBbits.LATB5 = 1;
+    PORTEbits.RE0 = 1;
+}
+
+void spi_model_attach(spi_model_device_t device)
+{
+    spi_device = device;
+}
+
+void spi_model_set_log(spi_model_event_t *log, size_t entries)
+{
+    spi_log = log;
+    spi_log_entries = entries;
+    spi_log_count = 0;
+}
+
+size_t spi_model_log_count(void)
+{
+    return spi_log_count;
+}
+
+const spi_model_stats_t *spi_model_get_stats(void)
+{
+    return &spi_stats;
+}
+
+bool spi_model_is_open(void)
+{
+    return spi_open_config >= 0;
+}
+
+static void spi_model_record(spi_model_op_t op, uint16_t length, uint8_t mosi, uint8_t miso)
+{
+    spi_stats.calls[op]++;
+
+    if ((spi_log != NULL) && (spi_log_count < spi_log_entries)) {
+        spi_model_event_t *event = &spi_log[spi_log_count++];
+
+        event->op = op;
+        event->config = (spi_open_config < 0) ? 0xFF : (uint8_t)spi_open_config;
+        event->selected = (LATBbits.LATB5 == 0);
+        event->length = length;
+        event->mosi = mosi;
+        event->miso = miso;
+    }
+}
+
+/* One SPI byte time. */
+static uint8_t spi_model_clock(uint8_t mosi)
+{
+    bool selected = (LATBbits.LATB5 == 0);
+
+    if (selected && !spi_was_selected) {
+        spi_stats.selects++;
+    }
+    spi_was_selected = selected;
+
+    spi_stats.bytes++;
+    if (spi_open_config == SDSLOW) {
+        spi_stats.slow_bytes++;
+    }
+
+    return (spi_device != NULL) ? spi_device(mosi, selected) : 0xFF;
+}
+
+uint8_t spi_model_shift(uint8_t mosi)
+{
+    return spi_model_clock(mosi);
+}
+
+static bool spi_model_open(spi_master_configurations_t config)
+{
+    /* Like SPI1_Open(), fail if the port is already enabled. */
+    if (spi_open_config >= 0) {
+        spi_stats.open_failures++;
+        return false;
+    }
+    spi_open_config = config;
+    spi_model_record(SPI_MODEL_OPEN, 0, 0, 0);
+    return true;
+}
+
+static bool spi_model_open_fast(void)
+{
+    return spi_model_open(SDFAST);
+}
+
+static bool spi_model_open_slow(void)
+{
+    return spi_model_open(SDSLOW);
+}
+
+static void spi_model_close(void)
+{
+    spi_model_record(SPI_MODEL_CLOSE, 0, 0, 0);
+    spi_open_config = -1;
+}
+
+static uint8_t spi_model_exchange_byte(uint8_t b)
+{
+    uint8_t miso = spi_model_clock(b);
+
+    spi_model_record(SPI_MODEL_EXCHANGE_BYTE, 1, b, miso);
+    return miso;
+}
+
+static void spi_model_exchange_block(void *block, size_t blockSize)
+{
+    uint8_t *data = block;
+    uint8_t first_out = blockSize ? data[0] : 0;
+
+    for (size_t i = 0; i < blockSize; i++) {
+        data[i] = spi_model_clock(data[i]);
+    }
+    spi_model_record(SPI_MODEL_EXCHANGE_BLOCK, (uint16_t)blockSize, first_out, blockSize ? data[0] : 0);
+}
+
+static void spi_model_write_block(void *block, size_t blockSize)
+{
+    const uint8_t *data = block;
+    uint8_t first_in = 0;
+
+    for (size_t i = 0; i < blockSize; i++) {
+        uint8_t miso = spi_model_clock(data[i]);
+        if (i == 0) first_in = miso;
+    }
+    spi_model_record(SPI_MODEL_WRITE_BLOCK, (uint16_t)blockSize, blockSize ? data[0] : 0, first_in);
+}
+
+static void spi_model_read_block(void *block, size_t blockSize)
+{
+    uint8_t *data = block;
+
+    /* Matches SPI1_ReadBlock(): 0xFF is transmitted for every byte. */
+    for (size_t i = 0; i < blockSize; i++) {
+        data[i] = spi_model_clock(0xFF);
+    }
+    spi_model_record(SPI_MODEL_READ_BLOCK, (uint16_t)blockSize, 0xFF, blockSize ? data[0] : 0);
+}
+
+static void spi_model_write_byte(uint8_t byte)
+{
+    (void)spi_model_exchange_byte(byte);
+}
+
+static uint8_t spi_model_read_byte(void)
+{
+    return spi_model_exchange_byte(0xFF);
+}
+
+const spi_master_functions_t spiMaster[] = {
+    { spi_model_close, spi_model_open_fast, spi_model_exchange_byte, spi_model_exchange_block, spi_model_write_block, spi_model_read_block, spi_model_write_byte, spi_model_read_byte, NULL, NULL },
+    { spi_model_close, spi_model_open_slow, spi_model_exchange_byte, spi_model_exchange_block, spi_model_write_block, spi_model_read_block, spi_model_write_byte, spi_model_read_byte, NULL, NULL }
+};
+
+bool spi_master_open(spi_master_configurations_t config)
+{
+    return spi_model_open(config);
+}
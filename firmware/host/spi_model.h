@@ -0,0 +1,62 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Host model of the spi_master_functions_t table used by the SD    *
+ * card driver.  Each SPI byte time is passed to an attached device      *
+ * callback along with the state of the SD card CS# pin, and every call  *
+ * through the table is counted and optionally logged so that the       *
+ * driver's command sequencing can be checked without hardware.          *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef SPI_MODEL_H
+#define SPI_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Called once per SPI byte time.  Returns the byte shifted in on MISO. */
+typedef uint8_t (*spi_model_device_t)(uint8_t mosi, bool selected);
+
+typedef enum {
+    SPI_MODEL_OPEN = 0,
+    SPI_MODEL_CLOSE,
+    SPI_MODEL_EXCHANGE_BYTE,
+    SPI_MODEL_EXCHANGE_BLOCK,
+    SPI_MODEL_WRITE_BLOCK,
+    SPI_MODEL_READ_BLOCK,
+    SPI_MODEL_NUM_OPS
+} spi_model_op_t;
+
+typedef struct {
+    spi_model_op_t op;
+    uint8_t  config;        /* spi_master_configurations_t the call came through */
+    bool     selected;      /* CS# asserted when the call was made */
+    uint16_t length;        /* Bytes transferred (1 for byte calls) */
+    uint8_t  mosi;          /* First byte transmitted */
+    uint8_t  miso;          /* First byte received */
+} spi_model_event_t;
+
+typedef struct {
+    uint32_t calls[SPI_MODEL_NUM_OPS];
+    uint32_t open_failures; /* Opens attempted while already open */
+    uint32_t selects;       /* CS# high to low transitions */
+    uint32_t bytes;         /* Total SPI byte times */
+    uint32_t slow_bytes;    /* Byte times clocked at the SDSLOW rate */
+} spi_model_stats_t;
+
+void spi_model_reset(void);
+void spi_model_attach(spi_model_device_t device);
+void spi_model_set_log(spi_model_event_t *log, size_t entries);
+size_t spi_model_log_count(void);
+const spi_model_stats_t *spi_model_get_stats(void);
+bool spi_model_is_open(void);
+
+/* One byte time for a register-level model of the port (spi1_model.c). */
+uint8_t spi_model_shift(uint8_t mosi);
+
+#endif /* SPI_MODEL_H */
@@ -0,0 +1,772 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Z80 CPU emulator for host builds.  Opcodes are decoded by their   *
+ * x/y/z/p/q fields.  With a DD or FD prefix, HL, H and L become IX/IY   *
+ * and their halves, and (HL) becomes (IX+d)/(IY+d); the prefix costs 4  *
+ * T-states and the displacement 8 (5 for LD (IX+d),n.)  Block           *
+ * instructions re-execute themselves until done, as on the real CPU, so *
+ * each iteration of INIR or OTIR is a separate step.                    *
+ *                                                                       *
+ *************************************************************************/
+
+#include <string.h>
+#include "z80.h"
+
+#define FLAG_C  0x01
+#define FLAG_N  0x02
+#define FLAG_PV 0x04
+#define FLAG_X  0x08
+#define FLAG_H  0x10
+#define FLAG_Y  0x20
+#define FLAG_Z  0x40
+#define FLAG_S  0x80
+
+#define A       (cpu->af >> 8)
+#define F       (cpu->af & 0xFF)
+#define SET_A(v) (cpu->af = (uint16_t)((cpu->af & 0x00FF) | ((uint16_t)(uint8_t)(v) << 8)))
+#define SET_F(v) (cpu->af = (uint16_t)((cpu->af & 0xFF00) | (uint8_t)(v)))
+#define B       (cpu->bc >> 8)
+#define C       (cpu->bc & 0xFF)
+
+/* Prefix in effect: HL, IX or IY */
+enum { PFX_HL, PFX_IX, PFX_IY };
+
+static uint8_t rd(z80_t *cpu, uint16_t addr)
+{
+    return cpu->mem[addr];
+}
+
+static void wr(z80_t *cpu, uint16_t addr, uint8_t v)
+{
+    cpu->mem[addr] = v;
+}
+
+static uint16_t rd16(z80_t *cpu, uint16_t addr)
+{
+    return (uint16_t)(rd(cpu, addr) | (rd(cpu, (uint16_t)(addr + 1)) << 8));
+}
+
+static void wr16(z80_t *cpu, uint16_t addr, uint16_t v)
+{
+    wr(cpu, addr, (uint8_t)v);
+    wr(cpu, (uint16_t)(addr + 1), (uint8_t)(v >> 8));
+}
+
+static uint8_t fetch(z80_t *cpu)
+{
+    return rd(cpu, cpu->pc++);
+}
+
+static uint16_t fetch16(z80_t *cpu)
+{
+    uint16_t v = rd16(cpu, cpu->pc);
+
+    cpu->pc += 2;
+    return v;
+}
+
+static void push(z80_t *cpu, uint16_t v)
+{
+    cpu->sp -= 2;
+    wr16(cpu, cpu->sp, v);
+}
+
+static uint16_t pop(z80_t *cpu)
+{
+    uint16_t v = rd16(cpu, cpu->sp);
+
+    cpu->sp += 2;
+    return v;
+}
+
+static void refresh(z80_t *cpu)
+{
+    cpu->r = (uint8_t)((cpu->r & 0x80) | ((cpu->r + 1) & 0x7F));
+}
+
+static uint8_t sz53(uint8_t v)
+{
+    return (v & (FLAG_S | FLAG_Y | FLAG_X)) | (v ? 0 : FLAG_Z);
+}
+
+static uint8_t sz53p(uint8_t v)
+{
+    return sz53(v) | (__builtin_parity(v) ? 0 : FLAG_PV);
+}
+
+/* HL, IX or IY */
+static uint16_t *idx_reg(z80_t *cpu, int pfx)
+{
+    return (pfx == PFX_IX) ? &cpu->ix : (pfx == PFX_IY) ? &cpu->iy : &cpu->hl;
+}
+
+/* Register r (B C D E H L - A); H and L follow the prefix. */
+static uint8_t get_r(z80_t *cpu, int r, int pfx)
+{
+    switch (r) {
+    case 0: return B;
+    case 1: return C;
+    case 2: return cpu->de >> 8;
+    case 3: return cpu->de & 0xFF;
+    case 4: return *idx_reg(cpu, pfx) >> 8;
+    case 5: return *idx_reg(cpu, pfx) & 0xFF;
+    default: return A;
+    }
+}
+
+static void set_r(z80_t *cpu, int r, int pfx, uint8_t v)
+{
+    uint16_t *p;
+
+    switch (r) {
+    case 0: cpu->bc = (uint16_t)((cpu->bc & 0x00FF) | (v << 8)); break;
+    case 1: cpu->bc = (uint16_t)((cpu->bc & 0xFF00) | v); break;
+    case 2: cpu->de = (uint16_t)((cpu->de & 0x00FF) | (v << 8)); break;
+    case 3: cpu->de = (uint16_t)((cpu->de & 0xFF00) | v); break;
+    case 4: p = idx_reg(cpu, pfx); *p = (uint16_t)((*p & 0x00FF) | (v << 8)); break;
+    case 5: p = idx_reg(cpu, pfx); *p = (uint16_t)((*p & 0xFF00) | v); break;
+    default: SET_A(v); break;
+    }
+}
+
+/* Address of (HL), or (IX+d)/(IY+d) with the displacement fetched. */
+static uint16_t hl_addr(z80_t *cpu, int pfx)
+{
+    if (pfx == PFX_HL) {
+        return cpu->hl;
+    }
+    return (uint16_t)(*idx_reg(cpu, pfx) + (int8_t)fetch(cpu));
+}
+
+/* BC, DE, HL/IX/IY, SP */
+static uint16_t *rp(z80_t *cpu, int p, int pfx)
+{
+    switch (p) {
+    case 0: return &cpu->bc;
+    case 1: return &cpu->de;
+    case 2: return idx_reg(cpu, pfx);
+    default: return &cpu->sp;
+    }
+}
+
+/* BC, DE, HL/IX/IY, AF */
+static uint16_t *rp2(z80_t *cpu, int p, int pfx)
+{
+    return (p == 3) ? &cpu->af : rp(cpu, p, pfx);
+}
+
+static bool cond(z80_t *cpu, int y)
+{
+    switch (y) {
+    case 0: return !(F & FLAG_Z);
+    case 1: return (F & FLAG_Z) != 0;
+    case 2: return !(F & FLAG_C);
+    case 3: return (F & FLAG_C) != 0;
+    case 4: return !(F & FLAG_PV);
+    case 5: return (F & FLAG_PV) != 0;
+    case 6: return !(F & FLAG_S);
+    default: return (F & FLAG_S) != 0;
+    }
+}
+
+/* ADD ADC SUB SBC AND XOR OR CP */
+static void alu(z80_t *cpu, int op, uint8_t v)
+{
+    uint8_t a = A;
+    unsigned r;
+    uint8_t c = (op == 1 || op == 3) ? (F & FLAG_C) : 0;
+
+    switch (op) {
+    case 0:
+    case 1:
+        r = a + v + c;
+        SET_A(r);
+        SET_F(sz53((uint8_t)r) | ((r >> 8) & FLAG_C) | ((a ^ v ^ r) & FLAG_H) |
+              ((((a ^ ~v) & (a ^ r)) & 0x80) >> 5));
+        break;
+    case 2:
+    case 3:
+    case 7:
+        r = a - v - c;
+        SET_F(((op == 7) ? ((sz53((uint8_t)r) & ~(FLAG_X | FLAG_Y)) | (v & (FLAG_X | FLAG_Y))) : sz53((uint8_t)r)) |
+              FLAG_N | ((r >> 8) & FLAG_C) | ((a ^ v ^ r) & FLAG_H) | ((((a ^ v) & (a ^ r)) & 0x80) >> 5));
+        if (op != 7) {
+            SET_A(r);
+        }
+        break;
+    case 4:
+        SET_A(a & v);
+        SET_F(sz53p(A) | FLAG_H);
+        break;
+    case 5:
+        SET_A(a ^ v);
+        SET_F(sz53p(A));
+        break;
+    default:
+        SET_A(a | v);
+        SET_F(sz53p(A));
+        break;
+    }
+}
+
+static uint8_t inc8(z80_t *cpu, uint8_t v)
+{
+    uint8_t r = (uint8_t)(v + 1);
+
+    SET_F((F & FLAG_C) | sz53(r) | (((v & 0x0F) == 0x0F) ? FLAG_H : 0) | ((v == 0x7F) ? FLAG_PV : 0));
+    return r;
+}
+
+static uint8_t dec8(z80_t *cpu, uint8_t v)
+{
+    uint8_t r = (uint8_t)(v - 1);
+
+    SET_F((F & FLAG_C) | FLAG_N | sz53(r) | (((v & 0x0F) == 0) ? FLAG_H : 0) | ((v == 0x80) ? FLAG_PV : 0));
+    return r;
+}
+
+static uint16_t add16(z80_t *cpu, uint16_t a, uint16_t v)
+{
+    uint32_t r = (uint32_t)a + v;
+
+    SET_F((F & (FLAG_S | FLAG_Z | FLAG_PV)) | ((r >> 16) & FLAG_C) | (((a ^ v ^ r) >> 8) & FLAG_H) |
+          ((r >> 8) & (FLAG_X | FLAG_Y)));
+    return (uint16_t)r;
+}
+
+static void adc16(z80_t *cpu, uint16_t v, bool sub)
+{
+    uint16_t a = cpu->hl;
+    uint32_t r = sub ? ((uint32_t)a - v - (F & FLAG_C)) : ((uint32_t)a + v + (F & FLAG_C));
+    uint16_t r16 = (uint16_t)r;
+    uint16_t ov = sub ? ((a ^ v) & (a ^ r16)) : ((a ^ ~v) & (a ^ r16));
+
+    cpu->hl = r16;
+    SET_F(((r16 >> 8) & (FLAG_S | FLAG_X | FLAG_Y)) | (r16 ? 0 : FLAG_Z) | (((a ^ v ^ r) >> 8) & FLAG_H) |
+          ((ov & 0x8000) ? FLAG_PV : 0) | ((r >> 16) & FLAG_C) | (sub ? FLAG_N : 0));
+}
+
+/* RLC RRC RL RR SLA SRA SLL SRL */
+static uint8_t rot(z80_t *cpu, int op, uint8_t v)
+{
+    uint8_t r, c;
+
+    switch (op) {
+    case 0: c = v >> 7; r = (uint8_t)((v << 1) | c); break;
+    case 1: c = v & 1; r = (uint8_t)((v >> 1) | (c << 7)); break;
+    case 2: c = v >> 7; r = (uint8_t)((v << 1) | (F & FLAG_C)); break;
+    case 3: c = v & 1; r = (uint8_t)((v >> 1) | ((F & FLAG_C) << 7)); break;
+    case 4: c = v >> 7; r = (uint8_t)(v << 1); break;
+    case 5: c = v & 1; r = (uint8_t)((v >> 1) | (v & 0x80)); break;
+    case 6: c = v >> 7; r = (uint8_t)((v << 1) | 1); break;
+    default: c = v & 1; r = v >> 1; break;
+    }
+    SET_F(sz53p(r) | c);
+    return r;
+}
+
+static void daa(z80_t *cpu)
+{
+    uint8_t a = A, corr = 0, carry = F & FLAG_C;
+    bool h;
+
+    if ((F & FLAG_H) || ((a & 0x0F) > 9)) corr = 0x06;
+    if (carry || (a > 0x99)) {
+        corr |= 0x60;
+        carry = FLAG_C;
+    }
+    if (F & FLAG_N) {
+        h = (F & FLAG_H) && ((a & 0x0F) < 6);
+        a = (uint8_t)(a - corr);
+    } else {
+        h = (a & 0x0F) > 9;
+        a = (uint8_t)(a + corr);
+    }
+    SET_A(a);
+    SET_F(sz53p(a) | (F & FLAG_N) | (h ? FLAG_H : 0) | carry);
+}
+
+static uint32_t exec_cb(z80_t *cpu, int pfx)
+{
+    uint16_t addr = 0;
+    uint8_t op, v, r = 0;
+    int x, y, z;
+
+    if (pfx != PFX_HL) {
+        /* DD CB d op: the displacement comes before the opcode. */
+        addr = hl_addr(cpu, pfx);
+        op = fetch(cpu);
+    } else {
+        op = fetch(cpu);
+        refresh(cpu);
+        if ((op & 7) == 6) {
+            addr = cpu->hl;
+        }
+    }
+    x = op >> 6;
+    y = (op >> 3) & 7;
+    z = op & 7;
+
+    v = ((pfx != PFX_HL) || (z == 6)) ? rd(cpu, addr) : get_r(cpu, z, PFX_HL);
+
+    switch (x) {
+    case 0:
+        r = rot(cpu, y, v);
+        break;
+    case 1:
+        SET_F((F & FLAG_C) | FLAG_H | ((v & (1 << y)) ? (v & (1 << y) & FLAG_S) : (FLAG_Z | FLAG_PV)) |
+              (((pfx != PFX_HL) ? (addr >> 8) : v) & (FLAG_X | FLAG_Y)));
+        if (pfx != PFX_HL) return 20;
+        return (z == 6) ? 12 : 8;
+    case 2:
+        r = (uint8_t)(v & ~(1 << y));
+        break;
+    default:
+        r = (uint8_t)(v | (1 << y));
+        break;
+    }
+
+    if (pfx != PFX_HL) {
+        wr(cpu, addr, r);
+        if (z != 6) {
+            set_r(cpu, z, PFX_HL, r);   /* Undocumented copy to a register */
+        }
+        return 23;
+    }
+    if (z == 6) {
+        wr(cpu, addr, r);
+        return 15;
+    }
+    set_r(cpu, z, PFX_HL, r);
+    return 8;
+}
+
+/* LDI CPI INI OUTI and their D and R forms */
+static uint32_t exec_block(z80_t *cpu, int y, int z)
+{
+    int dir = (y & 1) ? -1 : 1;
+    bool repeat = (y >= 6);
+    uint8_t v, b;
+
+    switch (z) {
+    case 0:     /* LDI */
+        v = rd(cpu, cpu->hl);
+        wr(cpu, cpu->de, v);
+        cpu->hl += dir;
+        cpu->de += dir;
+        cpu->bc--;
+        v = (uint8_t)(v + A);
+        SET_F((F & (FLAG_S | FLAG_Z | FLAG_C)) | (cpu->bc ? FLAG_PV : 0) | (v & FLAG_X) | ((v << 4) & FLAG_Y));
+        repeat = repeat && (cpu->bc != 0);
+        break;
+    case 1:     /* CPI */
+        {
+            uint8_t r;
+
+            v = rd(cpu, cpu->hl);
+            r = (uint8_t)(A - v);
+            cpu->hl += dir;
+            cpu->bc--;
+            SET_F((F & FLAG_C) | FLAG_N | (sz53(r) & (FLAG_S | FLAG_Z)) | ((A ^ v ^ r) & FLAG_H) |
+                  (cpu->bc ? FLAG_PV : 0));
+            repeat = repeat && (cpu->bc != 0) && (r != 0);
+        }
+        break;
+    case 2:     /* INI */
+        v = cpu->in(cpu, cpu->bc);
+        wr(cpu, cpu->hl, v);
+        cpu->hl += dir;
+        b = (uint8_t)(B - 1);
+        cpu->bc = (uint16_t)((cpu->bc & 0x00FF) | (b << 8));
+        SET_F(FLAG_N | sz53(b));
+        repeat = repeat && (b != 0);
+        break;
+    default:    /* OUTI */
+        v = rd(cpu, cpu->hl);
+        b = (uint8_t)(B - 1);
+        cpu->bc = (uint16_t)((cpu->bc & 0x00FF) | (b << 8));
+        cpu->out(cpu, cpu->bc, v);
+        cpu->hl += dir;
+        SET_F(FLAG_N | sz53(b));
+        repeat = repeat && (b != 0);
+        break;
+    }
+
+    if (repeat) {
+        cpu->pc -= 2;
+        return 21;
+    }
+    return 16;
+}
+
+static uint32_t exec_ed(z80_t *cpu)
+{
+    uint8_t op = fetch(cpu);
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+    uint8_t v;
+    uint16_t addr;
+
+    refresh(cpu);
+
+    if (x == 2) {
+        if ((z <= 3) && (y >= 4)) {
+            return exec_block(cpu, y, z);
+        }
+        return 8;
+    }
+    if (x != 1) {
+        return 8;
+    }
+
+    switch (z) {
+    case 0:
+        v = cpu->in(cpu, cpu->bc);
+        if (y != 6) {
+            set_r(cpu, y, PFX_HL, v);
+        }
+        SET_F((F & FLAG_C) | sz53p(v));
+        return 12;
+    case 1:
+        cpu->out(cpu, cpu->bc, (y == 6) ? 0 : get_r(cpu, y, PFX_HL));
+        return 12;
+    case 2:
+        adc16(cpu, *rp(cpu, p, PFX_HL), q == 0);
+        return 15;
+    case 3:
+        addr = fetch16(cpu);
+        if (q == 0) {
+            wr16(cpu, addr, *rp(cpu, p, PFX_HL));
+        } else {
+            *rp(cpu, p, PFX_HL) = rd16(cpu, addr);
+        }
+        return 20;
+    case 4:
+        v = A;
+        SET_A(0);
+        alu(cpu, 2, v);
+        return 8;
+    case 5:
+        cpu->iff1 = cpu->iff2;
+        cpu->pc = pop(cpu);
+        return 14;
+    case 6:
+        cpu->im = (y & 3) ? (uint8_t)((y & 3) - 1) : 0;
+        return 8;
+    default:
+        switch (y) {
+        case 0: cpu->i = A; return 9;
+        case 1: cpu->r = A; return 9;
+        case 2:
+        case 3:
+            v = (y == 2) ? cpu->i : cpu->r;
+            SET_A(v);
+            SET_F((F & FLAG_C) | sz53(v) | (cpu->iff2 ? FLAG_PV : 0));
+            return 9;
+        case 4:     /* RRD */
+            v = rd(cpu, cpu->hl);
+            wr(cpu, cpu->hl, (uint8_t)((A << 4) | (v >> 4)));
+            SET_A((A & 0xF0) | (v & 0x0F));
+            SET_F((F & FLAG_C) | sz53p(A));
+            return 18;
+        case 5:     /* RLD */
+            v = rd(cpu, cpu->hl);
+            wr(cpu, cpu->hl, (uint8_t)((v << 4) | (A & 0x0F)));
+            SET_A((A & 0xF0) | (v >> 4));
+            SET_F((F & FLAG_C) | sz53p(A));
+            return 18;
+        default:
+            return 8;
+        }
+    }
+}
+
+static uint32_t exec_main(z80_t *cpu, uint8_t op, int pfx)
+{
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+    uint32_t t = (pfx != PFX_HL) ? 4 : 0;
+    uint16_t addr, v16;
+    uint8_t v;
+
+    switch (x) {
+    case 0:
+        switch (z) {
+        case 0:
+            switch (y) {
+            case 0:
+                return t + 4;
+            case 1:
+                v16 = cpu->af; cpu->af = cpu->af_; cpu->af_ = v16;
+                return t + 4;
+            case 2:
+                v = fetch(cpu);
+                cpu->bc -= 0x100;
+                if (B != 0) {
+                    cpu->pc += (int8_t)v;
+                    return t + 13;
+                }
+                return t + 8;
+            case 3:
+                v = fetch(cpu);
+                cpu->pc += (int8_t)v;
+                return t + 12;
+            default:
+                v = fetch(cpu);
+                if (cond(cpu, y - 4)) {
+                    cpu->pc += (int8_t)v;
+                    return t + 12;
+                }
+                return t + 7;
+            }
+        case 1:
+            if (q == 0) {
+                *rp(cpu, p, pfx) = fetch16(cpu);
+                return t + 10;
+            }
+            *idx_reg(cpu, pfx) = add16(cpu, *idx_reg(cpu, pfx), *rp(cpu, p, pfx));
+            return t + 11;
+        case 2:
+            switch (y) {
+            case 0: wr(cpu, cpu->bc, A); return t + 7;
+            case 1: wr(cpu, cpu->de, A); return t + 7;
+            case 2: wr16(cpu, fetch16(cpu), *idx_reg(cpu, pfx)); return t + 16;
+            case 3: wr(cpu, fetch16(cpu), A); return t + 13;
+            case 4: SET_A(rd(cpu, cpu->bc)); return t + 7;
+            case 5: SET_A(rd(cpu, cpu->de)); return t + 7;
+            case 6: *idx_reg(cpu, pfx) = rd16(cpu, fetch16(cpu)); return t + 16;
+            default: SET_A(rd(cpu, fetch16(cpu))); return t + 13;
+            }
+        case 3:
+            if (q == 0) {
+                (*rp(cpu, p, pfx))++;
+            } else {
+                (*rp(cpu, p, pfx))--;
+            }
+            return t + 6;
+        case 4:
+        case 5:
+            if (y == 6) {
+                addr = hl_addr(cpu, pfx);
+                v = rd(cpu, addr);
+                wr(cpu, addr, (z == 4) ? inc8(cpu, v) : dec8(cpu, v));
+                return t + 11 + ((pfx != PFX_HL) ? 8 : 0);
+            }
+            v = get_r(cpu, y, pfx);
+            set_r(cpu, y, pfx, (z == 4) ? inc8(cpu, v) : dec8(cpu, v));
+            return t + 4;
+        case 6:
+            if (y == 6) {
+                addr = hl_addr(cpu, pfx);
+                wr(cpu, addr, fetch(cpu));
+                return t + 10 + ((pfx != PFX_HL) ? 5 : 0);
+            }
+            set_r(cpu, y, pfx, fetch(cpu));
+            return t + 7;
+        default:
+            v = A;
+            switch (y) {
+            case 0:
+                v = (uint8_t)((v << 1) | (v >> 7));
+                SET_A(v);
+                SET_F((F & (FLAG_S | FLAG_Z | FLAG_PV)) | (v & (FLAG_C | FLAG_X | FLAG_Y)));
+                break;
+            case 1:
+                SET_F((F & (FLAG_S | FLAG_Z | FLAG_PV)) | (v & FLAG_C));
+                v = (uint8_t)((v >> 1) | (v << 7));
+                SET_A(v);
+                SET_F(F | (v & (FLAG_X | FLAG_Y)));
+                break;
+            case 2:
+                SET_A((v << 1) | (F & FLAG_C));
+                SET_F((F & (FLAG_S | FLAG_Z | FLAG_PV)) | (v >> 7) | (A & (FLAG_X | FLAG_Y)));
+                break;
+            case 3:
+                SET_A((v >> 1) | ((F & FLAG_C) << 7));
+                SET_F((F & (FLAG_S | FLAG_Z | FLAG_PV)) | (v & FLAG_C) | (A & (FLAG_X | FLAG_Y)));
+                break;
+            case 4:
+                daa(cpu);
+                break;
+            case 5:
+                SET_A(~v);
+                SET_F((F & (FLAG_S | FLAG_Z | FLAG_PV | FLAG_C)) | FLAG_H | FLAG_N | (A & (FLAG_X | FLAG_Y)));
+                break;
+            case 6:
+                SET_F((F & (FLAG_S | FLAG_Z | FLAG_PV)) | FLAG_C | (v & (FLAG_X | FLAG_Y)));
+                break;
+            default:
+                SET_F((F & (FLAG_S | FLAG_Z | FLAG_PV)) | ((F & FLAG_C) ? FLAG_H : FLAG_C) | (v & (FLAG_X | FLAG_Y)));
+                break;
+            }
+            return t + 4;
+        }
+    case 1:
+        if ((y == 6) && (z == 6)) {
+            cpu->halted = true;
+            cpu->pc--;
+            return t + 4;
+        }
+        if (y == 6) {
+            /* LD (IX+d),r stores the real H or L. */
+            wr(cpu, hl_addr(cpu, pfx), get_r(cpu, z, PFX_HL));
+            return t + 7 + ((pfx != PFX_HL) ? 8 : 0);
+        }
+        if (z == 6) {
+            set_r(cpu, y, PFX_HL, rd(cpu, hl_addr(cpu, pfx)));
+            return t + 7 + ((pfx != PFX_HL) ? 8 : 0);
+        }
+        set_r(cpu, y, pfx, get_r(cpu, z, pfx));
+        return t + 4;
+    case 2:
+        if (z == 6) {
+            alu(cpu, y, rd(cpu, hl_addr(cpu, pfx)));
+            return t + 7 + ((pfx != PFX_HL) ? 8 : 0);
+        }
+        alu(cpu, y, get_r(cpu, z, pfx));
+        return t + 4;
+    default:
+        switch (z) {
+        case 0:
+            if (cond(cpu, y)) {
+                cpu->pc = pop(cpu);
+                return t + 11;
+            }
+            return t + 5;
+        case 1:
+            if (q == 0) {
+                *rp2(cpu, p, pfx) = pop(cpu);
+                return t + 10;
+            }
+            switch (p) {
+            case 0:
+                cpu->pc = pop(cpu);
+                return t + 10;
+            case 1:
+                v16 = cpu->bc; cpu->bc = cpu->bc_; cpu->bc_ = v16;
+                v16 = cpu->de; cpu->de = cpu->de_; cpu->de_ = v16;
+                v16 = cpu->hl; cpu->hl = cpu->hl_; cpu->hl_ = v16;
+                return t + 4;
+            case 2:
+                cpu->pc = *idx_reg(cpu, pfx);
+                return t + 4;
+            default:
+                cpu->sp = *idx_reg(cpu, pfx);
+                return t + 6;
+            }
+        case 2:
+            v16 = fetch16(cpu);
+            if (cond(cpu, y)) {
+                cpu->pc = v16;
+            }
+            return t + 10;
+        case 3:
+            switch (y) {
+            case 0:
+                cpu->pc = fetch16(cpu);
+                return t + 10;
+            case 1:
+                return t + exec_cb(cpu, pfx);
+            case 2:
+                v = fetch(cpu);
+                cpu->out(cpu, (uint16_t)((A << 8) | v), A);
+                return t + 11;
+            case 3:
+                v = fetch(cpu);
+                SET_A(cpu->in(cpu, (uint16_t)((A << 8) | v)));
+                return t + 11;
+            case 4:
+                v16 = rd16(cpu, cpu->sp);
+                wr16(cpu, cpu->sp, *idx_reg(cpu, pfx));
+                *idx_reg(cpu, pfx) = v16;
+                return t + 19;
+            case 5:
+                v16 = cpu->de; cpu->de = cpu->hl; cpu->hl = v16;
+                return t + 4;
+            case 6:
+                cpu->iff1 = cpu->iff2 = false;
+                return t + 4;
+            default:
+                cpu->iff1 = cpu->iff2 = true;
+                return t + 4;
+            }
+        case 4:
+            v16 = fetch16(cpu);
+            if (cond(cpu, y)) {
+                push(cpu, cpu->pc);
+                cpu->pc = v16;
+                return t + 17;
+            }
+            return t + 10;
+        case 5:
+            if (q == 0) {
+                push(cpu, *rp2(cpu, p, pfx));
+                return t + 11;
+            }
+            switch (p) {
+            case 0:
+                v16 = fetch16(cpu);
+                push(cpu, cpu->pc);
+                cpu->pc = v16;
+                return t + 17;
+            case 2:
+                return t + exec_ed(cpu);
+            default:
+                /* A prefix after a prefix: the first one acts as a NOP. */
+                cpu->pc--;
+                return t + 4;
+            }
+        case 6:
+            alu(cpu, y, fetch(cpu));
+            return t + 7;
+        default:
+            push(cpu, cpu->pc);
+            cpu->pc = (uint16_t)(y << 3);
+            return t + 11;
+        }
+    }
+}
+
+void z80_reset(z80_t *cpu)
+{
+    cpu->af = cpu->bc = cpu->de = cpu->hl = 0xFFFF;
+    cpu->af_ = cpu->bc_ = cpu->de_ = cpu->hl_ = 0xFFFF;
+    cpu->ix = cpu->iy = cpu->sp = 0xFFFF;
+    cpu->pc = 0;
+    cpu->i = cpu->r = 0;
+    cpu->iff1 = cpu->iff2 = false;
+    cpu->im = 0;
+    cpu->halted = false;
+    cpu->wait = 0;
+}
+
+uint32_t z80_step(z80_t *cpu)
+{
+    uint8_t op;
+    uint32_t t;
+
+    if (cpu->halted) {
+        /* HALT executes NOPs until an interrupt. */
+        cpu->cycles += 4;
+        return 4;
+    }
+
+    cpu->wait = 0;
+    op = fetch(cpu);
+    refresh(cpu);
+    if ((op == 0xDD) || (op == 0xFD)) {
+        int pfx = (op == 0xDD) ? PFX_IX : PFX_IY;
+
+        op = fetch(cpu);
+        refresh(cpu);
+        t = exec_main(cpu, op, pfx);
+    } else {
+        t = exec_main(cpu, op, PFX_HL);
+    }
+
+    t += cpu->wait;
+    cpu->cycles += t;
+    return t;
+}
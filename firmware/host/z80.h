@@ -0,0 +1,44 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (c) 2021 Howard M. Harte                                    *
+ * https://github.com/hharte                                             *
+ *                                                                       *
+ * Module Description:                                                   *
+ *     Z80 CPU emulator for host builds.  Executes the documented        *
+ * instruction set, including the CB, DD, ED and FD prefixes, one        *
+ * instruction per call, and counts T-states.  I/O goes through two      *
+ * callbacks, which may add wait states to the instruction in progress   *
+ * to model a peripheral holding WAIT#.  Interrupts are not emulated.    *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef Z80_H
+#define Z80_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct z80 z80_t;
+
+struct z80 {
+    uint16_t af, bc, de, hl;
+    uint16_t af_, bc_, de_, hl_;    /* Alternate set */
+    uint16_t ix, iy, sp, pc;
+    uint8_t  i, r;
+    bool     iff1, iff2;
+    uint8_t  im;
+    bool     halted;
+
+    uint64_t cycles;                /* T-states executed, including wait states */
+    uint32_t wait;                  /* Wait states added by the I/O callbacks for
+                                       the current instruction */
+    uint8_t  *mem;                  /* 64KB */
+    void     *ctx;                  /* For the callbacks */
+    uint8_t  (*in)(z80_t *cpu, uint16_t port);
+    void     (*out)(z80_t *cpu, uint16_t port, uint8_t value);
+};
+
+void z80_reset(z80_t *cpu);
+uint32_t z80_step(z80_t *cpu);     /* One instruction; returns its T-states */
+
+#endif /* Z80_H */
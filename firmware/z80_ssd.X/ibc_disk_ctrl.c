@@ -23,7 +23,8 @@
  * Performance:                                                          *
  * With debug printing disabled, the OASIS 5.6 VERIFY command can        *
  * verify the 16MB S partition in less than four minutes.  With          *
- * debug printing enabled, this slows to 6 minutes.                      *
+ * debug printing enabled, this slowed to 6 minutes; debug events now    *
+ * go to a binary trace ring instead (see IBC_HDC_TRACE.)                *
 *                                                                       *
  * MPLAB-X IDE v5.50                                                     *
  * MPLAB Code Configurator v5.2.4                                        *
@@ -33,10 +34,12 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "mcc_generated_files/mcc.h"
+#include "mcc_generated_files/fatfs/diskio.h"
 
-/* Debug flags */
+/* Debug flags, also the trace categories */
 #define DEBUG_INFO      (1 << 0)
 #define DEBUG_READ      (1 << 1)
 #define DEBUG_WRITE     (1 << 2)
@@ -47,12 +50,36 @@
 #define DEBUG_ERROR     (1 << 7)
 
 #define DEBUG
-uint8_t debug = (DEBUG_ERROR);// | DEBUG_INFO | DEBUG_REGWR | DEBUG_READ | DEBUG_WRITE | DEBUG_FORMAT);
-#ifdef DEBUG
-#define debug_print(dbglevel, x) do { if (debug & dbglevel) printf x; } while (0)
-#else
-#define debug_print(dbglevel, x) {}
+
+/* Trace categories compiled in.  A traced event costs a few instructions to
+ * store a record in the trace ring, which is only decoded when the console
+ * asks for it; the other categories compile to nothing.  DEBUG_REGWR,
+ * DEBUG_REGRD and DEBUG_FIFO trace from CLC2_ISR, and fill the ring quickly.
+ * With no categories the ring itself is left out.
+ */
+//#define IBC_HDC_TRACE     (DEBUG_INFO | DEBUG_READ | DEBUG_WRITE | DEBUG_FORMAT | DEBUG_ERROR)
+#ifndef IBC_HDC_TRACE
+#define IBC_HDC_TRACE       0
 #endif
+#define IBC_HDC_TRACE_LEN   32      /* Records in the trace ring, power of 2:
+                                       12 bytes each, 384 bytes of RAM */
+
+#define ibc_trace(cat, event, a, b) do { if ((IBC_HDC_TRACE) & (cat)) IBC_HDC_Trace((event), (a), (b)); } while (0)
+
+/* Trace events */
+#define TRC_NONE            0
+#define TRC_HARD_RESET      1
+#define TRC_RESET           2       /* a = command */
+#define TRC_READ            3       /* a = sectors from the cache */
+#define TRC_WRITE           4       /* a = SD commands issued */
+#define TRC_FORMAT          5       /* a = fill byte */
+#define TRC_ACCESS_FIFO     6
+#define TRC_READ_PARAMS     7
+#define TRC_REGWR           8       /* a = port, b = data */
+#define TRC_REGRD           9       /* a = port, b = data */
+#define TRC_FIFO_RD         10      /* a = FIFO index, b = data */
+#define TRC_BAD_WR          11      /* a = port, b = data */
+#define TRC_BAD_RD          12      /* a = port, b = data */
 
 #define IBC_HDC_MAX_DRIVES          4       /* Maximum number of drives supported */
 #define IBC_HDC_MAX_SECLEN          256     /* Maximum of 256 bytes per sector */
@@ -63,117 +90,1931 @@ uint8_t debug = (DEBUG_ERROR);// | DEBUG_INFO | DEBUG_REGWR | DEBUG_READ | DEBUG
 #define IBC_HDC_MAX_CYLS            1024
 #define IBC_HDC_MAX_HEADS           16
 #define IBC_HDC_MAX_SPT             256
+#define IBC_HDC_RING_SLOTS          10      /* sectbuf size, in sectors */
+#define IBC_HDC_CLMT_LEN            16      /* DWORDs per drive for the FatFs fast
+                                               seek cluster link map: 64 bytes,
+                                               enough for 7 fragments.  All four
+                                               drives cost 256 bytes of the 8K
+                                               RAM. */
+
+#define IBC_HDC_RAW_LBA                     /* Access contiguous disk images
+                                               directly by SD LBA, bypassing
+                                               FatFs. */
+#define IBC_HDC_SYNC_WRITES         32      /* f_sync a drive image after this
+                                               many FatFs writes... */
+#define IBC_HDC_SYNC_IDLE_MS        100UL   /* ...or after this long with no
+                                               command or background work. */
+#define IBC_HDC_CACHE                       /* Write-back cache of IBC sectors */
+#define IBC_HDC_CACHE_LINES         4       /* 512-byte lines, two IBC sectors each */
+#define IBC_HDC_CACHE_MAX_WRITE     2       /* Larger writes go straight to the card */
+#define IBC_HDC_CACHE_IDLE_POLLS    (uint16_t)1000  /* Idle polls before write-back starts */
+#define IBC_HDC_CACHE_MAX_AGE       64      /* Commands a line may stay dirty */
+#define IBC_HDC_READ_AHEAD                  /* Prefetch sequential reads into the cache */
+#define IBC_HDC_RA_MAX_BLOCKS       IBC_HDC_CACHE_LINES /* Read-ahead window limit, 512-byte blocks */
+#define IBC_HDC_READ_OVERLAP                /* Let the Z80 drain the FIFO while
+                                               later sectors are still being
+                                               read from the card */
+#define IBC_HDC_READ_LEAD           3       /* Sectors in the FIFO before a
+                                               streaming READ_SECT goes ready:
+                                               4ms of INIR for the card to keep
+                                               ahead of the Z80 in */
+#define IBC_HDC_WRITE_OVERLAP               /* Let the Z80 fill the FIFO for its
+                                               next command while a WRITE_SECT
+                                               is still being written */
+#define IBC_HDC_EARLY_SEEK                  /* Resolve the cylinder as soon as the
+                                               first half of the task file arrives */
+//#define IBC_HDC_FAST_READ                 /* Complete cached one-sector READ_SECTs in CLC2_ISR */
+//#define IBC_HDC_PERF                      /* Latency statistics per command type, about 520 bytes of RAM */
+#define IBC_HDC_PERF_BUCKETS        16      /* Latency histogram buckets, 2^n us */
+//#define IBC_HDC_STATS                     /* Z80-readable counters at ports 49h/4Ah */
+//#define IBC_HDC_RECORD                    /* Log commands to IBCTRACE.BIN, 512 bytes of RAM */
+#define IBC_HDC_BENCH                       /* SD card self-benchmark, run at boot */
+#define IBC_HDC_BENCH_BLOCKS        1024    /* Scratch file size, 512-byte blocks */
+#define IBC_HDC_BENCH_SAMPLES       64      /* Random accesses timed per test */
+#define IBC_HDC_SD_PDRV             0       /* FatFs physical drive of the SD card */
+#define IBC_HDC_EXTENT_MAGIC        0x32545845UL    /* "EXT2" */
+#define IBC_HDC_DIR_MODTIME         22      /* DIR_ModTime, offset in a FAT directory entry */
+
+#define DEV_NAME    "IBCHDC"
+
+/* Task File Register Offsets */
+#define TF_CSEC     0
+#define TF_HEAD     1
+#define TF_NSEC     2
+#define TF_SA3      3
+#define TF_CMD      4
+#define TF_DRIVE    5
+#define TF_TRKL     6
+#define TF_TRKH     7
+#define TF_FIFO     8
+
+#define IBC_HDC_STATUS_BUSY         (1 << 7)
+#define IBC_HDC_STATUS_READY        (1 << 6)
+#define IBC_HDC_STATUS_WRITE_FAULT  (1 << 5)
+#define IBC_HDC_STATUS_SEEK_COMPL   (1 << 4)
+#define IBC_HDC_STATUS_DRQ          (1 << 3)
+#define IBC_HDC_STATUS_ERROR        (1 << 0)
+
+#define IBC_HDC_ERROR_ID_NOT_FOUND  (1 << 4)
+
+#define IBC_HDC_CMD_RESET           0x00
+#define IBC_HDC_CMD_READ_SECT       0x01
+#define IBC_HDC_CMD_WRITE_SECT      0x02
+#define IBC_HDC_CMD_FORMAT_TRK      0x08
+#define IBC_HDC_CMD_ACCESS_FIFO     0x0b
+#define IBC_HDC_CMD_READ_PARAMETERS 0x10
+
+#define IBC_HDC_REG_STATUS          0x40
+#define IBC_HDC_REG_FIFO_STATUS     0x44
+#define IBC_HDC_REG_FIFO            0x48
+#define IBC_HDC_REG_STATS_INDEX     0x49    /* W: select counter, R: number of counters */
+#define IBC_HDC_REG_STATS_DATA      0x4a    /* R: counter bytes, LSB first */
+#define IBC_HDC_TEST_LOOPBACK       0x4c
+#define IBC_HDC_TEST_INCR           0x4d
+
+#define SCPE_OK						(0)
+#define SCPE_IOERR					(-1)
+
+typedef struct {
+    uint8_t  readonly;    /* Drive is read-only? */
+    uint16_t sectsize;    /* sector size */
+    uint16_t nsectors;    /* number of sectors/track */
+    uint16_t nheads;      /* number of heads */
+    uint16_t ncyls;       /* number of cylinders */
+    uint16_t cur_cyl;     /* Current cylinder */
+    uint8_t  cur_head;    /* Current Head */
+    uint8_t  cur_sect;    /* current starting sector of transfer */
+    uint16_t cur_sectsize;/* Current sector size in SA6 register */
+    uint16_t xfr_nsects;  /* Number of sectors to transfer */
+    uint8_t ready;        /* Is drive ready? */
+} IBC_HDC_DRIVE_INFO;
+
+typedef struct {
+    uint8_t   sel_drive;  /* Currently selected drive */
+    uint8_t   reg_temp_holding[4];
+    uint8_t   taskfile[9]; /* ATA Task File Registers */
+    volatile uint8_t   status_reg; /* IBC Disk Slave Status Register */
+    uint8_t   ndrives;    /* Number of drives attached to the controller */
+    IBC_HDC_DRIVE_INFO drive[IBC_HDC_MAX_DRIVES];
+} IBC_HDC_INFO;
+
+const char *disk_filenames[4] = {
+    "IBCDISK0.dsk",
+    "IBCDISK1.dsk",
+    "IBCDISK2.dsk",
+    "IBCDISK3.dsk",
+};
+
+#ifdef IBC_HDC_RAW_LBA
+/* Sidecar files holding the extent of each disk image, so the FAT chain
+ * doesn't need to be walked on every boot.
+ */
+const char *extent_filenames[4] = {
+    "IBCDISK0.ext",
+    "IBCDISK1.ext",
+    "IBCDISK2.ext",
+    "IBCDISK3.ext",
+};
+
+typedef struct {
+    uint32_t  magic;      /* IBC_HDC_EXTENT_MAGIC */
+    uint32_t  dir_sect;   /* Sector holding the image's directory entry */
+    uint16_t  dir_ofs;    /* Offset of the directory entry in that sector */
+    uint32_t  sclust;     /* First cluster of the image */
+    uint32_t  size;       /* Image size in bytes */
+    uint32_t  volume;     /* Serial number of the FAT volume */
+    uint32_t  mtime;      /* Last-modified date and time of the image */
+    uint32_t  start_lba;  /* SD sector holding the image's first byte, 0 if not mapped */
+} IBC_HDC_EXTENT;
+
+static IBC_HDC_EXTENT extent[IBC_HDC_MAX_DRIVES];
+#endif /* IBC_HDC_RAW_LBA */
+
+static IBC_HDC_INFO ibc_hdc_info_data = { 0x0 };
+static IBC_HDC_INFO *ibc_hdc_info = &ibc_hdc_info_data;
+
+uint8_t   sectbuf[IBC_HDC_MAX_SECLEN*IBC_HDC_RING_SLOTS];
+#ifdef DEBUG
+static uint8_t test_reg = 0;
+#endif /* DEBUG */
+volatile uint16_t  secbuf_index;
+volatile uint8_t   secbuf_ready = IBC_HDC_RING_SLOTS;
+                                        /* Slots of sectbuf the Z80 may access
+                                           while a transfer streams; CLC2_ISR
+                                           stalls FIFO accesses to later slots. */
+volatile uint8_t   secbuf_next_ready;   /* secbuf_ready for the Z80's next lap of
+                                           the ring, once it runs off the end */
+volatile uint8_t   secbuf_lap;          /* Lap of the ring the Z80 is on */
+volatile bool      secbuf_written;      /* The Z80 has written the FIFO since the
+                                           last command or FIFO reset, besides
+                                           a WRITE_SECT's data after it */
+static bool secbuf_overrun;             /* The Z80 ran off the end of the FIFO, or a stall timed out */
+static volatile bool late_error;        /* A transfer failed after its command
+                                           completed; see IBC_HDC_LateError() */
+static uint16_t xfr_len;
+static uint32_t file_offset;
+
+uint8_t IBC_HDC_Read(const uint8_t Addr);
+uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData);
+uint8_t IBC_HDC_doCommand(void);
+
+#define IBC_HDC_NAME    "IBC MCC ST-506 Hard Disk Controller"
+
+volatile extern bool do_command_flag;
+extern void z80_ssd_fifo_resume(void);
+extern bool z80_ssd_fifo_stalled(void);
+extern bool z80_ssd_fifo_timed_out(void);
+extern void z80_ssd_fifo_timeout_clear(void);
+extern void z80_ssd_WaitDump(void);
+extern void z80_ssd_WaitReset(void);
+extern void z80_ssd_BusTraceDump(void);
+
+static FATFS drive;
+static FIL file[IBC_HDC_MAX_DRIVES];
+static DWORD clmt[IBC_HDC_MAX_DRIVES][IBC_HDC_CLMT_LEN];  /* Fast seek link maps, [0] == 0 if unused */
+static DWORD vol_serial;            /* Serial number of the mounted volume */
+static uint16_t actualLength;
+static uint8_t unsynced_writes[IBC_HDC_MAX_DRIVES]; /* FatFs writes since the last f_sync */
+static uint16_t idle_polls;         /* Main loop polls since the last command */
+static bool sync_pending;           /* Idle f_sync not yet done since the last command */
+static uint32_t idle_start;         /* TMR1 at the end of the last command or idle work */
+static uint32_t write_count;        /* WRITE_SECT commands */
+static uint32_t write_sd_cmds;      /* SD commands issued by those WRITE_SECTs */
+static uint32_t sync_count;
+static uint32_t cmd_start;          /* TMR1 at doCommand() entry */
+static uint32_t cmd_ticks;          /* TMR1 ticks the last command took */
+
+#ifdef IBC_HDC_CACHE
+/* Each line caches one 512-byte block of a drive image, ie. two IBC
+ * sectors.  Lines are always filled completely, so the two sectors of an SD
+ * block are written back together.
+ */
+typedef struct {
+    bool      valid;
+    bool      dirty;
+    bool      prefetched; /* Loaded by read-ahead and not used yet */
+    uint8_t   drive;
+    uint16_t  used;       /* cache_clock at last access, for LRU */
+    uint16_t  dirtied;    /* cache_clock when the line became dirty */
+    uint32_t  block;      /* Image offset / 512 */
+    uint8_t   data[512];
+} IBC_HDC_CACHE_LINE;
+
+static IBC_HDC_CACHE_LINE cache[IBC_HDC_CACHE_LINES];
+#endif /* IBC_HDC_CACHE */
+static uint16_t cache_clock;        /* Incremented on each READ/WRITE command */
+static uint32_t cache_hits;         /* Sectors read from the cache */
+static uint32_t cache_writes;       /* Sectors written to the cache */
+static uint32_t cache_flushes;      /* Lines written back */
+
+#ifdef IBC_HDC_READ_AHEAD
+static uint8_t  ra_drive;           /* Drive of the last READ_SECT */
+static uint32_t ra_next;            /* Image offset following the last READ_SECT */
+static uint8_t  ra_window;          /* Blocks to keep prefetched past ra_next */
+#endif /* IBC_HDC_READ_AHEAD */
+static uint32_t ra_hits;            /* Sequential READ_SECTs served by read-ahead */
+static uint32_t ra_misses;          /* Sequential READ_SECTs that went to the card */
+static uint32_t ra_wasted;          /* Prefetched lines evicted unused */
+
+#ifdef IBC_HDC_EARLY_SEEK
+static volatile bool es_pending;    /* First half of a task file arrived, set by the ISR */
+static bool     es_valid;           /* es_base is the start of es_drive, es_cyl */
+static uint8_t  es_drive;
+static uint16_t es_cyl;
+static uint32_t es_base;            /* Image offset of the cylinder */
+#endif /* IBC_HDC_EARLY_SEEK */
+static uint32_t es_seeks;           /* FatFs cursors moved ahead of a command */
+static uint32_t fast_reads;         /* READ_SECTs completed by CLC2_ISR */
+
+#if IBC_HDC_TRACE
+typedef struct {
+    uint16_t  stamp;      /* TMR1, 0.5us ticks */
+    uint8_t   event;      /* TRC_xxx */
+    uint8_t   drive;
+    uint16_t  cyl;
+    uint8_t   head;
+    uint8_t   sect;
+    uint8_t   nsec;
+    uint8_t   a;          /* Event specific */
+    uint8_t   b;
+} IBC_HDC_TRACE_REC;
+
+static IBC_HDC_TRACE_REC trace[IBC_HDC_TRACE_LEN];
+static uint8_t trace_head;          /* Next record to write, free running */
+
+const char *trace_names[] = {
+    "", "HARD RESET", "RESET", "READ", "WRITE", "FORMAT", "ACCESS FIFO",
+    "READ PARAMS", "WR", "RD", "RD FIFO", "UNHANDLED WR", "UNHANDLED RD"
+};
+
+/* Store a trace record for the current drive and task file. */
+static void IBC_HDC_Trace(uint8_t event, uint8_t a, uint8_t b)
+{
+    IBC_HDC_DRIVE_INFO *pDrive = &ibc_hdc_info->drive[ibc_hdc_info->sel_drive];
+    IBC_HDC_TRACE_REC *pRec;
+    uint8_t gieh = INTCON0bits.GIEH;
+
+    /* Claim the record with CLC2_ISR held off, as it may trace too. */
+    INTERRUPT_GlobalInterruptHighDisable();
+    pRec = &trace[trace_head++ & (IBC_HDC_TRACE_LEN - 1)];
+    INTCON0bits.GIEH = gieh;
+
+    pRec->stamp = TMR1_ReadTimer();
+    pRec->event = event;
+    pRec->drive = ibc_hdc_info->sel_drive;
+    pRec->cyl = pDrive->cur_cyl;
+    pRec->head = pDrive->cur_head;
+    pRec->sect = pDrive->cur_sect;
+    pRec->nsec = pDrive->xfr_nsects;
+    pRec->a = a;
+    pRec->b = b;
+}
+
+/* Decode the trace ring to the console, oldest record first.  Each line
+ * waits for the UART to drain, so none of the dump is dropped.
+ */
+static void IBC_HDC_TraceDump(void)
+{
+    IBC_HDC_TRACE_REC *pRec;
+    uint8_t head = trace_head;
+    uint16_t prev = 0;
+    bool first = true;
+
+    printf("  delta(us) event\n\r");
+    for (uint8_t i = 0; i < IBC_HDC_TRACE_LEN; i++) {
+        pRec = &trace[(uint8_t)(head + i) & (IBC_HDC_TRACE_LEN - 1)];
+        if (pRec->event == TRC_NONE) {
+            continue;
+        }
+        while (!UART1_is_tx_done());
+        printf("%11u %s", first ? 0 : (uint16_t)(pRec->stamp - prev) / TMR1_TICKS_PER_US, trace_names[pRec->event]);
+        if (pRec->event >= TRC_REGWR) {
+            printf(" %02x=%02x\n\r", pRec->a, pRec->b);
+        } else {
+            printf(" D%u C:%04u/H:%u/S:%02u/#:%2u %02x\n\r",
+                pRec->drive, pRec->cyl, pRec->head, pRec->sect, pRec->nsec, pRec->a);
+        }
+        prev = pRec->stamp;
+        first = false;
+    }
+}
+#else
+static void IBC_HDC_Trace(uint8_t event, uint8_t a, uint8_t b) {}
+static void IBC_HDC_TraceDump(void) {}
+#endif /* IBC_HDC_TRACE */
+
+/* Command types and phases of the latency statistics */
+#define PERF_READ           0
+#define PERF_WRITE          1
+#define PERF_FORMAT         2
+#define PERF_RESET          3
+#define PERF_PARAMS         4
+#define PERF_TYPES          5
+
+#if defined(IBC_HDC_PERF) || defined(IBC_HDC_STATS)
+/* Map a command to its PERF_xxx type, or PERF_TYPES if it isn't counted. */
+static uint8_t IBC_HDC_CmdType(uint8_t cmd)
+{
+    switch (cmd) {
+    case IBC_HDC_CMD_READ_SECT:         return PERF_READ;
+    case IBC_HDC_CMD_WRITE_SECT:        return PERF_WRITE;
+    case IBC_HDC_CMD_FORMAT_TRK:        return PERF_FORMAT;
+    case IBC_HDC_CMD_RESET:             return PERF_RESET;
+    case IBC_HDC_CMD_READ_PARAMETERS:   return PERF_PARAMS;
+    default:                            return PERF_TYPES;
+    }
+}
+#endif
+
+#define PH_TOTAL            0       /* Whole command, including finishing the last one */
+#define PH_SEEK             1       /* f_lseek() */
+#define PH_DATA             2       /* f_read()/f_write(), and raw transfers */
+#define PH_OPEN             3       /* f_mount()/f_open()/f_close()/f_sync() */
+#define PH_SD               4       /* disk_read()/disk_write(), ie. SD_SPI_Sector*() */
+#define PH_COUNT            5
+
+#ifdef IBC_HDC_PERF
+typedef struct {
+    uint32_t  min;        /* TMR1 ticks */
+    uint32_t  max;
+    uint32_t  sum;
+} IBC_HDC_PERF_STAT;
+
+typedef struct {
+    uint32_t  count;
+    uint16_t  hist[IBC_HDC_PERF_BUCKETS];   /* Total latency, [n] counts 2^n..2^(n+1)-1 us */
+    IBC_HDC_PERF_STAT phase[PH_COUNT];
+} IBC_HDC_PERF_CMD;
+
+static IBC_HDC_PERF_CMD perf[PERF_TYPES];
+static uint32_t perf_phase[PH_COUNT];   /* Ticks spent by the current command */
+static bool perf_active;                /* Phases are only charged to commands,
+                                           not to idle loop work. */
+
+const char *perf_types[PERF_TYPES] = { "READ_SECT", "WRITE_SECT", "FORMAT_TRK", "RESET", "READ_PARAMS" };
+const char *perf_phases[PH_COUNT] = { "total", "seek", "data", "open", "sd" };
+
+static uint32_t IBC_HDC_PerfStart(void)
+{
+    return TMR1_ReadTimer32();
+}
+
+static void IBC_HDC_PerfEnd(uint8_t phase, uint32_t start)
+{
+    if (perf_active) {
+        perf_phase[phase] += TMR1_ReadTimer32() - start;
+    }
+}
+
+/* Start timing a command. */
+static void IBC_HDC_PerfBegin(void)
+{
+    memset(perf_phase, 0, sizeof(perf_phase));
+    perf_phase[PH_SD] = disk_busy_ticks;
+    perf_active = true;
+}
+
+/* Charge the command just completed to its type. */
+static void IBC_HDC_PerfCommand(uint8_t cmd)
+{
+    IBC_HDC_PERF_CMD *pCmd;
+    IBC_HDC_PERF_STAT *pStat;
+    uint32_t us;
+    uint8_t bucket = 0;
+    uint8_t type = IBC_HDC_CmdType(cmd);
+
+    perf_active = false;
+    perf_phase[PH_TOTAL] = cmd_ticks;
+    perf_phase[PH_SD] = disk_busy_ticks - perf_phase[PH_SD];
+
+    if (type == PERF_TYPES) {
+        return;
+    }
+    pCmd = &perf[type];
+
+    for (uint8_t i = 0; i < PH_COUNT; i++) {
+        pStat = &pCmd->phase[i];
+        if ((pCmd->count == 0) || (perf_phase[i] < pStat->min)) pStat->min = perf_phase[i];
+        if (perf_phase[i] > pStat->max) pStat->max = perf_phase[i];
+        pStat->sum += perf_phase[i];
+    }
+    pCmd->count++;
+
+    for (us = perf_phase[PH_TOTAL] / TMR1_TICKS_PER_US; (us > 1) && (bucket < (IBC_HDC_PERF_BUCKETS - 1)); us >>= 1) {
+        bucket++;
+    }
+    if (pCmd->hist[bucket] != 0xFFFF) {
+        pCmd->hist[bucket]++;
+    }
+}
+
+/* Print the latency statistics, in microseconds.  Each line waits for the
+ * UART to drain, so none of it is dropped.
+ */
+static void IBC_HDC_PerfDump(void)
+{
+    IBC_HDC_PERF_CMD *pCmd;
+    IBC_HDC_PERF_STAT *pStat;
+
+    for (uint8_t t = 0; t < PERF_TYPES; t++) {
+        pCmd = &perf[t];
+        if (pCmd->count == 0) {
+            continue;
+        }
+        while (!UART1_is_tx_done());
+        printf("%s: %lu commands\n\r", perf_types[t], (unsigned long)pCmd->count);
+        for (uint8_t i = 0; i < PH_COUNT; i++) {
+            pStat = &pCmd->phase[i];
+            while (!UART1_is_tx_done());
+            printf("  %-5s min %lu avg %lu max %lu\n\r", perf_phases[i],
+                (unsigned long)(pStat->min / TMR1_TICKS_PER_US),
+                (unsigned long)(pStat->sum / pCmd->count / TMR1_TICKS_PER_US),
+                (unsigned long)(pStat->max / TMR1_TICKS_PER_US));
+        }
+        for (uint8_t i = 0; i < IBC_HDC_PERF_BUCKETS; i++) {
+            if (pCmd->hist[i] != 0) {
+                while (!UART1_is_tx_done());
+                printf("  >=%5luus %u\n\r", 1UL << i, pCmd->hist[i]);
+            }
+        }
+    }
+}
+
+static void IBC_HDC_PerfReset(void)
+{
+    memset(perf, 0, sizeof(perf));
+    printf("Latency statistics cleared.\n\r");
+}
+#else
+static uint32_t IBC_HDC_PerfStart(void) { return 0; }
+static void IBC_HDC_PerfEnd(uint8_t phase, uint32_t start) {}
+static void IBC_HDC_PerfBegin(void) {}
+static void IBC_HDC_PerfCommand(uint8_t cmd) {}
+static void IBC_HDC_PerfDump(void) {}
+static void IBC_HDC_PerfReset(void) {}
+#endif /* IBC_HDC_PERF */
+
+/* Statistics window: the Z80 writes a counter number to port 49h, then
+ * reads the 32-bit counter from port 4Ah, LSB first.  The counter is latched
+ * when its first byte is read, and after the fourth byte the index moves on
+ * to the next counter, so INIR can fetch the whole table at once.  Reading
+ * port 49h returns the number of counters.  Counters are updated by the
+ * main loop, so read them while the controller is not busy.
+ */
+#define STAT_CMD_READ       0       /* Commands per type, PERF_xxx order */
+#define STAT_CMD_WRITE      1
+#define STAT_CMD_FORMAT     2
+#define STAT_CMD_RESET      3
+#define STAT_CMD_PARAMS     4
+#define STAT_SECTS_READ     5       /* Sectors transferred without error */
+#define STAT_SECTS_WRITTEN  6
+#define STAT_CACHE_HITS     7       /* Sectors read from the cache */
+#define STAT_SD_CMDS        8       /* Commands sent to the SD card */
+#define STAT_SD_BUSY        9       /* us spent in disk_read()/disk_write() */
+#define STAT_MAX_LATENCY    10      /* us, longest command */
+#define STAT_COUNT          11
+
+#ifdef IBC_HDC_STATS
+static uint32_t stat_cmds[PERF_TYPES];
+static uint32_t stat_sects_read;
+static uint32_t stat_sects_written;
+static uint32_t stat_max_ticks;
+static uint8_t  stat_index;
+static uint8_t  stat_byte;
+static uint32_t stat_latch;
+
+static void IBC_HDC_StatCommand(uint8_t cmd)
+{
+    uint8_t type = IBC_HDC_CmdType(cmd);
+
+    if (type != PERF_TYPES) {
+        stat_cmds[type]++;
+    }
+    if (cmd_ticks > stat_max_ticks) {
+        stat_max_ticks = cmd_ticks;
+    }
+}
+
+static void IBC_HDC_StatSectors(bool write, uint16_t nsects)
+{
+    if (write) {
+        stat_sects_written += nsects;
+    } else {
+        stat_sects_read += nsects;
+    }
+}
+
+static uint32_t IBC_HDC_StatValue(uint8_t index)
+{
+    if (index < PERF_TYPES) {
+        return stat_cmds[index];
+    }
+    switch (index) {
+    case STAT_SECTS_READ:       return stat_sects_read;
+    case STAT_SECTS_WRITTEN:    return stat_sects_written;
+    case STAT_CACHE_HITS:       return cache_hits;
+    case STAT_SD_CMDS:          return SD_SPI_GetCommandTotal();
+    case STAT_SD_BUSY:          return disk_busy_ticks / TMR1_TICKS_PER_US;
+    case STAT_MAX_LATENCY:      return stat_max_ticks / TMR1_TICKS_PER_US;
+    default:                    return 0;
+    }
+}
+
+/* Read port 4Ah; called from CLC2_ISR. */
+static uint8_t IBC_HDC_StatRead(void)
+{
+    uint8_t cData;
+
+    if (stat_byte == 0) {
+        stat_latch = IBC_HDC_StatValue(stat_index);
+    }
+    cData = (uint8_t)stat_latch;
+    stat_latch >>= 8;
+    if (++stat_byte == 4) {
+        stat_byte = 0;
+        stat_index++;
+    }
+    return cData;
+}
+
+static void IBC_HDC_StatSelect(uint8_t index)
+{
+    stat_index = index;
+    stat_byte = 0;
+}
+
+static void IBC_HDC_StatReset(void)
+{
+    memset(stat_cmds, 0, sizeof(stat_cmds));
+    stat_sects_read = 0;
+    stat_sects_written = 0;
+    stat_max_ticks = 0;
+}
+#else
+static void IBC_HDC_StatCommand(uint8_t cmd) {}
+static void IBC_HDC_StatSectors(bool write, uint16_t nsects) {}
+static void IBC_HDC_StatReset(void) {}
+#endif /* IBC_HDC_STATS */
+
+/* Workload recorder: one 16-byte record per command, batched in RAM and
+ * appended to IBCTRACE.BIN a whole block at a time from the idle loop.
+ * Each RESET starts a session with a marker record, as TMR1 restarts at
+ * power-up.  Records arriving while a full block waits to be written are
+ * dropped and counted.  Up to 31 records are lost at power-off.
+ * host/ibctrace summarises the file.
+ */
+#define IBC_HDC_RECORD_FILENAME     "IBCTRACE.BIN"
+#define IBC_HDC_RECORD_MAGIC        0x54434249UL    /* "IBCT" */
+#define IBC_HDC_RECORD_VERSION      1
+#define IBC_HDC_RECORD_SESSION      0xFF            /* cmd of the session marker */
+
+typedef struct {
+    uint32_t  stamp;      /* TMR1 at command start; session: TMR1 now */
+    uint32_t  latency;    /* TMR1 ticks; session: IBC_HDC_RECORD_MAGIC */
+    uint16_t  cyl;        /* session: IBC_HDC_RECORD_VERSION */
+    uint8_t   cmd;        /* Task file command, or IBC_HDC_RECORD_SESSION */
+    uint8_t   drive;
+    uint8_t   head;       /* session: TMR1 ticks per us */
+    uint8_t   sect;
+    uint8_t   nsec;       /* 0 means 1, as in the task file */
+    uint8_t   status;     /* Status register after the command */
+} IBC_HDC_RECORD_REC;
+
+#define IBC_HDC_RECORDS_PER_BLOCK   (512 / sizeof(IBC_HDC_RECORD_REC))
+
+#ifdef IBC_HDC_RECORD
+static IBC_HDC_RECORD_REC rec_block[IBC_HDC_RECORDS_PER_BLOCK];
+static uint8_t  rec_count;
+static bool     rec_open;
+static bool     rec_unsynced;
+static uint32_t rec_dropped;
+static FIL      rec_file;
+
+static IBC_HDC_RECORD_REC *IBC_HDC_RecordNext(void)
+{
+    if (rec_count == IBC_HDC_RECORDS_PER_BLOCK) {
+        rec_dropped++;
+        return NULL;
+    }
+    return &rec_block[rec_count++];
+}
+
+static void IBC_HDC_RecordCommand(uint8_t cmd)
+{
+    IBC_HDC_RECORD_REC *pRec = IBC_HDC_RecordNext();
+
+    if (pRec == NULL) {
+        return;
+    }
+    pRec->stamp = cmd_start;
+    pRec->latency = cmd_ticks;
+    pRec->cyl = ((uint16_t)ibc_hdc_info->taskfile[TF_TRKH] << 8) | ibc_hdc_info->taskfile[TF_TRKL];
+    pRec->cmd = cmd;
+    pRec->drive = ibc_hdc_info->sel_drive;
+    pRec->head = ibc_hdc_info->taskfile[TF_HEAD];
+    pRec->sect = ibc_hdc_info->taskfile[TF_CSEC];
+    pRec->nsec = ibc_hdc_info->taskfile[TF_NSEC];
+    pRec->status = ibc_hdc_info->status_reg;
+}
+
+/* Open the log after the card is mounted, and start a session.  A partial
+ * block left by a crash is overwritten, so the file stays block aligned.
+ */
+static void IBC_HDC_RecordOpen(void)
+{
+    IBC_HDC_RECORD_REC *pRec;
+
+    rec_open = (f_open(&rec_file, IBC_HDC_RECORD_FILENAME, FA_OPEN_ALWAYS | FA_WRITE) == FR_OK) &&
+               (f_lseek(&rec_file, f_size(&rec_file) & ~511UL) == FR_OK);
+    if (!rec_open) {
+        printf("Could not open %s\n\r", IBC_HDC_RECORD_FILENAME);
+        return;
+    }
+
+    if ((pRec = IBC_HDC_RecordNext()) != NULL) {
+        memset(pRec, 0, sizeof(IBC_HDC_RECORD_REC));
+        pRec->stamp = TMR1_ReadTimer32();
+        pRec->latency = IBC_HDC_RECORD_MAGIC;
+        pRec->cyl = IBC_HDC_RECORD_VERSION;
+        pRec->cmd = IBC_HDC_RECORD_SESSION;
+        pRec->head = TMR1_TICKS_PER_US;
+    }
+}
+
+static void IBC_HDC_RecordClose(void)
+{
+    if (rec_open) {
+        f_close(&rec_file);
+        rec_open = false;
+        rec_unsynced = false;
+    }
+    if (rec_dropped != 0) {
+        printf("%s: %lu records dropped\n\r", IBC_HDC_RECORD_FILENAME, (unsigned long)rec_dropped);
+    }
+}
+
+/* Append a full block; called from the idle loop.  Returns true if it did
+ * any work.
+ */
+static bool IBC_HDC_RecordFlush(void)
+{
+    UINT len;
+
+    if (!rec_open || (rec_count != IBC_HDC_RECORDS_PER_BLOCK)) {
+        return false;
+    }
+    if ((f_write(&rec_file, rec_block, sizeof(rec_block), &len) != FR_OK) || (len != sizeof(rec_block))) {
+        printf("Error writing %s\n\r", IBC_HDC_RECORD_FILENAME);
+        f_close(&rec_file);
+        rec_open = false;
+    }
+    rec_count = 0;
+    rec_unsynced = true;
+    return true;
+}
+
+static void IBC_HDC_RecordSync(void)
+{
+    if (rec_unsynced) {
+        f_sync(&rec_file);
+        rec_unsynced = false;
+    }
+}
+#else
+static void IBC_HDC_RecordCommand(uint8_t cmd) {}
+static void IBC_HDC_RecordOpen(void) {}
+static void IBC_HDC_RecordClose(void) {}
+static bool IBC_HDC_RecordFlush(void) { return false; }
+static void IBC_HDC_RecordSync(void) {}
+#endif /* IBC_HDC_RECORD */
+
+/* f_read() or f_write() part of a drive image. */
+static FRESULT IBC_HDC_FXfer(uint8_t drive, uint8_t *data, uint16_t len, UINT *actual, bool write)
+{
+    uint32_t start = IBC_HDC_PerfStart();
+    FRESULT res;
+
+    if (write) {
+        res = f_write(&file[drive], data, len, actual);
+    } else {
+        res = f_read(&file[drive], data, len, actual);
+    }
+    IBC_HDC_PerfEnd(PH_DATA, start);
+    return res;
+}
+
+/* The status register, without the side effects of a Z80 read of it. */
+uint8_t IBC_HDC_GetStatus(void)
+{
+    return ibc_hdc_info->status_reg;
+}
+
+/* Handle a character typed on the console. */
+void IBC_HDC_Console(char c)
+{
+    switch (tolower(c)) {
+    case 't':
+        IBC_HDC_TraceDump();
+        break;
+    case 'p':
+        IBC_HDC_PerfDump();
+        break;
+    case 'w':
+        z80_ssd_WaitDump();
+        break;
+    case 'b':
+        z80_ssd_BusTraceDump();
+        break;
+    case 'z':
+        IBC_HDC_PerfReset();
+        IBC_HDC_StatReset();
+        z80_ssd_WaitReset();
+        break;
+    default:
+        printf("T: dump trace, B: send bus trace, P: latency statistics, W: WAIT# hold times, Z: clear statistics\n\r");
+        break;
+    }
+}
+
+//#define SDTEST
+#ifdef SDTEST
+#undef  DISK0_FILENAME
+#define DISK0_FILENAME  "8mbtest.dsk"
+static FIL ofile;
+static uint16_t writeLength;
+static uint32_t seek_offset;
+#endif /* SDTEST */
+
+/* Build the FatFs fast seek cluster link map for an open drive image, so
+ * f_lseek() no longer walks the FAT chain from the first cluster.  If the
+ * image is empty or too fragmented for the table, the drive falls back to
+ * chain walking.
+ */
+static void IBC_HDC_CreateLinkMap(uint8_t drive)
+{
+    FRESULT res;
+
+    clmt[drive][0] = 0;
+
+    if (f_size(&file[drive]) == 0) {
+        /* A link map can't grow the file, so leave empty images alone. */
+        return;
+    }
+
+    clmt[drive][0] = IBC_HDC_CLMT_LEN;
+    file[drive].cltbl = clmt[drive];
+    res = f_lseek(&file[drive], CREATE_LINKMAP);
+
+    if (res == FR_OK) {
+        printf("%s: fast seek, %lu fragment(s).\n\r", disk_filenames[drive], (unsigned long)((clmt[drive][0] - 2) / 2));
+    } else {
+        printf("%s: link map needs %lu entries, using FAT chain.\n\r", disk_filenames[drive], (unsigned long)clmt[drive][0]);
+        file[drive].cltbl = NULL;
+        clmt[drive][0] = 0;
+    }
+}
+
+/* Seek within a drive image.  A link map can't extend the file, so a
+ * transfer that runs past the end of the image drops the map and lets FatFs
+ * grow the cluster chain as before.
+ */
+static FRESULT IBC_HDC_Seek(uint8_t drive, uint32_t offset, uint16_t len)
+{
+    uint32_t start;
+    FRESULT res;
+
+    if ((file[drive].cltbl != NULL) && ((offset + len) > f_size(&file[drive]))) {
+        file[drive].cltbl = NULL;
+        clmt[drive][0] = 0;
+    }
+
+    start = IBC_HDC_PerfStart();
+    res = f_lseek(&file[drive], offset);
+    IBC_HDC_PerfEnd(PH_SEEK, start);
+    return res;
+}
+
+#ifdef IBC_HDC_RAW_LBA
+/* The largest unaligned raw transfer; the last 512 bytes of sectbuf are used
+ * to read-modify-write SD sectors that are only half covered.
+ */
+#define IBC_HDC_RAW_MAX_LEN     (sizeof(sectbuf) - 512)
+
+/* Fill in the key of a drive image that has just been opened, while its
+ * directory entry is still in the FatFs window.  A card reformatted or an
+ * image copied back in by a PC changes the volume serial number or the
+ * modification time, even if the image lands in the same place.
+ */
+static void IBC_HDC_ExtentKey(uint8_t drive, IBC_HDC_EXTENT *pExtent)
+{
+    memset(pExtent, 0, sizeof(IBC_HDC_EXTENT));
+    pExtent->magic = IBC_HDC_EXTENT_MAGIC;
+    pExtent->dir_sect = file[drive].dir_sect;
+    pExtent->dir_ofs = (uint16_t)(file[drive].dir_ptr - file[drive].obj.fs->win);
+    pExtent->sclust = file[drive].obj.sclust;
+    pExtent->size = f_size(&file[drive]);
+    pExtent->volume = vol_serial;
+    memcpy(&pExtent->mtime, file[drive].dir_ptr + IBC_HDC_DIR_MODTIME, sizeof(pExtent->mtime));
+}
+
+/* Resolve a drive image to a single extent of SD sectors.  The extent is
+ * read from the sidecar file if its key still matches the image's directory
+ * entry, otherwise the link map tells whether the image is contiguous, and
+ * a new sidecar is written.  Fragmented images use the FatFs path.
+ */
+static void IBC_HDC_MapImage(uint8_t drive)
+{
+    FATFS *fs = file[drive].obj.fs;
+    IBC_HDC_EXTENT key;
+    FIL sidecar;
+    UINT len;
+
+    IBC_HDC_ExtentKey(drive, &key);
+    memset(&extent[drive], 0, sizeof(IBC_HDC_EXTENT));
+
+    if (f_open(&sidecar, extent_filenames[drive], FA_READ) == FR_OK) {
+        if ((f_read(&sidecar, &extent[drive], sizeof(IBC_HDC_EXTENT), &len) != FR_OK) ||
+            (len != sizeof(IBC_HDC_EXTENT)) ||
+            (memcmp(&extent[drive], &key, offsetof(IBC_HDC_EXTENT, start_lba)) != 0) ||
+            (extent[drive].start_lba < fs->database)) {
+            memset(&extent[drive], 0, sizeof(IBC_HDC_EXTENT));
+        }
+        f_close(&sidecar);
+    }
+
+    if (extent[drive].start_lba != 0) {
+        printf("%s: raw LBA %lu.\n\r", disk_filenames[drive], (unsigned long)extent[drive].start_lba);
+        return;
+    }
+
+    IBC_HDC_CreateLinkMap(drive);
+
+    /* One fragment: size, length, start cluster, terminator. */
+    if (clmt[drive][0] != 4) {
+        printf("%s: not contiguous, using FatFs.\n\r", disk_filenames[drive]);
+        return;
+    }
+
+    memcpy(&extent[drive], &key, sizeof(IBC_HDC_EXTENT));
+    extent[drive].start_lba = fs->database + (DWORD)fs->csize * (clmt[drive][2] - 2);
+    printf("%s: raw LBA %lu, saving %s.\n\r", disk_filenames[drive], (unsigned long)extent[drive].start_lba, extent_filenames[drive]);
+
+    if (f_open(&sidecar, extent_filenames[drive], FA_CREATE_ALWAYS | FA_WRITE) == FR_OK) {
+        f_write(&sidecar, &extent[drive], sizeof(IBC_HDC_EXTENT), &len);
+        f_close(&sidecar);
+    }
+}
+
+/* Can this transfer be done directly by SD LBA? */
+static bool IBC_HDC_RawMapped(uint8_t drive, uint32_t offset, uint16_t len)
+{
+    if ((extent[drive].start_lba == 0) || ((offset + len) > extent[drive].size)) {
+        return false;
+    }
+
+    /* Unaligned transfers need room for the bounce sector. */
+    return ((((uint16_t)offset | len) & 0x1FF) == 0) || (len <= IBC_HDC_RAW_MAX_LEN);
+}
+
+/* Transfer len bytes between data and a 256-byte aligned offset of a raw
+ * mapped drive image.  Half-covered SD sectors at either end are bounced
+ * through the tail of sectbuf, so unaligned transfers must come from sectbuf.
+ */
+static int IBC_HDC_RawXfer(uint8_t drive, uint32_t offset, uint8_t *data, uint16_t len, bool write)
+{
+    FATFS *fs = file[drive].obj.fs;
+    uint8_t *bounce = &sectbuf[IBC_HDC_RAW_MAX_LEN];
+    DWORD lba = extent[drive].start_lba + (offset >> 9);
+    DWORD first_lba = lba;
+    DWORD end_lba = lba + (((DWORD)((uint16_t)offset & 0x100) + len + 511) >> 9);
+    DRESULT res = RES_OK;
+    UINT count;
+    uint32_t start = IBC_HDC_PerfStart();
+
+    /* An unaligned write through FatFs may have left one of these sectors
+     * dirty in its window.  Write it out first, so a read sees it and it
+     * can't later land on top of what is written here.
+     */
+    if (fs->wflag && (fs->winsect >= first_lba) && (fs->winsect < end_lba)) {
+        res = disk_write(IBC_HDC_SD_PDRV, fs->win, fs->winsect, 1);
+        fs->wflag = 0;
+    }
+
+    if ((offset & 0x100) && (res == RES_OK)) {  /* Starts in the second half of an SD sector */
+        res = disk_read(IBC_HDC_SD_PDRV, bounce, lba, 1);
+        if (write) {
+            memcpy(&bounce[256], data, 256);
+            if (res == RES_OK) res = disk_write(IBC_HDC_SD_PDRV, bounce, lba, 1);
+        } else {
+            memcpy(data, &bounce[256], 256);
+        }
+        data += 256;
+        len -= 256;
+        lba++;
+    }
+
+    count = len >> 9;
+    if ((count != 0) && (res == RES_OK)) {
+        if (write) {
+            res = disk_write(IBC_HDC_SD_PDRV, data, lba, count);
+        } else {
+            res = disk_read(IBC_HDC_SD_PDRV, data, lba, count);
+        }
+        data += (uint16_t)count << 9;
+        len -= (uint16_t)count << 9;
+        lba += count;
+    }
+
+    if ((len != 0) && (res == RES_OK)) {    /* Ends in the first half of an SD sector */
+        res = disk_read(IBC_HDC_SD_PDRV, bounce, lba, 1);
+        if (write) {
+            memcpy(bounce, data, 256);
+            if (res == RES_OK) res = disk_write(IBC_HDC_SD_PDRV, bounce, lba, 1);
+        } else {
+            memcpy(data, bounce, 256);
+        }
+        lba++;
+    }
+
+    /* Don't let FatFs serve a stale copy of a sector we just wrote. */
+    if (write && (fs->winsect >= first_lba) && (fs->winsect < end_lba)) {
+        fs->winsect = (DWORD)-1;
+    }
+
+    IBC_HDC_PerfEnd(PH_DATA, start);
+    return ((res == RES_OK) ? SCPE_OK : SCPE_IOERR);
+}
+#else
+static void IBC_HDC_MapImage(uint8_t drive)
+{
+    IBC_HDC_CreateLinkMap(drive);
+}
+
+static bool IBC_HDC_RawMapped(uint8_t drive, uint32_t offset, uint16_t len)
+{
+    return false;
+}
+
+static int IBC_HDC_RawXfer(uint8_t drive, uint32_t offset, uint8_t *data, uint16_t len, bool write)
+{
+    return SCPE_IOERR;
+}
+#endif /* IBC_HDC_RAW_LBA */
+
+/* Fail a transfer whose command has already completed.  The error bit is
+ * set at once, but the next task file write or command overwrites the
+ * status register, so it is also latched in late_error until the Z80 has
+ * read it there, or the next command has completed with it.
+ */
+static void IBC_HDC_LateError(void)
+{
+    uint8_t gieh = INTCON0bits.GIEH;
+
+    INTERRUPT_GlobalInterruptHighDisable();
+    ibc_hdc_info->status_reg |= IBC_HDC_STATUS_ERROR;
+    late_error = true;
+    INTCON0bits.GIEH = gieh;
+}
+
+/* Flush a drive image's FatFs state (directory entry, FAT window) if it has
+ * been written since the last sync.
+ */
+static void IBC_HDC_SyncDrive(uint8_t drive)
+{
+    FRESULT res;
+    uint32_t start;
+
+    if (unsynced_writes[drive] != 0) {
+        start = IBC_HDC_PerfStart();
+        res = f_sync(&file[drive]);
+        IBC_HDC_PerfEnd(PH_OPEN, start);
+        if (res != FR_OK) {
+            printf("Error 0x%02x syncing %s.\n\r", res, disk_filenames[drive]);
+        }
+        unsynced_writes[drive] = 0;
+        sync_count++;
+    }
+}
+
+static void IBC_HDC_SyncAll(void)
+{
+    for (uint8_t i = 0; i < IBC_HDC_MAX_DRIVES; i++) {
+        IBC_HDC_SyncDrive(i);
+    }
+}
+
+/* Account for a FatFs write to a drive image, syncing every
+ * IBC_HDC_SYNC_WRITES writes.
+ */
+static void IBC_HDC_WriteDone(uint8_t drive)
+{
+    if (++unsynced_writes[drive] >= IBC_HDC_SYNC_WRITES) {
+        IBC_HDC_SyncDrive(drive);
+    }
+}
+
+#ifdef IBC_HDC_CACHE
+/* Transfer one 512-byte block of a drive image. */
+static int IBC_HDC_BlockXfer(uint8_t drive, uint32_t block, uint8_t *data, bool write)
+{
+    uint32_t offset = block << 9;
+    FRESULT res;
+    UINT len;
+
+    if (IBC_HDC_RawMapped(drive, offset, 512)) {
+        return (IBC_HDC_RawXfer(drive, offset, data, 512, write));
+    }
+
+    if ((res = IBC_HDC_Seek(drive, offset, 512)) == FR_OK) {
+        if (write) {
+            res = IBC_HDC_FXfer(drive, data, 512, &len, true);
+            IBC_HDC_WriteDone(drive);
+        } else {
+            res = IBC_HDC_FXfer(drive, data, 512, &len, false);
+        }
+    }
+
+    return (((res == FR_OK) && (len == 512)) ? SCPE_OK : SCPE_IOERR);
+}
+
+static void IBC_HDC_CacheFlushLine(IBC_HDC_CACHE_LINE *pLine)
+{
+    if (pLine->dirty) {
+        if (IBC_HDC_BlockXfer(pLine->drive, pLine->block, pLine->data, true) != SCPE_OK) {
+            printf("Error writing back drive %u block %lu.\n\r", pLine->drive, (unsigned long)pLine->block);
+            IBC_HDC_LateError();
+        }
+        pLine->dirty = false;
+        cache_flushes++;
+    }
+}
+
+static void IBC_HDC_CacheFlushAll(void)
+{
+    for (uint8_t i = 0; i < IBC_HDC_CACHE_LINES; i++) {
+        IBC_HDC_CacheFlushLine(&cache[i]);
+    }
+}
+
+/* Write back the line that has been dirty longest, if any, and if either
+ * the Z80 has gone quiet or the line has exceeded IBC_HDC_CACHE_MAX_AGE.
+ * Returns true if a line was written.
+ */
+static bool IBC_HDC_CacheFlushOne(bool idle)
+{
+    IBC_HDC_CACHE_LINE *pOldest = NULL;
+
+    for (uint8_t i = 0; i < IBC_HDC_CACHE_LINES; i++) {
+        if (cache[i].dirty &&
+            ((pOldest == NULL) || ((uint16_t)(cache_clock - cache[i].dirtied) > (uint16_t)(cache_clock - pOldest->dirtied)))) {
+            pOldest = &cache[i];
+        }
+    }
+
+    if ((pOldest == NULL) ||
+        (!idle && ((uint16_t)(cache_clock - pOldest->dirtied) < IBC_HDC_CACHE_MAX_AGE))) {
+        return false;
+    }
+
+    IBC_HDC_CacheFlushLine(pOldest);
+    return true;
+}
+
+static IBC_HDC_CACHE_LINE *IBC_HDC_CacheFind(uint8_t drive, uint32_t block)
+{
+    for (uint8_t i = 0; i < IBC_HDC_CACHE_LINES; i++) {
+        if (cache[i].valid && (cache[i].drive == drive) && (cache[i].block == block)) {
+            return &cache[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Find a line and mark it used. */
+static IBC_HDC_CACHE_LINE *IBC_HDC_CacheLookup(uint8_t drive, uint32_t block)
+{
+    IBC_HDC_CACHE_LINE *pLine;
+
+    if ((pLine = IBC_HDC_CacheFind(drive, block)) != NULL) {
+        pLine->used = cache_clock;
+        pLine->prefetched = false;
+    }
+
+    return pLine;
+}
+
+#ifdef IBC_HDC_READ_AHEAD
+/* Is the line one that read-ahead is keeping for the next READ_SECT? */
+static bool IBC_HDC_InReadAhead(IBC_HDC_CACHE_LINE *pLine)
+{
+    return ((pLine->drive == ra_drive) &&
+            (pLine->block >= (ra_next >> 9)) &&
+            (pLine->block < ((ra_next >> 9) + ra_window)));
+}
+#else
+#define IBC_HDC_InReadAhead(pLine)  false
+#endif /* IBC_HDC_READ_AHEAD */
+
+/* Find or load the line for a block, evicting the least recently used line
+ * if necessary.  A speculative load only replaces clean lines outside the
+ * read-ahead window.  Returns NULL if no line is available or the block
+ * can't be read.
+ */
+static IBC_HDC_CACHE_LINE *IBC_HDC_CacheLoad(uint8_t drive, uint32_t block, bool speculative)
+{
+    IBC_HDC_CACHE_LINE *pLine;
+
+    if ((pLine = IBC_HDC_CacheLookup(drive, block)) != NULL) {
+        return pLine;
+    }
+
+    for (uint8_t i = 0; i < IBC_HDC_CACHE_LINES; i++) {
+        if (!cache[i].valid) {
+            pLine = &cache[i];
+            break;
+        }
+        if (speculative && (cache[i].dirty || IBC_HDC_InReadAhead(&cache[i]))) {
+            continue;
+        }
+        if ((pLine == NULL) ||
+            ((uint16_t)(cache_clock - cache[i].used) > (uint16_t)(cache_clock - pLine->used))) {
+            pLine = &cache[i];
+        }
+    }
+
+    if (pLine == NULL) {
+        return NULL;
+    }
+
+    if (pLine->valid && pLine->prefetched) {
+        ra_wasted++;
+#ifdef IBC_HDC_READ_AHEAD
+        ra_window >>= 1;    /* Prefetching further ahead than is being read. */
+#endif /* IBC_HDC_READ_AHEAD */
+    }
+
+    IBC_HDC_CacheFlushLine(pLine);
+    pLine->valid = false;
+
+    if (IBC_HDC_BlockXfer(drive, block, pLine->data, false) != SCPE_OK) {
+        return NULL;
+    }
+
+    /* Valid last: CLC2_ISR may look the line up at any time. */
+    pLine->prefetched = speculative;
+    pLine->drive = drive;
+    pLine->block = block;
+    pLine->used = cache_clock;
+    pLine->valid = true;
+    return pLine;
+}
+
+/* Copy the IBC sectors of a transfer that are held in the cache between
+ * the cache and data.  Returns the number of sectors copied.
+ */
+static uint16_t IBC_HDC_CacheCopy(uint8_t drive, uint32_t offset, uint8_t *data, uint16_t len, bool write)
+{
+    IBC_HDC_CACHE_LINE *pLine;
+    uint8_t *pData;
+    uint16_t hits = 0;
+
+    for (uint16_t i = 0; i < len; i += 256, offset += 256) {
+        if ((pLine = IBC_HDC_CacheLookup(drive, offset >> 9)) == NULL) {
+            continue;
+        }
+        pData = &pLine->data[(uint16_t)offset & 0x100];
+        if (write) {
+            memcpy(pData, &data[i], 256);
+        } else {
+            memcpy(&data[i], pData, 256);
+        }
+        hits++;
+    }
+
+    return (hits);
+}
+
+/* Absorb a small write into the cache.  Returns false if a block couldn't
+ * be loaded; the caller then writes to the card directly.
+ */
+static bool IBC_HDC_CacheWrite(uint8_t drive, uint32_t offset, uint8_t *data, uint16_t len)
+{
+    IBC_HDC_CACHE_LINE *pLine;
+
+    if (len > (IBC_HDC_CACHE_MAX_WRITE * IBC_HDC_MAX_SECLEN)) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < len; i += 256) {
+        if (IBC_HDC_CacheLoad(drive, (offset + i) >> 9, false) == NULL) {
+            return false;
+        }
+    }
+
+    for (uint16_t i = 0; i < len; i += 256, offset += 256) {
+        if ((pLine = IBC_HDC_CacheLookup(drive, offset >> 9)) == NULL) {
+            return false;
+        }
+        memcpy(&pLine->data[(uint16_t)offset & 0x100], &data[i], 256);
+        if (!pLine->dirty) {
+            pLine->dirty = true;
+            pLine->dirtied = cache_clock;
+        }
+        cache_writes++;
+    }
+
+    return true;
+}
+
+#ifdef IBC_HDC_READ_AHEAD
+/* Track READ_SECTs to size the read-ahead window.  Each READ_SECT that
+ * starts where the previous one ended widens the window by a block, up to
+ * IBC_HDC_RA_MAX_BLOCKS; any other READ_SECT turns read-ahead off, so random
+ * workloads don't pay for it.
+ */
+static void IBC_HDC_ReadAheadTrack(uint8_t drive, uint32_t offset, uint16_t len, bool hit)
+{
+    if ((drive == ra_drive) && (offset == ra_next)) {
+        if (ra_window != 0) {
+            if (hit) {
+                ra_hits++;
+            } else {
+                ra_misses++;
+            }
+        }
+        if (ra_window < IBC_HDC_RA_MAX_BLOCKS) {
+            ra_window++;
+        }
+    } else {
+        ra_window = 0;
+    }
+
+    ra_drive = drive;
+    ra_next = offset + len;
+}
+
+/* Prefetch the next block of the read-ahead window that isn't cached yet.
+ * Called from the idle loop, so the card is read while the Z80 is still
+ * draining the FIFO.  Returns true if a block was read.
+ */
+static bool IBC_HDC_ReadAhead(void)
+{
+    uint32_t block = ra_next >> 9;
+
+    for (uint8_t i = 0; i < ra_window; i++, block++) {
+        if (((block + 1) << 9) > f_size(&file[ra_drive])) {
+            break;
+        }
+        if (IBC_HDC_CacheFind(ra_drive, block) == NULL) {
+            if (IBC_HDC_CacheLoad(ra_drive, block, true) == NULL) {
+                ra_window = 0;
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+#else
+static void IBC_HDC_ReadAheadTrack(uint8_t drive, uint32_t offset, uint16_t len, bool hit) {}
+static bool IBC_HDC_ReadAhead(void) { return false; }
+#endif /* IBC_HDC_READ_AHEAD */
+#else
+static void IBC_HDC_ReadAheadTrack(uint8_t drive, uint32_t offset, uint16_t len, bool hit) {}
+static bool IBC_HDC_ReadAhead(void) { return false; }
+static void IBC_HDC_CacheFlushAll(void) {}
+static bool IBC_HDC_CacheFlushOne(bool idle) { return false; }
+static uint16_t IBC_HDC_CacheCopy(uint8_t drive, uint32_t offset, uint8_t *data, uint16_t len, bool write) { return 0; }
+static bool IBC_HDC_CacheWrite(uint8_t drive, uint32_t offset, uint8_t *data, uint16_t len) { return false; }
+#endif /* IBC_HDC_CACHE */
+
+#if defined(IBC_HDC_READ_OVERLAP) || defined(IBC_HDC_WRITE_OVERLAP)
+/* A streaming transfer runs through sectbuf as a ring of slots, lap after
+ * lap, so it may be up to 255 sectors long.  CLC2_ISR stalls the Z80 at slot
+ * secbuf_ready of the current lap.  At the end of the ring it starts the Z80
+ * on the next lap itself if a slot of that is ready, so the main loop being
+ * busy with a slot doesn't hold the Z80 there; otherwise IBC_HDC_RingWrap()
+ * does, once one is.
+ */
+static bool     sx_active;          /* A streaming transfer is in progress */
+static uint8_t  sx_drive;           /* Drive of the streaming transfer */
+static uint32_t sx_offset;          /* Image offset of the next sector */
+static uint8_t  sx_seq;             /* Next sector to transfer */
+static uint8_t  sx_count;           /* Sectors in the transfer */
+static bool     sx_raw;             /* Transfer is raw LBA mapped */
+static bool     sx_write;           /* Draining a WRITE_SECT rather than filling a READ_SECT */
+static bool     sx_after;           /* ...whose data the Z80 writes after the command */
+
+/* The Z80's place in the transfer, in slots from the start of lap 0.  Only
+ * the high byte of secbuf_index is read, so the ISR can't tear it, but it
+ * may start the next lap in between, so the lap is read until it holds.
+ */
+static uint16_t IBC_HDC_ZPos(void)
+{
+    uint8_t lap, slot;
+
+    do {
+        lap = secbuf_lap;
+        slot = (uint8_t)(secbuf_index >> 8);
+    } while (lap != secbuf_lap);
+    return (uint16_t)lap * IBC_HDC_RING_SLOTS + slot;
+}
+
+/* Has the Z80 finished with ring slot `slot` of lap `lap`? */
+static bool IBC_HDC_ZDone(uint8_t lap, uint8_t slot)
+{
+    return IBC_HDC_ZPos() > (uint16_t)lap * IBC_HDC_RING_SLOTS + slot;
+}
+
+/* Let the Z80 at the first nslots slots of lap `lap`. */
+static void IBC_HDC_SlotsReady(uint8_t lap, uint8_t nslots)
+{
+    INTERRUPT_GlobalInterruptHighDisable();
+    if (lap == secbuf_lap) {
+        secbuf_ready = nslots;
+    } else if (lap == (uint8_t)(secbuf_lap + 1)) {
+        secbuf_next_ready = nslots;
+    }
+    INTERRUPT_GlobalInterruptHighEnable();
+}
+
+/* Start the Z80 on the next lap if it ran off the end of the ring before
+ * CLC2_ISR could.  It is let go at once, rather than after the slot it left
+ * behind has been moved.
+ */
+static void IBC_HDC_RingWrap(void)
+{
+    if ((uint8_t)(secbuf_index >> 8) >= IBC_HDC_RING_SLOTS) {
+        INTERRUPT_GlobalInterruptHighDisable();
+        secbuf_ready = secbuf_next_ready;
+        secbuf_next_ready = 0;
+        secbuf_lap++;
+        secbuf_index = 0;
+        INTERRUPT_GlobalInterruptHighEnable();
+        z80_ssd_fifo_resume();
+    }
+}
+
+/* Stop CLC2_ISR starting the Z80 on another lap, and let it at the whole
+ * FIFO: the streaming transfer is over.
+ */
+static void IBC_HDC_RingDone(void)
+{
+    sx_active = false;
+    secbuf_next_ready = 0;
+    secbuf_ready = IBC_HDC_RING_SLOTS;
+}
+
+/* Read a lone IBC sector of a raw streaming read.  The whole block goes into
+ * the cache, so the other half of it is a hit, and nothing is bounced
+ * through the end of sectbuf, which is part of the ring.
+ */
+static bool IBC_HDC_ReadHalf(uint8_t drive, uint32_t offset, uint8_t *data)
+{
+    UINT actual;
+#ifdef IBC_HDC_CACHE
+    IBC_HDC_CACHE_LINE *pLine;
+
+    if ((pLine = IBC_HDC_CacheLoad(drive, offset >> 9, false)) != NULL) {
+        memcpy(data, &pLine->data[(uint16_t)offset & 0x100], 256);
+        return true;
+    }
+#endif /* IBC_HDC_CACHE */
+    return (IBC_HDC_Seek(drive, offset, 256) == FR_OK) &&
+           (IBC_HDC_FXfer(drive, data, 256, &actual, false) == FR_OK) && (actual == 256);
+}
+
+/* Deal with a FIFO cycle that was let go without its slot.  If the Z80 was
+ * filling the FIFO for its next command behind a WRITE_SECT still draining,
+ * that data is incomplete: finish the WRITE_SECT, with the Z80 kept from
+ * stalling again meanwhile, and fail the next one as an overrun.  Otherwise
+ * the transfer the cycle belonged to has failed.
+ */
+static void IBC_HDC_FifoTimeout(void)
+{
+    if (!z80_ssd_fifo_timed_out()) {
+        return;
+    }
+    if (sx_active && sx_write && (IBC_HDC_ZPos() >= sx_count)) {
+        secbuf_overrun = true;
+        return;
+    }
+    if (sx_active) {
+        printf("Error: FIFO timed out after %u of %u sectors.\n\r", sx_seq, sx_count);
+        IBC_HDC_LateError();
+    } else {
+        secbuf_overrun = true;
+    }
+    IBC_HDC_RingDone();
+    z80_ssd_fifo_timeout_clear();
+}
+
+/* Move the next slot(s) of a streaming transfer between the ring and the
+ * card: a lone sector at a half block or at the end of the ring, whole
+ * 512-byte blocks otherwise.  Each slot waits for the Z80 to finish with it
+ * on the previous lap (reads), or to fill it (writes).  Releases the Z80 if
+ * it was stalled waiting for them.  Returns false if there is nothing to do.
+ */
+static bool IBC_HDC_XferStep(void)
+{
+    uint8_t lap, slot, n;
+    uint8_t *pData;
+    uint16_t len = 512;
+    uint16_t sd_cmds;
+    bool ok = true;
+    UINT actual;
+
+    IBC_HDC_FifoTimeout();
+
+    if (!sx_active) {
+        /* No transfer to wrap the ring for: the Z80 ran off the end of the
+         * FIFO, so start it over and fail the command, as an overrun.
+         */
+        if (((uint8_t)(secbuf_index >> 8) >= IBC_HDC_RING_SLOTS) && z80_ssd_fifo_stalled()) {
+            secbuf_overrun = true;
+            secbuf_index = 0;
+            z80_ssd_fifo_resume();
+        }
+        return false;
+    }
+
+    IBC_HDC_RingWrap();
+
+    if (sx_seq == sx_count) {
+        /* Everything is on the card, or in the ring; wait for the Z80 to
+         * read the last of it.
+         */
+        lap = (uint8_t)((sx_count - 1) / IBC_HDC_RING_SLOTS);
+        slot = (uint8_t)((sx_count - 1) % IBC_HDC_RING_SLOTS);
+        if (sx_write || IBC_HDC_ZDone(lap, slot)) {
+            IBC_HDC_RingDone();
+        }
+        z80_ssd_fifo_resume();
+        return false;
+    }
+
+    lap = sx_seq / IBC_HDC_RING_SLOTS;
+    slot = sx_seq % IBC_HDC_RING_SLOTS;
+    if ((sx_offset & 0x100) || ((uint8_t)(sx_seq + 1) == sx_count) || (slot == (IBC_HDC_RING_SLOTS - 1))) {
+        len = 256;
+    }
+    n = (uint8_t)(len >> 8);
+    pData = &sectbuf[(uint16_t)slot << 8];
+
+    if (sx_write ? !IBC_HDC_ZDone(lap, slot + n - 1) :
+                   ((lap != 0) && !IBC_HDC_ZDone(lap - 1, slot + n - 1))) {
+        z80_ssd_fifo_resume();
+        return false;
+    }
+
+    if (sx_write) {
+        sd_cmds = SD_SPI_GetCommandCount();
+        if (len == 256) {
+            /* Lone sectors are merged in the cache rather than read-modify-
+             * written through the end of sectbuf, which is part of the ring.
+             */
+            ok = IBC_HDC_CacheWrite(sx_drive, sx_offset, pData, len);
+        } else {
+            if (sx_raw) {
+                ok = (IBC_HDC_RawXfer(sx_drive, sx_offset, pData, len, true) == SCPE_OK);
+            } else {
+                ok = (IBC_HDC_Seek(sx_drive, sx_offset, len) == FR_OK) &&
+                     (IBC_HDC_FXfer(sx_drive, pData, len, &actual, true) == FR_OK) && (actual == len);
+                IBC_HDC_WriteDone(sx_drive);
+            }
+            /* Keep cached copies of these sectors current. */
+            IBC_HDC_CacheCopy(sx_drive, sx_offset, pData, len, true);
+        }
+        write_sd_cmds += (uint16_t)(SD_SPI_GetCommandCount() - sd_cmds);
+    } else if (IBC_HDC_CacheCopy(sx_drive, sx_offset, pData, len, false) == n) {
+        cache_hits += n;
+    } else if (sx_raw && (len == 256)) {
+        ok = IBC_HDC_ReadHalf(sx_drive, sx_offset, pData);
+    } else {
+        if (sx_raw) {
+            ok = (IBC_HDC_RawXfer(sx_drive, sx_offset, pData, len, false) == SCPE_OK);
+        } else {
+            ok = (IBC_HDC_Seek(sx_drive, sx_offset, len) == FR_OK) &&
+                 (IBC_HDC_FXfer(sx_drive, pData, len, &actual, false) == FR_OK) && (actual == len);
+        }
+        /* Cached sectors may be newer than the card. */
+        cache_hits += IBC_HDC_CacheCopy(sx_drive, sx_offset, pData, len, false);
+    }
+
+    if (!ok) {
+        printf("Error %s drive %u offset %lx.\n\r", sx_write ? "writing" : "reading", sx_drive, (unsigned long)sx_offset);
+        IBC_HDC_LateError();
+    }
+
+    sx_offset += len;
+    sx_seq += n;
+    if (sx_after && (sx_seq == sx_count)) {
+        /* All the data written after the command was the command's own;
+         * unless the Z80 has gone on writing, none is left for the next.
+         */
+        INTERRUPT_GlobalInterruptHighDisable();
+        if ((IBC_HDC_ZPos() == sx_count) && ((uint8_t)secbuf_index == 0)) {
+            secbuf_written = false;
+        }
+        INTERRUPT_GlobalInterruptHighEnable();
+    }
+    /* A written slot is free for the Z80's next lap. */
+    IBC_HDC_SlotsReady(sx_write ? lap + 1 : lap, slot + n);
+    z80_ssd_fifo_resume();
+
+    return true;
+}
+
+/* Start streaming a multi-sector transfer between the ring and the card.
+ *
+ * A READ_SECT reads only the first IBC_HDC_READ_LEAD slots here, and the
+ * idle loop reads the rest while the Z80 drains the FIFO, refilling each
+ * slot for the next lap as soon as the Z80 has read it.  The lead covers a
+ * FAT chain walk or the end of a write stream, which a stall alone can't
+ * (see STALL_MAX_US in z80_ssd.c).
+ *
+ * A WRITE_SECT whose data is already in the FIFO returns once its first
+ * slot(s) are on the card, and the idle loop writes the rest out while the
+ * Z80 starts filling the FIFO for its next command.  That only holds one ring's worth, so a longer write
+ * must be issued with the FIFO empty (data_ready false): the Z80 then
+ * writes the data after the command, and each slot goes to the card as soon
+ * as it is full.
+ *
+ * Either way the Z80 only stalls if it reaches a slot that isn't ready yet.
+ * Returns false if the transfer must be done in one go.
+ */
+static bool IBC_HDC_XferStart(uint8_t drive, uint32_t offset, uint16_t len, bool write, bool data_ready)
+{
+    uint8_t nsects = (uint8_t)(len >> 8);
+
+#ifndef IBC_HDC_READ_OVERLAP
+    if (!write) return false;
+#endif /* IBC_HDC_READ_OVERLAP */
+#ifndef IBC_HDC_WRITE_OVERLAP
+    if (write) return false;
+#endif /* IBC_HDC_WRITE_OVERLAP */
+#ifndef IBC_HDC_CACHE
+    /* Lone sectors of a streaming write are merged in the cache. */
+    if (write && (((offset | len) & 0x100) || (nsects > IBC_HDC_RING_SLOTS))) return false;
+#endif /* IBC_HDC_CACHE */
+
+    if (data_ready && ((nsects < 2) || (write && (nsects > IBC_HDC_RING_SLOTS)))) {
+        return false;
+    }
+
+    sx_raw = IBC_HDC_RawMapped(drive, offset, len);
+    sx_drive = drive;
+    sx_offset = offset;
+    sx_seq = 0;
+    sx_count = nsects;
+    sx_write = write;
+    sx_after = write && !data_ready;
+    secbuf_next_ready = 0;
+    sx_active = true;
+
+    /* The Z80 starts the FIFO over for the data; do it now, so a stale
+     * index isn't taken for the end of a lap.  The data of a WRITE_SECT
+     * issued after it is on lap 0, otherwise the Z80's next use of the FIFO
+     * is on lap 1, behind the slots still to be written.
+     */
+    secbuf_index = 0;
+    if (!write) {
+        secbuf_lap = 0;
+        secbuf_ready = 0;
+        while ((sx_seq < IBC_HDC_READ_LEAD) && IBC_HDC_XferStep());
+    } else if (data_ready) {
+        /* Write the first slot(s) out before status goes ready, so the
+         * Z80 doesn't stall filling the FIFO for its next command.
+         */
+        secbuf_lap = 1;
+        secbuf_ready = 0;
+        IBC_HDC_XferStep();
+    } else {
+        secbuf_lap = 0;
+        secbuf_ready = IBC_HDC_RING_SLOTS;
+    }
+    return true;
+}
+
+/* Complete a streaming transfer before starting another command.  Whatever
+ * is still waiting on the Z80 is abandoned: it has moved on.
+ */
+static void IBC_HDC_XferFinish(void)
+{
+    while (IBC_HDC_XferStep());
+
+    if (sx_active) {
+        if (sx_seq != sx_count) {
+            printf("Error: transfer abandoned after %u of %u sectors.\n\r", sx_seq, sx_count);
+        }
+        IBC_HDC_RingDone();
+    }
+    IBC_HDC_FifoTimeout();
+}
+
+/* Is a streaming transfer still using the card?  Nothing else may until it
+ * is done, or its multiple block command is broken up.  A read that only
+ * waits for the Z80 to drain the ring is done with the card, and reading on
+ * from where it stopped continues the same command.
+ */
+static bool IBC_HDC_XferActive(void)
+{
+    return sx_active && (sx_write || (sx_seq != sx_count));
+}
+#else
+static bool IBC_HDC_XferStep(void)
+{
+    /* Only the end of the FIFO stalls, so a timeout there is an overrun too. */
+    if (z80_ssd_fifo_timed_out()) {
+        secbuf_overrun = true;
+        z80_ssd_fifo_timeout_clear();
+    }
+    /* The Z80 ran off the end of the FIFO; start it over, as an overrun. */
+    if (((uint8_t)(secbuf_index >> 8) >= IBC_HDC_RING_SLOTS) && z80_ssd_fifo_stalled()) {
+        secbuf_overrun = true;
+        secbuf_index = 0;
+        z80_ssd_fifo_resume();
+    }
+    return false;
+}
+static bool IBC_HDC_XferStart(uint8_t drive, uint32_t offset, uint16_t len, bool write, bool data_ready) { return false; }
+static void IBC_HDC_XferFinish(void) {}
+static bool IBC_HDC_XferActive(void) { return false; }
+#endif /* IBC_HDC_READ_OVERLAP || IBC_HDC_WRITE_OVERLAP */
+
+#ifdef IBC_HDC_EARLY_SEEK
+/* Start on a command while the Z80 is still writing the second half of its
+ * task file.  The cylinder is already known, so work out where it starts in
+ * the drive image and, unless the image is raw mapped, move the FatFs cursor
+ * there: any FAT chain walking is done now, and the seek once the command
+ * arrives stays within the cylinder.  A cursor already in that cylinder is
+ * left alone, as the sector may lie behind it.  Returns false if there is
+ * nothing to do.
+ */
+static bool IBC_HDC_EarlySeek(void)
+{
+    IBC_HDC_DRIVE_INFO *pDrive;
+    uint8_t cmd;
+    uint32_t cyl_len;
+    uint32_t pos;
 
-#define DEV_NAME    "IBCHDC"
+    if (!es_pending) {
+        return false;
+    }
+    es_pending = false;
 
-/* Task File Register Offsets */
-#define TF_CSEC     0
-#define TF_HEAD     1
-#define TF_NSEC     2
-#define TF_SA3      3
-#define TF_CMD      4
-#define TF_DRIVE    5
-#define TF_TRKL     6
-#define TF_TRKH     7
-#define TF_FIFO     8
+    cmd = ibc_hdc_info->taskfile[TF_CMD] & 0x7F;
+    if ((cmd != IBC_HDC_CMD_READ_SECT) && (cmd != IBC_HDC_CMD_WRITE_SECT) && (cmd != IBC_HDC_CMD_FORMAT_TRK)) {
+        return false;
+    }
 
-#define IBC_HDC_STATUS_BUSY         (1 << 7)
-#define IBC_HDC_STATUS_READY        (1 << 6)
-#define IBC_HDC_STATUS_WRITE_FAULT  (1 << 5)
-#define IBC_HDC_STATUS_SEEK_COMPL   (1 << 4)
-#define IBC_HDC_STATUS_DRQ          (1 << 3)
-#define IBC_HDC_STATUS_ERROR        (1 << 0)
+    es_drive = ibc_hdc_info->taskfile[TF_DRIVE] & 0x03;
+    es_cyl   = (uint16_t)ibc_hdc_info->taskfile[TF_TRKH] << 8;
+    es_cyl  |= ibc_hdc_info->taskfile[TF_TRKL];
+    pDrive = &ibc_hdc_info->drive[es_drive];
+    if (es_cyl >= pDrive->ncyls) {
+        es_valid = false;
+        return false;
+    }
+    cyl_len = ((uint32_t)pDrive->nheads * (uint32_t)pDrive->nsectors) << 8;
+    es_base = es_cyl * cyl_len;
+    es_valid = true;
+
+    /* Short writes go to the cache and are written back later, from
+     * wherever the cursor is by then, so only reads and formats seek.
+     */
+    if ((cmd == IBC_HDC_CMD_WRITE_SECT) ||
+        (es_base >= f_size(&file[es_drive])) || IBC_HDC_RawMapped(es_drive, es_base, 0)) {
+        return true;
+    }
 
-#define IBC_HDC_ERROR_ID_NOT_FOUND  (1 << 4)
+    pos = f_tell(&file[es_drive]);
+    if ((pos < es_base) || ((pos - es_base) >= cyl_len)) {
+        if (f_lseek(&file[es_drive], es_base) == FR_OK) {
+            es_seeks++;
+        }
+    }
+    return true;
+}
 
-#define IBC_HDC_CMD_RESET           0x00
-#define IBC_HDC_CMD_READ_SECT       0x01
-#define IBC_HDC_CMD_WRITE_SECT      0x02
-#define IBC_HDC_CMD_FORMAT_TRK      0x08
-#define IBC_HDC_CMD_ACCESS_FIFO     0x0b
-#define IBC_HDC_CMD_READ_PARAMETERS 0x10
+/* Image offset of the current cylinder of the selected drive. */
+static uint32_t IBC_HDC_CylinderBase(IBC_HDC_DRIVE_INFO *pDrive)
+{
+    es_pending = false;
+    if (es_valid && (es_drive == ibc_hdc_info->sel_drive) && (es_cyl == pDrive->cur_cyl)) {
+        return es_base;
+    }
+    return ((uint32_t)pDrive->cur_cyl * (uint32_t)pDrive->nheads * (uint32_t)pDrive->nsectors) << 8;
+}
+#else
+static bool IBC_HDC_EarlySeek(void) { return false; }
 
-#define IBC_HDC_REG_STATUS          0x40
-#define IBC_HDC_REG_FIFO_STATUS     0x44
-#define IBC_HDC_REG_FIFO            0x48
-#define IBC_HDC_TEST_LOOPBACK       0x4c
-#define IBC_HDC_TEST_INCR           0x4d
+static uint32_t IBC_HDC_CylinderBase(IBC_HDC_DRIVE_INFO *pDrive)
+{
+    return ((uint32_t)pDrive->cur_cyl * (uint32_t)pDrive->nheads * (uint32_t)pDrive->nsectors) << 8;
+}
+#endif /* IBC_HDC_EARLY_SEEK */
+
+#if defined(IBC_HDC_FAST_READ) && defined(IBC_HDC_CACHE)
+static volatile bool fr_pending;    /* CLC2_ISR completed a READ_SECT the main loop
+                                       hasn't accounted for yet */
+static uint8_t  fr_drive;           /* Drive and image offset of that READ_SECT */
+static uint32_t fr_offset;
+static uint16_t fr_ticks;           /* TMR1 ticks it took in CLC2_ISR */
+
+/* Complete a one-sector READ_SECT that hits the cache in CLC2_ISR, on the
+ * write that ends the task file, so the Z80's first status poll already sees
+ * it done.  The sector is copied into the first slot of sectbuf, which is
+ * free as long as no transfer is streaming through it; WAIT# is held for the
+ * copy, so longer reads are left to the main loop.  The main loop accounts for the command later, in
+ * IBC_HDC_FastReadDone().  Returns false if the main loop must run the
+ * command.
+ */
+static bool IBC_HDC_FastRead(void)
+{
+    IBC_HDC_DRIVE_INFO *pDrive = &ibc_hdc_info->drive[ibc_hdc_info->sel_drive];
+    IBC_HDC_CACHE_LINE *pLine;
+    uint16_t start = TMR1_ReadTimer();
+    uint16_t cyl;
+    uint8_t head = ibc_hdc_info->taskfile[TF_HEAD];
+    uint8_t sect = ibc_hdc_info->taskfile[TF_CSEC];
+    uint8_t nsects = ibc_hdc_info->taskfile[TF_NSEC];
+    uint32_t offset;
+
+    if (((ibc_hdc_info->taskfile[TF_CMD] & 0x7F) != IBC_HDC_CMD_READ_SECT) || fr_pending || late_error ||
+        (secbuf_ready != IBC_HDC_RING_SLOTS)) {
+        return false;
+    }
+#if defined(IBC_HDC_READ_OVERLAP) || defined(IBC_HDC_WRITE_OVERLAP)
+    if (sx_active) {
+        return false;
+    }
+#endif /* IBC_HDC_READ_OVERLAP || IBC_HDC_WRITE_OVERLAP */
 
-#define SCPE_OK						(0)
-#define SCPE_IOERR					(-1)
+    cyl  = (uint16_t)ibc_hdc_info->taskfile[TF_TRKH] << 8;
+    cyl |= ibc_hdc_info->taskfile[TF_TRKL];
+    /* A count of 0 is one sector. */
+    if ((nsects > 1) || (cyl >= pDrive->ncyls) || (head >= pDrive->nheads) || (sect >= pDrive->nsectors)) {
+        return false;
+    }
 
-typedef struct {
-    uint8_t  readonly;    /* Drive is read-only? */
-    uint16_t sectsize;    /* sector size */
-    uint16_t nsectors;    /* number of sectors/track */
-    uint16_t nheads;      /* number of heads */
-    uint16_t ncyls;       /* number of cylinders */
-    uint16_t cur_cyl;     /* Current cylinder */
-    uint8_t  cur_head;    /* Current Head */
-    uint8_t  cur_sect;    /* current starting sector of transfer */
-    uint16_t cur_sectsize;/* Current sector size in SA6 register */
-    uint16_t xfr_nsects;  /* Number of sectors to transfer */
-    uint8_t ready;        /* Is drive ready? */
-} IBC_HDC_DRIVE_INFO;
+    offset = (((uint32_t)cyl * pDrive->nheads + head) * pDrive->nsectors + sect) << 8;
+    if ((pLine = IBC_HDC_CacheFind(ibc_hdc_info->sel_drive, offset >> 9)) == NULL) {
+        return false;
+    }
+    memcpy(sectbuf, &pLine->data[(uint16_t)offset & 0x100], 256);
 
-typedef struct {
-    uint8_t   sel_drive;  /* Currently selected drive */
-    uint8_t   reg_temp_holding[4];
-    uint8_t   taskfile[9]; /* ATA Task File Registers */
-    volatile uint8_t   status_reg; /* IBC Disk Slave Status Register */
-    uint8_t   ndrives;    /* Number of drives attached to the controller */
-    IBC_HDC_DRIVE_INFO drive[IBC_HDC_MAX_DRIVES];
-} IBC_HDC_INFO;
+    pDrive->cur_cyl = cyl;
+    pDrive->cur_head = head;
+    pDrive->cur_sect = sect;
+    pDrive->xfr_nsects = 1;
+    pDrive->cur_sectsize = 256;
+    fr_drive = ibc_hdc_info->sel_drive;
+    fr_offset = offset;
+#ifdef IBC_HDC_EARLY_SEEK
+    es_pending = false;
+#endif /* IBC_HDC_EARLY_SEEK */
+    /* Start the FIFO over for the data, as doCommand() would have. */
+    secbuf_index = 0;
+    secbuf_written = false;
+    secbuf_overrun = false;
+    ibc_hdc_info->status_reg = 0x60;
+    fr_pending = true;
+    fr_ticks = TMR1_ReadTimer() - start;
+    return true;
+}
 
-const char *disk_filenames[4] = {
-    "IBCDISK0.dsk",
-    "IBCDISK1.dsk",
-    "IBCDISK2.dsk",
-    "IBCDISK3.dsk",
-};
+/* Do what doCommand() would have done besides the transfer for a READ_SECT
+ * completed by CLC2_ISR.  Returns false if there is nothing to do.
+ */
+static bool IBC_HDC_FastReadDone(void)
+{
+    if (!fr_pending) {
+        return false;
+    }
 
-static IBC_HDC_INFO ibc_hdc_info_data = { 0x0 };
-static IBC_HDC_INFO *ibc_hdc_info = &ibc_hdc_info_data;
+    idle_polls = 0;
+    sync_pending = true;
+    cache_clock++;
+    cmd_start = TMR1_ReadTimer32();
+    cmd_ticks = fr_ticks;
+    IBC_HDC_PerfBegin();
+    putchar('R');
+
+    /* Mark the line used, as IBC_HDC_CacheCopy() would have. */
+    IBC_HDC_CacheLookup(fr_drive, fr_offset >> 9);
+    IBC_HDC_ReadAheadTrack(fr_drive, fr_offset, 256, true);
+    cache_hits++;
+    fast_reads++;
+    ibc_trace(DEBUG_READ, TRC_READ, 1, 0);
+    IBC_HDC_StatSectors(false, 1);
+
+    IBC_HDC_PerfCommand(IBC_HDC_CMD_READ_SECT);
+    IBC_HDC_StatCommand(IBC_HDC_CMD_READ_SECT);
+    IBC_HDC_RecordCommand(IBC_HDC_CMD_READ_SECT);
+    fr_pending = false;
+    return true;
+}
+#else
+static bool IBC_HDC_FastRead(void) { return false; }
+static bool IBC_HDC_FastReadDone(void) { return false; }
+#endif /* IBC_HDC_FAST_READ && IBC_HDC_CACHE */
 
-uint8_t   sectbuf[IBC_HDC_MAX_SECLEN*10];
-#ifdef DEBUG
-static uint8_t test_reg = 0;
-#endif /* DEBUG */
-volatile uint16_t  secbuf_index;
-static uint16_t xfr_len;
-static uint32_t file_offset;
+/* One step of background work; false if there was nothing to do. */
+static bool IBC_HDC_IdleWork(void)
+{
+    /* One block per poll, so a new command isn't held up for long. */
+    if (IBC_HDC_FastReadDone() || IBC_HDC_XferStep() || IBC_HDC_EarlySeek()) {
+        return true;
+    }
 
-uint8_t IBC_HDC_Read(const uint8_t Addr);
-uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData);
-uint8_t IBC_HDC_doCommand(void);
+    /* Prefetch only once a streaming transfer is off the card, so its
+     * blocks stay in one multiple block command.
+     */
+    if (!IBC_HDC_XferActive() && IBC_HDC_ReadAhead()) {
+        return true;
+    }
 
-#define IBC_HDC_NAME    "IBC MCC ST-506 Hard Disk Controller"
+    return IBC_HDC_CacheFlushOne(idle_polls >= IBC_HDC_CACHE_IDLE_POLLS) || IBC_HDC_RecordFlush();
+}
 
-volatile extern bool do_command_flag;
+/* Called from the main loop while no command is pending.  Writes back
+ * dirty cache lines, then syncs the drive images once the controller has
+ * had nothing to do for IBC_HDC_SYNC_IDLE_MS.
+ */
+void IBC_HDC_IdleTasks(void)
+{
+    if (idle_polls < IBC_HDC_CACHE_IDLE_POLLS) {
+        idle_polls++;
+    }
 
-static FATFS drive;
-static FIL file[IBC_HDC_MAX_DRIVES];
-static uint16_t actualLength;
+    if (IBC_HDC_IdleWork()) {
+        idle_start = TMR1_ReadTimer32();
+        return;
+    }
 
-//#define SDTEST
-#ifdef SDTEST
-#undef  DISK0_FILENAME
-#define DISK0_FILENAME  "8mbtest.dsk"
-static FIL ofile;
-static uint16_t writeLength;
-static uint32_t seek_offset;
-#endif /* SDTEST */
+    if (sync_pending && ((TMR1_ReadTimer32() - idle_start) >= (IBC_HDC_SYNC_IDLE_MS * 1000UL * TMR1_TICKS_PER_US))) {
+        IBC_HDC_SyncAll();
+        IBC_HDC_RecordSync();
+        sync_pending = false;
+    }
+}
 
 void IBC_HDC_Hard_Reset(void)
 {
     ibc_hdc_info->taskfile[TF_CMD] = 0;
-    debug_print(DEBUG_INFO, ("Hard Reset.\n\r"));
+#if defined(IBC_HDC_READ_OVERLAP) || defined(IBC_HDC_WRITE_OVERLAP)
+    /* Abandon a streaming read, but let a WRITE_SECT that has already been
+     * acknowledged finish draining to the card.
+     */
+    if (!sx_write) {
+        sx_active = false;
+        secbuf_ready = IBC_HDC_RING_SLOTS;
+    }
+#else
+    secbuf_ready = IBC_HDC_RING_SLOTS;
+#endif /* IBC_HDC_READ_OVERLAP || IBC_HDC_WRITE_OVERLAP */
+    ibc_trace(DEBUG_INFO, TRC_HARD_RESET, 0, 0);
 }
 
 void IBC_HDC_Reset(void)
 {
     char VolLabel[12];
-    uint32_t sn;
+
+    /* Make sure everything written so far is on the card. */
+    IBC_HDC_CacheFlushAll();
+    IBC_HDC_SyncAll();
+    if (write_count != 0) {
+        printf("Writes: %lu, SD commands: %lu, syncs: %lu\n\r", (unsigned long)write_count,
+            (unsigned long)write_sd_cmds, (unsigned long)sync_count);
+    }
+    if ((cache_hits | cache_writes) != 0) {
+        printf("Cache hits: %lu, writes: %lu, write-backs: %lu\n\r", (unsigned long)cache_hits,
+            (unsigned long)cache_writes, (unsigned long)cache_flushes);
+    }
+    if ((ra_hits | ra_misses) != 0) {
+        printf("Read-ahead hits: %lu, misses: %lu, wasted: %lu\n\r", (unsigned long)ra_hits,
+            (unsigned long)ra_misses, (unsigned long)ra_wasted);
+    }
+    if (es_seeks != 0) {
+        printf("Early seeks: %lu\n\r", (unsigned long)es_seeks);
+    }
+    if (fast_reads != 0) {
+        printf("Reads completed in CLC2_ISR: %lu\n\r", (unsigned long)fast_reads);
+    }
+    if (UART1_GetTxDroppedCount() != 0) {
+        printf("Console bytes dropped: %u\n\r", UART1_GetTxDroppedCount());
+    }
+#ifdef IBC_HDC_CACHE
+    memset(cache, 0, sizeof(cache));
+#endif /* IBC_HDC_CACHE */
+#ifdef IBC_HDC_READ_AHEAD
+    ra_window = 0;
+#endif /* IBC_HDC_READ_AHEAD */
+#ifdef IBC_HDC_EARLY_SEEK
+    es_valid = false;
+#endif /* IBC_HDC_EARLY_SEEK */
     
     memset(ibc_hdc_info, 0, sizeof(IBC_HDC_INFO));
     ibc_hdc_info->ndrives = IBC_HDC_MAX_DRIVES;
@@ -213,6 +2054,10 @@ void IBC_HDC_Reset(void)
     if (f_close(&file[3]) == FR_OK) {
         printf("Closed %s\n\r", disk_filenames[3]);
     }
+    IBC_HDC_RecordClose();
+
+    memset(clmt, 0, sizeof(clmt));
+    memset(unsynced_writes, 0, sizeof(unsynced_writes));
 
     if (f_unmount("0:") == FR_OK)
     {
@@ -221,13 +2066,15 @@ void IBC_HDC_Reset(void)
     if (f_mount(&drive,"0:",1) == FR_OK)
     {
         /* Get volume label of the default drive */
-        f_getlabel("", VolLabel, &sn);
+        vol_serial = 0;
+        f_getlabel("", VolLabel, &vol_serial);
 
-        printf("Volume Label: %s\nSerial number: %08lX\n\r", VolLabel, sn);
+        printf("Volume Label: %s\nSerial number: %08lX\n\r", VolLabel, (unsigned long)vol_serial);
 
         if (f_open(&file[0], disk_filenames[0], FA_READ | FA_WRITE) == FR_OK)
         {
             printf("Opened %s.\n\r", disk_filenames[0]);
+            IBC_HDC_MapImage(0);
 
 #ifdef SDTEST
             if (f_open(&ofile, "filecopy.bin", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK)
@@ -238,7 +2085,7 @@ void IBC_HDC_Reset(void)
                 /* Copy source to destination */
                 for (;;) {
                     f_read(&file[ibc_hdc_info->sel_drive], sectbuf, sizeof(sectbuf), &actualLength); /* Read a chunk of data from the source file */
-                    printf("R[%05lu]\n\r", seek_offset);
+                    printf("R[%05lu]\n\r", (unsigned long)seek_offset);
                     if (actualLength == 0) {
                         printf("Error reading.\n\r");
                         break; /* error or eof */
@@ -248,7 +2095,7 @@ void IBC_HDC_Reset(void)
                     f_write(&ofile, sectbuf, actualLength, &writeLength);           /* Write it to the destination file */
                     putchar('W');
                     if (writeLength < actualLength) {
-                        printf("Error writing %d bytes.\n\r", actualLength);
+                        printf("Error writing %u bytes.\n\r", actualLength);
                         break; /* error or disk full */
                     }
                 }
@@ -269,10 +2116,12 @@ void IBC_HDC_Reset(void)
         if (f_open(&file[3], disk_filenames[3], FA_OPEN_ALWAYS | FA_READ | FA_WRITE) == FR_OK)
         {
             printf("Opened %s.\n\r", disk_filenames[3]);
+            IBC_HDC_MapImage(3);
         } else {
             printf("Could not open %s\n\r", disk_filenames[3]);
             ibc_hdc_info->status_reg |= IBC_HDC_STATUS_ERROR;
         }
+        IBC_HDC_RecordOpen();
     } else {
         printf("Mount SD card failed.\n\r");
     }
@@ -280,6 +2129,276 @@ void IBC_HDC_Reset(void)
     puts("IBC SSD: Reset Complete.\n\r");
 }
 
+/* Boot-time self-benchmark, to qualify an SD card before it goes into a
+ * machine.  A scratch file is written with f_write(), and its first fragment
+ * is used for raw SD_SPI_SectorWrite()/SD_SPI_SectorRead() runs: single
+ * blocks at random, and IBC_HDC_BENCH_MULTI blocks at a time in sequence.
+ * Reads are checked against what was written.  f_lseek() into IBCDISK0.dsk
+ * is timed walking the FAT chain and with a link map, then random 256-byte
+ * reads and write+f_sync cycles are timed through FatFs.  Results are
+ * printed and appended to SDBENCH.TXT.  Runs before the card is mounted for
+ * the Z80, using file[] and clmt[] as scratch.
+ */
+#define IBC_HDC_BENCH_TMP           "SDBENCH.TMP"
+#define IBC_HDC_BENCH_RESULTS       "SDBENCH.TXT"
+#define IBC_HDC_BENCH_MULTI         4       /* Blocks per multi-block transfer */
+#define IBC_HDC_BENCH_SEEKS         4       /* f_lseek() targets across the image */
+
+#ifdef IBC_HDC_BENCH
+static bool     bench_logging;      /* file[1] holds the results file */
+static uint32_t bench_rand = 1;
+
+static uint32_t IBC_HDC_BenchRandom(void)
+{
+    bench_rand = bench_rand * 1103515245UL + 12345UL;
+    return bench_rand >> 8;
+}
+
+/* Print a line of results and append it to the results file. */
+static void IBC_HDC_BenchPrint(const char *fmt, ...)
+{
+    static char line[80];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsprintf(line, fmt, ap);
+    va_end(ap);
+
+    while (!UART1_is_tx_done());
+    printf("%s\n\r", line);
+    if (bench_logging) {
+        f_puts(line, &file[1]);
+        f_puts("\r\n", &file[1]);
+    }
+}
+
+/* KB/s for 512-byte blocks moved in TMR1 ticks. */
+static uint32_t IBC_HDC_BenchRate(uint32_t blocks, uint32_t ticks)
+{
+    return (ticks != 0) ? blocks * (500000UL * TMR1_TICKS_PER_US) / ticks : 0;
+}
+
+static void IBC_HDC_BenchFill(uint8_t *data, DWORD lba, uint8_t nblocks)
+{
+    for (uint16_t i = 0; i < (uint16_t)nblocks * 512; i++) {
+        data[i] = (uint8_t)((lba + (i >> 9)) * 7 + i);
+    }
+}
+
+static bool IBC_HDC_BenchCheck(const uint8_t *data, DWORD lba, uint8_t nblocks)
+{
+    for (uint16_t i = 0; i < (uint16_t)nblocks * 512; i++) {
+        if (data[i] != (uint8_t)((lba + (i >> 9)) * 7 + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Time raw SD transfers over `blocks` blocks from `lba`: single blocks at
+ * random, or IBC_HDC_BENCH_MULTI at a time in sequence.  Only the driver
+ * calls and the final stream close are timed.
+ */
+static void IBC_HDC_BenchRaw(const char *name, DWORD lba, uint16_t blocks, bool multi, bool write)
+{
+    uint8_t n = multi ? IBC_HDC_BENCH_MULTI : 1;
+    uint16_t calls = multi ? blocks / IBC_HDC_BENCH_MULTI : IBC_HDC_BENCH_SAMPLES * 4;
+    uint16_t errors = 0;
+    uint32_t ticks = 0, start;
+    bool ok;
+
+    for (uint16_t i = 0; i < calls; i++) {
+        DWORD b = lba + (multi ? (DWORD)i * n : IBC_HDC_BenchRandom() % blocks);
+
+        if (write) {
+            IBC_HDC_BenchFill(sectbuf, b, n);
+            start = TMR1_ReadTimer32();
+            ok = SD_SPI_SectorWrite(b, sectbuf, n);
+        } else {
+            start = TMR1_ReadTimer32();
+            ok = SD_SPI_SectorRead(b, sectbuf, n);
+        }
+        ticks += TMR1_ReadTimer32() - start;
+        if (!ok || (!write && !IBC_HDC_BenchCheck(sectbuf, b, n))) {
+            errors++;
+        }
+    }
+    start = TMR1_ReadTimer32();
+    SD_SPI_StreamClose();
+    ticks += TMR1_ReadTimer32() - start;
+
+    IBC_HDC_BenchPrint("%-20s %5lu KB/s %6lu us/call %u errors", name,
+                       (unsigned long)IBC_HDC_BenchRate((uint32_t)calls * n, ticks),
+                       (unsigned long)(ticks / calls / TMR1_TICKS_PER_US), errors);
+}
+
+/* Random 256-byte reads, or writes followed by f_sync(), of the scratch
+ * file through FatFs.
+ */
+static void IBC_HDC_BenchRandomFile(const char *name, bool write)
+{
+    uint32_t min = UINT32_MAX, max = 0, sum = 0, ticks, start;
+    uint16_t errors = 0;
+    UINT len;
+
+    for (uint16_t i = 0; i < IBC_HDC_BENCH_SAMPLES; i++) {
+        uint32_t offset = (IBC_HDC_BenchRandom() % (IBC_HDC_BENCH_BLOCKS * 2UL)) << 8;
+        FRESULT res;
+
+        start = TMR1_ReadTimer32();
+        res = f_lseek(&file[2], offset);
+        if (write) {
+            if (res == FR_OK) res = f_write(&file[2], sectbuf, 256, &len);
+            if (res == FR_OK) res = f_sync(&file[2]);
+        } else {
+            if (res == FR_OK) res = f_read(&file[2], sectbuf, 256, &len);
+        }
+        ticks = TMR1_ReadTimer32() - start;
+        if ((res != FR_OK) || (len != 256)) {
+            errors++;
+        }
+        sum += ticks;
+        if (ticks < min) min = ticks;
+        if (ticks > max) max = ticks;
+    }
+    IBC_HDC_BenchPrint("%-20s min %lu avg %lu max %lu us, %u errors", name,
+                       (unsigned long)(min / TMR1_TICKS_PER_US),
+                       (unsigned long)(sum / IBC_HDC_BENCH_SAMPLES / TMR1_TICKS_PER_US),
+                       (unsigned long)(max / TMR1_TICKS_PER_US), errors);
+}
+
+/* Time f_lseek() from the start of IBCDISK0.dsk to points across it. */
+static void IBC_HDC_BenchSeek(const char *name)
+{
+    uint32_t size = f_size(&file[0]), start, ticks;
+
+    for (uint8_t i = 1; i <= IBC_HDC_BENCH_SEEKS; i++) {
+        uint32_t offset = (size / IBC_HDC_BENCH_SEEKS * i - 1) & ~511UL;
+
+        f_lseek(&file[0], 0);
+        start = TMR1_ReadTimer32();
+        f_lseek(&file[0], offset);
+        ticks = TMR1_ReadTimer32() - start;
+        IBC_HDC_BenchPrint("f_lseek %-8s %3d%% %7lu us", name, i * (100 / IBC_HDC_BENCH_SEEKS),
+                           (unsigned long)(ticks / TMR1_TICKS_PER_US));
+    }
+}
+
+/* Tests on the scratch file, file[2]. */
+static void IBC_HDC_BenchScratch(void)
+{
+    FATFS *fs = &drive;
+    uint32_t start, ticks;
+    uint16_t blocks;
+    DWORD lba;
+    UINT len;
+
+    if (f_open(&file[2], IBC_HDC_BENCH_TMP, FA_CREATE_ALWAYS | FA_READ | FA_WRITE) != FR_OK) {
+        IBC_HDC_BenchPrint("Could not create %s.", IBC_HDC_BENCH_TMP);
+        return;
+    }
+    memset(sectbuf, 0xE5, sizeof(sectbuf));
+    start = TMR1_ReadTimer32();
+    for (blocks = 0; blocks < IBC_HDC_BENCH_BLOCKS; blocks += IBC_HDC_BENCH_MULTI) {
+        if ((f_write(&file[2], sectbuf, IBC_HDC_BENCH_MULTI * 512, &len) != FR_OK) ||
+            (len != IBC_HDC_BENCH_MULTI * 512)) {
+            break;
+        }
+    }
+    f_sync(&file[2]);
+    ticks = TMR1_ReadTimer32() - start;
+    IBC_HDC_BenchPrint("%-20s %5lu KB/s", "FatFs seq write", (unsigned long)IBC_HDC_BenchRate(blocks, ticks));
+    if (blocks < IBC_HDC_BENCH_BLOCKS) {
+        IBC_HDC_BenchPrint("Card full after %u blocks.", blocks);
+        return;
+    }
+
+    /* Raw tests stay within the first fragment of the scratch file. */
+    clmt[2][0] = IBC_HDC_CLMT_LEN;
+    file[2].cltbl = clmt[2];
+    if (f_lseek(&file[2], CREATE_LINKMAP) != FR_OK) {
+        file[2].cltbl = NULL;
+    }
+    lba = fs->database + (DWORD)fs->csize * (clmt[2][2] - 2);
+    if ((DWORD)fs->csize * clmt[2][1] < blocks) {
+        blocks = (uint16_t)(fs->csize * clmt[2][1]);
+    }
+    IBC_HDC_BenchRaw("SD write single", lba, blocks, false, true);
+    IBC_HDC_BenchRaw("SD write multi", lba, blocks, true, true);
+    IBC_HDC_BenchRaw("SD read single", lba, blocks, false, false);
+    IBC_HDC_BenchRaw("SD read multi", lba, blocks, true, false);
+
+    /* Don't let FatFs serve a stale copy of a sector the raw writes replaced. */
+    if ((fs->wflag == 0) && (fs->winsect >= lba) && (fs->winsect < lba + blocks)) {
+        fs->winsect = (DWORD)-1;
+    }
+
+    IBC_HDC_BenchRandomFile("FatFs read 256", false);
+    IBC_HDC_BenchRandomFile("FatFs write+sync 256", true);
+}
+
+/* f_lseek() into IBCDISK0.dsk, file[0], with and without a link map. */
+static void IBC_HDC_BenchImage(void)
+{
+    uint32_t start, ticks;
+
+    if (f_open(&file[0], disk_filenames[0], FA_READ) != FR_OK) {
+        IBC_HDC_BenchPrint("Could not open %s.", disk_filenames[0]);
+        return;
+    }
+    IBC_HDC_BenchSeek("chain");
+    clmt[0][0] = IBC_HDC_CLMT_LEN;
+    file[0].cltbl = clmt[0];
+    start = TMR1_ReadTimer32();
+    if (f_lseek(&file[0], CREATE_LINKMAP) == FR_OK) {
+        ticks = TMR1_ReadTimer32() - start;
+        IBC_HDC_BenchPrint("Link map: %lu fragment(s), built in %lu us", (unsigned long)((clmt[0][0] - 2) / 2),
+                           (unsigned long)(ticks / TMR1_TICKS_PER_US));
+        IBC_HDC_BenchSeek("link map");
+    } else {
+        IBC_HDC_BenchPrint("Link map needs %lu entries.", (unsigned long)clmt[0][0]);
+    }
+    f_close(&file[0]);
+}
+
+void IBC_HDC_SelfBench(void)
+{
+    uint32_t start = TMR1_ReadTimer32();
+    bool logged;
+
+    printf("SD card self-benchmark.\n\r");
+    if (!SD_SPI_IsMediaPresent() || (f_mount(&drive, "0:", 1) != FR_OK)) {
+        printf("Mount SD card failed.\n\r");
+        return;
+    }
+
+    logged = bench_logging = (f_open(&file[1], IBC_HDC_BENCH_RESULTS, FA_OPEN_APPEND | FA_WRITE) == FR_OK);
+    IBC_HDC_BenchPrint("SD card: %lu sectors, %u sectors/cluster, mounted in %lu ms",
+                       (unsigned long)SD_SPI_GetSectorCount(), drive.csize,
+                       (unsigned long)((TMR1_ReadTimer32() - start) / (1000UL * TMR1_TICKS_PER_US)));
+
+    IBC_HDC_BenchScratch();
+    f_close(&file[2]);
+    f_unlink(IBC_HDC_BENCH_TMP);
+    IBC_HDC_BenchImage();
+
+    if (bench_logging) {
+        f_puts("\r\n", &file[1]);
+        f_close(&file[1]);
+        bench_logging = false;
+    }
+    memset(file, 0, sizeof(file));
+    memset(clmt, 0, sizeof(clmt));
+    f_unmount("0:");
+    printf("Self-benchmark done%s.\n\r", logged ? ", results appended to " IBC_HDC_BENCH_RESULTS : "");
+}
+#else
+void IBC_HDC_SelfBench(void)
+{
+    printf("SD card self-benchmark not built in (IBC_HDC_BENCH).\n\r");
+}
+#endif /* IBC_HDC_BENCH */
+
 /* I/O Write to IBC Disk Slave Task File */
 uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData)
 {
@@ -287,11 +2406,7 @@ uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData)
 
     pDrive = &ibc_hdc_info->drive[ibc_hdc_info->sel_drive];
 
-#ifdef DEBUG
-    INTERRUPT_GlobalInterruptHighDisable();
-    debug_print(DEBUG_REGWR, ("WR:%02x=%02x\n\r", Addr, cData));
-    INTERRUPT_GlobalInterruptHighEnable();
-#endif /* DEBUG */
+    ibc_trace(DEBUG_REGWR, TRC_REGWR, Addr, cData);
 
     switch(Addr) {
     case 0x40:
@@ -305,6 +2420,9 @@ uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData)
                 ibc_hdc_info->sel_drive = ibc_hdc_info->taskfile[TF_DRIVE] & 0x03;
             }
             ibc_hdc_info->status_reg = 0x30;
+#ifdef IBC_HDC_EARLY_SEEK
+            es_pending = true;
+#endif /* IBC_HDC_EARLY_SEEK */
         }
         else {
             ibc_hdc_info->taskfile[TF_CSEC] = ibc_hdc_info->reg_temp_holding[0];
@@ -319,7 +2437,7 @@ uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData)
                 if (ibc_hdc_info->taskfile[TF_CMD] != IBC_HDC_CMD_RESET) {
                     printf("ERROR: command already in progress.\n\r");
                 }
-            } else {
+            } else if (!IBC_HDC_FastRead()) {
                 ibc_hdc_info->status_reg = 0x10;    /* HDC is busy */
                 do_command_flag = 1;
             }
@@ -333,10 +2451,18 @@ uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData)
         break;
     case IBC_HDC_REG_FIFO_STATUS:
         secbuf_index = 0;
+        secbuf_written = false;
+        secbuf_overrun = false;
         break;
     case IBC_HDC_REG_FIFO:
         sectbuf[secbuf_index++] = cData;
+        secbuf_written = true;
+        break;
+#ifdef IBC_HDC_STATS
+    case IBC_HDC_REG_STATS_INDEX:
+        IBC_HDC_StatSelect(cData);
         break;
+#endif /* IBC_HDC_STATS */
 #ifdef DEBUG
     case IBC_HDC_TEST_LOOPBACK:
         test_reg = cData;
@@ -348,7 +2474,7 @@ uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData)
         break;
 #endif /* DEBUG */
     default:
-        debug_print(DEBUG_ERROR, ("Unhandled WR:%02x=%02x\n\r", Addr, cData));
+        ibc_trace(DEBUG_ERROR, TRC_BAD_WR, Addr, cData);
         break;
     }
 
@@ -367,16 +2493,26 @@ uint8_t IBC_HDC_Read(const uint8_t Addr)
     switch (Addr) {
     case IBC_HDC_REG_STATUS:
         cData = ibc_hdc_info->status_reg;
-        debug_print(DEBUG_REGRD, ("RD STATUS=0x%02x\n\r", cData));
+        if ((cData & (0x10 | IBC_HDC_STATUS_ERROR)) == IBC_HDC_STATUS_ERROR) {
+            late_error = false;     /* Reported, with the HDC not busy */
+        }
+        ibc_trace(DEBUG_REGRD, TRC_REGRD, Addr, cData);
         break;
     case IBC_HDC_REG_FIFO:
         cData = sectbuf[secbuf_index];
-
-        debug_print(DEBUG_FIFO, ("RD FIFO[%02x]=0x%02x\n\r", secbuf_index, cData));
+        ibc_trace(DEBUG_FIFO, TRC_FIFO_RD, (uint8_t)secbuf_index, cData);
         secbuf_index++;
         break;
     case IBC_HDC_REG_FIFO_STATUS:
         break;
+#ifdef IBC_HDC_STATS
+    case IBC_HDC_REG_STATS_INDEX:
+        cData = STAT_COUNT;
+        break;
+    case IBC_HDC_REG_STATS_DATA:
+        cData = IBC_HDC_StatRead();
+        break;
+#endif /* IBC_HDC_STATS */
 #ifdef DEBUG
     case IBC_HDC_TEST_LOOPBACK:
         cData = test_reg;
@@ -388,7 +2524,7 @@ uint8_t IBC_HDC_Read(const uint8_t Addr)
         break;
 #endif /* DEBUG */
     default:
-        debug_print(DEBUG_ERROR, ("Unhandled RD 0x%02x=0x%02x\n\r", Addr, cData));
+        ibc_trace(DEBUG_ERROR, TRC_BAD_RD, Addr, cData);
         break;
     }
     return (cData);
@@ -410,7 +2546,7 @@ static int IBC_HDC_Validate_CHSN(IBC_HDC_DRIVE_INFO* pDrive)
         /* Set error bit in status register. */
         ibc_hdc_info->status_reg |= IBC_HDC_STATUS_ERROR;
 
-        printf("Drive %d: C:%d/H:%d/S:%d/N:%d: ID Not Found (check disk geometry.)\n\r",
+        printf("Drive %u: C:%u/H:%u/S:%u/N:%u: ID Not Found (check disk geometry.)\n\r",
             ibc_hdc_info->sel_drive,
             pDrive->cur_cyl,
             pDrive->cur_head,
@@ -452,9 +2588,19 @@ unsigned char HDParameters[108] = {
 uint8_t IBC_HDC_doCommand(void)
 {
     uint8_t fstatus = FR_OK;
+    bool raw;
+    bool data_ready = false;
+    bool data_overrun = false;
+    bool failed = false;
+    uint16_t sd_cmds;
+    uint16_t hits;
+    uint32_t start;
     IBC_HDC_DRIVE_INFO* pDrive;
     uint8_t cmd = ibc_hdc_info->taskfile[TF_CMD];
 
+    /* Account for a READ_SECT done by CLC2_ISR before the idle loop got to it. */
+    IBC_HDC_FastReadDone();
+
     pDrive = &ibc_hdc_info->drive[ibc_hdc_info->sel_drive];
 
     pDrive->cur_cyl    = (uint16_t)ibc_hdc_info->taskfile[TF_TRKH] << 8;
@@ -467,80 +2613,135 @@ uint8_t IBC_HDC_doCommand(void)
     if (pDrive->xfr_nsects == 0) {
         pDrive->xfr_nsects = 1;
     }
+    idle_polls = 0;
+    sync_pending = true;
+    cmd_start = TMR1_ReadTimer32();
+    IBC_HDC_PerfBegin();
+
+    if (cmd != IBC_HDC_CMD_ACCESS_FIFO) {
+        IBC_HDC_XferFinish();
+
+        /* The FIFO only holds data for this command if the Z80 has written
+         * it since starting it over.  Start it over for the command's own
+         * data, so nothing an earlier command left in it is taken for that.
+         */
+        data_ready = secbuf_written || secbuf_overrun;
+        data_overrun = secbuf_overrun;
+        secbuf_index = 0;
+        secbuf_written = false;
+        secbuf_overrun = false;
+    }
 
     switch (cmd) {
     case IBC_HDC_CMD_RESET:  /* Reset */
         INTERRUPT_GlobalInterruptHighDisable();
-        debug_print(DEBUG_INFO, ("RESET COMMAND 0x%02x\n\r", cmd));
-        IBC_HDC_Reset();
+        ibc_trace(DEBUG_INFO, TRC_RESET, cmd, 0);
+        start = IBC_HDC_PerfStart();
+        IBC_HDC_Reset();    /* Mostly remounting the card */
+        IBC_HDC_PerfEnd(PH_OPEN, start);
         ibc_hdc_info->status_reg = 0x00;
         INTERRUPT_GlobalInterruptHighEnable();
         break;
     case IBC_HDC_CMD_READ_SECT:
     case IBC_HDC_CMD_WRITE_SECT:
     {
-#ifdef DEBUG
-        INTERRUPT_GlobalInterruptHighDisable();
-#endif /* DEBUG */
-
         /* Abort the read/write operation if C/H/S/N is not valid. */
         if (IBC_HDC_Validate_CHSN(pDrive) != SCPE_OK) break;
 
-        /* Calculate file offset */
-        file_offset  = ((uint32_t)pDrive->cur_cyl * (uint32_t)pDrive->nheads * (uint32_t)pDrive->nsectors);   /* Full cylinders */
-        file_offset += ((uint32_t)pDrive->cur_head * (uint32_t)pDrive->nsectors);   /* Add full heads */
+        /* Calculate file offset; the cylinder was usually resolved while
+         * the Z80 wrote the rest of the task file.
+         */
+        file_offset  = ((uint32_t)pDrive->cur_head * (uint32_t)pDrive->nsectors);   /* Full heads */
         file_offset += ((uint32_t)pDrive->cur_sect);  /* Add sectors for current request */
         file_offset <<= 8; //*= (uint32_t)pDrive->sectsize;    /* Convert #sectors to byte offset */
+        file_offset += IBC_HDC_CylinderBase(pDrive);   /* Add full cylinders */
 
         xfr_len = pDrive->xfr_nsects * pDrive->sectsize;
-
-        f_lseek(&file[ibc_hdc_info->sel_drive], file_offset);
+        cache_clock++;
 
         if (cmd == IBC_HDC_CMD_READ_SECT) { /* Read */
             putchar('R');
-            f_read(&file[ibc_hdc_info->sel_drive], sectbuf, xfr_len, &actualLength);
-            debug_print(DEBUG_READ, ("Drive %d: READ SECTOR  C:%04d/H:%d/S:%04d/#:%2d, offset=%lx, len=%4d\n\r",
-                ibc_hdc_info->sel_drive,
-                pDrive->cur_cyl, pDrive->cur_head,
-                pDrive->cur_sect, pDrive->xfr_nsects, file_offset, xfr_len));
+            hits = 0;
+            if ((xfr_len <= sizeof(sectbuf)) &&
+                ((hits = IBC_HDC_CacheCopy(ibc_hdc_info->sel_drive, file_offset, sectbuf, xfr_len, false)) == pDrive->xfr_nsects)) {
+                actualLength = xfr_len;
+            } else if (IBC_HDC_XferStart(ibc_hdc_info->sel_drive, file_offset, xfr_len, false, true)) {
+                /* Status goes ready with the first slot resident. */
+                actualLength = xfr_len;
+                hits = 0;
+            } else if (xfr_len > sizeof(sectbuf)) {
+                printf("Error: %u sectors won't fit in the FIFO.\n\r", pDrive->xfr_nsects);
+                actualLength = 0;
+            } else {
+                if (IBC_HDC_RawMapped(ibc_hdc_info->sel_drive, file_offset, xfr_len)) {
+                    actualLength = (IBC_HDC_RawXfer(ibc_hdc_info->sel_drive, file_offset, sectbuf, xfr_len, false) == SCPE_OK) ? xfr_len : 0;
+                } else {
+                    IBC_HDC_Seek(ibc_hdc_info->sel_drive, file_offset, xfr_len);
+                    IBC_HDC_FXfer(ibc_hdc_info->sel_drive, sectbuf, xfr_len, &actualLength, false);
+                }
+                /* Cached sectors may be newer than the card. */
+                hits = IBC_HDC_CacheCopy(ibc_hdc_info->sel_drive, file_offset, sectbuf, xfr_len, false);
+            }
+            IBC_HDC_ReadAheadTrack(ibc_hdc_info->sel_drive, file_offset, xfr_len, (hits == pDrive->xfr_nsects));
+            cache_hits += hits;
+            ibc_trace(DEBUG_READ, TRC_READ, (uint8_t)hits, 0);
 
             if (actualLength != xfr_len) {
-                printf("Error: tried to read %d but got %d\n\r", xfr_len, actualLength);
-                ibc_hdc_info->status_reg |= IBC_HDC_STATUS_ERROR;
+                printf("Error: tried to read %u but got %u\n\r", xfr_len, actualLength);
+                failed = true;
+            } else {
+                IBC_HDC_StatSectors(false, pDrive->xfr_nsects);
             }
             ibc_hdc_info->status_reg = 0x60;
         }
         else { /* Write */
             putchar('W');
-            debug_print(DEBUG_WRITE, ("Drive %d: WRITE SECTOR C:%04d/H:%d/S:%04d/#:%2d, offset=%lx, len=%4d, ix=%d, file=%p\n\r",
-                ibc_hdc_info->sel_drive,
-                pDrive->cur_cyl, pDrive->cur_head,
-                pDrive->cur_sect, pDrive->xfr_nsects, file_offset, xfr_len,
-                secbuf_index,
-                &file));
-
-            if ((fstatus = f_write(&file[ibc_hdc_info->sel_drive], sectbuf, xfr_len, &actualLength)) != FR_OK) {
-                printf("Error 0x%02x writing.\n\r", fstatus);
+            sd_cmds = SD_SPI_GetCommandCount();
+            /* An unwritten FIFO means the data follows the command.  More
+             * data than the FIFO holds can't come first: the Z80 has
+             * overrun it.
+             */
+            if (data_ready && (data_overrun || (xfr_len > sizeof(sectbuf)))) {
+                printf("Error: FIFO overrun, %u sectors.\n\r", pDrive->xfr_nsects);
+                actualLength = 0;
+            } else if (data_ready && IBC_HDC_CacheWrite(ibc_hdc_info->sel_drive, file_offset, sectbuf, xfr_len)) {
+                /* Small writes, such as directory updates, complete as soon
+                 * as they are in the cache; the idle loop writes them back.
+                 */
+                actualLength = xfr_len;
+            } else if (IBC_HDC_XferStart(ibc_hdc_info->sel_drive, file_offset, xfr_len, true, data_ready)) {
+                /* Status goes ready at once; the idle loop writes the slots out. */
+                actualLength = xfr_len;
+            } else if (!data_ready) {
+                printf("Error: can't stream %u sectors.\n\r", pDrive->xfr_nsects);
+                actualLength = 0;
+            } else {
+                if (IBC_HDC_RawMapped(ibc_hdc_info->sel_drive, file_offset, xfr_len)) {
+                    /* Raw writes bypass FatFs, so there is nothing to sync. */
+                    actualLength = (IBC_HDC_RawXfer(ibc_hdc_info->sel_drive, file_offset, sectbuf, xfr_len, true) == SCPE_OK) ? xfr_len : 0;
+                } else {
+                    IBC_HDC_Seek(ibc_hdc_info->sel_drive, file_offset, xfr_len);
+                    if ((fstatus = IBC_HDC_FXfer(ibc_hdc_info->sel_drive, sectbuf, xfr_len, &actualLength, true)) != FR_OK) {
+                        printf("Error 0x%02x writing.\n\r", fstatus);
+                    }
+                    IBC_HDC_WriteDone(ibc_hdc_info->sel_drive);
+                }
+                /* Keep cached copies of these sectors current. */
+                IBC_HDC_CacheCopy(ibc_hdc_info->sel_drive, file_offset, sectbuf, xfr_len, true);
             }
             if (actualLength != xfr_len) {
-                printf("Error: tried to write %d but got %d\n\r", xfr_len, actualLength);
-                ibc_hdc_info->status_reg |= IBC_HDC_STATUS_ERROR;
+                printf("Error: tried to write %u but got %u\n\r", xfr_len, actualLength);
+                failed = true;
+            } else {
+                IBC_HDC_StatSectors(true, pDrive->xfr_nsects);
             }
 
-            f_close(&file[ibc_hdc_info->sel_drive]);
-
-            /* For some reason the first reopen always fails. */
-            for (uint8_t i = 0;i<10;i++) {
-                if (f_open(&file[ibc_hdc_info->sel_drive], disk_filenames[ibc_hdc_info->sel_drive], FA_READ | FA_WRITE) == FR_OK)
-                {
-                    break;
-                }
-            }
+            sd_cmds = SD_SPI_GetCommandCount() - sd_cmds;
+            write_count++;
+            write_sd_cmds += sd_cmds;
+            ibc_trace(DEBUG_WRITE, TRC_WRITE, (sd_cmds > 0xFF) ? 0xFF : (uint8_t)sd_cmds, 0);
         }
-        ibc_hdc_info->status_reg = 0x40;
-#ifdef DEBUG
-        INTERRUPT_GlobalInterruptHighEnable();
-#endif /* DEBUG */
+        ibc_hdc_info->status_reg = failed ? (0x40 | IBC_HDC_STATUS_ERROR) : 0x40;
         break;
     }
     case IBC_HDC_CMD_FORMAT_TRK:
@@ -555,33 +2756,33 @@ uint8_t IBC_HDC_doCommand(void)
         putchar('F');
 
         /* Calculate file offset, formatting always handles a full track at a time. */
-        file_offset = ((uint32_t)pDrive->cur_cyl * (uint32_t)pDrive->nheads * (uint32_t)pDrive->nsectors);   /* Full cylinders */
-        file_offset += ((uint32_t)pDrive->cur_head * (uint32_t)pDrive->nsectors);   /* Add full heads */
+        file_offset = ((uint32_t)pDrive->cur_head * (uint32_t)pDrive->nsectors);   /* Full heads */
         file_offset <<= 8; //*= pDrive->sectsize;    /* Convert #sectors to byte offset */
+        file_offset += IBC_HDC_CylinderBase(pDrive);   /* Add full cylinders */
 
-        debug_print(DEBUG_FORMAT, ("Drive %d: FORMAT TRACK: C:%d/H:%d/Fill=0x%02x/Len=%d, offset=%lx\n\r",
-        ibc_hdc_info->sel_drive,
-        pDrive->cur_cyl,
-        pDrive->cur_head, IBC_HDC_FORMAT_FILL_BYTE, data_len, file_offset));
+        ibc_trace(DEBUG_FORMAT, TRC_FORMAT, IBC_HDC_FORMAT_FILL_BYTE, 0);
 
         INTERRUPT_GlobalInterruptHighDisable();
         memset(sectbuf, IBC_HDC_FORMAT_FILL_BYTE, IBC_HDC_FORMAT_CHUNK_LEN);
-        f_lseek(&file[ibc_hdc_info->sel_drive], file_offset);
+        raw = IBC_HDC_RawMapped(ibc_hdc_info->sel_drive, file_offset, data_len);
+        if (!raw) {
+            IBC_HDC_Seek(ibc_hdc_info->sel_drive, file_offset, data_len);
+        }
         for (uint16_t bytesFormatted = 0; bytesFormatted < data_len; bytesFormatted += IBC_HDC_FORMAT_CHUNK_LEN) {
-            f_write(&file[ibc_hdc_info->sel_drive], sectbuf, IBC_HDC_FORMAT_CHUNK_LEN, &actualLength );
+            if (raw) {
+                actualLength = (IBC_HDC_RawXfer(ibc_hdc_info->sel_drive, file_offset + bytesFormatted, sectbuf, IBC_HDC_FORMAT_CHUNK_LEN, true) == SCPE_OK) ? IBC_HDC_FORMAT_CHUNK_LEN : 0;
+            } else {
+                IBC_HDC_FXfer(ibc_hdc_info->sel_drive, sectbuf, IBC_HDC_FORMAT_CHUNK_LEN, &actualLength, true);
+            }
+            IBC_HDC_CacheCopy(ibc_hdc_info->sel_drive, file_offset + bytesFormatted, sectbuf, IBC_HDC_FORMAT_CHUNK_LEN, true);
             if (actualLength != IBC_HDC_FORMAT_CHUNK_LEN) {
-                printf("Error: tried to write %d but got %d\n\r", IBC_HDC_FORMAT_CHUNK_LEN, actualLength);
+                printf("Error: tried to write %d but got %u\n\r", IBC_HDC_FORMAT_CHUNK_LEN, actualLength);
             }
             ibc_hdc_info->status_reg |= IBC_HDC_STATUS_ERROR;
         }
 
-        f_close(&file[ibc_hdc_info->sel_drive]);
-        /* For some reason the first reopen always fails. */
-        for (uint8_t i = 0;i<10;i++) {
-            if (f_open(&file[ibc_hdc_info->sel_drive], disk_filenames[ibc_hdc_info->sel_drive], FA_READ | FA_WRITE) == FR_OK)
-            {
-                    break;
-            }
+        if (!raw) {
+            IBC_HDC_WriteDone(ibc_hdc_info->sel_drive);
         }
         INTERRUPT_GlobalInterruptHighEnable();
         ibc_hdc_info->status_reg = 0x20;
@@ -589,23 +2790,14 @@ uint8_t IBC_HDC_doCommand(void)
         break;
     }
     case IBC_HDC_CMD_ACCESS_FIFO: /* Access FIFO */
-        debug_print(DEBUG_INFO, ("ACCESS FIFO  %d blocks.\n\r",
-            ibc_hdc_info->taskfile[TF_NSEC]));
+        ibc_trace(DEBUG_INFO, TRC_ACCESS_FIFO, 0, 0);
         secbuf_index = 0;
+        secbuf_written = false;
+        secbuf_overrun = false;
         ibc_hdc_info->status_reg = 0x20;
         break;
     case IBC_HDC_CMD_READ_PARAMETERS:  /* Read Drive Parameters */
-        debug_print(DEBUG_INFO, ("READ DRIVE PARAMETERS C:%0d/H:%d/S:%2d\n\r",
-            pDrive->cur_cyl, pDrive->cur_head, pDrive->cur_sect));
-
-        for (uint8_t i = 0; i < IBC_HDC_MAX_DRIVES; i++) {
-            debug_print(DEBUG_INFO, ("Drive %d: C:%d/H:%d/S:%d/N:%d\n\r",
-                    i,
-                    ibc_hdc_info->drive[i].ncyls,
-                    ibc_hdc_info->drive[i].nheads,
-                    ibc_hdc_info->drive[i].nsectors,
-                    ibc_hdc_info->drive[i].sectsize));
-        }
+        ibc_trace(DEBUG_INFO, TRC_READ_PARAMS, 0, 0);
 
         memcpy(sectbuf, HDParameters, sizeof(HDParameters));
         ibc_hdc_info->status_reg = 0x60;
@@ -616,6 +2808,22 @@ uint8_t IBC_HDC_doCommand(void)
         ibc_hdc_info->status_reg = 0x60;
         break;
     }
+
+    /* An earlier transfer failed after its command completed, and the Z80
+     * hasn't seen the error yet: fail this command with it.
+     */
+    INTERRUPT_GlobalInterruptHighDisable();
+    if (late_error) {
+        ibc_hdc_info->status_reg |= IBC_HDC_STATUS_ERROR;
+        late_error = false;
+    }
+    INTERRUPT_GlobalInterruptHighEnable();
+
+    idle_start = TMR1_ReadTimer32();
+    cmd_ticks = idle_start - cmd_start;
+    IBC_HDC_PerfCommand(cmd);
+    IBC_HDC_StatCommand(cmd);
+    IBC_HDC_RecordCommand(cmd);
     return SCPE_OK;
 }
 
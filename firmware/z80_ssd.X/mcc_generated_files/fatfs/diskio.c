@@ -10,6 +10,9 @@
 #include "diskio.h"		/* FatFs lower layer API */
 #include <stdio.h>
 #include "../../mcc_generated_files/sd_spi/sd_spi.h"
+#include "../../mcc_generated_files/tmr1.h"
+
+volatile DWORD disk_busy_ticks;
 
 
 /* Definitions of physical drive number for each drive */
@@ -96,6 +99,7 @@ DRESULT disk_read (
 )
 {
     DRESULT res = RES_PARERR;
+    DWORD start = TMR1_ReadTimer32();
 //    printf("DiskRead: LBA: %6lu, count=%d\n\r", sector, count);
     switch (pdrv) {
         case DRVA :
@@ -113,6 +117,7 @@ DRESULT disk_read (
             break;
     }
 
+    disk_busy_ticks += TMR1_ReadTimer32() - start;
     return res;
 }
 
@@ -130,6 +135,7 @@ DRESULT disk_write (
 )
 {
     DRESULT res = RES_PARERR;
+    DWORD start = TMR1_ReadTimer32();
 
 //    printf("DiskWrite: LBA: %6lu, count=%d\n\r", sector, count);
     switch (pdrv) {
@@ -148,6 +154,7 @@ DRESULT disk_write (
             break;
     }
 
+    disk_busy_ticks += TMR1_ReadTimer32() - start;
     return res;
 }
 
@@ -167,6 +174,13 @@ DRESULT disk_ioctl (
 
     switch (pdrv) {
         case DRVA :
+            if (cmd == CTRL_SYNC)
+            {
+                /* Terminate any open multi-block stream so all data written
+                 * so far is committed to the card.
+                 */
+                SD_SPI_StreamClose();
+            }
             return res;
 
         default:
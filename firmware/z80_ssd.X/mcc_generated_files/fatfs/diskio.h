@@ -35,6 +35,9 @@ DRESULT disk_read (BYTE pdrv, BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
+/* TMR1 ticks spent in disk_read() and disk_write() */
+extern volatile DWORD disk_busy_ticks;
+
 
 /* Disk Status Bits (DSTATUS) */
 
@@ -70,7 +70,10 @@ void  INTERRUPT_Initialize (void)
     GIE = state;
     // Assign peripheral interrupt priority vectors
     IPR6bits.CLC2IP = 1;
+    IPR3bits.TMR0IP = 1;
     IPR1bits.INT0IP = 1;
+    IPR4bits.U1TXIP = 0;
+    IPR3bits.TMR1IP = 0;
 }
 
 void __interrupt(irq(default),base(8)) Default_ISR()
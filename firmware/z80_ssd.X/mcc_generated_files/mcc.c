@@ -58,6 +58,8 @@ void SYSTEM_Initialize(void)
     CLC2_Initialize();
     EXT_INT_Initialize();
     UART1_Initialize();
+    TMR1_Initialize();
+    TMR0_Initialize();
     SPI1_Initialize();
 }
 
@@ -58,6 +58,8 @@
 #include "clc2.h"
 #include "clc1.h"
 #include "uart1.h"
+#include "tmr1.h"
+#include "tmr0.h"
 #include "sd_spi/sd_spi.h"
 #include "drivers/spi_master.h"
 #include "spi1.h"
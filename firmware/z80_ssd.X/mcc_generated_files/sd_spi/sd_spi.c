@@ -3,6 +3,7 @@
 #include <stdbool.h>
 
 #include "../pin_manager.h"
+#include "../tmr1.h"
 #include "../drivers/spi_master.h"
 
 #include "sd_spi.h"
@@ -17,10 +18,31 @@
 #define SD_NAC_TIMEOUT     (uint32_t)0x40000     //SPI byte times we should wait when performing read operations (should be at least 100ms for SD cards)
 #define SD_WRITE_TIMEOUT   (uint32_t)0xA0000     //SPI byte times to wait before timing out when the media is performing a write operation (should be at least 250ms for SD cards).
 
+// Description: Sequential stream mode.  When enabled, READ_MULTI_BLOCK and
+// WRITE_MULTI_BLOCK transactions are left open between calls to
+// SD_SPI_SectorRead()/SD_SPI_SectorWrite() as long as each request continues
+// at the LBA following the previous one.  A stream is only opened for a
+// request of more than one sector, or one that continues the previous
+// request; a lone single-sector request elsewhere is a READ_SINGLE_BLOCK or
+// WRITE_SINGLE_BLOCK, so random access pays no stop.  The transaction is
+// closed on a discontinuity, a request of the other direction, CTRL_SYNC, or
+// after SD_STREAM_IDLE_MS of TMR1 time with no transfers, checked by
+// SD_SPI_StreamIdleTasks().
+// Building with SD_SPI_STREAM_DISABLE defined falls back to one
+// READ_MULTI_BLOCK/WRITE_MULTI_BLOCK per call (ACMD23 pre-erase for writes,
+// closed by STOP_TRANSMISSION or the stop token before returning); the host
+// build's sdsim_single exercises that configuration.
+#ifndef SD_SPI_STREAM_DISABLE
+#define SD_SPI_STREAM_ENABLE
+#endif
+#define SD_STREAM_IDLE_MS    30ul                //Idle time before an open stream is closed
+
 #define SD_SPI_ChipSelect() SDCard_CS_SetLow()
 #define SD_SPI_ChipDeselect() SDCard_CS_SetHigh()
 #define SD_SPI_exchangeByte(data) spiMaster[SDFAST].exchangeByte(data)
 #define SD_SPI_exchangeBlock(data, length) spiMaster[SDFAST].exchangeBlock(data, length)
+#define SD_SPI_writeBlock(data, length) spiMaster[SDFAST].writeBlock(data, length)
+#define SD_SPI_readBlock(data, length) spiMaster[SDFAST].readBlock(data, length)
 #define SD_SPI_master_open(config) spiMaster[config].spiOpen()
 #define SD_SPI_close() spiMaster[SDFAST].spiClose()
 #define SD_SPI_GetCardDetect() SDCard_CD_GetValue()
@@ -285,6 +307,24 @@ typedef union
 static struct MEDIA_INFORMATION mediaInformation = {MEDIA_NO_ERROR, SD_MEDIA_BLOCK_SIZE, SD_STATE_NOT_INITIALIZED, 0ul, SD_MODE_NORMAL};
 static struct SD_ASYNC_IO ioInfo; //Declared global context, for fast/code efficient access
 
+#ifdef SD_SPI_STREAM_ENABLE
+enum SD_STREAM_STATE
+{
+    SD_STREAM_CLOSED,
+    SD_STREAM_READ,     //READ_MULTI_BLOCK in progress, card selected
+    SD_STREAM_WRITE     //WRITE_MULTI_BLOCK in progress, card selected
+};
+
+//State of the open sequential stream, if any.
+static struct
+{
+    enum SD_STREAM_STATE state;
+    enum SD_STREAM_STATE dir;   //Direction of the last request, CLOSED after an error
+    uint32_t nextLBA;           //LBA that continues the last request
+    uint32_t lastTicks;         //TMR1 time at the end of the last transfer
+} sdStream = {SD_STREAM_CLOSED, SD_STREAM_CLOSED, 0ul, 0ul};
+#endif
+
 // Summary: An enumeration of SD commands
 // Description: This enumeration corresponds to the position of each command in the sdmmc_cmdtable array
 //              These macros indicate to the SD_SendCmd function which element of the sdmmc_cmdtable array
@@ -357,8 +397,15 @@ static const struct SD_COMMAND_TABLE_ENTRY sdmmc_cmdtable[] =
  * Private Prototypes
  *****************************************************************************/
 static SD_RESPONSE SD_SendCmd(uint8_t cmd, uint32_t address);
+static uint32_t sdCommandCount;
 static uint8_t SD_SPI_AsyncWriteTasks(struct SD_ASYNC_IO* info);
 static uint8_t SD_SPI_AsyncReadTasks(struct SD_ASYNC_IO* info);
+#ifdef SD_SPI_STREAM_ENABLE
+static bool SD_SPI_StreamWanted(enum SD_STREAM_STATE dir, uint32_t sector_address, uint16_t sector_count);
+static void SD_SPI_StreamFollow(enum SD_STREAM_STATE dir, uint32_t sector_address, bool result);
+static bool SD_SPI_StreamSectorRead(uint32_t sector_address, uint8_t* buffer, uint16_t sector_count);
+static bool SD_SPI_StreamSectorWrite(uint32_t sector_address, const uint8_t* buffer, uint16_t sector_count);
+#endif
 
 
 /******************************************************************************
@@ -369,6 +416,16 @@ bool SD_SPI_IsMediaPresent(void)
     return SD_SPI_GetCardDetect() ? true: false;
 }//end MediaDetect
 
+uint16_t SD_SPI_GetCommandCount(void)
+{
+    return (uint16_t)sdCommandCount;
+}
+
+uint32_t SD_SPI_GetCommandTotal(void)
+{
+    return sdCommandCount;
+}
+
 uint16_t SD_SPI_GetSectorSize(void)
 {
     return mediaInformation.sectorSize;
@@ -384,42 +441,58 @@ bool SD_SPI_SectorRead(uint32_t sector_address, uint8_t* buffer, uint16_t sector
     struct SD_ASYNC_IO info;
     uint8_t status;
     bool result = false;
-    uint16_t i;
-    
-    for(i=0; i<sector_count; i++)
+    uint8_t* pNextPacket = buffer;
+
+    //Issue the whole request as a single READ_SINGLE_BLOCK or READ_MULTI_BLOCK
+    //command, so the SPI port is opened and the card selected only once no
+    //matter how many sectors FatFs asks for.
+    info.wNumBytes = 1 << 9;  //Equivalent to multiply by 512
+    info.dwBytesRemaining = (uint32_t)sector_count << 9;  //Equivalent to multiply by 512
+    info.pBuffer = buffer;
+    info.dwAddress = sector_address;
+    info.bStateVariable = SD_ASYNC_READ_QUEUED;
+
+#ifdef SD_SPI_STREAM_ENABLE
+    if(SD_SPI_StreamWanted(SD_STREAM_READ, sector_address, sector_count))
+    {
+        return SD_SPI_StreamSectorRead(sector_address, buffer, sector_count);
+    }
+#endif
+
+    if( SD_SPI_master_open(SDFAST) == false )
+    {
+        return false;
+    }
+    SD_SPI_ChipSelect();
+
+    while(1)
     {
-        //Initialize info structure for using the SD_SPI_AsyncReadTasks() function.
-        info.wNumBytes = 1 << 9;  //Equivalent to multiply by 512
-        info.dwBytesRemaining = 1 << 9;  //Equivalent to multiply by 512
-        info.pBuffer = buffer + (i << 9); //Equivalent to multiply by 512
-        info.dwAddress = sector_address + i;
-        info.bStateVariable = SD_ASYNC_READ_QUEUED;
-
-        if( SD_SPI_master_open(SDFAST) == false )
+        status = SD_SPI_AsyncReadTasks(&info);
+        if(status == SD_ASYNC_READ_NEW_PACKET_READY)
         {
-            return false;
+            //The next call receives one 512 byte block, point it at the
+            //next slot in the caller's buffer.
+            info.pBuffer = pNextPacket;
+            pNextPacket += 1 << 9;  //Equivalent to multiply by 512
         }
-        SD_SPI_ChipSelect();
-
-        while(1)
+        else if(status == SD_ASYNC_READ_COMPLETE)
         {
-            status = SD_SPI_AsyncReadTasks(&info);
-            if(status == SD_ASYNC_READ_COMPLETE)
-            {
-                result = true;
-                break;
-            }
-            else if(status == SD_ASYNC_READ_ERROR)
-            {
-                result = false;
-                break;
-            } 
-        }       
+            result = true;
+            break;
+        }
+        else if(status == SD_ASYNC_READ_ERROR)
+        {
+            result = false;
+            break;
+        } 
+    }       
 
-        SD_SPI_ChipDeselect();
-        SD_SPI_close();
-    }
-    
+    SD_SPI_ChipDeselect();
+    SD_SPI_close();
+
+#ifdef SD_SPI_STREAM_ENABLE
+    SD_SPI_StreamFollow(SD_STREAM_READ, sector_address, result);
+#endif
     return result;
 }    
 
@@ -428,44 +501,285 @@ bool SD_SPI_SectorWrite(uint32_t sector_address, const uint8_t* buffer, uint16_t
     struct SD_ASYNC_IO info;
     uint8_t status;
     bool result = false;
-    uint16_t i;
-    
-    for(i=0; i<sector_count; i++)
+    uint8_t* pNextPacket = (uint8_t*)buffer;
+
+    //Issue the whole request as a single WRITE_SINGLE_BLOCK or
+    //WRITE_MULTI_BLOCK command (preceded by the ACMD23 pre-erase hint), so
+    //the SPI port is opened and the card selected only once.
+    info.wNumBytes = 1 << 9;  //Equivalent to multiply by 512;
+    info.dwBytesRemaining = (uint32_t)sector_count << 9;  //Equivalent to multiply by 512
+    info.pBuffer = (uint8_t*)buffer;
+    info.dwAddress = sector_address;
+    info.bStateVariable = SD_ASYNC_WRITE_QUEUED;
+
+#ifdef SD_SPI_STREAM_ENABLE
+    if(SD_SPI_StreamWanted(SD_STREAM_WRITE, sector_address, sector_count))
     {
-        //Initialize structure so we write a single sector worth of data.
-        info.wNumBytes = 1 << 9;  //Equivalent to multiply by 512;
-        info.dwBytesRemaining = 1 << 9;  //Equivalent to multiply by 512
-        info.pBuffer = (uint8_t*)buffer + (i << 9); //Equivalent to multiply by 512
-        info.dwAddress = sector_address + i;
-        info.bStateVariable = SD_ASYNC_WRITE_QUEUED;
-
-        if( SD_SPI_master_open(SDFAST) == false )
+        return SD_SPI_StreamSectorWrite(sector_address, buffer, sector_count);
+    }
+#endif
+
+    if( SD_SPI_master_open(SDFAST) == false )
+    {
+        return false;
+    }
+    SD_SPI_ChipSelect();
+
+    while(1)
+    {
+        status = SD_SPI_AsyncWriteTasks(&info);
+        if(status == SD_ASYNC_WRITE_SEND_PACKET)
         {
-            return false;
+            //The next call transmits one 512 byte block, point it at the
+            //next slot in the caller's buffer.
+            info.pBuffer = pNextPacket;
+            pNextPacket += 1 << 9;  //Equivalent to multiply by 512
         }
-        SD_SPI_ChipSelect();
+        else if(status == SD_ASYNC_WRITE_COMPLETE)
+        {
+            result = true;
+            break;
+        }    
+        else if(status == SD_ASYNC_WRITE_ERROR)
+        {
+            result = false;
+            break;
+        }
+    }   
+
+    SD_SPI_ChipDeselect();
+    SD_SPI_close();
+
+#ifdef SD_SPI_STREAM_ENABLE
+    SD_SPI_StreamFollow(SD_STREAM_WRITE, sector_address, result);
+#endif
+    return result;
+}    
+
+#ifdef SD_SPI_STREAM_ENABLE
+/* Is a request worth a stream?  Yes if it is more than one sector, or if it
+ * continues the previous request, which is then likely part of a sequential
+ * run.  Otherwise any open stream is closed, and the caller issues a single
+ * block command.
+ */
+static bool SD_SPI_StreamWanted(enum SD_STREAM_STATE dir, uint32_t sector_address, uint16_t sector_count)
+{
+    if((sector_count > 1) || ((sdStream.dir == dir) && (sdStream.nextLBA == sector_address)))
+    {
+        return true;
+    }
+    SD_SPI_StreamClose();
+    return false;
+}
 
-        while(1)
+/* Remember where a single block request ended, so that a request that
+ * continues it opens a stream.
+ */
+static void SD_SPI_StreamFollow(enum SD_STREAM_STATE dir, uint32_t sector_address, bool result)
+{
+    sdStream.dir = result ? dir : SD_STREAM_CLOSED;
+    sdStream.nextLBA = sector_address + 1;
+}
+
+/* Wait for the card to release the busy (0x00) condition after a block has
+ * been programmed, or after the stop token of a multi-block write.
+ */
+static bool SD_SPI_StreamWaitReady(void)
+{
+    uint32_t timeout = SD_WRITE_TIMEOUT;
+
+    while(SD_SPI_exchangeByte(0xFF) == 0x00)
+    {
+        if(--timeout == 0)
         {
-            status = SD_SPI_AsyncWriteTasks(&info);
-            if(status == SD_ASYNC_WRITE_COMPLETE)
-            {
-                result = true;
-                break;
-            }    
-            else if(status == SD_ASYNC_WRITE_ERROR)
-            {
-                result = false;
-                break;
-            }
-        }   
+            return false;
+        }
+    }
+    return true;
+}
 
+/* Drop an open stream after an error, without waiting for the card. */
+static void SD_SPI_StreamAbort(void)
+{
+    (void)SD_SendCmd(SD_STOP_TRANSMISSION, 0x00000000);
+    SD_SPI_ChipDeselect();
+    (void)SD_SPI_exchangeByte(0xFF);
+    SD_SPI_close();
+    sdStream.state = SD_STREAM_CLOSED;
+    sdStream.dir = SD_STREAM_CLOSED;
+    mediaInformation.state = SD_STATE_READY_FOR_COMMAND;
+}
+
+/* Start a READ_MULTI_BLOCK or WRITE_MULTI_BLOCK transaction at the given LBA
+ * and leave the card selected.
+ */
+static bool SD_SPI_StreamOpen(enum SD_STREAM_STATE state, uint32_t sector_address)
+{
+    SD_RESPONSE response;
+    uint32_t address = sector_address;
+
+    if( SD_SPI_master_open(SDFAST) == false )
+    {
+        return false;
+    }
+
+    //Standard capacity cards expect a byte address.
+    if (mediaInformation.gSDMode == SD_MODE_NORMAL)
+    {
+        address <<= 9;  //Equivalent to multiply by 512
+    }
+
+    SD_SPI_ChipSelect();
+    response = SD_SendCmd((state == SD_STREAM_READ) ? SD_READ_MULTI_BLOCK : SD_WRITE_MULTI_BLOCK, address);
+    if(response.r1._byte != 0x00)
+    {
         SD_SPI_ChipDeselect();
+        (void)SD_SPI_exchangeByte(0xFF);
         SD_SPI_close();
+        return false;
+    }
+
+    mediaInformation.state = SD_STATE_BUSY;
+    sdStream.state = state;
+    sdStream.dir = state;
+    sdStream.nextLBA = sector_address;
+    return true;
+}
+
+void SD_SPI_StreamClose(void)
+{
+    switch(sdStream.state)
+    {
+        case SD_STREAM_READ:
+            //CMD12 waits for the card to go non-busy (R1b).
+            (void)SD_SendCmd(SD_STOP_TRANSMISSION, 0x00000000);
+            break;
+        case SD_STREAM_WRITE:
+            //Let the last block finish programming, send the stop token, then
+            //wait for the card to finish internally writing.
+            (void)SD_SPI_StreamWaitReady();
+            (void)SD_SPI_exchangeByte(SD_TOKEN_STOP_TRANSMISSION);
+            (void)SD_SPI_exchangeByte(0xFF);    //NBR timing parameter
+            (void)SD_SPI_StreamWaitReady();
+            break;
+        default:
+            return;
+    }
+
+    SD_SPI_ChipDeselect();
+    (void)SD_SPI_exchangeByte(0xFF);
+    SD_SPI_close();
+    sdStream.state = SD_STREAM_CLOSED;
+    mediaInformation.state = SD_STATE_READY_FOR_COMMAND;
+}
+
+void SD_SPI_StreamIdleTasks(void)
+{
+    if(sdStream.state == SD_STREAM_CLOSED)
+    {
+        return;
+    }
+
+    if((TMR1_ReadTimer32() - sdStream.lastTicks) >= (SD_STREAM_IDLE_MS * 1000ul * TMR1_TICKS_PER_US))
+    {
+        SD_SPI_StreamClose();
+    }
+}
+
+static bool SD_SPI_StreamSectorRead(uint32_t sector_address, uint8_t* buffer, uint16_t sector_count)
+{
+    uint32_t timeout;
+    uint8_t bData;
+
+    if((sdStream.state != SD_STREAM_READ) || (sdStream.nextLBA != sector_address))
+    {
+        SD_SPI_StreamClose();
+        if(SD_SPI_StreamOpen(SD_STREAM_READ, sector_address) == false)
+        {
+            return false;
+        }
+    }
+
+    while(sector_count--)
+    {
+        //Poll for the data start token.  The card holds off with 0xFF while
+        //it fetches the next block (NAC).
+        timeout = SD_NAC_TIMEOUT;
+        do
+        {
+            bData = SD_SPI_exchangeByte(0xFF);
+        }while((bData == SD_TOKEN_FLOATING_BUS) && (--timeout != 0));
+
+        if(bData != SD_TOKEN_START)
+        {
+            SD_SPI_StreamAbort();
+            return false;
+        }
+
+        SD_SPI_readBlock(buffer, SD_MEDIA_BLOCK_SIZE);
+
+        //Discard the CRC-16.
+        (void)SD_SPI_exchangeByte(0xFF);
+        (void)SD_SPI_exchangeByte(0xFF);
+
+        buffer += SD_MEDIA_BLOCK_SIZE;
+        sdStream.nextLBA++;
+    }
+
+    sdStream.lastTicks = TMR1_ReadTimer32();
+    return true;
+}
+
+static bool SD_SPI_StreamSectorWrite(uint32_t sector_address, const uint8_t* buffer, uint16_t sector_count)
+{
+    if((sdStream.state != SD_STREAM_WRITE) || (sdStream.nextLBA != sector_address))
+    {
+        SD_SPI_StreamClose();
+        if(SD_SPI_StreamOpen(SD_STREAM_WRITE, sector_address) == false)
+        {
+            return false;
+        }
     }
-    
-    return result;
-}    
+
+    while(sector_count--)
+    {
+        //The previous block may still be programming, the card holds the
+        //bus at 0x00 until it can accept the next one.
+        if(SD_SPI_StreamWaitReady() == false)
+        {
+            SD_SPI_StreamAbort();
+            return false;
+        }
+
+        (void)SD_SPI_exchangeByte(SD_TOKEN_START_MULTI_BLOCK);
+        SD_SPI_writeBlock((uint8_t*)buffer, SD_MEDIA_BLOCK_SIZE);
+
+        //This version does not calculate CRC, send dummy data.
+        (void)SD_SPI_exchangeByte(0xFF);
+        (void)SD_SPI_exchangeByte(0xFF);
+
+        if((SD_SPI_exchangeByte(0xFF) & SD_WRITE_RESPONSE_TOKEN_MASK) != SD_TOKEN_DATA_ACCEPTED)
+        {
+            SD_SPI_StreamAbort();
+            return false;
+        }
+
+        buffer += SD_MEDIA_BLOCK_SIZE;
+        sdStream.nextLBA++;
+    }
+
+    sdStream.lastTicks = TMR1_ReadTimer32();
+    return true;
+}
+#else
+void SD_SPI_StreamClose(void)
+{
+}
+
+void SD_SPI_StreamIdleTasks(void)
+{
+}
+#endif
 
 bool  SD_SPI_IsMediaInitialized (void)
 {
@@ -501,6 +815,10 @@ bool SD_SPI_MediaInitialize (void)
     uint8_t c_size_mult;
     uint8_t block_len;
 
+    //Any stream left open from before a reset must be closed, since the SPI
+    //port is re-opened at the slow initialization clock below.
+    SD_SPI_StreamClose();
+
     mediaInformation.state = SD_STATE_NOT_INITIALIZED;
     mediaInformation.errorCode = MEDIA_NO_ERROR;
     mediaInformation.finalLBA = 0x00000000;	
@@ -939,8 +1257,9 @@ static uint8_t SD_SPI_AsyncReadTasks(struct SD_ASYNC_IO* info)
 
                 //Now read a ioInfo.wNumbytes packet worth of SPI bytes, 
                 //and place the received bytes in the user specified pBuffer.
-                (void)memset(ioInfo.pBuffer, 0xFF, ioInfo.wNumBytes);
-                SD_SPI_exchangeBlock(ioInfo.pBuffer, ioInfo.wNumBytes);
+                //readBlock clocks out 0xFF itself, so the buffer does not
+                //need to be pre-filled.
+                SD_SPI_readBlock(ioInfo.pBuffer, ioInfo.wNumBytes);
 
                 //Check if we have received a multiple of the media block 
                 //size (ex: 512 bytes).  If so, the next two bytes are going to 
@@ -1105,7 +1424,7 @@ static uint8_t SD_SPI_AsyncWriteTasks(struct SD_ASYNC_IO* info)
             ioInfo.dwBytesRemaining -= ioInfo.wNumBytes;
             blockCounter -= ioInfo.wNumBytes;
             
-            SD_SPI_exchangeBlock(ioInfo.pBuffer, ioInfo.wNumBytes);
+            SD_SPI_writeBlock(ioInfo.pBuffer, ioInfo.wNumBytes);
  
             //Check if we have finished sending a 512 byte block.  If so,
             //need to receive 16-bit CRC, and retrieve the data_response token
@@ -1251,6 +1570,7 @@ static SD_RESPONSE SD_SendCmd (uint8_t cmd, uint32_t address)
     uint32_t longTimeout;
     uint8_t address_bytes[4];
     
+    sdCommandCount++;
     SD_SPI_ChipSelect();
     
     (void)memcpy(address_bytes, &address, sizeof(address));
@@ -119,6 +119,16 @@ uint32_t SD_SPI_GetSectorCount(void);
     This function performs a synchronous read operation.  In other words, this
     function is a blocking function, and will not return until either the data
     has fully been read, or, a timeout or other error occurred.
+
+    In stream mode (the default) a request of more than one sector, or one
+    that starts where the previous read ended, is transferred with
+    READ_MULTI_BLOCK and the transaction is left open when the function
+    returns, so a following request that starts at the next LBA continues it
+    without a new command; see SD_SPI_StreamClose.  A request at any other
+    LBA, or a write, stops the open stream first, and a single sector
+    elsewhere is read with READ_SINGLE_BLOCK.  Built with
+    SD_SPI_STREAM_DISABLE, each call issues its own READ_SINGLE_BLOCK, or
+    READ_MULTI_BLOCK ended with STOP_TRANSMISSION.
   ***************************************************************************************/
 bool SD_SPI_SectorRead(uint32_t sector_address, uint8_t* buffer, uint16_t sector_count);
 
@@ -150,7 +160,54 @@ bool SD_SPI_SectorRead(uint32_t sector_address, uint8_t* buffer, uint16_t sector
     The card expects the address field in the command packet to be a uint8_t address.
     The sector_addr value is converted to a uint8_t address by shifting it left nine
     times (multiplying by 512).
+
+    In stream mode (the default) a request of more than one sector, or one
+    that starts where the previous write ended, is transferred with
+    WRITE_MULTI_BLOCK; no ACMD23 pre-erase count is sent and the stop token
+    is held back, so a following request for the next LBA continues the
+    same transaction.  A request at any other LBA, or a read, ends it first,
+    and a single sector elsewhere is written with WRITE_SINGLE_BLOCK.  Built
+    with SD_SPI_STREAM_DISABLE, each call issues its own WRITE_SINGLE_BLOCK,
+    or ACMD23 for sector_count blocks and a WRITE_MULTI_BLOCK ended with the
+    stop token.
   ***************************************************************************************/
 bool SD_SPI_SectorWrite(uint32_t sector_address, const uint8_t* buffer, uint16_t sector_count);
 
+/*****************************************************************************
+  Function:
+    void SD_SPI_StreamClose(void)
+    void SD_SPI_StreamIdleTasks(void)
+  Summary:
+    Close, or age out, an open sequential read/write stream.
+  Description:
+    In stream mode, SD_SPI_SectorRead and SD_SPI_SectorWrite leave
+    the READ_MULTI_BLOCK/WRITE_MULTI_BLOCK transaction open so that a request
+    for the following LBA continues it without a new command.
+    SD_SPI_StreamClose terminates the transaction (CMD12 or stop token) and
+    waits for the card to go idle.  SD_SPI_StreamIdleTasks should be called
+    from the application's idle loop; it closes the stream after a period
+    with no transfers.  Built with SD_SPI_STREAM_DISABLE, both are no-ops.
+  ***************************************************************************************/
+void SD_SPI_StreamClose(void);
+void SD_SPI_StreamIdleTasks(void);
+
+/*****************************************************************************
+  Function:
+    uint16_t SD_SPI_GetCommandCount(void)
+  Summary:
+    Running count of commands sent to the card.
+  Description:
+    Wraps at 65536; take the difference of two readings to find how many
+    commands an operation cost.
+  ***************************************************************************************/
+uint16_t SD_SPI_GetCommandCount(void);
+
+/*****************************************************************************
+  Function:
+    uint32_t SD_SPI_GetCommandTotal(void)
+  Summary:
+    Commands sent to the card since power-up, as a 32-bit count.
+  ***************************************************************************************/
+uint32_t SD_SPI_GetCommandTotal(void);
+
 #endif
@@ -56,6 +56,21 @@ typedef struct {
 } spi1_configuration_t;
 
 
+#ifdef SPI1_DMA_ENABLE
+#define SPI1_DMA_RX_CHANNEL     0x00    // DMASELECT value for DMA1
+#define SPI1_DMA_TX_CHANNEL     0x01    // DMASELECT value for DMA2
+#define SPI1_DMA_SIRQ_SPI1RX    0x18    // SPI1 receive interrupt vector number
+#define SPI1_DMA_SIRQ_SPI1TX    0x19    // SPI1 transmit interrupt vector number
+
+static uint8_t spi1DmaFill = 0xFF;      // Transmitted while receiving a block
+static uint8_t spi1DmaDiscard;          // Sink for bytes received while transmitting a block
+
+static void SPI1_DMA_Exchange(const void *txBlock, void *rxBlock, size_t blockSize);
+#elif defined(SPI1_BURST_ENABLE)
+static void SPI1_BurstReadBlock(uint8_t *data);
+static void SPI1_BurstWriteBlock(const uint8_t *data);
+#endif
+
 //con0 == SPIxCON0, con1 == SPIxCON1, con2 == SPIxCON2, baud == SPIxBAUD, operation == Master/Slave
 static const spi1_configuration_t spi1_configuration[] = {   
     { 0x2, 0x20, 0x0, 0x3, 0 },
@@ -76,6 +91,9 @@ void SPI1_Initialize(void)
     //BAUD 64; 
     SPI1BAUD = 0x40;
     TRISCbits.TRISC3 = 0;
+#ifdef SPI1_DMA_ENABLE
+    SPI1_DMA_Initialize();
+#endif
 }
 
 bool SPI1_Open(spi1_modes_t spi1UniqueConfiguration)
@@ -110,6 +128,24 @@ uint8_t SPI1_ExchangeByte(uint8_t data)
 void SPI1_ExchangeBlock(void *block, size_t blockSize)
 {
     uint8_t *data = block;
+#ifdef SPI1_DMA_ENABLE
+    if(blockSize >= SPI1_DMA_MIN_BLOCK)
+    {
+        SPI1_DMA_Exchange(block, block, blockSize);
+        return;
+    }
+#elif defined(SPI1_BURST_ENABLE)
+    // Load the transfer counter once, then just keep the FIFOs moving.
+    SPI1TCNTH = (uint8_t)(blockSize >> 8);
+    SPI1TCNTL = (uint8_t)blockSize;
+    while(blockSize--)
+    {
+        SPI1TXB = *data;
+        while(!PIR3bits.SPI1RXIF);
+        *data++ = SPI1RXB;
+    }
+    return;
+#endif
     while(blockSize--)
     {
         SPI1TCNTL = 1;
@@ -123,18 +159,47 @@ void SPI1_ExchangeBlock(void *block, size_t blockSize)
 void SPI1_WriteBlock(void *block, size_t blockSize)
 {
     uint8_t *data = block;
+#ifdef SPI1_DMA_ENABLE
+    if(blockSize >= SPI1_DMA_MIN_BLOCK)
+    {
+        SPI1_DMA_Exchange(block, NULL, blockSize);
+        return;
+    }
+#elif defined(SPI1_BURST_ENABLE)
+    if(blockSize == SPI1_BURST_BLOCK)
+    {
+        SPI1_BurstWriteBlock(data);
+        return;
+    }
+#endif
     while(blockSize--)
     {
         SPI1_ExchangeByte(*data++);
     }
 }
 
+/* The dummy byte is 0xFF, since SD cards expect DI to be held high while
+ * they are sending a data block.
+ */
 void SPI1_ReadBlock(void *block, size_t blockSize)
 {
     uint8_t *data = block;
+#ifdef SPI1_DMA_ENABLE
+    if(blockSize >= SPI1_DMA_MIN_BLOCK)
+    {
+        SPI1_DMA_Exchange(NULL, block, blockSize);
+        return;
+    }
+#elif defined(SPI1_BURST_ENABLE)
+    if(blockSize == SPI1_BURST_BLOCK)
+    {
+        SPI1_BurstReadBlock(data);
+        return;
+    }
+#endif
     while(blockSize--)
     {
-        *data++ = SPI1_ExchangeByte(0);
+        *data++ = SPI1_ExchangeByte(0xFF);
     }
 }
 
@@ -146,4 +211,144 @@ void SPI1_WriteByte(uint8_t byte)
 uint8_t SPI1_ReadByte(void)
 {
     return SPI1RXB;
-}
\ No newline at end of file
+}
+
+#ifdef SPI1_DMA_ENABLE
+void SPI1_DMA_Initialize(void)
+{
+    // System arbiter: the CLC2 (WAIT#) ISR keeps top priority so Z80 I/O
+    // latency is unaffected, then SPI1 RX, SPI1 TX and the main line code.
+    ISRPR = 0;
+    DMA1PR = 1;
+    DMA2PR = 2;
+    MAINPR = 3;
+
+    bool state = (unsigned char)GIE;
+    GIE = 0;
+    PRLOCK = 0x55;
+    PRLOCK = 0xAA;
+    PRLOCKbits.PRLOCKED = 1;    // lock priorities, required for DMA operation
+    GIE = state;
+
+    // DMA1: SPI1RXB -> memory, one byte per SPI1 RX trigger.
+    DMASELECT = SPI1_DMA_RX_CHANNEL;
+    DMAnCON0 = 0x00;
+    DMAnSSA = (uint24_t)&SPI1RXB;
+    DMAnSSZ = 1;
+    DMAnSIRQ = SPI1_DMA_SIRQ_SPI1RX;
+    DMAnAIRQ = 0x00;
+
+    // DMA2: memory -> SPI1TXB, one byte per SPI1 TX trigger.
+    DMASELECT = SPI1_DMA_TX_CHANNEL;
+    DMAnCON0 = 0x00;
+    DMAnDSA = (uint16_t)&SPI1TXB;
+    DMAnDSZ = 1;
+    DMAnSIRQ = SPI1_DMA_SIRQ_SPI1TX;
+    DMAnAIRQ = 0x00;
+}
+
+/* Full-duplex block transfer.  If txBlock is NULL, 0xFF is transmitted for
+ * every byte.  If rxBlock is NULL, received bytes are discarded.  txBlock and
+ * rxBlock may be the same buffer.
+ */
+static void SPI1_DMA_Exchange(const void *txBlock, void *rxBlock, size_t blockSize)
+{
+    // RX channel: stop when the destination count reloads.
+    DMASELECT = SPI1_DMA_RX_CHANNEL;
+    if(rxBlock != NULL)
+    {
+        DMAnCON1 = 0x60;    // DMODE incremented; DSTP set; SMR SFR/GPR; SMODE unchanged; SSTP clear
+        DMAnDSA = (uint16_t)rxBlock;
+    }
+    else
+    {
+        DMAnCON1 = 0x20;    // DMODE unchanged; DSTP set; SMR SFR/GPR; SMODE unchanged; SSTP clear
+        DMAnDSA = (uint16_t)&spi1DmaDiscard;
+    }
+    DMAnDSZ = blockSize;
+    PIR2bits.DMA1DCNTIF = 0;
+    DMAnCON0 = 0xC0;        // EN enabled; SIRQEN enabled
+
+    // TX channel: stop when the source count reloads.
+    DMASELECT = SPI1_DMA_TX_CHANNEL;
+    if(txBlock != NULL)
+    {
+        DMAnCON1 = 0x03;    // DMODE unchanged; DSTP clear; SMR SFR/GPR; SMODE incremented; SSTP set
+        DMAnSSA = (uint24_t)txBlock;
+    }
+    else
+    {
+        DMAnCON1 = 0x01;    // DMODE unchanged; DSTP clear; SMR SFR/GPR; SMODE unchanged; SSTP set
+        DMAnSSA = (uint24_t)&spi1DmaFill;
+    }
+    DMAnSSZ = blockSize;
+
+    // Load the transfer counter for the whole block, then let the TX channel
+    // start filling the FIFO.
+    SPI1TCNTH = (uint8_t)(blockSize >> 8);
+    SPI1TCNTL = (uint8_t)blockSize;
+    DMAnCON0 = 0xC0;        // EN enabled; SIRQEN enabled
+
+    // Completion is detected from the RX channel's destination count flag,
+    // so this also works with interrupts disabled.
+    while(!PIR2bits.DMA1DCNTIF);
+    PIR2bits.DMA1DCNTIF = 0;
+    DMASELECT = SPI1_DMA_RX_CHANNEL;
+    DMAnCON0 = 0x00;
+    DMASELECT = SPI1_DMA_TX_CHANNEL;
+    DMAnCON0 = 0x00;
+}
+#elif defined(SPI1_BURST_ENABLE)
+/* Receive SPI1_BURST_BLOCK bytes in receive-only mode.  Writing SPI1TCNT
+ * starts the clocks for the whole block without touching the TX FIFO; SDO
+ * holds the last bit shifted out, which is 1 after the 0xFF poll that
+ * returned the SD data start token.
+ */
+static void SPI1_BurstReadBlock(uint8_t *data)
+{
+    uint8_t i, j;
+
+    SPI1CON2 = _SPI1CON2_SPI1RXR_MASK;
+    SPI1TCNTH = (uint8_t)(SPI1_BURST_BLOCK >> 8);
+    SPI1TCNTL = (uint8_t)SPI1_BURST_BLOCK;
+
+    // 8-bit loop counters: 2 x 256 bytes.
+    for(j = SPI1_BURST_BLOCK / 256; j != 0; j--)
+    {
+        i = 0;
+        do
+        {
+            while(!PIR3bits.SPI1RXIF);
+            *data++ = SPI1RXB;
+        } while(--i != 0);
+    }
+
+    SPI1CON2 = _SPI1CON2_SPI1RXR_MASK | _SPI1CON2_SPI1TXR_MASK;
+}
+
+/* Transmit SPI1_BURST_BLOCK bytes in transmit-only mode; received bytes are
+ * not stored, so only the TX FIFO needs servicing.
+ */
+static void SPI1_BurstWriteBlock(const uint8_t *data)
+{
+    uint8_t i, j;
+
+    SPI1CON2 = _SPI1CON2_SPI1TXR_MASK;
+    SPI1TCNTH = (uint8_t)(SPI1_BURST_BLOCK >> 8);
+    SPI1TCNTL = (uint8_t)SPI1_BURST_BLOCK;
+
+    for(j = SPI1_BURST_BLOCK / 256; j != 0; j--)
+    {
+        i = 0;
+        do
+        {
+            while(!PIR3bits.SPI1TXIF);
+            SPI1TXB = *data++;
+        } while(--i != 0);
+    }
+
+    // Let the last byte shift out before the mode changes back.
+    while(SPI1CON2bits.BUSY);
+    SPI1CON2 = _SPI1CON2_SPI1RXR_MASK | _SPI1CON2_SPI1TXR_MASK;
+}
+#endif
\ No newline at end of file
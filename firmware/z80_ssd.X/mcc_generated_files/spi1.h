@@ -62,6 +62,29 @@ typedef enum {
     SPI1_DEFAULT
 } spi1_modes_t;
 
+/* Block transfer mode, exactly one of:
+ *
+ * SPI1_DMA_ENABLE: blocks of at least SPI1_DMA_MIN_BLOCK bytes are moved by
+ * DMA1 (SPI1 RX) and DMA2 (SPI1 TX) instead of the polled byte loop.
+ *
+ * SPI1_BURST_ENABLE: transfer-counter burst mode for builds that need the
+ * DMA channels elsewhere.  SPI1TCNT is loaded once per block instead of
+ * once per byte.  512 byte reads run receive-only and 512 byte writes
+ * transmit-only, so the CPU services a single FIFO in a tight loop.
+ *
+ * SPI1_POLLED: the byte loop for every block.
+ *
+ * DMA is used unless the build defines one of the others.
+ */
+#if !defined(SPI1_BURST_ENABLE) && !defined(SPI1_POLLED)
+#define SPI1_DMA_ENABLE
+#endif
+#if (defined(SPI1_DMA_ENABLE) + defined(SPI1_BURST_ENABLE) + defined(SPI1_POLLED)) != 1
+#error "Define only one of SPI1_DMA_ENABLE, SPI1_BURST_ENABLE and SPI1_POLLED"
+#endif
+#define SPI1_DMA_MIN_BLOCK  16
+#define SPI1_BURST_BLOCK    512
+
 void SPI1_Initialize(void);
 bool SPI1_Open(spi1_modes_t spi1UniqueConfiguration);
 void SPI1_Close(void);
@@ -72,4 +95,8 @@ void SPI1_ReadBlock(void *block, size_t blockSize);
 void SPI1_WriteByte(uint8_t byte);
 uint8_t SPI1_ReadByte(void);
 
+#ifdef SPI1_DMA_ENABLE
+void SPI1_DMA_Initialize(void);
+#endif
+
 #endif //SPI1_H
\ No newline at end of file
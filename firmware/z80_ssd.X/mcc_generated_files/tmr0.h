@@ -0,0 +1,182 @@
+/**
+  TMR0 Generated Driver API Header File
+
+  @Company
+    Microchip Technology Inc.
+
+  @File Name
+    tmr0.h
+
+  @Summary
+    This is the generated header file for the TMR0 driver using PIC10 / PIC12 / PIC16 / PIC18 MCUs
+
+  @Description
+    This header file provides APIs for TMR0.
+    Generation Information :
+        Product Revision  :  PIC10 / PIC12 / PIC16 / PIC18 MCUs - 1.81.7
+        Device            :  PIC18F47Q43
+        Driver Version    :  2.11
+    The generated drivers are tested against the following:
+        Compiler          :  XC8 2.31 and above
+        MPLAB             :  MPLAB X 5.45
+*/
+
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries. 
+    
+    Subject to your compliance with these terms, you may use Microchip software and any 
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party 
+    license terms applicable to your use of third party software (including open source software) that 
+    may accompany Microchip software.
+    
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER 
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY 
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS 
+    FOR A PARTICULAR PURPOSE.
+    
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE, 
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND 
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP 
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO 
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL 
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT 
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS 
+    SOFTWARE.
+*/
+
+
+#ifndef TMR0_H
+#define TMR0_H
+
+/**
+  Section: Included Files
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus  // Provide C++ Compatibility
+
+    extern "C" {
+
+#endif
+
+/**
+  Section: Macro Declarations
+*/
+
+#define TMR0_TICKS_PER_US   16      /* FOSC/4 = 16MHz, 1:1 prescale */
+
+/**
+  Section: TMR0 APIs
+*/
+
+/**
+  @Summary
+    Initializes the TMR0
+
+  @Description
+    This routine initializes the TMR0.
+    This routine must be called before any other TMR0 routine is called.
+    This routine should only be called once during system initialization.
+    TMR0 free-runs in 16-bit mode from FOSC/4 with no prescale, ie. it
+    counts in 62.5ns ticks and wraps every 4.1ms.  The interrupt is left
+    disabled; z80_ssd.c reloads TMR0 and enables it to time out FIFO stalls.
+
+  @Preconditions
+    None
+
+  @Param
+    None
+
+  @Returns
+    None
+*/
+void TMR0_Initialize(void);
+
+/**
+  @Summary
+    This function starts the TMR0.
+
+  @Description
+    This function starts the TMR0 operation.
+    This function must be called after the initialization of TMR0.
+
+  @Preconditions
+    Initialize  the TMR0 before calling this function.
+
+  @Param
+    None
+
+  @Returns
+    None
+*/
+void TMR0_StartTimer(void);
+
+/**
+  @Summary
+    This function stops the TMR0.
+
+  @Description
+    This function stops the TMR0 operation.
+    This function must be called after the initialization of TMR0.
+
+  @Preconditions
+    Initialize  the TMR0 before calling this function.
+
+  @Param
+    None
+
+  @Returns
+    None
+*/
+void TMR0_StopTimer(void);
+
+/**
+  @Summary
+    Reads the 16 bits TMR0 register value.
+
+  @Description
+    This function reads the 16 bits TMR0 register value and return it.
+    Reading TMR0L latches TMR0H, so TMR0L must be read first.
+
+  @Preconditions
+    Initialize  the TMR0 before calling this function.
+
+  @Param
+    None
+
+  @Returns
+    This function returns the 16 bits value of TMR0 register
+*/
+uint16_t TMR0_ReadTimer(void);
+
+/**
+  @Summary
+    Writes the 16 bits value to TMR0 register.
+
+  @Description
+    This function writes the 16 bits value to TMR0 register.
+    This function must be called after the initialization of TMR0.
+
+  @Preconditions
+    Initialize  the TMR0 before calling this function.
+
+  @Param
+    timerVal - Value to write into TMR0 register.
+
+  @Returns
+    None
+*/
+void TMR0_WriteTimer(uint16_t timerVal);
+
+#ifdef __cplusplus  // Provide C++ Compatibility
+
+    }
+
+#endif
+
+#endif // TMR0_H
+/**
+ End of File
+*/
@@ -0,0 +1,173 @@
+/**
+  TMR1 Generated Driver File
+
+  @Company
+    Microchip Technology Inc.
+
+  @File Name
+    tmr1.c
+
+  @Summary
+    This is the generated driver implementation file for the TMR1 driver using PIC10 / PIC12 / PIC16 / PIC18 MCUs
+
+  @Description
+    This source file provides APIs for TMR1.
+    Generation Information :
+        Product Revision  :  PIC10 / PIC12 / PIC16 / PIC18 MCUs - 1.81.7
+        Device            :  PIC18F47Q43
+        Driver Version    :  2.11
+    The generated drivers are tested against the following:
+        Compiler          :  XC8 2.31 and above
+        MPLAB             :  MPLAB X 5.45
+*/
+
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries. 
+    
+    Subject to your compliance with these terms, you may use Microchip software and any 
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party 
+    license terms applicable to your use of third party software (including open source software) that 
+    may accompany Microchip software.
+    
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER 
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY 
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS 
+    FOR A PARTICULAR PURPOSE.
+    
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE, 
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND 
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP 
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO 
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL 
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT 
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS 
+    SOFTWARE.
+*/
+
+
+/**
+  Section: Included Files
+*/
+
+#include <xc.h>
+#include "tmr1.h"
+
+/**
+  Section: Global Variables Definitions
+*/
+static volatile uint16_t tmr1Overflows;
+
+/**
+  Section: TMR1 APIs
+*/
+
+void TMR1_Initialize(void)
+{
+    //Set the Timer to the options selected in the GUI
+
+    //T1GE disabled; T1GTM disabled; T1GPOL low; T1GGO done; T1GSPM disabled; 
+    T1GCON = 0x00;
+
+    //GSS T1G_pin; 
+    T1GATE = 0x00;
+
+    //CS FOSC/4; 
+    T1CLK = 0x01;
+
+    //TMR1H 0; 
+    TMR1H = 0x00;
+
+    //TMR1L 0; 
+    TMR1L = 0x00;
+
+    // Clearing IF flag.
+    PIR3bits.TMR1IF = 0;
+
+    // Enabling TMR1 interrupt, which extends TMR1 to 32 bits.
+    tmr1Overflows = 0;
+    PIE3bits.TMR1IE = 1;
+
+    // CKPS 1:8; NOT_SYNC synchronize; TMR1ON enabled; T1RD16 enabled; 
+    T1CON = 0x33;
+}
+
+void TMR1_StartTimer(void)
+{
+    // Start the Timer by writing to TMRxON bit
+    T1CONbits.TMR1ON = 1;
+}
+
+void TMR1_StopTimer(void)
+{
+    // Stop the Timer by writing to TMRxON bit
+    T1CONbits.TMR1ON = 0;
+}
+
+uint16_t TMR1_ReadTimer(void)
+{
+    uint16_t readVal;
+    uint8_t readValHigh;
+    uint8_t readValLow;
+    
+    readValLow = TMR1L;
+    readValHigh = TMR1H;
+    
+    readVal = ((uint16_t)readValHigh << 8) | readValLow;
+
+    return readVal;
+}
+
+uint32_t TMR1_ReadTimer32(void)
+{
+    uint16_t hi;
+    uint16_t lo;
+    uint8_t giel = INTCON0bits.GIEL;
+
+    INTCON0bits.GIEL = 0;
+    lo = TMR1_ReadTimer();
+    hi = tmr1Overflows;
+
+    // An overflow the ISR hasn't counted yet, eg. with interrupts disabled.
+    if (PIR3bits.TMR1IF)
+    {
+        PIR3bits.TMR1IF = 0;
+        tmr1Overflows = ++hi;
+        lo = TMR1_ReadTimer();
+    }
+    INTCON0bits.GIEL = giel;
+
+    return ((uint32_t)hi << 16) | lo;
+}
+
+void TMR1_WriteTimer(uint16_t timerVal)
+{
+    if (T1CONbits.nT1SYNC == 1)
+    {
+        // Stop the Timer by writing to TMRxON bit
+        T1CONbits.TMR1ON = 0;
+
+        // Write to the Timer1 register
+        TMR1H = (uint8_t)(timerVal >> 8);
+        TMR1L = (uint8_t)timerVal;
+
+        // Start the Timer after writing to the register
+        T1CONbits.TMR1ON =1;
+    }
+    else
+    {
+        // Write to the Timer1 register
+        TMR1H = (uint8_t)(timerVal >> 8);
+        TMR1L = (uint8_t)timerVal;
+    }
+}
+
+void __interrupt(irq(TMR1),base(8),low_priority) TMR1_ISR()
+{
+    // Clear the TMR1 interrupt flag
+    PIR3bits.TMR1IF = 0;
+    tmr1Overflows++;
+}
+
+/**
+  End of File
+*/
@@ -50,6 +50,20 @@
 #include <xc.h>
 #include "uart1.h"
 
+/**
+  Section: Macro Declarations
+*/
+#define UART1_TX_BUFFER_SIZE 128
+
+/**
+  Section: Global Variables
+*/
+static volatile uint8_t uart1TxHead = 0;
+static volatile uint8_t uart1TxTail = 0;
+static volatile uint8_t uart1TxBuffer[UART1_TX_BUFFER_SIZE];
+static volatile uint8_t uart1TxBufferRemaining;
+static volatile uint16_t uart1TxDropped;
+
 static volatile uart1_status_t uart1RxLastError;
 
 /**
@@ -66,6 +80,7 @@ void UART1_DefaultErrorHandler(void);
 void UART1_Initialize(void)
 {
     // Disable interrupts before changing states
+    PIE4bits.U1TXIE = 0;
 
     // Set the UART1 module to the options selected in the user interface.
 
@@ -121,6 +136,11 @@ void UART1_Initialize(void)
 
     uart1RxLastError.status = 0;
 
+    // initializing the driver state
+    uart1TxHead = 0;
+    uart1TxTail = 0;
+    uart1TxBufferRemaining = sizeof(uart1TxBuffer);
+    uart1TxDropped = 0;
 }
 
 bool UART1_is_rx_ready(void)
@@ -130,12 +150,17 @@ bool UART1_is_rx_ready(void)
 
 bool UART1_is_tx_ready(void)
 {
-    return (bool)(PIR4bits.U1TXIF && U1CON0bits.TXEN);
+    return (bool)(uart1TxBufferRemaining && U1CON0bits.TXEN);
 }
 
 bool UART1_is_tx_done(void)
 {
-    return U1ERRIRbits.TXMTIF;
+    return (uart1TxBufferRemaining == sizeof(uart1TxBuffer)) && U1ERRIRbits.TXMTIF;
+}
+
+uint16_t UART1_GetTxDroppedCount(void)
+{
+    return uart1TxDropped;
 }
 
 uart1_status_t UART1_get_last_status(void){
@@ -169,11 +194,53 @@ uint8_t UART1_Read(void)
 
 void UART1_Write(uint8_t txData)
 {
-    while(0 == PIR4bits.U1TXIF)
+    if(0 == uart1TxBufferRemaining)
     {
+        if(INTCON0bits.GIEH && INTCON0bits.GIEL)
+        {
+            // Never hold up the disk path waiting for the console.
+            uart1TxDropped++;
+            return;
+        }
+
+        // The TX interrupt can't run, so make room by polling.
+        while(0 == PIR4bits.U1TXIF)
+        {
+        }
+        UART1_Transmit_ISR();
     }
 
-    U1TXB = txData;    // Write the data byte to the USART.
+    PIE4bits.U1TXIE = 0;
+    uart1TxBuffer[uart1TxHead++] = txData;
+    if(sizeof(uart1TxBuffer) <= uart1TxHead)
+    {
+        uart1TxHead = 0;
+    }
+    uart1TxBufferRemaining--;
+    PIE4bits.U1TXIE = 1;
+}
+
+void __interrupt(irq(U1TX),base(8),low_priority) UART1_tx_vect_isr()
+{
+    UART1_Transmit_ISR();
+}
+
+void UART1_Transmit_ISR(void)
+{
+    // add your UART1 interrupt custom code
+    if(sizeof(uart1TxBuffer) > uart1TxBufferRemaining)
+    {
+        U1TXB = uart1TxBuffer[uart1TxTail++];
+        if(sizeof(uart1TxBuffer) <= uart1TxTail)
+        {
+            uart1TxTail = 0;
+        }
+        uart1TxBufferRemaining++;
+    }
+    else
+    {
+        PIE4bits.U1TXIE = 0;
+    }
 }
 
 char getch(void)
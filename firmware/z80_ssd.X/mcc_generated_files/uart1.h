@@ -359,14 +359,18 @@ uint8_t UART1_Read(void);
 
   @Preconditions
     UART1_Initialize() function should have been called
-    before calling this function. The transfer status should be checked to see
-    if transmitter is not busy before calling this function.
+    before calling this function.
 
   @Param
     txData  - Data byte to write to the UART1
 
   @Returns
     None
+
+  @Comment
+    The byte is queued and sent by the low priority TX interrupt.  If the
+    queue is full the byte is dropped and counted, unless interrupts are
+    disabled, in which case this waits for room.
   
   @Example
       <code>
@@ -375,6 +379,43 @@ uint8_t UART1_Read(void);
 */
 void UART1_Write(uint8_t txData);
 
+/**
+  @Summary
+    Maintains the driver's transmitter state machine and implements its ISR.
+
+  @Description
+    This routine is used to maintain the driver's internal transmitter state
+    machine. This interrupt service routine is called when the state of the
+    transmitter needs to be maintained in a non polled manner.
+
+  @Preconditions
+    UART1_Initialize() function should have been called
+    for the ISR to execute correctly.
+
+  @Param
+    None
+
+  @Returns
+    None
+*/
+void UART1_Transmit_ISR(void);
+
+/**
+  @Summary
+    Returns the number of bytes dropped because the TX queue was full.
+
+  @Preconditions
+    UART1_Initialize() function should have been called
+    before calling this function.
+
+  @Param
+    None
+
+  @Returns
+    Number of bytes dropped since UART1_Initialize()
+*/
+uint16_t UART1_GetTxDroppedCount(void);
+
 
 
 /**
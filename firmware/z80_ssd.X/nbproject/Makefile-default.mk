@@ -57,17 +57,17 @@ OBJECTDIR=build/${CND_CONF}/${IMAGE_TYPE}
 DISTDIR=dist/${CND_CONF}/${IMAGE_TYPE}
 
 # Source Files Quoted if spaced
-SOURCEFILES_QUOTED_IF_SPACED=mcc_generated_files/drivers/spi_master.c mcc_generated_files/fatfs/diskio.c mcc_generated_files/fatfs/fatfs_demo.c mcc_generated_files/fatfs/ffunicode.c mcc_generated_files/fatfs/ffsystem.c mcc_generated_files/fatfs/ff.c mcc_generated_files/sd_spi/sd_spi.c mcc_generated_files/pin_manager.c mcc_generated_files/clc1.c mcc_generated_files/clc2.c mcc_generated_files/interrupt_manager.c mcc_generated_files/device_config.c mcc_generated_files/mcc.c mcc_generated_files/uart1.c mcc_generated_files/spi1.c mcc_generated_files/ext_int.c mcc_generated_files/clc3.c main.c ibc_disk_ctrl.c z80_ssd.c
+SOURCEFILES_QUOTED_IF_SPACED=mcc_generated_files/drivers/spi_master.c mcc_generated_files/fatfs/diskio.c mcc_generated_files/fatfs/fatfs_demo.c mcc_generated_files/fatfs/ffunicode.c mcc_generated_files/fatfs/ffsystem.c mcc_generated_files/fatfs/ff.c mcc_generated_files/sd_spi/sd_spi.c mcc_generated_files/pin_manager.c mcc_generated_files/clc1.c mcc_generated_files/clc2.c mcc_generated_files/interrupt_manager.c mcc_generated_files/device_config.c mcc_generated_files/mcc.c mcc_generated_files/uart1.c mcc_generated_files/tmr1.c mcc_generated_files/tmr0.c mcc_generated_files/spi1.c mcc_generated_files/ext_int.c mcc_generated_files/clc3.c main.c ibc_disk_ctrl.c z80_ssd.c
 
 # Object Files Quoted if spaced
-OBJECTFILES_QUOTED_IF_SPACED=${OBJECTDIR}/mcc_generated_files/drivers/spi_master.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/diskio.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/fatfs_demo.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ffunicode.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ffsystem.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ff.p1 ${OBJECTDIR}/mcc_generated_files/sd_spi/sd_spi.p1 ${OBJECTDIR}/mcc_generated_files/pin_manager.p1 ${OBJECTDIR}/mcc_generated_files/clc1.p1 ${OBJECTDIR}/mcc_generated_files/clc2.p1 ${OBJECTDIR}/mcc_generated_files/interrupt_manager.p1 ${OBJECTDIR}/mcc_generated_files/device_config.p1 ${OBJECTDIR}/mcc_generated_files/mcc.p1 ${OBJECTDIR}/mcc_generated_files/uart1.p1 ${OBJECTDIR}/mcc_generated_files/spi1.p1 ${OBJECTDIR}/mcc_generated_files/ext_int.p1 ${OBJECTDIR}/mcc_generated_files/clc3.p1 ${OBJECTDIR}/main.p1 ${OBJECTDIR}/ibc_disk_ctrl.p1 ${OBJECTDIR}/z80_ssd.p1
-POSSIBLE_DEPFILES=${OBJECTDIR}/mcc_generated_files/drivers/spi_master.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/diskio.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/fatfs_demo.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/ffunicode.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/ffsystem.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/ff.p1.d ${OBJECTDIR}/mcc_generated_files/sd_spi/sd_spi.p1.d ${OBJECTDIR}/mcc_generated_files/pin_manager.p1.d ${OBJECTDIR}/mcc_generated_files/clc1.p1.d ${OBJECTDIR}/mcc_generated_files/clc2.p1.d ${OBJECTDIR}/mcc_generated_files/interrupt_manager.p1.d ${OBJECTDIR}/mcc_generated_files/device_config.p1.d ${OBJECTDIR}/mcc_generated_files/mcc.p1.d ${OBJECTDIR}/mcc_generated_files/uart1.p1.d ${OBJECTDIR}/mcc_generated_files/spi1.p1.d ${OBJECTDIR}/mcc_generated_files/ext_int.p1.d ${OBJECTDIR}/mcc_generated_files/clc3.p1.d ${OBJECTDIR}/main.p1.d ${OBJECTDIR}/ibc_disk_ctrl.p1.d ${OBJECTDIR}/z80_ssd.p1.d
+OBJECTFILES_QUOTED_IF_SPACED=${OBJECTDIR}/mcc_generated_files/drivers/spi_master.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/diskio.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/fatfs_demo.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ffunicode.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ffsystem.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ff.p1 ${OBJECTDIR}/mcc_generated_files/sd_spi/sd_spi.p1 ${OBJECTDIR}/mcc_generated_files/pin_manager.p1 ${OBJECTDIR}/mcc_generated_files/clc1.p1 ${OBJECTDIR}/mcc_generated_files/clc2.p1 ${OBJECTDIR}/mcc_generated_files/interrupt_manager.p1 ${OBJECTDIR}/mcc_generated_files/device_config.p1 ${OBJECTDIR}/mcc_generated_files/mcc.p1 ${OBJECTDIR}/mcc_generated_files/uart1.p1 ${OBJECTDIR}/mcc_generated_files/tmr1.p1 ${OBJECTDIR}/mcc_generated_files/tmr0.p1 ${OBJECTDIR}/mcc_generated_files/spi1.p1 ${OBJECTDIR}/mcc_generated_files/ext_int.p1 ${OBJECTDIR}/mcc_generated_files/clc3.p1 ${OBJECTDIR}/main.p1 ${OBJECTDIR}/ibc_disk_ctrl.p1 ${OBJECTDIR}/z80_ssd.p1
+POSSIBLE_DEPFILES=${OBJECTDIR}/mcc_generated_files/drivers/spi_master.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/diskio.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/fatfs_demo.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/ffunicode.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/ffsystem.p1.d ${OBJECTDIR}/mcc_generated_files/fatfs/ff.p1.d ${OBJECTDIR}/mcc_generated_files/sd_spi/sd_spi.p1.d ${OBJECTDIR}/mcc_generated_files/pin_manager.p1.d ${OBJECTDIR}/mcc_generated_files/clc1.p1.d ${OBJECTDIR}/mcc_generated_files/clc2.p1.d ${OBJECTDIR}/mcc_generated_files/interrupt_manager.p1.d ${OBJECTDIR}/mcc_generated_files/device_config.p1.d ${OBJECTDIR}/mcc_generated_files/mcc.p1.d ${OBJECTDIR}/mcc_generated_files/uart1.p1.d ${OBJECTDIR}/mcc_generated_files/tmr1.p1.d ${OBJECTDIR}/mcc_generated_files/tmr0.p1.d ${OBJECTDIR}/mcc_generated_files/spi1.p1.d ${OBJECTDIR}/mcc_generated_files/ext_int.p1.d ${OBJECTDIR}/mcc_generated_files/clc3.p1.d ${OBJECTDIR}/main.p1.d ${OBJECTDIR}/ibc_disk_ctrl.p1.d ${OBJECTDIR}/z80_ssd.p1.d
 
 # Object Files
-OBJECTFILES=${OBJECTDIR}/mcc_generated_files/drivers/spi_master.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/diskio.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/fatfs_demo.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ffunicode.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ffsystem.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ff.p1 ${OBJECTDIR}/mcc_generated_files/sd_spi/sd_spi.p1 ${OBJECTDIR}/mcc_generated_files/pin_manager.p1 ${OBJECTDIR}/mcc_generated_files/clc1.p1 ${OBJECTDIR}/mcc_generated_files/clc2.p1 ${OBJECTDIR}/mcc_generated_files/interrupt_manager.p1 ${OBJECTDIR}/mcc_generated_files/device_config.p1 ${OBJECTDIR}/mcc_generated_files/mcc.p1 ${OBJECTDIR}/mcc_generated_files/uart1.p1 ${OBJECTDIR}/mcc_generated_files/spi1.p1 ${OBJECTDIR}/mcc_generated_files/ext_int.p1 ${OBJECTDIR}/mcc_generated_files/clc3.p1 ${OBJECTDIR}/main.p1 ${OBJECTDIR}/ibc_disk_ctrl.p1 ${OBJECTDIR}/z80_ssd.p1
+OBJECTFILES=${OBJECTDIR}/mcc_generated_files/drivers/spi_master.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/diskio.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/fatfs_demo.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ffunicode.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ffsystem.p1 ${OBJECTDIR}/mcc_generated_files/fatfs/ff.p1 ${OBJECTDIR}/mcc_generated_files/sd_spi/sd_spi.p1 ${OBJECTDIR}/mcc_generated_files/pin_manager.p1 ${OBJECTDIR}/mcc_generated_files/clc1.p1 ${OBJECTDIR}/mcc_generated_files/clc2.p1 ${OBJECTDIR}/mcc_generated_files/interrupt_manager.p1 ${OBJECTDIR}/mcc_generated_files/device_config.p1 ${OBJECTDIR}/mcc_generated_files/mcc.p1 ${OBJECTDIR}/mcc_generated_files/uart1.p1 ${OBJECTDIR}/mcc_generated_files/tmr1.p1 ${OBJECTDIR}/mcc_generated_files/tmr0.p1 ${OBJECTDIR}/mcc_generated_files/spi1.p1 ${OBJECTDIR}/mcc_generated_files/ext_int.p1 ${OBJECTDIR}/mcc_generated_files/clc3.p1 ${OBJECTDIR}/main.p1 ${OBJECTDIR}/ibc_disk_ctrl.p1 ${OBJECTDIR}/z80_ssd.p1
 
 # Source Files
-SOURCEFILES=mcc_generated_files/drivers/spi_master.c mcc_generated_files/fatfs/diskio.c mcc_generated_files/fatfs/fatfs_demo.c mcc_generated_files/fatfs/ffunicode.c mcc_generated_files/fatfs/ffsystem.c mcc_generated_files/fatfs/ff.c mcc_generated_files/sd_spi/sd_spi.c mcc_generated_files/pin_manager.c mcc_generated_files/clc1.c mcc_generated_files/clc2.c mcc_generated_files/interrupt_manager.c mcc_generated_files/device_config.c mcc_generated_files/mcc.c mcc_generated_files/uart1.c mcc_generated_files/spi1.c mcc_generated_files/ext_int.c mcc_generated_files/clc3.c main.c ibc_disk_ctrl.c z80_ssd.c
+SOURCEFILES=mcc_generated_files/drivers/spi_master.c mcc_generated_files/fatfs/diskio.c mcc_generated_files/fatfs/fatfs_demo.c mcc_generated_files/fatfs/ffunicode.c mcc_generated_files/fatfs/ffsystem.c mcc_generated_files/fatfs/ff.c mcc_generated_files/sd_spi/sd_spi.c mcc_generated_files/pin_manager.c mcc_generated_files/clc1.c mcc_generated_files/clc2.c mcc_generated_files/interrupt_manager.c mcc_generated_files/device_config.c mcc_generated_files/mcc.c mcc_generated_files/uart1.c mcc_generated_files/tmr1.c mcc_generated_files/tmr0.c mcc_generated_files/spi1.c mcc_generated_files/ext_int.c mcc_generated_files/clc3.c main.c ibc_disk_ctrl.c z80_ssd.c
 
 
 
@@ -205,6 +205,22 @@ ${OBJECTDIR}/mcc_generated_files/uart1.p1: mcc_generated_files/uart1.c  nbprojec
 	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c  -D__DEBUG=1   -mdfp="${DFP_DIR}/xc8"  -fno-short-double -fno-short-float -memi=wordwrite -O2 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mdefault-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/mcc_generated_files/uart1.p1 mcc_generated_files/uart1.c 
 	@-${MV} ${OBJECTDIR}/mcc_generated_files/uart1.d ${OBJECTDIR}/mcc_generated_files/uart1.p1.d 
 	@${FIXDEPS} ${OBJECTDIR}/mcc_generated_files/uart1.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+
+${OBJECTDIR}/mcc_generated_files/tmr1.p1: mcc_generated_files/tmr1.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}/mcc_generated_files" 
+	@${RM} ${OBJECTDIR}/mcc_generated_files/tmr1.p1.d 
+	@${RM} ${OBJECTDIR}/mcc_generated_files/tmr1.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c  -D__DEBUG=1   -mdfp="${DFP_DIR}/xc8"  -fno-short-double -fno-short-float -memi=wordwrite -O2 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mdefault-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/mcc_generated_files/tmr1.p1 mcc_generated_files/tmr1.c 
+	@-${MV} ${OBJECTDIR}/mcc_generated_files/tmr1.d ${OBJECTDIR}/mcc_generated_files/tmr1.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/mcc_generated_files/tmr1.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+
+${OBJECTDIR}/mcc_generated_files/tmr0.p1: mcc_generated_files/tmr0.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}/mcc_generated_files" 
+	@${RM} ${OBJECTDIR}/mcc_generated_files/tmr0.p1.d 
+	@${RM} ${OBJECTDIR}/mcc_generated_files/tmr0.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c  -D__DEBUG=1   -mdfp="${DFP_DIR}/xc8"  -fno-short-double -fno-short-float -memi=wordwrite -O2 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mdefault-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/mcc_generated_files/tmr0.p1 mcc_generated_files/tmr0.c 
+	@-${MV} ${OBJECTDIR}/mcc_generated_files/tmr0.d ${OBJECTDIR}/mcc_generated_files/tmr0.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/mcc_generated_files/tmr0.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
 	
 ${OBJECTDIR}/mcc_generated_files/spi1.p1: mcc_generated_files/spi1.c  nbproject/Makefile-${CND_CONF}.mk 
 	@${MKDIR} "${OBJECTDIR}/mcc_generated_files" 
@@ -366,6 +382,22 @@ ${OBJECTDIR}/mcc_generated_files/uart1.p1: mcc_generated_files/uart1.c  nbprojec
 	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c   -mdfp="${DFP_DIR}/xc8"  -fno-short-double -fno-short-float -memi=wordwrite -O2 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mdefault-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/mcc_generated_files/uart1.p1 mcc_generated_files/uart1.c 
 	@-${MV} ${OBJECTDIR}/mcc_generated_files/uart1.d ${OBJECTDIR}/mcc_generated_files/uart1.p1.d 
 	@${FIXDEPS} ${OBJECTDIR}/mcc_generated_files/uart1.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+
+${OBJECTDIR}/mcc_generated_files/tmr1.p1: mcc_generated_files/tmr1.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}/mcc_generated_files" 
+	@${RM} ${OBJECTDIR}/mcc_generated_files/tmr1.p1.d 
+	@${RM} ${OBJECTDIR}/mcc_generated_files/tmr1.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c   -mdfp="${DFP_DIR}/xc8"  -fno-short-double -fno-short-float -memi=wordwrite -O2 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mdefault-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/mcc_generated_files/tmr1.p1 mcc_generated_files/tmr1.c 
+	@-${MV} ${OBJECTDIR}/mcc_generated_files/tmr1.d ${OBJECTDIR}/mcc_generated_files/tmr1.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/mcc_generated_files/tmr1.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+
+${OBJECTDIR}/mcc_generated_files/tmr0.p1: mcc_generated_files/tmr0.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}/mcc_generated_files" 
+	@${RM} ${OBJECTDIR}/mcc_generated_files/tmr0.p1.d 
+	@${RM} ${OBJECTDIR}/mcc_generated_files/tmr0.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c   -mdfp="${DFP_DIR}/xc8"  -fno-short-double -fno-short-float -memi=wordwrite -O2 -fasmfile -maddrqual=ignore -xassembler-with-cpp -mwarn=-3 -Wa,-a -DXPRJ_default=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mdefault-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/mcc_generated_files/tmr0.p1 mcc_generated_files/tmr0.c 
+	@-${MV} ${OBJECTDIR}/mcc_generated_files/tmr0.d ${OBJECTDIR}/mcc_generated_files/tmr0.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/mcc_generated_files/tmr0.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
 	
 ${OBJECTDIR}/mcc_generated_files/spi1.p1: mcc_generated_files/spi1.c  nbproject/Makefile-${CND_CONF}.mk 
 	@${MKDIR} "${OBJECTDIR}/mcc_generated_files" 
@@ -28,6 +28,21 @@
 #define CPU_RD_N            PORTCbits.RC2
 #define SDCARD_EN           PORTEbits.RE1
 
+//#define Z80_SSD_WAIT_MONITOR            /* Measure how long CLC2_ISR holds WAIT# */
+#define WAIT_HIST_BUCKETS   8           /* Hold time histogram, 2^n us */
+//#define Z80_SSD_BUS_TRACE               /* Record Z80 I/O cycles (512 bytes of RAM) */
+#define BUS_TRACE_LEN       128         /* Records, power of two */
+#define BUS_TRACE_POST      (BUS_TRACE_LEN / 2) /* Records kept after the trigger */
+#define BUS_TRACE_TRIG_ADDR 0x40        /* Trigger on an IN from this port... */
+#define BUS_TRACE_TRIG_MASK 0x01        /* ...returning data & MASK == VALUE, */
+#define BUS_TRACE_TRIG_VALUE 0x01       /* ie. the status register's error bit. */
+#define STALL_MAX_US        1000        /* Longest a FIFO cycle is held for the SD card */
+#define RING_SLOTS          10          /* Slots in sectbuf, IBC_HDC_RING_SLOTS */
+#define BENCH_KEY           'S'         /* Hold at power-up for the SD card self-benchmark */
+//#define Z80_SSD_BENCH_WAIT              /* Look for BENCH_KEY for BENCH_WINDOW_MS at boot */
+#define BENCH_WINDOW_MS     500         /* How long to look for it */
+//#define Z80_SSD_BENCH_ALWAYS            /* Run the self-benchmark at every power-up */
+
 volatile bool do_command_flag = 0;
 
 static uint8_t cpu_addr;
@@ -37,12 +52,325 @@ static uint8_t cpu_wr;
 
 extern void IBC_HDC_Hard_Reset(void);
 extern void IBC_HDC_Reset(void);
+extern void IBC_HDC_IdleTasks(void);
+extern void IBC_HDC_Console(char c);
+extern void IBC_HDC_SelfBench(void);
 extern uint8_t IBC_HDC_Write(const uint8_t Addr, uint8_t cData);
 extern uint8_t IBC_HDC_Read(const uint8_t Addr);
 extern uint8_t IBC_HDC_doCommand(void);
 
 extern uint8_t   sectbuf[];
 volatile extern uint16_t  secbuf_index;
+volatile extern uint8_t   secbuf_ready;
+volatile extern bool      secbuf_written;
+volatile extern uint8_t   secbuf_next_ready;
+volatile extern uint8_t   secbuf_lap;
+static volatile uint8_t fifo_stalled;   /* FIFO cycle held on WAIT#: 1 = read, 2 = write */
+static volatile bool fifo_timed_out;    /* A stall hit STALL_MAX_US; FIFO cycles no longer wait */
+
+/* WAIT# hold times, in TMR0 ticks (62.5ns), from CLC2_ISR entry to the
+ * write to CLEAR_WAIT.  The interrupt latency before the first instruction of
+ * CLC2_ISR, and any time spent finishing the previous ISR, are not included.
+ * FIFO cycles stalled behind a streaming transfer can outlast TMR0, so they
+ * are timed with TMR1 and kept separately.
+ */
+#define WAIT_FIFO           0           /* Port 48h */
+#define WAIT_STATUS         1           /* Status reads, port 44h */
+#define WAIT_TASKFILE       2           /* Task file writes, ports 40h-43h */
+#define WAIT_OTHER          3
+#define WAIT_STALL          4           /* FIFO cycles held for the SD card */
+#define WAIT_CLASSES        5
+
+#ifdef Z80_SSD_WAIT_MONITOR
+/* CLC2_ISR only counts the cycles and keeps the longest hold of each class,
+ * and leaves one hold time at a time in wait_sample.  z80_ssd_WaitIdleTasks()
+ * folds those into wait_stat from the main loop, so the minimum, average and
+ * histogram are taken over the cycles sampled, not every cycle.
+ */
+typedef struct {
+    uint16_t  count;        /* Since the last fold; saturates */
+    uint16_t  max;
+} Z80_SSD_WAIT_FAST;
+
+typedef struct {
+    uint32_t  count;
+    uint16_t  min;          /* Of the samples */
+    uint16_t  max;
+    uint32_t  sum;          /* Of the samples, halved with nsamp before it overflows */
+    uint32_t  nsamp;
+    uint16_t  hist[WAIT_HIST_BUCKETS];  /* [n] samples 2^(n-1)..2^n-1 us, [0] < 1us */
+} Z80_SSD_WAIT_STAT;
+
+static volatile Z80_SSD_WAIT_FAST wait_fast[WAIT_CLASSES];
+static volatile uint16_t wait_sample;
+static volatile uint8_t  wait_sample_class = WAIT_CLASSES;  /* WAIT_CLASSES: empty */
+static Z80_SSD_WAIT_STAT wait_stat[WAIT_CLASSES];
+static uint16_t wait_start;
+static uint32_t wait_stall_start;       /* TMR1 when a FIFO cycle stalled */
+static volatile uint16_t wait_max;      /* Longest hold seen, and what caused it */
+static volatile uint8_t  wait_max_addr;
+static volatile uint8_t  wait_max_rd;
+static volatile bool     wait_max_busy;
+
+static const char *wait_names[WAIT_CLASSES] = { "FIFO", "status", "taskfile", "other", "stalled" };
+
+/* Called with WAIT# already released; keep it short, it runs every cycle. */
+static void z80_ssd_WaitRecord(uint8_t wclass, uint16_t ticks)
+{
+    volatile Z80_SSD_WAIT_FAST *pFast = &wait_fast[wclass];
+
+    if (pFast->count != 0xFFFF) pFast->count++;
+    if (ticks > pFast->max) pFast->max = ticks;
+    if (wait_sample_class == WAIT_CLASSES) {
+        wait_sample = ticks;
+        wait_sample_class = wclass;
+    }
+
+    if (ticks > wait_max) {
+        wait_max = ticks;
+        wait_max_addr = cpu_addr;
+        wait_max_rd = !cpu_rd;
+        wait_max_busy = do_command_flag;
+    }
+}
+
+/* TMR0 ticks since a FIFO cycle stalled, at most 0xFFFF (4.1ms). */
+static uint16_t z80_ssd_StallTicks(void)
+{
+    uint32_t ticks = (TMR1_ReadTimer32() - wait_stall_start) * (TMR0_TICKS_PER_US / TMR1_TICKS_PER_US);
+
+    return (ticks > 0xFFFFUL) ? 0xFFFF : (uint16_t)ticks;
+}
+
+static uint8_t z80_ssd_WaitClass(void)
+{
+    if (cpu_addr == 0x48) return WAIT_FIFO;
+    if (cpu_addr == 0x44) return WAIT_STATUS;
+    if (cpu_addr == 0x40) return (cpu_rd ? WAIT_TASKFILE : WAIT_STATUS);
+    if (cpu_addr < 0x44) return WAIT_TASKFILE;
+    return WAIT_OTHER;
+}
+
+/* Fold the counts, maxima and sample left by CLC2_ISR into wait_stat.
+ * Called from the main loop while the guest is idle, and before a dump.
+ */
+void z80_ssd_WaitIdleTasks(void)
+{
+    Z80_SSD_WAIT_STAT *pStat;
+    uint16_t count, max, ticks;
+    uint8_t wclass, bucket;
+    uint8_t gieh = INTCON0bits.GIEH;
+
+    for (uint8_t c = 0; c < WAIT_CLASSES; c++) {
+        INTERRUPT_GlobalInterruptHighDisable();
+        count = wait_fast[c].count;
+        max = wait_fast[c].max;
+        wait_fast[c].count = 0;
+        wait_fast[c].max = 0;
+        INTCON0bits.GIEH = gieh;
+
+        pStat = &wait_stat[c];
+        pStat->count += count;
+        if (max > pStat->max) pStat->max = max;
+    }
+
+    INTERRUPT_GlobalInterruptHighDisable();
+    ticks = wait_sample;
+    wclass = wait_sample_class;
+    wait_sample_class = WAIT_CLASSES;
+    INTCON0bits.GIEH = gieh;
+    if (wclass == WAIT_CLASSES) {
+        return;
+    }
+
+    pStat = &wait_stat[wclass];
+    if ((pStat->nsamp == 0) || (ticks < pStat->min)) pStat->min = ticks;
+    if (pStat->sum & 0x80000000UL) {
+        pStat->sum >>= 1;
+        pStat->nsamp >>= 1;
+    }
+    pStat->sum += ticks;
+    pStat->nsamp++;
+
+    ticks /= TMR0_TICKS_PER_US;
+    for (bucket = 0; (ticks != 0) && (bucket < (WAIT_HIST_BUCKETS - 1)); bucket++) {
+        ticks >>= 1;
+    }
+    if (pStat->hist[bucket] != 0xFFFF) {
+        pStat->hist[bucket]++;
+    }
+}
+
+static void z80_ssd_WaitPrint(const char *name, uint16_t ticks)
+{
+    printf(" %s %u.%uus", name, ticks / TMR0_TICKS_PER_US,
+        ((ticks % TMR0_TICKS_PER_US) * 10) / TMR0_TICKS_PER_US);
+}
+
+/* Print the WAIT# statistics.  Each line waits for the UART to drain, so
+ * none of it is dropped.
+ */
+void z80_ssd_WaitDump(void)
+{
+    Z80_SSD_WAIT_STAT *pStat;
+
+    z80_ssd_WaitIdleTasks();
+    for (uint8_t c = 0; c < WAIT_CLASSES; c++) {
+        pStat = &wait_stat[c];
+        if (pStat->count == 0) {
+            continue;
+        }
+        while (!UART1_is_tx_done());
+        printf("WAIT# %s: %lu cycles, %lu sampled,", wait_names[c], (unsigned long)pStat->count,
+            (unsigned long)pStat->nsamp);
+        if (pStat->nsamp != 0) {
+            z80_ssd_WaitPrint("min", pStat->min);
+            z80_ssd_WaitPrint("avg", (uint16_t)(pStat->sum / pStat->nsamp));
+        }
+        z80_ssd_WaitPrint("max", pStat->max);
+        printf("\n\r ");
+        for (uint8_t i = 0; i < WAIT_HIST_BUCKETS; i++) {
+            printf(" %s%luus:%u", (i == 0) ? "<" : ">=", (i == 0) ? 1UL : (1UL << (i - 1)), pStat->hist[i]);
+        }
+        printf("\n\r");
+    }
+    if (wait_max != 0) {
+        while (!UART1_is_tx_done());
+        printf("Longest:");
+        z80_ssd_WaitPrint("", wait_max);
+        printf(" %s port %02xh%s\n\r", wait_max_rd ? "IN" : "OUT",
+            wait_max_addr, wait_max_busy ? " (busy)" : "");
+    }
+}
+
+void z80_ssd_WaitReset(void)
+{
+    uint8_t gieh = INTCON0bits.GIEH;
+
+    INTERRUPT_GlobalInterruptHighDisable();
+    memset((void *)wait_fast, 0, sizeof(wait_fast));
+    wait_sample_class = WAIT_CLASSES;
+    wait_max = 0;
+    INTCON0bits.GIEH = gieh;
+    memset(wait_stat, 0, sizeof(wait_stat));
+}
+#else
+void z80_ssd_WaitIdleTasks(void) {}
+void z80_ssd_WaitDump(void) {}
+void z80_ssd_WaitReset(void) {}
+#endif /* Z80_SSD_WAIT_MONITOR */
+
+/* Bus trace: the last BUS_TRACE_LEN I/O cycles, four bytes each:
+ *
+ *   flags   bit 7: IN, bit 6: stalled on the FIFO, bit 5: trigger,
+ *           bits 3-0: port (40h-4Fh)
+ *   data    byte read or written
+ *   stamp   TMR1 (0.5us ticks), LSB first; wraps every 32.8ms
+ *
+ * Recording stops BUS_TRACE_POST cycles after the trigger, so the ring holds
+ * what led up to it and what followed.  Console B sends the ring in binary,
+ * oldest record first, and re-arms it; host/bustrace decodes the capture.
+ */
+#define BUS_TRACE_IN        0x80
+#define BUS_TRACE_STALL     0x40
+#define BUS_TRACE_TRIG      0x20
+
+#define BUS_TRACE_MAGIC0    'B'
+#define BUS_TRACE_MAGIC1    'T'
+#define BUS_TRACE_VERSION   1
+
+#ifdef Z80_SSD_BUS_TRACE
+typedef struct {
+    uint8_t   flags;
+    uint8_t   data;
+    uint16_t  stamp;
+} Z80_SSD_BUS_REC;
+
+static Z80_SSD_BUS_REC bus_trace[BUS_TRACE_LEN];
+static uint8_t  bus_head;               /* Next record to write */
+static uint8_t  bus_count;
+static uint8_t  bus_post;               /* Records left after the trigger */
+static bool     bus_triggered;
+static bool     bus_run = true;
+
+static void z80_ssd_BusRecord(uint8_t flags)
+{
+    Z80_SSD_BUS_REC *pRec;
+
+    if (!bus_run) {
+        return;
+    }
+    if (!cpu_rd) {
+        flags |= BUS_TRACE_IN;
+        if (!bus_triggered && (cpu_addr == BUS_TRACE_TRIG_ADDR) &&
+            ((cpu_data & BUS_TRACE_TRIG_MASK) == BUS_TRACE_TRIG_VALUE)) {
+            flags |= BUS_TRACE_TRIG;
+            bus_triggered = true;
+            bus_post = BUS_TRACE_POST;
+        }
+    }
+
+    pRec = &bus_trace[bus_head];
+    pRec->flags = flags | (cpu_addr & 0x0F);
+    pRec->data = cpu_data;
+    pRec->stamp = TMR1_ReadTimer();
+    bus_head = (bus_head + 1) & (BUS_TRACE_LEN - 1);
+    if (bus_count < BUS_TRACE_LEN) {
+        bus_count++;
+    }
+    if (bus_triggered && (--bus_post == 0)) {
+        bus_run = false;
+    }
+}
+
+static void z80_ssd_BusPut(uint8_t c, uint8_t *sum)
+{
+    while (!UART1_is_tx_ready());
+    UART1_Write(c);
+    *sum += c;
+}
+
+/* Send the capture: "BT", version, flags (bit 0: triggered), TMR1 ticks per
+ * us, record count, the records, then an 8-bit sum of everything before it.
+ */
+void z80_ssd_BusTraceDump(void)
+{
+    Z80_SSD_BUS_REC *pRec;
+    uint8_t sum = 0;
+    uint8_t i;
+    uint8_t count;
+
+    bus_run = false;
+    count = bus_count;
+    i = (bus_head - count) & (BUS_TRACE_LEN - 1);
+
+    z80_ssd_BusPut(BUS_TRACE_MAGIC0, &sum);
+    z80_ssd_BusPut(BUS_TRACE_MAGIC1, &sum);
+    z80_ssd_BusPut(BUS_TRACE_VERSION, &sum);
+    z80_ssd_BusPut(bus_triggered ? 1 : 0, &sum);
+    z80_ssd_BusPut(TMR1_TICKS_PER_US, &sum);
+    z80_ssd_BusPut(count, &sum);
+    while (count-- != 0) {
+        pRec = &bus_trace[i];
+        z80_ssd_BusPut(pRec->flags, &sum);
+        z80_ssd_BusPut(pRec->data, &sum);
+        z80_ssd_BusPut((uint8_t)pRec->stamp, &sum);
+        z80_ssd_BusPut((uint8_t)(pRec->stamp >> 8), &sum);
+        i = (i + 1) & (BUS_TRACE_LEN - 1);
+    }
+    z80_ssd_BusPut(sum, &sum);
+
+    /* Re-arm */
+    bus_count = 0;
+    bus_triggered = false;
+    bus_run = true;
+}
+#else
+void z80_ssd_BusTraceDump(void)
+{
+    printf("Bus trace not enabled.\n\r");
+}
+#endif /* Z80_SSD_BUS_TRACE */
 
 void CPU_RESET_ISR(void)
 {
@@ -54,12 +382,46 @@ void CPU_RESET_ISR(void)
     /* Make sure the WAIT# flip flop in CLC2 is clear. */
     CLEAR_WAIT = 0;
     CLEAR_WAIT = 1;
+    PIE3bits.TMR0IE = 0;
+    fifo_stalled = 0;
+    fifo_timed_out = false;
 
     SDCARD_EN = 1;
 
     IBC_HDC_Hard_Reset();
 }
 
+/* Leave a FIFO cycle waiting for its slot (1 = read, 2 = write), with TMR0
+ * set to give up on it after STALL_MAX_US.
+ */
+static void z80_ssd_StallStart(uint8_t dir)
+{
+    fifo_stalled = dir;
+    TMR0_WriteTimer((uint16_t)(0x10000UL - (STALL_MAX_US * TMR0_TICKS_PER_US)));
+    PIR3bits.TMR0IF = 0;
+    PIE3bits.TMR0IE = 1;
+#ifdef Z80_SSD_WAIT_MONITOR
+    wait_stall_start = TMR1_ReadTimer32();
+#endif /* Z80_SSD_WAIT_MONITOR */
+    PIR6bits.CLC2IF = 0;
+}
+
+/* Start the Z80 on the next lap of a streaming transfer when it runs off the
+ * end of the ring, if the main loop has a slot of that lap ready.  Returns
+ * false if the cycle must wait.
+ */
+static bool z80_ssd_RingWrap(void)
+{
+    if (((uint8_t)(secbuf_index >> 8) < RING_SLOTS) || (secbuf_next_ready == 0)) {
+        return false;
+    }
+    secbuf_ready = secbuf_next_ready;
+    secbuf_next_ready = 0;
+    secbuf_lap++;
+    secbuf_index = 0;
+    return true;
+}
+
 /* CLC2 Interrupt Handler - WAIT#
  *
  * When an I/O access matches the disk controller's address (0x40-0x4F,)
@@ -75,13 +437,32 @@ void CPU_RESET_ISR(void)
  *
  * The timing of the ISR is fairly critical, as holding WAIT# for a very long
  * time can kill the DRAM refresh.
+ * The one exception is a FIFO access that overtakes a streaming transfer.
+ * It is held until the main loop has moved the slot, which takes whatever
+ * the loop was doing plus an SD block read or write: usually well under a
+ * millisecond, but a card may take 100ms to answer.  So TMR0 lets the cycle
+ * go after STALL_MAX_US, without its data, and the transfer fails.  The Z80
+ * refreshes a DRAM row per M1 cycle and must get round all 128 rows in 2ms;
+ * once a slot is ready, the INIR or OTIR takes 512 M1 cycles to reach the
+ * next one, so 1ms holds leave it time to.  Writes rarely stall at all: a
+ * WRITE_SECT with its data in the FIFO keeps status busy until the first
+ * slot is free for the Z80's next command.
  *
  * Disk controller commands are carried out in the z80_ssd_main() while(1)
  * loop.  These are generally not timing critical, as the disk controller driver
  * will poll the status register to determine when the controller is ready.
+ * The exception, with IBC_HDC_FAST_READ, is a one-sector READ_SECT that hits
+ * the cache, which IBC_HDC_Write() completes here, copying 256 bytes.
  */
 void __interrupt(irq(CLC2),base(8)) CLC2_ISR()
 {
+#ifdef Z80_SSD_WAIT_MONITOR
+    uint16_t wait_end;
+
+    /* TMR0L first: reading it latches TMR0H. */
+    wait_start = TMR0L;
+    wait_start |= (uint16_t)TMR0H << 8;
+#endif /* Z80_SSD_WAIT_MONITOR */
     cpu_rd = CPU_RD_N;
     /* We don't really need WR#, so save some time by not reading it. */
 //    cpu_wr = CPU_WR_N;
@@ -92,7 +473,20 @@ void __interrupt(irq(CLC2),base(8)) CLC2_ISR()
         TRISD = 0x00;    // Data bus is output.
 
         if (cpu_addr == 0x48) { /* Handle the FIFO as quickly as possible. */
-            cpu_data = sectbuf[secbuf_index++];
+            if (((uint8_t)(secbuf_index >> 8) < secbuf_ready) || z80_ssd_RingWrap()) {
+                cpu_data = sectbuf[secbuf_index++];
+            } else if (fifo_timed_out) {
+                /* The transfer has already failed; don't hold the Z80 again. */
+                cpu_data = 0xFF;
+            } else {
+                /* The Z80 has overtaken a streaming transfer.  Leave WAIT#
+                 * asserted; z80_ssd_fifo_resume() completes the cycle once
+                 * the slot has been read from the SD card, or TMR0_ISR once
+                 * STALL_MAX_US is up.
+                 */
+                z80_ssd_StallStart(1);
+                return;
+            }
         } else { /* All other registers */
             cpu_data = IBC_HDC_Read(cpu_addr);
         }
@@ -100,7 +494,18 @@ void __interrupt(irq(CLC2),base(8)) CLC2_ISR()
     } else {  /* CPU I/O Write (1.75uS) */
         cpu_data = PORTD;
         if (cpu_addr == 0x48) { /* Handle the FIFO as quickly as possible. */
-            sectbuf[secbuf_index++] = cpu_data;
+            if (((uint8_t)(secbuf_index >> 8) < secbuf_ready) || z80_ssd_RingWrap()) {
+                sectbuf[secbuf_index++] = cpu_data;
+                secbuf_written = true;
+            } else if (fifo_timed_out) {
+                /* The transfer has already failed; drop the byte. */
+            } else {
+                /* The slot still holds a WRITE_SECT that hasn't reached the
+                 * SD card; hold the Z80 until it has, as for a read.
+                 */
+                z80_ssd_StallStart(2);
+                return;
+            }
         } else { /* All other registers */
             IBC_HDC_Write(cpu_addr, cpu_data);
         }
@@ -110,6 +515,10 @@ void __interrupt(irq(CLC2),base(8)) CLC2_ISR()
      * important!
      */
     PIR6bits.CLC2IF = 0;
+#ifdef Z80_SSD_WAIT_MONITOR
+    wait_end = TMR0L;
+    wait_end |= (uint16_t)TMR0H << 8;
+#endif /* Z80_SSD_WAIT_MONITOR */
     
     /* De-assert WAIT# */
     CLEAR_WAIT = 0;
@@ -117,6 +526,138 @@ void __interrupt(irq(CLC2),base(8)) CLC2_ISR()
 
     /* Tri-state MCU Port D (Data Bus port) */
     TRISD = 0xFF;       // Data bus is input.
+
+#ifdef Z80_SSD_WAIT_MONITOR
+    /* Bookkeeping after WAIT# is released, so it doesn't lengthen the cycle. */
+    z80_ssd_WaitRecord(z80_ssd_WaitClass(), (uint16_t)(wait_end - wait_start));
+#endif /* Z80_SSD_WAIT_MONITOR */
+#ifdef Z80_SSD_BUS_TRACE
+    z80_ssd_BusRecord(0);
+#endif /* Z80_SSD_BUS_TRACE */
+}
+
+/* TMR0 Interrupt Handler - FIFO stall timeout
+ *
+ * Armed by CLC2_ISR when it stalls a FIFO cycle.  If the slot still isn't
+ * ready, release the Z80 rather than hold WAIT# any longer: a read gets
+ * 0xFF, and a write is dropped.  FIFO cycles that would stall then complete
+ * at once the same way, until ibc_disk_ctrl.c has dealt with it; see
+ * z80_ssd_fifo_timed_out().
+ */
+void __interrupt(irq(TMR0),base(8)) TMR0_ISR()
+{
+    PIE3bits.TMR0IE = 0;
+    PIR3bits.TMR0IF = 0;
+
+    if (fifo_stalled) {
+        if (fifo_stalled == 1) {
+            PORTD = 0xFF;
+        }
+        fifo_stalled = 0;
+        fifo_timed_out = true;
+#ifdef Z80_SSD_WAIT_MONITOR
+        z80_ssd_WaitRecord(WAIT_STALL, z80_ssd_StallTicks());
+#endif /* Z80_SSD_WAIT_MONITOR */
+#ifdef Z80_SSD_BUS_TRACE
+        z80_ssd_BusRecord(BUS_TRACE_STALL);
+#endif /* Z80_SSD_BUS_TRACE */
+
+        /* De-assert WAIT# */
+        CLEAR_WAIT = 0;
+        CLEAR_WAIT = 1;
+
+        /* Tri-state MCU Port D (Data Bus port) */
+        TRISD = 0xFF;       // Data bus is input.
+    }
+}
+
+/* Complete a FIFO access that CLC2_ISR left waiting for a slot.  The Z80
+ * is frozen in the I/O cycle, so CLC2_ISR can't run until WAIT# is released
+ * here; TMR0_ISR can, so it is kept out of the way.
+ */
+void z80_ssd_fifo_resume(void)
+{
+    PIE3bits.TMR0IE = 0;
+    if (fifo_stalled && ((uint8_t)(secbuf_index >> 8) >= secbuf_ready)) {
+        /* Not yet; the timeout still stands. */
+        PIE3bits.TMR0IE = 1;
+    } else if (fifo_stalled) {
+        if (fifo_stalled == 1) {
+            cpu_data = sectbuf[secbuf_index++];
+            PORTD = cpu_data;
+        } else {
+            sectbuf[secbuf_index++] = cpu_data;
+            secbuf_written = true;
+        }
+        fifo_stalled = 0;
+#ifdef Z80_SSD_WAIT_MONITOR
+        /* Recorded while the Z80 is still held, so CLC2_ISR can't run in
+         * the middle of it.
+         */
+        z80_ssd_WaitRecord(WAIT_STALL, z80_ssd_StallTicks());
+#endif /* Z80_SSD_WAIT_MONITOR */
+#ifdef Z80_SSD_BUS_TRACE
+        z80_ssd_BusRecord(BUS_TRACE_STALL);
+#endif /* Z80_SSD_BUS_TRACE */
+
+        /* De-assert WAIT# */
+        CLEAR_WAIT = 0;
+        CLEAR_WAIT = 1;
+
+        /* Tri-state MCU Port D (Data Bus port) */
+        TRISD = 0xFF;       // Data bus is input.
+    }
+}
+
+/* Is a FIFO access waiting for a slot?  A FIFO filled to the end isn't an
+ * overrun until the Z80 tries to go past it.
+ */
+bool z80_ssd_fifo_stalled(void)
+{
+    return fifo_stalled != 0;
+}
+
+/* Did a FIFO cycle time out?  The Z80 was let go without its data, so the
+ * transfer has failed.  Once the Z80 won't stall again at once, clear it
+ * with z80_ssd_fifo_timeout_clear().
+ */
+bool z80_ssd_fifo_timed_out(void)
+{
+    return fifo_timed_out;
+}
+
+void z80_ssd_fifo_timeout_clear(void)
+{
+    fifo_timed_out = false;
+}
+
+/* Is the benchmark key held?  The terminal's auto-repeat sends it while the
+ * key is down, so it has arrived by the time the banner is out; boot doesn't
+ * wait for it unless Z80_SSD_BENCH_WAIT is defined.
+ */
+static bool z80_ssd_BenchRequested(void)
+{
+#ifdef Z80_SSD_BENCH_ALWAYS
+    return true;
+#else
+    bool held = false;
+#ifdef Z80_SSD_BENCH_WAIT
+    uint32_t start = TMR1_ReadTimer32();
+
+    while ((TMR1_ReadTimer32() - start) < (BENCH_WINDOW_MS * 1000UL * TMR1_TICKS_PER_US)) {
+        if (UART1_is_rx_ready() && (toupper(UART1_Read()) == BENCH_KEY)) {
+            held = true;
+        }
+    }
+#else
+    while (UART1_is_rx_ready()) {
+        if (toupper(UART1_Read()) == BENCH_KEY) {
+            held = true;
+        }
+    }
+#endif /* Z80_SSD_BENCH_WAIT */
+    return held;
+#endif /* Z80_SSD_BENCH_ALWAYS */
 }
 
 void z80_ssd_main(void)
@@ -129,6 +670,13 @@ void z80_ssd_main(void)
     puts("\x1b[2J\x1b[HIBC/Integrated Business Computers Solid-State Disk v1.0\n\r" \
          "(c) 2021 Howard M. Harte - github.com/hharte/z80_ssd\n\r");
 
+    if (z80_ssd_BenchRequested()) {
+        IBC_HDC_SelfBench();
+        while (UART1_is_rx_ready()) {
+            UART1_Read();
+        }
+    }
+
     printf("Controller ready.\n\r");
     
     INT0_SetInterruptHandler (CPU_RESET_ISR);
@@ -138,6 +686,16 @@ void z80_ssd_main(void)
         if (do_command_flag == 1) {
             IBC_HDC_doCommand();
             do_command_flag = 0;
+        } else if (UART1_is_rx_ready()) {
+            IBC_HDC_Console(UART1_Read());
+        } else {
+            /* Sync the disk images and close any SD stream left open by a
+             * sequential run of reads or writes once the guest has gone
+             * quiet, and fold in the WAIT# samples.
+             */
+            IBC_HDC_IdleTasks();
+            SD_SPI_StreamIdleTasks();
+            z80_ssd_WaitIdleTasks();
         }
     }
 }